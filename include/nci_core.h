@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2018-2025 Slava Monich <slava@monich.com>
+ * Copyright (C) 2018-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2018-2021 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -47,12 +47,17 @@ G_BEGIN_DECLS
 /*
  * If current_state != next_state, the state machine is transitioning
  * from one state to another. That may take a while.
+ *
+ * cmd_window is the maximum number of commands which may be waiting
+ * for a response at any given time. NCI specification allows only one
+ * (which is the default) but some NFCCs can handle more than that.
  */
 
 typedef struct nci_core {
     NCI_STATE current_state;
     NCI_STATE next_state;
     guint cmd_timeout;
+    guint cmd_window; /* Since 1.1.34 */
 } NciCore;
 
 /* NCI parameters */
@@ -100,6 +105,14 @@ void
     guint len,
     void* user_data);
 
+typedef
+void
+(*NciCoreDataBytesFunc)(
+    NciCore* nci,
+    guint8 cid,
+    GBytes* payload,
+    void* user_data); /* Since 1.1.34 */
+
 typedef
 void
 (*NciCoreIntfActivationFunc)(
@@ -162,6 +175,16 @@ nci_core_set_tech(
     NciCore* nci,
     NCI_TECH tech);  /* Since 1.1.21 */
 
+/*
+ * By default, each NciHalIoFunctions.write() call carries exactly one
+ * NCI packet (header + payload). HALs which can take several packets
+ * in one go may allow more of them to be combined into a single write.
+ */
+void
+nci_core_set_max_write_packets(
+    NciCore* nci,
+    guint max); /* Since 1.1.34 */
+
 guint
 nci_core_send_data_msg(
     NciCore* nci,
@@ -171,11 +194,188 @@ nci_core_send_data_msg(
     GDestroyNotify destroy,
     void* user_data);
 
+/*
+ * Same as nci_core_send_data_msg() but sends directly from the caller's
+ * buffer which must remain valid until the destroy callback is invoked.
+ * Saves allocating GBytes for each message.
+ */
+guint
+nci_core_send_data_buf(
+    NciCore* nci,
+    guint8 cid,
+    const void* data,
+    gsize size,
+    NciCoreSendFunc complete,
+    GDestroyNotify destroy,
+    void* user_data); /* Since 1.1.34 */
+
+/*
+ * Sends the fragments back to back as a single data message, without
+ * concatenating them. E.g. a protocol header can be prepended to the
+ * payload without copying the payload.
+ */
+guint
+nci_core_send_data_msgv(
+    NciCore* nci,
+    guint8 cid,
+    GBytes* const* frags,
+    guint count,
+    NciCoreSendFunc complete,
+    GDestroyNotify destroy,
+    void* user_data); /* Since 1.1.34 */
+
 void
 nci_core_cancel(
     NciCore* nci,
     guint id);
 
+/*
+ * Cancels all data packets queued for the specified logical connection.
+ * Completion callbacks are not invoked for the cancelled packets.
+ */
+void
+nci_core_cancel_data(
+    NciCore* nci,
+    guint8 cid); /* Since 1.1.34 */
+
+/*
+ * Weights only apply to the logical connections which already exist,
+ * i.e. they have to be set after the number of connections has been
+ * negotiated with NFCC. Zero weight is the same as one (the default).
+ * Statistics are only available for existing connections too.
+ */
+void
+nci_core_set_data_scheduler(
+    NciCore* nci,
+    NCI_DATA_SCHED sched); /* Since 1.1.34 */
+
+void
+nci_core_set_data_weight(
+    NciCore* nci,
+    guint8 cid,
+    guint weight); /* Since 1.1.34 */
+
+gboolean
+nci_core_get_data_stats(
+    NciCore* nci,
+    guint8 cid,
+    NciConnStats* stats); /* Since 1.1.34 */
+
+/*
+ * Receive window. NCI doesn't let DH throttle NFCC, so once the amount
+ * of data delivered but not acknowledged with nci_core_data_consumed()
+ * reaches the window size, packets for this connection are held back
+ * (in order) until the consumer catches up. The occupancy reported by
+ * nci_core_get_data_rx_status() is what the upper layer protocol (e.g.
+ * LLCP) can use to slow down the peer. Zero window (the default) means
+ * that packets are delivered immediately and nothing is tracked.
+ *
+ * Held packets are limited to 64K bytes per connection by default (zero
+ * restores the default). Once a packet doesn't fit, all packets are
+ * dropped until the held ones are consumed, so that the stream doesn't
+ * silently continue past a gap. Whatever is held for the RF connection
+ * is discarded when the target is deactivated, and everything is
+ * discarded when NciCore is restarted.
+ */
+void
+nci_core_set_data_rx_window(
+    NciCore* nci,
+    guint8 cid,
+    guint window); /* Since 1.1.34 */
+
+void
+nci_core_set_data_rx_limit(
+    NciCore* nci,
+    guint8 cid,
+    guint max_bytes); /* Since 1.1.34 */
+
+void
+nci_core_data_consumed(
+    NciCore* nci,
+    guint8 cid,
+    guint bytes); /* Since 1.1.34 */
+
+gboolean
+nci_core_get_data_rx_status(
+    NciCore* nci,
+    guint8 cid,
+    NciConnRxStatus* status); /* Since 1.1.34 */
+
+/*
+ * Per-GID/OID command statistics. The snapshot is allocated as a
+ * single block, free it with g_free(). NULL means that there's nothing
+ * to report, or that libncicore has been built with NCI_STATS=0.
+ */
+NciCoreStats*
+nci_core_get_stats(
+    NciCore* nci); /* Since 1.1.34 */
+
+/*
+ * State machine statistics. Residency of the current state includes
+ * the time spent in it so far. FALSE means NCI_STATS=0 (or NULL nci).
+ */
+gboolean
+nci_core_get_sm_stats(
+    NciCore* nci,
+    NciSmStats* stats); /* Since 1.1.34 */
+
+/* Clears both command and state machine statistics */
+void
+nci_core_reset_stats(
+    NciCore* nci); /* Since 1.1.34 */
+
+/* Non-zero interval turns on periodic logging of the summary */
+void
+nci_core_set_stats_log_interval(
+    NciCore* nci,
+    guint sec); /* Since 1.1.34 */
+
+/*
+ * Packet trace keeps the most recent NCI packets in a ring buffer of
+ * the specified size (in bytes), zero size turns it off. The trace can
+ * be retrieved or saved in pcapng format at any time.
+ */
+void
+nci_core_set_trace_size(
+    NciCore* nci,
+    gsize size); /* Since 1.1.34 */
+
+GBytes*
+nci_core_get_trace(
+    NciCore* nci); /* Since 1.1.34 */
+
+gboolean
+nci_core_save_trace(
+    NciCore* nci,
+    const char* file); /* Since 1.1.34 */
+
+/* NULL restores the default policy */
+void
+nci_core_set_select_policy(
+    NciCore* nci,
+    const NciSelectPolicy* policy); /* Since 1.1.34 */
+
+/* Zero (default) disables detection of repeated activations */
+void
+nci_core_set_activation_cache_size(
+    NciCore* nci,
+    guint size); /* Since 1.1.34 */
+
+/* Describes the last activation, e.g. to the intf_activated handler */
+gboolean
+nci_core_get_activation_info(
+    NciCore* nci,
+    NciActivationInfo* info); /* Since 1.1.34 */
+
+/*
+ * The last activation. Inside the intf_activated handler its ntf is the
+ * one being passed to the handler. Use nci_util_activation_ref() to keep
+ * it around without copying anything.
+ */
+NciActivation*
+nci_core_get_activation(
+    NciCore* nci); /* Since 1.1.34 */
+
 gulong
 nci_core_add_current_state_changed_handler(
     NciCore* nci,
@@ -213,6 +413,43 @@ nci_core_add_param_change_handler(
     NciCoreParamChangeFunc func,
     void* user_data); /* Since 1.1.29 */
 
+/*
+ * Data sinks receive the same packets as data packet handlers but
+ * are invoked directly, without going through GSignal emission,
+ * which makes them noticeably cheaper. Sinks are invoked before
+ * the handlers, in the order they have been added. NCI_CORE_ANY_CID
+ * sink receives packets for all logical connections.
+ *
+ * Bytes sinks get the payload as GBytes which they may keep as long
+ * as they need. Whenever possible, it references the reassembly buffer
+ * or the buffer handed over by the HAL (see read_bytes in nci_hal.h)
+ * rather than a copy.
+ *
+ * Sink ids are not signal handler ids, they can only be removed
+ * with nci_core_remove_data_sink().
+ */
+
+#define NCI_CORE_ANY_CID (0xff) /* Since 1.1.34 */
+
+gulong
+nci_core_add_data_sink(
+    NciCore* nci,
+    guint8 cid,
+    NciCoreDataPacketFunc func,
+    void* user_data); /* Since 1.1.34 */
+
+gulong
+nci_core_add_data_bytes_sink(
+    NciCore* nci,
+    guint8 cid,
+    NciCoreDataBytesFunc func,
+    void* user_data); /* Since 1.1.34 */
+
+void
+nci_core_remove_data_sink(
+    NciCore* nci,
+    gulong id); /* Since 1.1.34 */
+
 void
 nci_core_remove_handler(
     NciCore* nci,
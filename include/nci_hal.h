@@ -1,6 +1,6 @@
 /*
+ * Copyright (C) 2018-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2018-2019 Jolla Ltd.
- * Copyright (C) 2018-2019 Slava Monich <slava.monich@jolla.com>
  *
  * You may use this file under the terms of BSD license as follows:
  *
@@ -35,6 +35,8 @@
 
 #include <nci_types.h>
 
+G_BEGIN_DECLS
+
 /* Hardware abstraction layer */
 
 /* Functions provided by HAL implementation */
@@ -62,12 +64,29 @@ struct nci_hal_io {
 typedef struct nci_hal_client_functions {
     void (*error)(NciHalClient* client);
     void (*read)(NciHalClient* client, const void* data, guint len);
+    /* Same as read but the core may keep a reference. Since 1.1.34 */
+    void (*read_bytes)(NciHalClient* client, GBytes* bytes);
 } NciHalClientFunctions;
 
 struct nci_hal_client {
     const NciHalClientFunctions* fn;
 };
 
+/*
+ * HAL implementations which have their data in refcounted buffers
+ * should pass those to nci_hal_client_read_bytes() rather than calling
+ * read_bytes directly. It falls back to read if the client doesn't
+ * provide read_bytes, and being a symbol (as opposed to a structure
+ * field which may not be there) it makes the dependency on the right
+ * version of libncicore explicit. Older HALs simply keep calling read.
+ */
+void
+nci_hal_client_read_bytes(
+    NciHalClient* client,
+    GBytes* bytes); /* Since 1.1.34 */
+
+G_END_DECLS
+
 #endif /* NFC_HAL_H */
 
 /*
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2018-2025 Slava Monich <slava@monich.com>
+ * Copyright (C) 2018-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2018-2020 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -269,6 +269,16 @@ typedef struct nci_intf_activated_ntf {
     const NciActivationParam* activation_param;
 } NciIntfActivationNtf;
 
+/*
+ * Parsed RF_INTF_ACTIVATED_NTF and its raw payload, allocated as a single
+ * reference counted block. All pointers in ntf point into the same block
+ * and remain valid for as long as a reference is held.
+ */
+typedef struct nci_activation {
+    NciIntfActivationNtf ntf;
+    GUtilData raw;
+} NciActivation; /* Since 1.1.34 */
+
 /* Control Messages to Start Discovery */
 typedef struct nci_discovery_ntf {
     guint8 discovery_id;
@@ -280,6 +290,54 @@ typedef struct nci_discovery_ntf {
     gboolean last;
 } NciDiscoveryNtf;
 
+/*
+ * Target selection policy, applied in RFST_W4_HOST_SELECT state (i.e.
+ * when more than one target has been discovered). Targets are ranked
+ * by the first matching priority entry, the ones which don't match any
+ * come last. Ties are resolved by discovery id. The default priority
+ * order is NFC-DEP, ISO-DEP, T2T.
+ *
+ * Targets activated less than recent_sec seconds ago are skipped. Up
+ * to recent_count targets are remembered, the least recently activated
+ * ones get forgotten first. Targets are identified by NFCID1 (NFC-A),
+ * NFCID0 (NFC-B), NFCID2 (NFC-F) or UID (NFC-V).
+ *
+ * The filter callback (if any) is invoked synchronously and returns
+ * FALSE to skip the target.
+ */
+typedef struct nci_select_priority {
+    NCI_PROTOCOL protocol;
+    NCI_MODE mode;
+    gboolean any_mode;  /* If TRUE, mode is ignored */
+} NciSelectPriority; /* Since 1.1.34 */
+
+typedef
+gboolean
+(*NciSelectFunc)(
+    const NciDiscoveryNtf* ntf,
+    void* user_data); /* Since 1.1.34 */
+
+typedef struct nci_select_policy {
+    const NciSelectPriority* priority;
+    guint priority_count;   /* Zero means the default order */
+    guint recent_sec;       /* Zero to select recent targets too */
+    guint recent_count;
+    NciSelectFunc filter;   /* Optional */
+    void* user_data;
+} NciSelectPolicy; /* Since 1.1.34 */
+
+/*
+ * Describes the last activation. A repeat is an activation of the
+ * target with the same id (see above) and the same activation params
+ * as one of the recently activated targets. last_seen is the monotonic
+ * time (g_get_monotonic_time) of the previous such activation, or zero
+ * if it's not a repeat.
+ */
+typedef struct nci_activation_info {
+    gboolean repeat;
+    gint64 last_seen;
+} NciActivationInfo; /* Since 1.1.34 */
+
 /* NFCID1 can be 4, 7, or 10 bytes long. */
 typedef struct nci_nfcid {
     guint8 len;
@@ -390,6 +448,117 @@ typedef enum nci_op_mode {
     NFC_OP_MODE_LISTEN = 0x10   /* Listen side/Target */
 } NCI_OP_MODE; /* Since 1.1.0 */
 
+/*
+ * Scheduling of outgoing data packets between logical connections.
+ * Commands always go first, regardless of the policy.
+ *
+ * NCI_DATA_SCHED_PRIORITY picks the lowest cid which has something
+ * to send (and credits to send it). NCI_DATA_SCHED_ROUND_ROBIN sends
+ * one packet per connection in turn. NCI_DATA_SCHED_WEIGHTED shares
+ * the bandwidth (in bytes) between connections in proportion to
+ * their weights (deficit round robin).
+ */
+
+typedef enum nci_data_sched {
+    NCI_DATA_SCHED_PRIORITY,    /* Default */
+    NCI_DATA_SCHED_ROUND_ROBIN,
+    NCI_DATA_SCHED_WEIGHTED
+} NCI_DATA_SCHED; /* Since 1.1.34 */
+
+/* Per-connection statistics, times are in microseconds */
+
+typedef struct nci_conn_stats {
+    guint queued;       /* Packets currently waiting in the queue */
+    guint max_queued;   /* Queue depth high watermark */
+    guint64 packets;    /* Packets taken from the queue for sending */
+    guint64 bytes;      /* Payload bytes in those packets */
+    guint64 wait_total; /* Total time spent in the queue */
+    guint64 wait_max;   /* Maximum time spent in the queue */
+} NciConnStats; /* Since 1.1.34 */
+
+/* Receive side flow control state, sizes are in payload bytes */
+
+typedef struct nci_conn_rx_status {
+    guint window;       /* Receive window, zero if unlimited */
+    guint outstanding;  /* Delivered but not acknowledged yet */
+    guint queued;       /* Packets held back */
+    guint queued_bytes; /* Payload bytes in those packets */
+    guint limit;        /* Max queued bytes */
+    guint dropped;      /* Packets dropped because of the limit */
+} NciConnRxStatus; /* Since 1.1.34 */
+
+/*
+ * Command statistics, times are in microseconds. Latency is measured
+ * from handing the command over to SAR till the matching response.
+ * Histogram bucket n counts the responses which took at least 2^n
+ * but less than 2^(n+1) microseconds (the first one starts at zero,
+ * the last one collects everything slower than that).
+ */
+
+#define NCI_CMD_LATENCY_BUCKETS (24) /* Since 1.1.34 */
+
+typedef struct nci_cmd_stats {
+    guint8 gid;
+    guint8 oid;
+    guint8 last_error;  /* Status of the last failed response */
+    guint sent;         /* Submitted to SAR */
+    guint responses;    /* Matching responses received */
+    guint errors;       /* Responses with non-OK status */
+    guint timeouts;     /* No response in time */
+    guint cancelled;    /* Cancelled while waiting for response */
+    guint64 latency_total;
+    guint64 latency_max;
+    guint latency[NCI_CMD_LATENCY_BUCKETS];
+} NciCmdStats; /* Since 1.1.34 */
+
+typedef struct nci_core_stats {
+    guint count;
+    const NciCmdStats* cmd; /* Sorted by GID and OID */
+} NciCoreStats; /* Since 1.1.34 */
+
+/*
+ * State machine statistics, times are in microseconds. Histogram
+ * buckets work the same way as command latency buckets.
+ */
+
+#define NCI_TIME_BUCKETS (32) /* Since 1.1.34 */
+
+typedef struct nci_time_histogram {
+    guint count;
+    guint64 total;
+    guint64 max;
+    guint bucket[NCI_TIME_BUCKETS];
+} NciTimeHistogram; /* Since 1.1.34 */
+
+typedef enum nci_core_transition {
+    NCI_CORE_TRANSITION_RESET,
+    NCI_CORE_TRANSITION_IDLE_TO_DISCOVERY,
+    NCI_CORE_TRANSITION_DEACTIVATE_TO_IDLE,
+    NCI_CORE_TRANSITION_DEACTIVATE_TO_DISCOVERY,
+    NCI_CORE_TRANSITION_POLL_ACTIVE_TO_IDLE,
+    NCI_CORE_TRANSITION_LISTEN_ACTIVE_TO_IDLE,
+    NCI_CORE_TRANSITIONS
+} NCI_CORE_TRANSITION; /* Since 1.1.34 */
+
+typedef struct nci_state_stats {
+    guint entered;
+    guint64 residency;  /* Total time spent in the state */
+} NciStateStats; /* Since 1.1.34 */
+
+typedef struct nci_transition_stats {
+    guint started;
+    guint failed;       /* Stalled or interrupted */
+    NciTimeHistogram duration; /* Of the completed ones */
+} NciTransitionStats; /* Since 1.1.34 */
+
+typedef struct nci_sm_stats {
+    NciStateStats state[NCI_CORE_STATES];
+    NciTransitionStats transition[NCI_CORE_TRANSITIONS];
+    guint stall_stop;
+    guint stall_error;
+    NciTimeHistogram activation; /* RF_INTF_ACTIVATED to deactivation */
+} NciSmStats; /* Since 1.1.34 */
+
 /* Logging */
 
 #define NCI_LOG_MODULE nci_log
@@ -1,4 +1,5 @@
 /*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2020 Jolla Ltd.
  * Copyright (C) 2019-2020 Slava Monich <slava.monich@jolla.com>
  * Copyright (C) 2020 Open Mobile Platform LLC.
@@ -51,6 +52,14 @@ nci_util_copy_activation_param(
     NCI_RF_INTERFACE intf,
     NCI_MODE mode); /* Since 1.1.13 */
 
+NciActivation*
+nci_util_activation_ref(
+    NciActivation* act); /* Since 1.1.34 */
+
+void
+nci_util_activation_unref(
+    NciActivation* act); /* Since 1.1.34 */
+
 G_END_DECLS
 
 #endif /* NCI_UTIL_H */
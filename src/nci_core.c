@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2018-2025 Slava Monich <slava@monich.com>
+ * Copyright (C) 2018-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2018-2021 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -37,7 +37,7 @@
  * any official policies, either expressed or implied.
  */
 
-#include "nci_core.h"
+#include "nci_core_p.h"
 #include "nci_sar.h"
 #include "nci_sm.h"
 #include "nci_state.h"
@@ -61,11 +61,82 @@ typedef struct nci_core_closure {
     } func;
 } NciCoreClosure;
 
-typedef struct nci_core_send_data {
+typedef struct nci_core_object NciCoreObject;
+typedef struct nci_core_send_data NciCoreSendData;
+
+struct nci_core_send_data {
+    NciCoreSendData* next; /* Free list link */
+    NciCoreObject* core;
     NciCoreSendFunc complete;
     GDestroyNotify destroy;
     gpointer user_data;
-} NciCoreSendData;
+};
+
+#define NCI_CORE_MAX_FREE_SEND_DATA (8)
+
+/*
+ * Data sinks are invoked directly, bypassing GSignal machinery.
+ * Each sink has either func or bytes set. Removed sinks have both
+ * set to NULL while packets are being dispatched and get squeezed
+ * out of the array afterwards.
+ */
+typedef struct nci_core_data_sink {
+    gulong id;
+    guint8 cid;
+    NciCoreDataPacketFunc func;
+    NciCoreDataBytesFunc bytes;
+    gpointer user_data;
+} NciCoreDataSink;
+
+#define nci_core_data_sink_active(sink) ((sink)->func || (sink)->bytes)
+
+/*
+ * Receive window of a logical connection. Packets which arrive while
+ * the consumer is behind by the window size (or while older packets
+ * are still waiting) are queued here, along with their payload. Once
+ * a packet doesn't fit under the limit, everything is dropped until the
+ * queue drains (or gets flushed), so that the consumer doesn't receive
+ * a stream with a silent hole in the middle.
+ */
+typedef struct nci_core_rx_window {
+    guint window;
+    guint limit; /* Max queued bytes */
+    guint outstanding; /* Delivered but not acknowledged */
+    guint queued_bytes;
+    guint dropped;
+    GQueue queue; /* GBytes */
+    gboolean draining;
+    gboolean overflow; /* Dropping everything until drained */
+} NciCoreRxWindow;
+
+#define NCI_CORE_RX_CIDS (16) /* Connection id is 4 bits */
+#define NCI_CORE_RX_DEFAULT_LIMIT (0x10000)
+#define NCI_CORE_ACTIVATED_STATE(state) ((state) == NCI_RFST_POLL_ACTIVE || \
+    (state) == NCI_RFST_LISTEN_ACTIVE || (state) == NCI_RFST_LISTEN_SLEEP)
+
+typedef struct nci_core_command NciCoreCommand;
+
+/*
+ * Commands are kept in the order they have been issued. Those that
+ * have been submitted to SAR and are waiting for a response (at most
+ * NciCore.cmd_window of them) are at the beginning of the list.
+ */
+struct nci_core_command {
+    NciCoreCommand* next;
+    NciCoreObject* core;
+    GBytes* payload; /* Until submitted */
+    guint ref_count; /* SAR holds a reference until it's done with it */
+    guint id; /* Non-zero until written */
+    guint timeout_id;
+    gboolean submitted;
+    guint8 gid;
+    guint8 oid;
+    NciSmResponseFunc handler;
+    gpointer user_data;
+#if NCI_STATS
+    gint64 submit_time;
+#endif
+};
 
 enum nci_core_events {
     EVENT_LAST_STATE,
@@ -74,20 +145,29 @@ enum nci_core_events {
     EVENT_COUNT
 };
 
-typedef struct nci_core_object {
+struct nci_core_object {
     GObject object;
     NciCore core;
     NciSarClient sar_client;
     NciSmIo io;
     NciSm* sm;
-    guint cmd_id;
-    guint cmd_timeout_id;
-    guint8 rsp_gid;
-    guint8 rsp_oid;
-    NciSmResponseFunc rsp_handler;
-    gpointer rsp_data;
+    NciCoreCommand* cmd_queue;
+    guint cmd_submitted;
+    NciCoreSendData* free_send_data; /* Released contexts for reuse */
+    guint free_send_data_count;
+    NciCoreDataSink* sinks;
+    guint n_sinks;
+    gulong last_sink_id;
+    guint sink_dispatch; /* Dispatch nesting level */
+    gboolean sinks_removed;
+    guint n_bytes_sinks;
+    NciCoreRxWindow* rx; /* NCI_CORE_RX_CIDS entries, allocated on demand */
+#if NCI_STATS
+    GHashTable* cmd_stats; /* GID << 8 | OID => NciCmdStats */
+    guint stats_log_id;
+#endif
     gulong event_ids[EVENT_COUNT];
-} NciCoreObject;
+};
 
 typedef GObjectClass NciCoreObjectClass;
 
@@ -115,6 +195,7 @@ typedef enum nci_core_signal {
 static guint nci_core_signals[SIGNAL_COUNT] = { 0 };
 
 #define DEFAULT_TIMEOUT (2000) /* msec */
+#define DEFAULT_CMD_WINDOW (1)
 
 static const NciCoreParamValue NCI_DEFAULT_LLC_VERSION = { .uint8 = 0x11 };
 static const NciCoreParamValue NCI_DEFAULT_LLC_WKS = { .uint16 = 0x0003 };
@@ -137,29 +218,240 @@ static inline NciCoreObject* nci_core_object_cast_sar_client(NciSarClient* ptr)
 static inline NciCoreObject* nci_core_object_cast_sm_io(NciSmIo* ptr)
     { return THIS(G_CAST(ptr, NciCoreObject, io)); }
 
+/*==========================================================================*
+ * Command statistics
+ *==========================================================================*/
+
+#if NCI_STATS
+
+static
+NciCmdStats*
+nci_core_cmd_stats(
+    NciCoreObject* self,
+    NciCoreCommand* cmd)
+{
+    gpointer key = GUINT_TO_POINTER(((guint)cmd->gid << 8) | cmd->oid);
+    NciCmdStats* stats;
+
+    if (!self->cmd_stats) {
+        self->cmd_stats = g_hash_table_new_full(g_direct_hash,
+            g_direct_equal, NULL, g_free);
+    }
+    stats = g_hash_table_lookup(self->cmd_stats, key);
+    if (!stats) {
+        stats = g_new0(NciCmdStats, 1);
+        stats->gid = cmd->gid;
+        stats->oid = cmd->oid;
+        g_hash_table_insert(self->cmd_stats, key, stats);
+    }
+    return stats;
+}
+
+static
+void
+nci_core_cmd_stats_sent(
+    NciCoreObject* self,
+    NciCoreCommand* cmd)
+{
+    cmd->submit_time = g_get_monotonic_time();
+    nci_core_cmd_stats(self, cmd)->sent++;
+}
+
+static
+void
+nci_core_cmd_stats_response(
+    NciCoreObject* self,
+    NciCoreCommand* cmd,
+    const GUtilData* payload)
+{
+    NciCmdStats* stats = nci_core_cmd_stats(self, cmd);
+    const guint64 latency = g_get_monotonic_time() - cmd->submit_time;
+
+    stats->responses++;
+    if (payload->size && payload->bytes[0] != NCI_STATUS_OK) {
+        stats->errors++;
+        stats->last_error = payload->bytes[0];
+    }
+    stats->latency_total += latency;
+    if (stats->latency_max < latency) {
+        stats->latency_max = latency;
+    }
+    stats->latency[nci_time_bucket(latency, NCI_CMD_LATENCY_BUCKETS)]++;
+}
+
+#define nci_core_cmd_stats_timeout(self,cmd) \
+    (nci_core_cmd_stats(self, cmd)->timeouts++)
+#define nci_core_cmd_stats_cancelled(self,cmd) \
+    (nci_core_cmd_stats(self, cmd)->cancelled++)
+
+static
+int
+nci_core_cmd_stats_compare(
+    const void* p1,
+    const void* p2)
+{
+    const NciCmdStats* s1 = p1;
+    const NciCmdStats* s2 = p2;
+
+    return (s1->gid != s2->gid) ? ((int)s1->gid - (int)s2->gid) :
+        ((int)s1->oid - (int)s2->oid);
+}
+
+static
+gboolean
+nci_core_stats_log(
+    gpointer user_data)
+{
+    NciCoreObject* self = THIS(user_data);
+
+    nci_sm_log_stats(self->sm);
+    if (self->cmd_stats) {
+        guint sent = 0, errors = 0, timeouts = 0;
+        GHashTableIter it;
+        gpointer value;
+
+        g_hash_table_iter_init(&it, self->cmd_stats);
+        while (g_hash_table_iter_next(&it, NULL, &value)) {
+            const NciCmdStats* stats = value;
+
+            sent += stats->sent;
+            errors += stats->errors;
+            timeouts += stats->timeouts;
+        }
+        GINFO("commands: %u sent, %u errors, %u timeouts", sent, errors,
+            timeouts);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+#else
+
+#define nci_core_cmd_stats_sent(self,cmd) ((void)0)
+#define nci_core_cmd_stats_response(self,cmd,payload) ((void)0)
+#define nci_core_cmd_stats_timeout(self,cmd) ((void)0)
+#define nci_core_cmd_stats_cancelled(self,cmd) ((void)0)
+
+#endif /* NCI_STATS */
+
 /*==========================================================================*
  * Implementation
  *==========================================================================*/
 
+static
+NciCoreCommand*
+nci_core_command_ref(
+    NciCoreCommand* cmd)
+{
+    cmd->ref_count++;
+    return cmd;
+}
+
 static
 void
-nci_core_cancel_command(
-    NciCoreObject* self)
+nci_core_command_unref(
+    gpointer data)
+{
+    NciCoreCommand* cmd = data;
+
+    GASSERT(cmd->ref_count > 0);
+    if (!--cmd->ref_count) {
+        GASSERT(!cmd->timeout_id);
+        if (cmd->payload) {
+            g_bytes_unref(cmd->payload);
+        }
+        g_slice_free(NciCoreCommand, cmd);
+    }
+}
+
+static
+void
+nci_core_command_remove(
+    NciCoreObject* self,
+    NciCoreCommand* cmd)
+{
+    NciCoreCommand** ptr = &self->cmd_queue;
+
+    while (*ptr != cmd) {
+        ptr = &((*ptr)->next);
+    }
+    *ptr = cmd->next;
+    cmd->next = NULL;
+    if (cmd->submitted) {
+        GASSERT(self->cmd_submitted > 0);
+        self->cmd_submitted--;
+    }
+    gutil_source_clear(&cmd->timeout_id);
+}
+
+static
+void
+nci_core_command_cancel(
+    NciCoreObject* self,
+    NciCoreCommand* cmd)
+{
+    /* The command must be already removed from the queue */
+    if (cmd->id) {
+        const guint id = cmd->id;
+
+        /* This is going to drop the reference held by SAR */
+        cmd->id = 0;
+        nci_sar_cancel(self->io.sar, id);
+    }
+}
+
+static
+void
+nci_core_command_done(
+    NciCoreCommand* cmd,
+    NCI_REQUEST_STATUS status,
+    const GUtilData* payload)
+{
+    NciSmResponseFunc handler = cmd->handler;
+    gpointer user_data = cmd->user_data;
+    const guint8 gid = cmd->gid;
+    const guint8 oid = cmd->oid;
+
+    /* The command must be already removed from the queue */
+    nci_core_command_unref(cmd);
+    if (handler) {
+        if (payload) {
+            handler(status, payload, user_data);
+        } else {
+            GUtilData empty;
+
+            memset(&empty, 0, sizeof(empty));
+            handler(status, &empty, user_data);
+        }
+    } else if (status != NCI_REQUEST_SUCCESS) {
+        GWARN("Command %02x/%02x failed", gid, oid);
+    }
+}
+
+static
+void
+nci_core_cancel_commands(
+    NciCoreObject* self,
+    gboolean notify)
 {
-    gutil_source_clear(&self->cmd_timeout_id);
-    if (self->cmd_id) {
-        gpointer user_data = self->rsp_data;
+    NciCoreCommand* cmd;
 
-        nci_sar_cancel(self->io.sar, self->cmd_id);
-        self->cmd_id = 0;
-        self->rsp_data = NULL;
-        if (self->rsp_handler) {
-            NciSmResponseFunc handler = self->rsp_handler;
-            GUtilData payload;
+    /*
+     * Handlers are only notified about the commands which haven't
+     * been written yet. Remove the commands from the queue one by
+     * one because the handlers may issue new commands.
+     */
+    while ((cmd = self->cmd_queue) != NULL) {
+        const gboolean written = cmd->submitted && !cmd->id;
 
-            self->rsp_handler = NULL;
-            memset(&payload, 0, sizeof(payload));
-            handler(NCI_REQUEST_CANCELLED, &payload, user_data);
+        if (cmd->submitted) {
+            nci_core_cmd_stats_cancelled(self, cmd);
+        }
+        nci_core_command_remove(self, cmd);
+        nci_core_command_cancel(self, cmd);
+        if (notify && !written) {
+            nci_core_command_done(cmd, NCI_REQUEST_CANCELLED, NULL);
+        } else {
+            nci_core_command_unref(cmd);
         }
     }
 }
@@ -171,51 +463,126 @@ nci_core_command_completion(
     gboolean success,
     gpointer user_data)
 {
-    NciCoreObject* self = THIS(user_data);
+    NciCoreCommand* cmd = user_data;
 
-    self->cmd_id = 0;
+    cmd->id = 0;
     if (!success) {
-        GWARN("Failed to send command %02x/%02x", self->rsp_gid, self->rsp_oid);
-        nci_sm_error(self->sm);
+        GWARN("Failed to send command %02x/%02x", cmd->gid, cmd->oid);
+        nci_sm_error(nci_core_object_cast_sar_client(sar_client)->sm);
     }
 }
 
 static
-void
-nci_core_io_dummy_resp(
-    NCI_REQUEST_STATUS status,
-    const GUtilData* payload,
+gboolean
+nci_core_command_timeout(
     gpointer user_data)
 {
-    if (status != NCI_REQUEST_SUCCESS) {
-        GWARN("Command %02x/%02x failed", THIS(user_data)->rsp_gid,
-            THIS(user_data)->rsp_oid);
+    NciCoreCommand* cmd = user_data;
+    NciCoreObject* self = cmd->core;
+
+    GWARN("Command %02x/%02x timed out", cmd->gid, cmd->oid);
+    cmd->timeout_id = 0;
+    nci_core_cmd_stats_timeout(self, cmd);
+    nci_core_command_remove(self, cmd);
+    nci_core_command_cancel(self, cmd);
+    nci_core_command_done(cmd, NCI_REQUEST_TIMEOUT, NULL);
+    nci_sm_error(self->sm);
+    return G_SOURCE_REMOVE;
+}
+
+static
+gboolean
+nci_core_command_submit(
+    NciCoreObject* self,
+    NciCoreCommand* cmd)
+{
+    NciCore* core = &self->core;
+
+    cmd->id = nci_sar_send_command(self->io.sar, cmd->gid, cmd->oid,
+        cmd->payload, nci_core_command_completion, nci_core_command_unref,
+        nci_core_command_ref(cmd));
+    if (cmd->payload) {
+        g_bytes_unref(cmd->payload);
+        cmd->payload = NULL;
+    }
+    if (cmd->id) {
+        cmd->submitted = TRUE;
+        self->cmd_submitted++;
+        nci_core_cmd_stats_sent(self, cmd);
+        if (core->cmd_timeout) {
+            cmd->timeout_id = g_timeout_add(core->cmd_timeout,
+                nci_core_command_timeout, cmd);
+        }
+        return TRUE;
+    } else {
+        /* SAR didn't take the reference */
+        nci_core_command_unref(cmd);
+        return FALSE;
+    }
+}
+
+static
+void
+nci_core_submit_commands(
+    NciCoreObject* self)
+{
+    /* Submit as many as the window allows */
+    while (self->cmd_submitted < MAX(self->core.cmd_window, 1)) {
+        NciCoreCommand* cmd = self->cmd_queue;
+
+        /* Skip the ones which are already waiting for a response */
+        while (cmd && cmd->submitted) {
+            cmd = cmd->next;
+        }
+
+        if (!cmd) {
+            break;
+        } else if (!nci_core_command_submit(self, cmd)) {
+            /* The handler may modify the queue, start over */
+            nci_core_command_remove(self, cmd);
+            nci_core_command_done(cmd, NCI_REQUEST_CANCELLED, NULL);
+        }
     }
 }
 
 static
 gboolean
-nci_core_command_timeout(
+nci_core_queue_command(
+    NciCoreObject* self,
+    guint8 gid,
+    guint8 oid,
+    GBytes* payload,
+    NciSmResponseFunc resp,
     gpointer user_data)
 {
-    NciCoreObject* self = THIS(user_data);
-    gpointer rsp_data = self->rsp_data;
-
-    GWARN("Command %02x/%02x timed out", self->rsp_gid, self->rsp_oid);
-    self->cmd_timeout_id = 0;
-    self->rsp_data = NULL;
-    nci_sar_cancel(self->io.sar, self->cmd_id);
-    self->cmd_id = 0;
-    if (self->rsp_handler) {
-        NciSmResponseFunc handler = self->rsp_handler;
-        GUtilData payload;
+    NciCoreCommand* cmd = g_slice_new0(NciCoreCommand);
+    NciCoreCommand** ptr = &self->cmd_queue;
+
+    cmd->core = self;
+    cmd->ref_count = 1;
+    cmd->gid = gid;
+    cmd->oid = oid;
+    cmd->handler = resp;
+    cmd->user_data = user_data;
+    if (payload) {
+        cmd->payload = g_bytes_ref(payload);
+    }
 
-        self->rsp_handler = NULL;
-        memset(&payload, 0, sizeof(payload));
-        handler(NCI_REQUEST_TIMEOUT, &payload, rsp_data);
+    /* Append it to the queue */
+    while (*ptr) {
+        ptr = &((*ptr)->next);
     }
-    nci_sm_error(self->sm);
-    return G_SOURCE_REMOVE;
+    *ptr = cmd;
+
+    /* Submit it right away if the window allows */
+    if (self->cmd_submitted < MAX(self->core.cmd_window, 1)) {
+        if (!nci_core_command_submit(self, cmd)) {
+            nci_core_command_remove(self, cmd);
+            nci_core_command_unref(cmd);
+            return FALSE;
+        }
+    }
+    return TRUE;
 }
 
 static
@@ -233,17 +600,95 @@ nci_core_send_data_msg_complete(
     }
 }
 
+static
+void
+nci_core_send_data_release(
+    NciCoreObject* self,
+    NciCoreSendData* send)
+{
+    if (self->free_send_data_count < NCI_CORE_MAX_FREE_SEND_DATA) {
+        send->next = self->free_send_data;
+        self->free_send_data = send;
+        self->free_send_data_count++;
+    } else {
+        g_slice_free(NciCoreSendData, send);
+    }
+}
+
 static
 void
 nci_core_send_data_msg_destroy(
     gpointer data)
 {
     NciCoreSendData* send = data;
+    GDestroyNotify destroy = send->destroy;
+    gpointer user_data = send->user_data;
+
+    /* SAR is freed before NciCoreObject, the latter is still alive */
+    nci_core_send_data_release(send->core, send);
+    if (destroy) {
+        destroy(user_data);
+    }
+}
+
+static
+NciCoreSendData*
+nci_core_send_data_new(
+    NciCoreObject* self,
+    NciCoreSendFunc complete,
+    GDestroyNotify destroy,
+    gpointer user_data)
+{
+    NciCoreSendData* send = self->free_send_data;
+
+    if (send) {
+        self->free_send_data = send->next;
+        self->free_send_data_count--;
+    } else {
+        send = g_slice_new(NciCoreSendData);
+    }
+    send->next = NULL;
+    send->core = self;
+    send->complete = complete;
+    send->destroy = destroy;
+    send->user_data = user_data;
+    return send;
+}
+
+static
+void
+nci_core_rx_flush(
+    NciCoreObject* self,
+    guint8 cid)
+{
+    if (self->rx) {
+        NciCoreRxWindow* rx = self->rx + cid;
+        GQueue* queue = &rx->queue;
+
+        /* Nothing held for the previous target should reach the next one */
+        if (queue->length || rx->outstanding) {
+            GDEBUG("Flushing connection %u (%u packet(s), %u byte(s))",
+                cid, queue->length, rx->queued_bytes);
+        }
+        while (queue->length) {
+            g_bytes_unref(g_queue_pop_head(queue));
+        }
+        rx->outstanding = 0;
+        rx->queued_bytes = 0;
+        rx->overflow = FALSE;
+    }
+}
+
+static
+void
+nci_core_rx_flush_all(
+    NciCoreObject* self)
+{
+    guint8 cid;
 
-    if (send->destroy) {
-        send->destroy(send->user_data);
+    for (cid = 0; cid < NCI_CORE_RX_CIDS; cid++) {
+        nci_core_rx_flush(self, cid);
     }
-    g_slice_free(NciCoreSendData, send);
 }
 
 static
@@ -253,8 +698,14 @@ nci_core_last_state_changed(
     void* user_data)
 {
     NciCoreObject* self = THIS(user_data);
+    const NCI_STATE prev = self->core.current_state;
 
     self->core.current_state = sm->last_state->state;
+    if (NCI_CORE_ACTIVATED_STATE(prev) &&
+        !NCI_CORE_ACTIVATED_STATE(self->core.current_state)) {
+        /* RF connection is gone along with the target */
+        nci_core_rx_flush(self, NCI_STATIC_RF_CONN_ID);
+    }
     g_signal_emit(self, nci_core_signals[SIGNAL_CURRENT_STATE], 0);
 }
 
@@ -362,8 +813,9 @@ void
 nci_core_restart_internal(
     NciCoreObject* self)
 {
-    nci_core_cancel_command(self);
+    nci_core_cancel_commands(self, TRUE);
     nci_sar_reset(self->io.sar);
+    nci_core_rx_flush_all(self);
     nci_sm_reset(self->sm);
 }
 
@@ -600,33 +1052,24 @@ nci_core_io_send(
     gpointer user_data)
 {
     NciCoreObject* self = nci_core_object_cast_sm_io(io);
-    NciCore* core = &self->core;
 
-    /* Cancel the previous one, if any */
-    nci_core_cancel_command(self);
+    /* Cancel the previous ones, if any */
+    nci_core_cancel_commands(self, TRUE);
+    return nci_core_queue_command(self, gid, oid, payload, resp, user_data);
+}
 
-    self->rsp_gid = gid;
-    self->rsp_oid = oid;
-    if (resp) {
-        self->rsp_handler = resp;
-        self->rsp_data = user_data;
-    } else {
-        self->rsp_handler = nci_core_io_dummy_resp;
-        self->rsp_data = self;
-    }
-    self->cmd_id = nci_sar_send_command(self->io.sar, gid, oid, payload,
-        nci_core_command_completion, NULL, self);
-    if (self->cmd_id) {
-        if (core->cmd_timeout) {
-            self->cmd_timeout_id = g_timeout_add(core->cmd_timeout,
-                nci_core_command_timeout, self);
-        }
-        return TRUE;
-    } else {
-        self->rsp_handler = NULL;
-        self->rsp_data = NULL;
-        return FALSE;
-    }
+static
+gboolean
+nci_core_io_queue(
+    NciSmIo* io,
+    guint8 gid,
+    guint8 oid,
+    GBytes* payload,
+    NciSmResponseFunc resp,
+    gpointer user_data)
+{
+    return nci_core_queue_command(nci_core_object_cast_sm_io(io),
+        gid, oid, payload, resp, user_data);
 }
 
 static
@@ -634,11 +1077,7 @@ void
 nci_core_io_cancel(
     NciSmIo* io)
 {
-    NciCoreObject* self = nci_core_object_cast_sm_io(io);
-
-    self->rsp_handler = NULL;
-    self->rsp_data = NULL;
-    nci_core_cancel_command(self);
+    nci_core_cancel_commands(nci_core_object_cast_sm_io(io), FALSE);
 }
 
 /*==========================================================================*
@@ -664,24 +1103,25 @@ nci_core_sar_handle_response(
     guint len)
 {
     NciCoreObject* self = nci_core_object_cast_sar_client(client);
+    NciCoreCommand* cmd = self->cmd_queue;
 
-    if (self->rsp_handler) {
-        if (self->rsp_gid == gid && self->rsp_oid == oid) {
-            NciSmResponseFunc handler = self->rsp_handler;
-            gpointer handler_data = self->rsp_data;
-            GUtilData payload;
+    /* Responses are matched against the oldest submitted command */
+    while (cmd && cmd->submitted && (cmd->gid != gid || cmd->oid != oid)) {
+        cmd = cmd->next;
+    }
 
-            gutil_source_clear(&self->cmd_timeout_id);
-            self->cmd_id = 0;
-            self->rsp_handler = NULL;
-            self->rsp_data = NULL;
+    if (cmd && cmd->submitted) {
+        GUtilData payload;
 
-            payload.bytes = data;
-            payload.size = len;
-            handler(NCI_REQUEST_SUCCESS, &payload, handler_data);
-        } else {
-            GWARN("Invalid response %02x/%02x", gid, oid);
-        }
+        payload.bytes = data;
+        payload.size = len;
+        nci_core_cmd_stats_response(self, cmd, &payload);
+        /* SAR may not be done with the command yet, leave it alone */
+        nci_core_command_remove(self, cmd);
+        nci_core_command_done(cmd, NCI_REQUEST_SUCCESS, &payload);
+        nci_core_submit_commands(self);
+    } else if (self->cmd_submitted) {
+        GWARN("Invalid response %02x/%02x", gid, oid);
     } else {
         GWARN("Unexpected response %02x/%02x", gid, oid);
     }
@@ -706,38 +1146,191 @@ nci_core_sar_handle_notification(
 
 static
 void
-nci_core_sar_handle_data_packet(
-    NciSarClient* client,
-    guint8 cid,
-    const void* payload,
-    guint len)
+nci_core_compact_sinks(
+    NciCoreObject* self)
 {
-    g_signal_emit(nci_core_object_cast_sar_client(client), nci_core_signals
-        [SIGNAL_DATA_PACKET], 0, cid, payload, len);
-}
+    guint i, n = 0;
 
-/*==========================================================================*
- * Interface
- *==========================================================================*/
+    for (i = 0; i < self->n_sinks; i++) {
+        if (nci_core_data_sink_active(self->sinks + i)) {
+            if (n != i) {
+                self->sinks[n] = self->sinks[i];
+            }
+            n++;
+        }
+    }
+    self->n_sinks = n;
+    self->sinks_removed = FALSE;
+}
 
-NciCore*
-nci_core_new(
-    NciHalIo* hal)
+static
+void
+nci_core_dispatch_data_packet(
+    NciCoreObject* self,
+    guint8 cid,
+    const void* payload,
+    guint len,
+    GBytes* bytes)
 {
-    if (G_LIKELY(hal)) {
-        NciCoreObject* self = g_object_new(THIS_TYPE, NULL);
-        NciCore* core = &self->core;
-        NciSm* sm;
-        guint i;
+    const guint n = self->n_sinks;
 
-        self->io.sar = nci_sar_new(hal, &self->sar_client);
-        self->sm = sm = nci_sm_new(&self->io);
+    if (n) {
+        GBytes* copy = NULL;
+        guint i;
 
-        for (i = 0; i < NCI_CORE_PARAM_COUNT; i++) {
-            nci_core_params[i].reset(self);
+        /* Sinks added by the callbacks don't get this packet */
+        self->sink_dispatch++;
+        for (i = 0; i < n; i++) {
+            /* The array may get reallocated by the callback */
+            const NciCoreDataSink* sink = self->sinks + i;
+
+            if (sink->cid == cid || sink->cid == NCI_CORE_ANY_CID) {
+                if (sink->func) {
+                    sink->func(&self->core, cid, payload, len,
+                        sink->user_data);
+                } else if (sink->bytes) {
+                    if (!bytes) {
+                        /* SAR didn't provide GBytes, make a copy */
+                        bytes = copy = g_bytes_new(payload, len);
+                    }
+                    sink->bytes(&self->core, cid, bytes, sink->user_data);
+                }
+            }
         }
-
-        core->current_state = sm->last_state->state;
+        if (copy) {
+            g_bytes_unref(copy);
+        }
+        if (!--self->sink_dispatch && self->sinks_removed) {
+            nci_core_compact_sinks(self);
+        }
+    }
+    /* Don't pay for signal emission if there's no one to receive it */
+    if (g_signal_has_handler_pending(self,
+        nci_core_signals[SIGNAL_DATA_PACKET], 0, FALSE)) {
+        g_signal_emit(self, nci_core_signals[SIGNAL_DATA_PACKET], 0,
+            cid, payload, len);
+    }
+}
+
+static
+void
+nci_core_handle_data_packet(
+    NciCoreObject* self,
+    guint8 cid,
+    const void* payload,
+    guint len,
+    GBytes* bytes)
+{
+    NciCoreRxWindow* rx = (self->rx && cid < NCI_CORE_RX_CIDS) ?
+        (self->rx + cid) : NULL;
+
+    if (rx && rx->window) {
+        if (rx->queue.length || rx->outstanding >= rx->window) {
+            if (rx->overflow || rx->queued_bytes + len > rx->limit) {
+                /* The consumer is too far behind */
+                if (!rx->overflow) {
+                    GWARN("Connection %u overflow, dropping packets", cid);
+                    rx->overflow = TRUE;
+                }
+                GDEBUG("Dropping %u byte(s) received from connection %u",
+                    len, cid);
+                rx->dropped++;
+            } else {
+                /* The consumer is behind, hold the packet */
+                g_queue_push_tail(&rx->queue, bytes ? g_bytes_ref(bytes) :
+                    g_bytes_new(payload, len));
+                rx->queued_bytes += len;
+            }
+            return;
+        }
+        rx->outstanding += len;
+    }
+    nci_core_dispatch_data_packet(self, cid, payload, len, bytes);
+}
+
+static
+void
+nci_core_rx_drain(
+    NciCoreObject* self,
+    guint8 cid)
+{
+    NciCoreRxWindow* rx = self->rx + cid;
+
+    /* Nested calls are made by the callbacks, the outer loop continues */
+    if (!rx->draining && rx->queue.length) {
+        g_object_ref(self);
+        rx->draining = TRUE;
+        while (rx->queue.length &&
+            (!rx->window || rx->outstanding < rx->window)) {
+            GBytes* bytes = g_queue_pop_head(&rx->queue);
+            gsize len;
+            const void* data = g_bytes_get_data(bytes, &len);
+
+            rx->queued_bytes -= len;
+            if (rx->window) {
+                rx->outstanding += len;
+            }
+            nci_core_dispatch_data_packet(self, cid, data, len, bytes);
+            g_bytes_unref(bytes);
+        }
+        rx->draining = FALSE;
+        g_object_unref(self);
+    }
+    if (!rx->queue.length && rx->overflow) {
+        /* The consumer has caught up, the next packet starts over */
+        GDEBUG("Connection %u queue drained", cid);
+        rx->overflow = FALSE;
+    }
+}
+
+static
+void
+nci_core_sar_handle_data_packet(
+    NciSarClient* client,
+    guint8 cid,
+    const void* payload,
+    guint len)
+{
+    nci_core_handle_data_packet(nci_core_object_cast_sar_client(client),
+        cid, payload, len, NULL);
+}
+
+static
+void
+nci_core_sar_handle_data_bytes(
+    NciSarClient* client,
+    guint8 cid,
+    GBytes* payload)
+{
+    gsize len;
+    const void* data = g_bytes_get_data(payload, &len);
+
+    nci_core_handle_data_packet(nci_core_object_cast_sar_client(client),
+        cid, data, len, payload);
+}
+
+/*==========================================================================*
+ * Interface
+ *==========================================================================*/
+
+NciCore*
+nci_core_new(
+    NciHalIo* hal)
+{
+    if (G_LIKELY(hal)) {
+        NciCoreObject* self = g_object_new(THIS_TYPE, NULL);
+        NciCore* core = &self->core;
+        NciSm* sm;
+        guint i;
+
+        self->io.sar = nci_sar_new(hal, &self->sar_client);
+        self->sm = sm = nci_sm_new(&self->io);
+
+        for (i = 0; i < NCI_CORE_PARAM_COUNT; i++) {
+            nci_core_params[i].reset(self);
+        }
+
+        core->current_state = sm->last_state->state;
         core->next_state = sm->next_state->state;
 
         self->event_ids[EVENT_LAST_STATE] = nci_sm_add_last_state_handler(sm,
@@ -752,6 +1345,15 @@ nci_core_new(
     return NULL;
 }
 
+NciSm*
+nci_core_sm(
+    NciCore* core)
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    return G_LIKELY(self) ? self->sm : NULL;
+}
+
 void
 nci_core_free(
     NciCore* core)
@@ -762,7 +1364,7 @@ nci_core_free(
         NciSm* sm = self->sm;
 
         sm->io = NULL;
-        gutil_source_clear(&self->cmd_timeout_id);
+        nci_core_cancel_commands(self, FALSE);
         nci_sar_free(self->io.sar);
         self->io.sar = NULL;
         g_object_unref(self);
@@ -936,6 +1538,18 @@ nci_core_set_tech(
     return G_LIKELY(self) ? nci_sm_set_tech(self->sm, tech) : NCI_TECH_NONE;
 }
 
+void
+nci_core_set_max_write_packets(
+    NciCore* core,
+    guint max) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self)) {
+        nci_sar_set_max_write_packets(self->io.sar, max);
+    }
+}
+
 guint
 nci_core_send_data_msg(
     NciCore* core,
@@ -949,14 +1563,17 @@ nci_core_send_data_msg(
 
     if (G_LIKELY(self)) {
         if (complete || destroy) {
-            NciCoreSendData* data = g_slice_new0(NciCoreSendData);
-
-            data->complete = complete;
-            data->destroy = destroy;
-            data->user_data = user_data;
-            return nci_sar_send_data_packet(self->io.sar, cid, payload,
-                nci_core_send_data_msg_complete,
-                nci_core_send_data_msg_destroy, data);
+            NciCoreSendData* send = nci_core_send_data_new(self,
+                complete, destroy, user_data);
+            const guint id = nci_sar_send_data_packet(self->io.sar, cid,
+                payload, nci_core_send_data_msg_complete,
+                nci_core_send_data_msg_destroy, send);
+
+            if (!id) {
+                /* Nothing has been queued */
+                nci_core_send_data_release(self, send);
+            }
+            return id;
         } else {
             return nci_sar_send_data_packet(self->io.sar, cid, payload,
                 NULL, NULL, NULL);
@@ -965,6 +1582,72 @@ nci_core_send_data_msg(
     return 0;
 }
 
+guint
+nci_core_send_data_buf(
+    NciCore* core,
+    guint8 cid,
+    const void* data,
+    gsize size,
+    NciCoreSendFunc complete,
+    GDestroyNotify destroy,
+    void* user_data) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self)) {
+        if (complete || destroy) {
+            NciCoreSendData* send = nci_core_send_data_new(self,
+                complete, destroy, user_data);
+            const guint id = nci_sar_send_data_buf(self->io.sar, cid,
+                data, size, nci_core_send_data_msg_complete,
+                nci_core_send_data_msg_destroy, send);
+
+            if (!id) {
+                /* Nothing has been queued */
+                nci_core_send_data_release(self, send);
+            }
+            return id;
+        } else {
+            return nci_sar_send_data_buf(self->io.sar, cid, data, size,
+                NULL, NULL, NULL);
+        }
+    }
+    return 0;
+}
+
+guint
+nci_core_send_data_msgv(
+    NciCore* core,
+    guint8 cid,
+    GBytes* const* frags,
+    guint count,
+    NciCoreSendFunc complete,
+    GDestroyNotify destroy,
+    void* user_data) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self)) {
+        if (complete || destroy) {
+            NciCoreSendData* send = nci_core_send_data_new(self,
+                complete, destroy, user_data);
+            const guint id = nci_sar_send_data_packetv(self->io.sar,
+                cid, frags, count, nci_core_send_data_msg_complete,
+                nci_core_send_data_msg_destroy, send);
+
+            if (!id) {
+                /* Nothing has been queued */
+                nci_core_send_data_release(self, send);
+            }
+            return id;
+        } else {
+            return nci_sar_send_data_packetv(self->io.sar, cid, frags, count,
+                NULL, NULL, NULL);
+        }
+    }
+    return 0;
+}
+
 void
 nci_core_cancel(
     NciCore* core,
@@ -977,6 +1660,320 @@ nci_core_cancel(
     }
 }
 
+void
+nci_core_cancel_data(
+    NciCore* core,
+    guint8 cid) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self)) {
+        nci_sar_cancel_data(self->io.sar, cid);
+    }
+}
+
+void
+nci_core_set_data_scheduler(
+    NciCore* core,
+    NCI_DATA_SCHED sched) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self)) {
+        nci_sar_set_data_scheduler(self->io.sar, sched);
+    }
+}
+
+void
+nci_core_set_data_weight(
+    NciCore* core,
+    guint8 cid,
+    guint weight) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self)) {
+        nci_sar_set_data_weight(self->io.sar, cid, weight);
+    }
+}
+
+gboolean
+nci_core_get_data_stats(
+    NciCore* core,
+    guint8 cid,
+    NciConnStats* stats) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    return G_LIKELY(self) && nci_sar_get_data_stats(self->io.sar, cid, stats);
+}
+
+static
+NciCoreRxWindow*
+nci_core_rx_window(
+    NciCoreObject* self,
+    guint8 cid)
+{
+    if (!self->rx) {
+        guint i;
+
+        /* Zero-initialized GQueue is an empty queue */
+        self->rx = g_new0(NciCoreRxWindow, NCI_CORE_RX_CIDS);
+        for (i = 0; i < NCI_CORE_RX_CIDS; i++) {
+            self->rx[i].limit = NCI_CORE_RX_DEFAULT_LIMIT;
+        }
+    }
+    return self->rx + cid;
+}
+
+void
+nci_core_set_data_rx_window(
+    NciCore* core,
+    guint8 cid,
+    guint window) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self) && cid < NCI_CORE_RX_CIDS && (self->rx || window)) {
+        NciCoreRxWindow* rx;
+
+        rx = nci_core_rx_window(self, cid);
+        rx->window = window;
+        if (!window) {
+            rx->outstanding = 0;
+        }
+        /* Bigger window (or no window at all) may let something through */
+        nci_core_rx_drain(self, cid);
+    }
+}
+
+void
+nci_core_set_data_rx_limit(
+    NciCore* core,
+    guint8 cid,
+    guint max_bytes) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self) && cid < NCI_CORE_RX_CIDS) {
+        nci_core_rx_window(self, cid)->limit = max_bytes ? max_bytes :
+            NCI_CORE_RX_DEFAULT_LIMIT;
+    }
+}
+
+void
+nci_core_data_consumed(
+    NciCore* core,
+    guint8 cid,
+    guint bytes) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self) && self->rx && cid < NCI_CORE_RX_CIDS) {
+        NciCoreRxWindow* rx = self->rx + cid;
+
+        rx->outstanding -= MIN(bytes, rx->outstanding);
+        nci_core_rx_drain(self, cid);
+    }
+}
+
+gboolean
+nci_core_get_data_rx_status(
+    NciCore* core,
+    guint8 cid,
+    NciConnRxStatus* status) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self) && cid < NCI_CORE_RX_CIDS) {
+        if (status) {
+            if (self->rx) {
+                const NciCoreRxWindow* rx = self->rx + cid;
+
+                status->window = rx->window;
+                status->outstanding = rx->outstanding;
+                status->queued = rx->queue.length;
+                status->queued_bytes = rx->queued_bytes;
+                status->limit = rx->limit;
+                status->dropped = rx->dropped;
+            } else {
+                memset(status, 0, sizeof(*status));
+                status->limit = NCI_CORE_RX_DEFAULT_LIMIT;
+            }
+        }
+        return TRUE;
+    }
+    return FALSE;
+}
+
+NciCoreStats*
+nci_core_get_stats(
+    NciCore* core) /* Since 1.1.34 */
+{
+#if NCI_STATS
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self) && self->cmd_stats &&
+        g_hash_table_size(self->cmd_stats)) {
+        const guint n = g_hash_table_size(self->cmd_stats);
+        const gsize size = G_ALIGN8(sizeof(NciCoreStats));
+        NciCoreStats* stats = g_malloc(size + n * sizeof(NciCmdStats));
+        NciCmdStats* cmd = (NciCmdStats*)((guint8*)stats + size);
+        NciCmdStats* ptr = cmd;
+        GHashTableIter it;
+        gpointer value;
+
+        g_hash_table_iter_init(&it, self->cmd_stats);
+        while (g_hash_table_iter_next(&it, NULL, &value)) {
+            *ptr++ = *(NciCmdStats*)value;
+        }
+        qsort(cmd, n, sizeof(NciCmdStats), nci_core_cmd_stats_compare);
+        stats->count = n;
+        stats->cmd = cmd;
+        return stats;
+    }
+#endif
+    return NULL;
+}
+
+void
+nci_core_reset_stats(
+    NciCore* core) /* Since 1.1.34 */
+{
+#if NCI_STATS
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self)) {
+        if (self->cmd_stats) {
+            g_hash_table_remove_all(self->cmd_stats);
+        }
+        nci_sm_reset_stats(self->sm);
+    }
+#endif
+}
+
+gboolean
+nci_core_get_sm_stats(
+    NciCore* core,
+    NciSmStats* stats) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    return G_LIKELY(self) && nci_sm_get_stats(self->sm, stats);
+}
+
+void
+nci_core_set_stats_log_interval(
+    NciCore* core,
+    guint sec) /* Since 1.1.34 */
+{
+#if NCI_STATS
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self)) {
+        if (self->stats_log_id) {
+            g_source_remove(self->stats_log_id);
+            self->stats_log_id = 0;
+        }
+        if (sec) {
+            self->stats_log_id = g_timeout_add_seconds(sec,
+                nci_core_stats_log, self);
+        }
+    }
+#endif
+}
+
+void
+nci_core_set_trace_size(
+    NciCore* core,
+    gsize size) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self)) {
+        nci_sar_set_trace_size(self->io.sar, size);
+    }
+}
+
+GBytes*
+nci_core_get_trace(
+    NciCore* core) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    return G_LIKELY(self) ? nci_sar_get_trace(self->io.sar) : NULL;
+}
+
+gboolean
+nci_core_save_trace(
+    NciCore* core,
+    const char* file) /* Since 1.1.34 */
+{
+    GBytes* trace = nci_core_get_trace(core);
+    gboolean ok = FALSE;
+
+    if (trace && file) {
+        GError* error = NULL;
+        gsize size;
+        const void* data = g_bytes_get_data(trace, &size);
+
+        if (g_file_set_contents(file, data, size, &error)) {
+            GDEBUG("Saved %u bytes to %s", (guint) size, file);
+            ok = TRUE;
+        } else {
+            GERR("Error saving %s: %s", file, error->message);
+            g_error_free(error);
+        }
+    }
+    if (trace) {
+        g_bytes_unref(trace);
+    }
+    return ok;
+}
+
+void
+nci_core_set_select_policy(
+    NciCore* core,
+    const NciSelectPolicy* policy) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self)) {
+        nci_sm_set_select_policy(self->sm, policy);
+    }
+}
+
+void
+nci_core_set_activation_cache_size(
+    NciCore* core,
+    guint size) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self)) {
+        nci_sm_set_activation_cache_size(self->sm, size);
+    }
+}
+
+gboolean
+nci_core_get_activation_info(
+    NciCore* core,
+    NciActivationInfo* info) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    return G_LIKELY(self) && nci_sm_get_activation_info(self->sm, info);
+}
+
+NciActivation*
+nci_core_get_activation(
+    NciCore* core) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    return G_LIKELY(self) ? nci_sm_get_activation(self->sm) : NULL;
+}
+
 gulong
 nci_core_add_current_state_changed_handler(
     NciCore* core,
@@ -1046,6 +2043,87 @@ nci_core_add_param_change_handler(
             G_CALLBACK(func), user_data) : 0;
 }
 
+static
+gulong
+nci_core_add_sink(
+    NciCoreObject* self,
+    guint8 cid,
+    NciCoreDataPacketFunc func,
+    NciCoreDataBytesFunc bytes,
+    void* user_data)
+{
+    NciCoreDataSink* sink;
+
+    self->sinks = g_renew(NciCoreDataSink, self->sinks, self->n_sinks + 1);
+    sink = self->sinks + (self->n_sinks++);
+    sink->id = ++self->last_sink_id;
+    sink->cid = cid;
+    sink->func = func;
+    sink->bytes = bytes;
+    sink->user_data = user_data;
+    if (bytes && !(self->n_bytes_sinks++)) {
+        /* First bytes sink, ask SAR for GBytes */
+        nci_sar_set_data_bytes(nci_sm_sar(self->sm), TRUE);
+    }
+    return sink->id;
+}
+
+gulong
+nci_core_add_data_sink(
+    NciCore* core,
+    guint8 cid,
+    NciCoreDataPacketFunc func,
+    void* user_data) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    return (G_LIKELY(self) && G_LIKELY(func)) ?
+        nci_core_add_sink(self, cid, func, NULL, user_data) : 0;
+}
+
+gulong
+nci_core_add_data_bytes_sink(
+    NciCore* core,
+    guint8 cid,
+    NciCoreDataBytesFunc func,
+    void* user_data) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    return (G_LIKELY(self) && G_LIKELY(func)) ?
+        nci_core_add_sink(self, cid, NULL, func, user_data) : 0;
+}
+
+void
+nci_core_remove_data_sink(
+    NciCore* core,
+    gulong id) /* Since 1.1.34 */
+{
+    NciCoreObject* self = nci_core_object_cast(core);
+
+    if (G_LIKELY(self) && G_LIKELY(id)) {
+        guint i;
+
+        for (i = 0; i < self->n_sinks; i++) {
+            NciCoreDataSink* sink = self->sinks + i;
+
+            if (sink->id == id && nci_core_data_sink_active(sink)) {
+                if (sink->bytes && !(--self->n_bytes_sinks)) {
+                    /* Back to raw pointers */
+                    nci_sar_set_data_bytes(nci_sm_sar(self->sm), FALSE);
+                }
+                sink->func = NULL;
+                sink->bytes = NULL;
+                self->sinks_removed = TRUE;
+                if (!self->sink_dispatch) {
+                    nci_core_compact_sinks(self);
+                }
+                return;
+            }
+        }
+    }
+}
+
 void
 nci_core_remove_handler(
     NciCore* core,
@@ -1080,15 +2158,18 @@ nci_core_object_init(
         .error = nci_core_sar_error,
         .handle_response = nci_core_sar_handle_response,
         .handle_notification = nci_core_sar_handle_notification,
-        .handle_data_packet = nci_core_sar_handle_data_packet
+        .handle_data_packet = nci_core_sar_handle_data_packet,
+        .handle_data_bytes = nci_core_sar_handle_data_bytes
     };
 
     NciCore* core = &self->core;
 
     core->cmd_timeout = DEFAULT_TIMEOUT;
+    core->cmd_window = DEFAULT_CMD_WINDOW;
     self->sar_client.fn = &sar_client_functions;
     self->io.timeout = nci_core_io_timeout;
     self->io.send = nci_core_io_send;
+    self->io.queue = nci_core_io_queue;
     self->io.cancel = nci_core_io_cancel;
 }
 
@@ -1099,10 +2180,27 @@ nci_core_object_finalize(
 {
     NciCoreObject* self = THIS(object);
 
-    gutil_source_remove(self->cmd_timeout_id);
+    nci_core_cancel_commands(self, FALSE);
     nci_sm_remove_all_handlers(self->sm, self->event_ids);
     nci_sm_free(self->sm);
     nci_sar_free(self->io.sar);
+    while (self->free_send_data) {
+        NciCoreSendData* send = self->free_send_data;
+
+        self->free_send_data = send->next;
+        g_slice_free(NciCoreSendData, send);
+    }
+    g_free(self->sinks);
+#if NCI_STATS
+    if (self->stats_log_id) {
+        g_source_remove(self->stats_log_id);
+    }
+    if (self->cmd_stats) {
+        g_hash_table_destroy(self->cmd_stats);
+    }
+#endif
+    nci_core_rx_flush_all(self);
+    g_free(self->rx);
     G_OBJECT_CLASS(nci_core_object_parent_class)->finalize(object);
 }
 
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+#include "nci_layout.h"
+#include "nci_log.h"
+
+#include <gutil_macros.h>
+
+gboolean
+nci_layout_decode(
+    const NciLayout* layout,
+    const guint8* pkt,
+    guint len,
+    void* view)
+{
+    const guint8* ptr = pkt;
+    const guint8* end = pkt + len;
+    guint i;
+
+    for (i = 0; i < layout->count; i++) {
+        const NciField* field = layout->fields + i;
+        void* dest = G_STRUCT_MEMBER_P(view, field->offset);
+        const guint left = end - ptr;
+        gboolean ok = FALSE;
+
+        switch ((NCI_FIELD_TYPE)field->type) {
+        case NCI_FIELD_U8:
+            if (left >= 1) {
+                *(guint*)dest = ptr[0];
+                ptr++;
+                ok = TRUE;
+            }
+            break;
+        case NCI_FIELD_U16:
+            if (left >= 2) {
+                *(guint*)dest = ((guint)ptr[1] << 8) + ptr[0];
+                ptr += 2;
+                ok = TRUE;
+            }
+            break;
+        case NCI_FIELD_BYTES:
+            if (left >= field->size) {
+                *(const guint8**)dest = ptr;
+                ptr += field->size;
+                ok = TRUE;
+            }
+            break;
+        case NCI_FIELD_DATA:
+            if (left >= 1 && ptr[0] >= field->size && left >= 1u + ptr[0]) {
+                GUtilData* data = dest;
+
+                data->size = ptr[0];
+                data->bytes = data->size ? (ptr + 1) : NULL;
+                ptr += 1 + data->size;
+                ok = TRUE;
+            }
+            break;
+        case NCI_FIELD_REST:
+            if (left >= field->size) {
+                GUtilData* data = dest;
+
+                data->size = left;
+                data->bytes = left ? ptr : NULL;
+                ptr = end;
+                ok = TRUE;
+            }
+            break;
+        }
+
+        if (!ok) {
+            GVERBOSE("%s: field #%u doesn't fit", layout->name, i);
+            return FALSE;
+        }
+    }
+    if ((layout->flags & NCI_LAYOUT_EXACT) && ptr != end) {
+        GVERBOSE("%s: %u extra byte(s)", layout->name, (guint)(end - ptr));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+#ifndef NCI_LAYOUT_H
+#define NCI_LAYOUT_H
+
+#include "nci_types_p.h"
+
+/*
+ * Declarative description of NCI message layouts. A layout is a static
+ * table of fields, each one decoded into a member of a fixed-layout view
+ * structure. Decoding doesn't allocate anything, pointers in the view
+ * point into the packet. The packet gets validated as it's being decoded,
+ * and if anything doesn't fit, the view is left partially filled and
+ * FALSE is returned.
+ *
+ * Multi-byte integers are little endian (NCI 1.0, 1.11 Coding Conventions).
+ */
+
+typedef enum nci_field_type {
+    NCI_FIELD_U8,       /* 1 byte => guint */
+    NCI_FIELD_U16,      /* 2 bytes => guint */
+    NCI_FIELD_BYTES,    /* size bytes => const guint8* */
+    NCI_FIELD_DATA,     /* Length byte and at least size bytes => GUtilData */
+    NCI_FIELD_REST      /* At least size bytes up to the end => GUtilData */
+} NCI_FIELD_TYPE;
+
+typedef struct nci_field {
+    guint8 type;        /* NCI_FIELD_TYPE */
+    guint8 size;
+    guint16 offset;     /* Offset of the member within the view */
+} NciField;
+
+typedef enum nci_layout_flags {
+    NCI_LAYOUT_FLAGS_NONE = 0x00,
+    NCI_LAYOUT_EXACT = 0x01   /* No trailing bytes allowed */
+} NCI_LAYOUT_FLAGS;
+
+typedef struct nci_layout {
+    const char* name;
+    const NciField* fields;
+    guint count;
+    NCI_LAYOUT_FLAGS flags;
+} NciLayout;
+
+#define NCI_FIELD(type,view,member) \
+    { NCI_FIELD_##type, 0, G_STRUCT_OFFSET(view,member) }
+#define NCI_FIELD_N(type,n,view,member) \
+    { NCI_FIELD_##type, n, G_STRUCT_OFFSET(view,member) }
+#define NCI_LAYOUT(name,fields,flags) \
+    { name, fields, G_N_ELEMENTS(fields), flags }
+
+/* Zero-length DATA and REST fields are decoded as { NULL, 0 } */
+gboolean
+nci_layout_decode(
+    const NciLayout* layout,
+    const guint8* pkt,
+    guint len,
+    void* view)
+    NCI_INTERNAL;
+
+#endif /* NCI_LAYOUT_H */
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -1,4 +1,5 @@
 /*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019 Jolla Ltd.
  * Copyright (C) 2019 Slava Monich <slava.monich@jolla.com>
  *
@@ -50,7 +51,7 @@ nci_param_w4_all_discoveries_new(
         NciParamW4AllDiscoveries* self =
             g_object_new(NCI_TYPE_PARAM_W4_ALL_DISCOVERIES, NULL);
 
-        self->ntf = nci_discovery_ntf_copy(ntf);
+        self->ntf = ntf;
         return self;
     }
     return NULL;
@@ -67,23 +68,11 @@ nci_param_w4_all_discoveries_init(
 {
 }
 
-static
-void
-nci_param_w4_all_discoveries_finalize(
-    GObject* obj)
-{
-    NciParamW4AllDiscoveries* self = NCI_PARAM_W4_ALL_DISCOVERIES(obj);
-
-    g_free(self->ntf);
-    G_OBJECT_CLASS(nci_param_w4_all_discoveries_parent_class)->finalize(obj);
-}
-
 static
 void
 nci_param_w4_all_discoveries_class_init(
     NciParamClass* klass)
 {
-    G_OBJECT_CLASS(klass)->finalize = nci_param_w4_all_discoveries_finalize;
 }
 
 /*
@@ -1,4 +1,5 @@
 /*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2020 Jolla Ltd.
  * Copyright (C) 2019-2020 Slava Monich <slava.monich@jolla.com>
  *
@@ -37,7 +38,7 @@
 
 typedef struct nci_param_w4_all_discoveries {
     NciParam param;
-    NciDiscoveryNtf* ntf;
+    const NciDiscoveryNtf* ntf; /* Not a copy */
 } NciParamW4AllDiscoveries;
 
 GType nci_param_w4_all_discoveries_get_type(void) NCI_INTERNAL;
@@ -48,6 +49,11 @@ GType nci_param_w4_all_discoveries_get_type(void) NCI_INTERNAL;
 #define NCI_PARAM_W4_ALL_DISCOVERIES(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), \
         NCI_TYPE_PARAM_W4_ALL_DISCOVERIES, NciParamW4AllDiscoveries)
 
+/*
+ * The notification is referenced, not copied. The parameter is only
+ * good for the duration of nci_sm_enter_state() call, and the state
+ * copies the notification into the discovery arena.
+ */
 NciParamW4AllDiscoveries*
 nci_param_w4_all_discoveries_new(
     const NciDiscoveryNtf* ntf)
@@ -1,4 +1,5 @@
 /*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019 Jolla Ltd.
  * Copyright (C) 2019 Slava Monich <slava.monich@jolla.com>
  *
@@ -41,6 +42,7 @@ G_DEFINE_TYPE(NciParamW4HostSelect, nci_param_w4_host_select, NCI_TYPE_PARAM)
  * Interface
  *==========================================================================*/
 
+/* Notifications are referenced, they must stay in the arena */
 NciParamW4HostSelect*
 nci_param_w4_host_select_new(
     const NciDiscoveryNtf* const* ntf,
@@ -49,7 +51,7 @@ nci_param_w4_host_select_new(
     NciParamW4HostSelect* self =
         g_object_new(NCI_TYPE_PARAM_W4_HOST_SELECT, NULL);
 
-    self->ntf = nci_discovery_ntf_copy_array(ntf, count);
+    self->ntf = ntf;
     self->count = count;
     return self;
 }
@@ -65,23 +67,11 @@ nci_param_w4_host_select_init(
 {
 }
 
-static
-void
-nci_param_w4_host_select_finalize(
-    GObject* obj)
-{
-    NciParamW4HostSelect* self = NCI_PARAM_W4_HOST_SELECT(obj);
-
-    g_free(self->ntf);
-    G_OBJECT_CLASS(nci_param_w4_host_select_parent_class)->finalize(obj);
-}
-
 static
 void
 nci_param_w4_host_select_class_init(
     NciParamClass* klass)
 {
-    G_OBJECT_CLASS(klass)->finalize = nci_param_w4_host_select_finalize;
 }
 
 /*
@@ -1,4 +1,5 @@
 /*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2020 Jolla Ltd.
  * Copyright (C) 2019-2020 Slava Monich <slava.monich@jolla.com>
  *
@@ -37,7 +38,7 @@
 
 typedef struct nci_param_w4_host_select {
     NciParam param;
-    NciDiscoveryNtf* ntf;
+    const NciDiscoveryNtf* const* ntf; /* In the discovery arena */
     guint count;
 } NciParamW4HostSelect;
 
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2018-2025 Slava Monich <slava@monich.com>
+ * Copyright (C) 2018-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2018-2020 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -39,6 +39,7 @@
 
 #include "nci_sar.h"
 #include "nci_hal.h"
+#include "nci_trace.h"
 #include "nci_log.h"
 
 #include <gutil_macros.h>
@@ -49,18 +50,29 @@
 #define SAR_MIN_CONTROL_PAYLOAD_LIMIT (0x20) /* Valid range is 32 to 255 */
 #define SAR_MIN_DATA_PAYLOAD_LIMIT (0x01) /* Valid range is 1 to 255 */
 #define SAR_UNLIMITED_CREDITS (0xff)
+#define SAR_MAX_WRITE_PACKETS (0xff)
+#define SAR_MAX_FREE_PACKETS (16)
 
 #define NCI_HDR_SIZE (3)
+#define NCI_MAX_PACKET_SIZE (NCI_HDR_SIZE + 0xff)
 
 typedef struct nci_sar_packet_out NciSarPacketOut;
 typedef struct nci_sar_logical_connection NciSarLogicalConnection;
 
 struct nci_sar_packet_out {
     NciSarPacketOut* next;
-    NciSarLogicalConnection* conn;
-    guint8 hdr[NCI_HDR_SIZE];
-    GBytes* payload;
-    guint payload_pos;
+    NciSarPacketOut* prev;
+    gboolean queued; /* TRUE if it's sitting in cmd or connection queue */
+    guint8 hdr[NCI_HDR_SIZE - 1]; /* Length is set for each segment */
+    GBytes* payload; /* Keeps data alive, NULL if it's owned by the caller */
+    const guint8* data;
+    GBytes** frags; /* Replaces data if the payload is fragmented */
+    guint nfrags;
+    guint frag_index;
+    gsize frag_pos;
+    gsize size;
+    gsize payload_pos;
+    gint64 queued_at; /* For statistics */
     NciSarCompletionFunc complete;
     GDestroyNotify destroy;
     gpointer user_data;
@@ -70,12 +82,16 @@ struct nci_sar_packet_out {
 typedef struct nci_sar_packet_out_queue {
     NciSarPacketOut* first;
     NciSarPacketOut* last;
+    guint count;
 } NciSarPacketOutQueue;
 
 struct nci_sar_logical_connection {
     guint8 credits;
     GByteArray* in;
     NciSarPacketOutQueue out;
+    guint weight; /* Zero means the default (one) */
+    gsize deficit;
+    NciConnStats stats;
 };
 
 struct nci_sar {
@@ -89,11 +105,26 @@ struct nci_sar {
     guint last_packet_id;
     guint start_write_id;
     gboolean write_pending;
-    NciSarPacketOut* writing;
+    guint max_write_packets;
+    NCI_DATA_SCHED sched;
+    guint sched_next; /* Next cid to look at (round robin) */
+    guint write_buf_size;
+    guint write_chunks_size;
+    guint8* write_hdr;
+    GUtilData* write_chunks;
+    NciSarPacketOutQueue writing;
     NciSarPacketOutQueue cmd;
+    GHashTable* packets; /* id => NciSarPacketOut */
+    NciSarPacketOut* free_packets; /* Released descriptors for reuse */
+    guint free_count;
+    guint packets_allocated; /* Statistics */
     NciSarLogicalConnection* conn;
     GByteArray* control_in;
-    GByteArray* read_buf;
+    gboolean data_bytes; /* Deliver data packets as GBytes */
+    GBytes* read_bytes; /* HAL buffer being parsed, if HAL provided one */
+    guint read_len;
+    guint8* read_buf; /* NCI_MAX_PACKET_SIZE bytes, may be handed over */
+    NciTrace* trace; /* NULL unless tracing is enabled */
 };
 
 /* Control packets */
@@ -124,19 +155,170 @@ nci_sar_from_hal_client(
     return G_CAST(hal_client, NciSar, hal_client);
 }
 
+static
+NciSarPacketOut*
+nci_sar_packet_out_new(
+    NciSar* self)
+{
+    NciSarPacketOut* out = self->free_packets;
+
+    /* Reuse a released descriptor if there is one */
+    if (out) {
+        self->free_packets = out->next;
+        self->free_count--;
+        memset(out, 0, sizeof(*out));
+    } else {
+        out = g_slice_new0(NciSarPacketOut);
+        self->packets_allocated++;
+    }
+    return out;
+}
+
 static
 void
 nci_sar_packet_out_free(
+    NciSar* self,
     NciSarPacketOut* out)
 {
     /* Caller makes sure that argument is not NULL */
-    if (out->payload) {
-        g_bytes_unref(out->payload);
+    GBytes* payload = out->payload;
+    GBytes** frags = out->frags;
+    const guint nfrags = out->nfrags;
+    GDestroyNotify destroy = out->destroy;
+    gpointer user_data = out->user_data;
+
+    g_hash_table_remove(self->packets, GUINT_TO_POINTER(out->id));
+
+    /*
+     * Release the descriptor before invoking the destroy callback,
+     * in case if the callback decides to free the whole thing.
+     */
+    if (self->free_count < SAR_MAX_FREE_PACKETS) {
+        out->next = self->free_packets;
+        self->free_packets = out;
+        self->free_count++;
+    } else {
+        g_slice_free(NciSarPacketOut, out);
+    }
+    if (payload) {
+        g_bytes_unref(payload);
+    }
+    if (frags) {
+        guint i;
+
+        for (i = 0; i < nfrags; i++) {
+            g_bytes_unref(frags[i]);
+        }
+        g_free(frags);
+    }
+    if (destroy) {
+        destroy(user_data);
+    }
+}
+
+static
+gboolean
+nci_sar_packet_out_done(
+    const NciSarPacketOut* out)
+{
+    return out->payload_pos >= out->size;
+}
+
+static
+void
+nci_sar_queue_push(
+    NciSarPacketOutQueue* queue,
+    NciSarPacketOut* out)
+{
+    out->next = NULL;
+    out->prev = queue->last;
+    queue->count++;
+    if (queue->last) {
+        GASSERT(queue->first);
+        queue->last->next = out;
+        queue->last = out;
+    } else {
+        GASSERT(!queue->first);
+        queue->first = queue->last = out;
+    }
+}
+
+static
+void
+nci_sar_queue_push_front(
+    NciSarPacketOutQueue* queue,
+    NciSarPacketOut* out)
+{
+    out->prev = NULL;
+    out->next = queue->first;
+    queue->count++;
+    if (queue->first) {
+        queue->first->prev = out;
+    } else {
+        GASSERT(!queue->last);
+        queue->last = out;
+    }
+    queue->first = out;
+}
+
+static
+void
+nci_sar_queue_remove(
+    NciSarPacketOutQueue* queue,
+    NciSarPacketOut* out)
+{
+    if (out->prev) {
+        out->prev->next = out->next;
+    } else {
+        GASSERT(queue->first == out);
+        queue->first = out->next;
     }
-    if (out->destroy) {
-        out->destroy(out->user_data);
+    if (out->next) {
+        out->next->prev = out->prev;
+    } else {
+        GASSERT(queue->last == out);
+        queue->last = out->prev;
+    }
+    GASSERT(queue->count);
+    queue->count--;
+    out->next = out->prev = NULL;
+}
+
+static
+NciSarPacketOut*
+nci_sar_queue_pop(
+    NciSarPacketOutQueue* queue)
+{
+    NciSarPacketOut* out = queue->first;
+
+    if (out) {
+        if ((queue->first = out->next) != NULL) {
+            queue->first->prev = NULL;
+        } else {
+            queue->last = NULL;
+        }
+        GASSERT(queue->count);
+        queue->count--;
+        out->next = NULL;
+    }
+    return out;
+}
+
+static
+void
+nci_sar_complete_queue(
+    NciSar* self,
+    NciSarPacketOutQueue* queue,
+    gboolean ok)
+{
+    NciSarPacketOut* out;
+
+    while ((out = nci_sar_queue_pop(queue)) != NULL) {
+        if (out->complete) {
+            out->complete(self->client, ok, out->user_data);
+        }
+        nci_sar_packet_out_free(self, out);
     }
-    g_slice_free(NciSarPacketOut, out);
 }
 
 static
@@ -146,39 +328,169 @@ nci_sar_write_completed(
     gboolean ok)
 {
     NciSar* self = nci_sar_from_hal_client(client);
-    NciSarPacketOut* out = self->writing;
+    NciSarPacketOutQueue done;
 
-    GASSERT(out);
+    GASSERT(self->writing.first);
     GASSERT(self->write_pending);
     self->write_pending = FALSE;
-    if (ok) {
-        gsize payload_len = out->payload ? g_bytes_get_size(out->payload) : 0;
-
-        GASSERT(payload_len >= out->payload_pos);
-        if (payload_len == out->payload_pos) {
-            /* Done with this packet */
-            self->writing = NULL;
-            if (out->complete) {
-                out->complete(self->client, TRUE, out->user_data);
-            }
-            nci_sar_packet_out_free(out);
-        }
 
+    /*
+     * Detach the packets which have been fully written (or all of
+     * them if the write has failed) before invoking the completion
+     * callbacks. Only the last packet may still have more segments
+     * to send.
+     */
+    memset(&done, 0, sizeof(done));
+    while (self->writing.first &&
+        (!ok || nci_sar_packet_out_done(self->writing.first))) {
+        nci_sar_queue_push(&done, nci_sar_queue_pop(&self->writing));
+    }
+
+    nci_sar_complete_queue(self, &done, ok);
+    if (ok) {
         /* And try to write the next segment or packet */
         nci_sar_attempt_write(self);
     } else {
         NciSarClient* client = self->client;
 
-        /* Drop this packet and indicate an error */
-        self->writing = NULL;
-        if (out->complete) {
-            out->complete(self->client, FALSE, out->user_data);
-        }
-        nci_sar_packet_out_free(out);
+        /* Indicate an error */
         client->fn->error(client);
     }
 }
 
+static
+NciSarLogicalConnection*
+nci_sar_packet_conn(
+    NciSar* self,
+    const NciSarPacketOut* out)
+{
+    /*
+     * The connection array gets reallocated when the number of logical
+     * connections changes, so the connection is looked up by cid every
+     * time. NULL for control packets and for connections which are gone.
+     */
+    if ((out->hdr[0] & NCI_MT_MASK) == NCI_MT_DATA_PKT) {
+        const guint cid = out->hdr[0] & NCI_DATA_CID_MASK;
+
+        if (cid < self->max_logical_conns) {
+            return self->conn + cid;
+        }
+    }
+    return NULL;
+}
+
+static
+gboolean
+nci_sar_conn_ready(
+    const NciSarLogicalConnection* conn)
+{
+    return conn->out.first && conn->credits;
+}
+
+static
+gsize
+nci_sar_conn_quantum(
+    NciSar* self,
+    const NciSarLogicalConnection* conn)
+{
+    /* Weight is the number of full size packets per round */
+    return MAX(conn->weight, 1) * self->data_payload_limit;
+}
+
+static
+NciSarLogicalConnection*
+nci_sar_sched_priority(
+    NciSar* self)
+{
+    guint i;
+
+    for (i = 0; i < self->max_logical_conns; i++) {
+        NciSarLogicalConnection* conn = self->conn + i;
+
+        if (nci_sar_conn_ready(conn)) {
+            return conn;
+        }
+    }
+    return NULL;
+}
+
+static
+NciSarLogicalConnection*
+nci_sar_sched_round_robin(
+    NciSar* self)
+{
+    const guint n = self->max_logical_conns;
+    guint i;
+
+    for (i = 0; i < n; i++) {
+        const guint cid = (self->sched_next + i) % n;
+        NciSarLogicalConnection* conn = self->conn + cid;
+
+        if (nci_sar_conn_ready(conn)) {
+            self->sched_next = (cid + 1) % n;
+            return conn;
+        }
+    }
+    return NULL;
+}
+
+static
+NciSarLogicalConnection*
+nci_sar_sched_weighted(
+    NciSar* self)
+{
+    const guint n = self->max_logical_conns;
+    gsize rounds = 0;
+    guint i;
+
+    /*
+     * Deficit round robin. The connection which is being served
+     * keeps the turn until it runs out of deficit, then the next
+     * one which can afford its head packet gets it. The whole packet
+     * is charged when it's picked for the first time.
+     */
+    for (i = 0; i < n; i++) {
+        const guint cid = (self->sched_next + i) % n;
+        NciSarLogicalConnection* conn = self->conn + cid;
+
+        if (nci_sar_conn_ready(conn)) {
+            const NciSarPacketOut* out = conn->out.first;
+            /* A packet put back for lack of credits has been paid for */
+            const gsize size = out->payload_pos ? 0 : out->size;
+
+            if (conn->deficit >= size) {
+                conn->deficit -= size;
+                self->sched_next = cid;
+                return conn;
+            } else {
+                const gsize q = nci_sar_conn_quantum(self, conn);
+                const gsize r = (size - conn->deficit + q - 1) / q;
+
+                /* Minimum number of rounds until someone can send */
+                if (!rounds || r < rounds) {
+                    rounds = r;
+                }
+            }
+        }
+    }
+
+    if (rounds) {
+        /* Nobody can afford to send, skip the idle rounds at once */
+        for (i = 0; i < n; i++) {
+            NciSarLogicalConnection* conn = self->conn + i;
+
+            if (nci_sar_conn_ready(conn)) {
+                conn->deficit += rounds * nci_sar_conn_quantum(self, conn);
+            }
+        }
+
+        /* The next connection in line gets its turn */
+        self->sched_next = (self->sched_next + 1) % n;
+        return nci_sar_sched_weighted(self);
+    }
+    return NULL;
+}
+
 static
 NciSarPacketOutQueue*
 nci_sar_write_queue(
@@ -187,38 +499,75 @@ nci_sar_write_queue(
     if (self->cmd.first) {
         return &self->cmd;
     } else {
-        guint i;
-
-        for (i = 0; i < self->max_logical_conns; i++) {
-            NciSarLogicalConnection* conn = self->conn + i;
+        NciSarLogicalConnection* conn;
+
+        switch (self->sched) {
+        case NCI_DATA_SCHED_ROUND_ROBIN:
+            conn = nci_sar_sched_round_robin(self);
+            break;
+        case NCI_DATA_SCHED_WEIGHTED:
+            conn = nci_sar_sched_weighted(self);
+            break;
+        case NCI_DATA_SCHED_PRIORITY:
+        default:
+            conn = nci_sar_sched_priority(self);
+            break;
+        }
 
-            if (conn->out.first && conn->credits) {
-                if (conn->credits != SAR_UNLIMITED_CREDITS) {
-                    conn->credits--;
-                    GVERBOSE("cid %u: %u credit(s)", i, conn->credits);
-                }
-                return &conn->out;
+        if (conn) {
+            if (conn->credits != SAR_UNLIMITED_CREDITS) {
+                conn->credits--;
+                GVERBOSE("cid %d: %u credit(s)", (int)(conn - self->conn),
+                    conn->credits);
             }
+            return &conn->out;
         }
     }
     return NULL;
 }
 
+static
+void
+nci_sar_packet_out_dequeued(
+    NciSar* self,
+    NciSarPacketOut* out)
+{
+    NciSarLogicalConnection* conn = nci_sar_packet_conn(self, out);
+
+    out->queued = FALSE;
+    if (conn) {
+        if (!conn->out.first) {
+            /* Idle connections don't accumulate deficit */
+            conn->deficit = 0;
+        }
+        if (!out->payload_pos) {
+            /* First segment, i.e. it's not being put back */
+            NciConnStats* stats = &conn->stats;
+            const guint64 wait = g_get_monotonic_time() - out->queued_at;
+
+            stats->packets++;
+            stats->bytes += out->size;
+            stats->wait_total += wait;
+            if (stats->wait_max < wait) {
+                stats->wait_max = wait;
+            }
+        }
+    }
+}
+
 static
 gboolean
 nci_sar_can_write(
     NciSar* self)
 {
-    if (!self->writing) {
+    if (!self->writing.first) {
         if (self->cmd.first) {
             return TRUE;
         } else {
             guint i;
 
             for (i = 0; i < self->max_logical_conns; i++) {
-                NciSarLogicalConnection* conn = self->conn + i;
-
-                if (conn->out.first && conn->credits) {
+                if (nci_sar_conn_ready(self->conn + i)) {
                     return TRUE;
                 }
             }
@@ -227,81 +576,176 @@ nci_sar_can_write(
     return FALSE;
 }
 
+static
+guint
+nci_sar_add_chunk(
+    NciSar* self,
+    guint nchunks,
+    const void* bytes,
+    gsize size)
+{
+    /* Fragmented packets may need more than two chunks per segment */
+    if (nchunks >= self->write_chunks_size) {
+        self->write_chunks_size = MAX(2 * self->write_chunks_size, 4);
+        self->write_chunks = g_renew(GUtilData, self->write_chunks,
+            self->write_chunks_size);
+    }
+    self->write_chunks[nchunks].bytes = bytes;
+    self->write_chunks[nchunks].size = size;
+    return nchunks + 1;
+}
+
+static
+guint
+nci_sar_write_segment(
+    NciSar* self,
+    NciSarPacketOut* out,
+    guint8* hdr,
+    guint nchunks)
+{
+    const gsize remaining_payload_len = out->size - out->payload_pos;
+    const guint max_payload_size = ((out->hdr[0] & NCI_MT_MASK) ==
+        NCI_MT_CMD_PKT) ? self->control_payload_limit :
+        self->data_payload_limit;
+    gsize len;
+
+    GASSERT(out->size >= out->payload_pos);
+    hdr[1] = out->hdr[1];
+    if (remaining_payload_len <= max_payload_size) {
+        /* We can send the whole thing */
+        hdr[0] = out->hdr[0] & ~NCI_PBF;
+        len = remaining_payload_len;
+    } else {
+        /* Send a fragment */
+        hdr[0] = out->hdr[0] | NCI_PBF;
+        len = max_payload_size;
+    }
+    hdr[2] = (guint8)len;
+    nchunks = nci_sar_add_chunk(self, nchunks, hdr, NCI_HDR_SIZE);
+    out->payload_pos += len;
+
+    if (out->frags) {
+        /* Fragment boundaries are passed through to the HAL */
+        while (len > 0) {
+            gsize frag_size;
+            const guint8* frag = g_bytes_get_data(out->frags[out->frag_index],
+                &frag_size);
+            const gsize n = MIN(frag_size - out->frag_pos, len);
+
+            if (n) {
+                nchunks = nci_sar_add_chunk(self, nchunks,
+                    frag + out->frag_pos, n);
+                out->frag_pos += n;
+                len -= n;
+            }
+            if (out->frag_pos == frag_size) {
+                out->frag_index++;
+                out->frag_pos = 0;
+            }
+        }
+    } else if (len) {
+        nchunks = nci_sar_add_chunk(self, nchunks, out->data +
+            out->payload_pos - len, len);
+    }
+    return nchunks;
+}
+
+static
+void
+nci_sar_trace_write(
+    NciSar* self,
+    guint nchunks)
+{
+    const GUtilData* chunk = self->write_chunks;
+    const GUtilData* end = chunk + nchunks;
+
+    while (chunk < end) {
+        /* Each segment starts with the header chunk */
+        const GUtilData* hdr = chunk++;
+        gsize len = hdr->bytes[2];
+
+        while (len && chunk < end) {
+            len -= chunk->size;
+            chunk++;
+        }
+        nci_trace_packet(self->trace, NCI_TRACE_OUT, hdr, chunk - hdr);
+    }
+}
+
 static
 void
 nci_sar_attempt_write(
     NciSar* self)
 {
     if (!self->write_pending) {
-        if (self->writing && self->writing->conn) {
-            NciSarLogicalConnection* conn = self->writing->conn;
-
-            if (conn->credits) {
-                if (conn->credits != SAR_UNLIMITED_CREDITS) {
-                    conn->credits--;
-                    GVERBOSE("cid %d: %u credit(s)", (int)(conn - self->conn),
-                        conn->credits);
-                }
-            } else {
+        /* Only the packet which hasn't been fully written may be here */
+        NciSarPacketOut* out = self->writing.first;
+        guint npackets = 0, nchunks = 0;
+
+        GASSERT(!out || !out->next);
+        if (out) {
+            NciSarLogicalConnection* conn = nci_sar_packet_conn(self, out);
+
+            if (conn && !conn->credits) {
                 /* No more credits left, put it back to the queue */
-                self->writing->next = conn->out.first;
-                conn->out.first = self->writing;
-                self->writing = NULL;
+                memset(&self->writing, 0, sizeof(self->writing));
+                nci_sar_queue_push_front(&conn->out, out);
+                out->queued = TRUE;
+                out = NULL;
             }
         }
-        if (!self->writing) {
-            NciSarPacketOutQueue* queue = nci_sar_write_queue(self);
 
-            if (queue) {
-                self->writing = queue->first;
-                queue->first = self->writing->next;
-                self->writing->next = NULL;
-                if (!queue->first) {
-                    queue->last = NULL;
-                }
-            }
+        /* Write buffers are only touched when no write is pending */
+        if (self->write_buf_size < self->max_write_packets) {
+            self->write_buf_size = self->max_write_packets;
+            self->write_hdr = g_realloc(self->write_hdr,
+                NCI_HDR_SIZE * self->write_buf_size);
         }
-        if (self->writing) {
-            NciHalIo* io = self->io;
-            NciSarPacketOut* out = self->writing;
-            const guint8* payload = NULL;
-            gsize remaining_payload_len = 0;
-            GUtilData chunks[2];
-            int nchunks = 1;
-            gboolean write_submitted = FALSE;
-            const guint max_payload_size = ((out->hdr[0] & NCI_MT_MASK) ==
-                NCI_MT_CMD_PKT) ? self->control_payload_limit :
-                self->data_payload_limit;
 
-            if (out->payload) {
-                gsize payload_len = 0;
+        /*
+         * Pack as many segments as allowed into a single write. Each
+         * segment is one NCI packet, data packets take one credit each.
+         * Commands still take precedence over data when the next packet
+         * is picked.
+         */
+        while (npackets < self->max_write_packets) {
+            if (out) {
+                NciSarLogicalConnection* conn = nci_sar_packet_conn(self,
+                    out);
+
+                /* Next segment of the same packet */
+                if (conn) {
+                    if (!conn->credits) {
+                        break;
+                    } else if (conn->credits != SAR_UNLIMITED_CREDITS) {
+                        conn->credits--;
+                        GVERBOSE("cid %d: %u credit(s)",
+                            (int)(conn - self->conn), conn->credits);
+                    }
+                }
+            } else {
+                NciSarPacketOutQueue* queue = nci_sar_write_queue(self);
 
-                payload = g_bytes_get_data(out->payload, &payload_len);
-                GASSERT(payload_len >= out->payload_pos);
-                remaining_payload_len = payload_len - out->payload_pos;
+                if (queue) {
+                    out = nci_sar_queue_pop(queue);
+                    nci_sar_packet_out_dequeued(self, out);
+                    nci_sar_queue_push(&self->writing, out);
+                } else {
+                    break;
+                }
             }
 
-            chunks[0].bytes = out->hdr;
-            chunks[0].size = NCI_HDR_SIZE;
-            if (remaining_payload_len <= max_payload_size) {
-                /* We can send the whole thing */
-                out->hdr[0] &= ~NCI_PBF;
-                out->hdr[2] = (guint8)remaining_payload_len;
-                if (remaining_payload_len) {
-                    chunks[nchunks].bytes = payload + out->payload_pos;
-                    chunks[nchunks].size = remaining_payload_len;
-                    out->payload_pos += remaining_payload_len;
-                    nchunks++;
-                }
-            } else {
-                /* Send a fragment */
-                out->hdr[0] |= NCI_PBF;
-                out->hdr[2] = max_payload_size;
-                chunks[nchunks].bytes = payload + out->payload_pos;
-                chunks[nchunks].size = max_payload_size;
-                out->payload_pos += chunks[nchunks].size;
-                nchunks++;
+            nchunks = nci_sar_write_segment(self, out, self->write_hdr +
+                NCI_HDR_SIZE * npackets, nchunks);
+            npackets++;
+            if (nci_sar_packet_out_done(out)) {
+                out = NULL;
             }
+        }
+
+        if (npackets) {
+            NciHalIo* io = self->io;
+            gboolean write_submitted = FALSE;
 
             /* Start HAL on demand */
             if (!self->started) {
@@ -310,8 +754,11 @@ nci_sar_attempt_write(
 
             /* Submit write request to the HAL */
             if (self->started) {
+                if (G_UNLIKELY(self->trace)) {
+                    nci_sar_trace_write(self, nchunks);
+                }
                 self->write_pending = TRUE;
-                if (io->fn->write(io, chunks, nchunks,
+                if (io->fn->write(io, self->write_chunks, nchunks,
                     nci_sar_write_completed)) {
                     write_submitted = TRUE;
                 } else {
@@ -322,13 +769,11 @@ nci_sar_attempt_write(
             /* Bail out if something went wrong */
             if (!write_submitted) {
                 NciSarClient* client = self->client;
+                NciSarPacketOutQueue failed = self->writing;
 
-                /* Drop this packet and indicate an error */
-                self->writing = NULL;
-                if (out->complete) {
-                    out->complete(self->client, FALSE, out->user_data);
-                }
-                nci_sar_packet_out_free(out);
+                /* Drop these packets and indicate an error */
+                memset(&self->writing, 0, sizeof(self->writing));
+                nci_sar_complete_queue(self, &failed, FALSE);
                 client->fn->error(client);
 
                 /* Try the next one even though it will probably fail too */
@@ -360,6 +805,55 @@ nci_sar_schedule_write(
     }
 }
 
+static
+NciSarPacketOut*
+nci_sar_packet_out_new_bytes(
+    NciSar* self,
+    GBytes* payload)
+{
+    NciSarPacketOut* out = nci_sar_packet_out_new(self);
+
+    if (payload) {
+        out->payload = g_bytes_ref(payload);
+        out->data = g_bytes_get_data(payload, &out->size);
+    }
+    return out;
+}
+
+static
+NciSarPacketOut*
+nci_sar_packet_out_new_buf(
+    NciSar* self,
+    const void* data,
+    gsize size)
+{
+    NciSarPacketOut* out = nci_sar_packet_out_new(self);
+
+    /* Caller keeps the data alive until destroy is invoked */
+    out->data = data;
+    out->size = size;
+    return out;
+}
+
+static
+NciSarPacketOut*
+nci_sar_packet_out_new_frags(
+    NciSar* self,
+    GBytes* const* frags,
+    guint count)
+{
+    NciSarPacketOut* out = nci_sar_packet_out_new(self);
+    guint i;
+
+    out->frags = g_new(GBytes*, count);
+    out->nfrags = count;
+    for (i = 0; i < count; i++) {
+        out->frags[i] = g_bytes_ref(frags[i]);
+        out->size += g_bytes_get_size(frags[i]);
+    }
+    return out;
+}
+
 static
 guint
 nci_sar_send(
@@ -367,37 +861,37 @@ nci_sar_send(
     NciSarPacketOutQueue* queue,
     NciSarLogicalConnection* conn,
     const guint8* hdr,
-    GBytes* payload,
+    NciSarPacketOut* out, /* With payload already filled in */
     NciSarCompletionFunc complete,
     GDestroyNotify destroy,
     gpointer user_data)
 {
-    guint id = 0;
-    NciSarPacketOut* out = g_slice_new0(NciSarPacketOut);
+    guint id;
 
-    /* Generate id */
-    id = (++self->last_packet_id);
-    if (!id) id = (++self->last_packet_id);
+    /* Generate id, skipping zero and the ones still in use */
+    do {
+        id = (++self->last_packet_id);
+    } while (!id || g_hash_table_contains(self->packets,
+        GUINT_TO_POINTER(id)));
 
     /* Fill in the packet structure */
     out->id = id;
-    out->conn = conn;
     out->complete = complete;
     out->destroy = destroy;
     out->user_data = user_data;
-    memcpy(out->hdr, hdr, NCI_HDR_SIZE - 1); /* Ignore the length */
-    if (payload) {
-        out->payload = g_bytes_ref(payload);
-    }
+    memcpy(out->hdr, hdr, sizeof(out->hdr)); /* Ignore the length */
 
     /* Queue the packet */
-    if (queue->last) {
-        GASSERT(queue->first);
-        queue->last->next = out;
-        queue->last = out;
-    } else {
-        GASSERT(!queue->first);
-        queue->first = queue->last = out;
+    g_hash_table_insert(self->packets, GUINT_TO_POINTER(id), out);
+    nci_sar_queue_push(queue, out);
+    out->queued = TRUE;
+    if (conn) {
+        NciConnStats* stats = &conn->stats;
+
+        out->queued_at = g_get_monotonic_time();
+        if (stats->max_queued < queue->count) {
+            stats->max_queued = queue->count;
+        }
     }
 
     /* Schedule write */
@@ -405,6 +899,26 @@ nci_sar_send(
     return id;
 }
 
+static
+guint
+nci_sar_send_data(
+    NciSar* self,
+    guint8 cid,
+    NciSarPacketOut* out,
+    NciSarCompletionFunc complete,
+    GDestroyNotify destroy,
+    gpointer user_data)
+{
+    /* cid is checked by the caller */
+    NciSarLogicalConnection* conn = self->conn + cid;
+    guint8 hdr[NCI_HDR_SIZE];
+
+    hdr[0] = cid & NCI_DATA_CID_MASK;
+    hdr[1] = 0;
+    return nci_sar_send(self, &conn->out, conn, hdr, out,
+        complete, destroy, user_data);
+}
+
 static
 void
 nci_sar_take_credits(
@@ -463,6 +977,48 @@ nci_sar_hal_handle_data_packet(
     client->fn->handle_data_packet(client, cid, payload, payload_len);
 }
 
+static
+GBytes*
+nci_sar_hal_packet_bytes(
+    NciSar* self,
+    const guint8* payload,
+    guint payload_len)
+{
+    GBytes* bytes = self->read_bytes;
+
+    if (bytes) {
+        gsize size;
+        const guint8* data = g_bytes_get_data(bytes, &size);
+
+        /* Reference the HAL buffer if the payload is sitting there */
+        if (payload >= data && (payload + payload_len) <= (data + size)) {
+            return g_bytes_new_from_bytes(bytes, payload - data, payload_len);
+        }
+    }
+    return g_bytes_new(payload, payload_len);
+}
+
+static
+gboolean
+nci_sar_hal_data_bytes(
+    NciSar* self)
+{
+    return self->data_bytes && self->client->fn->handle_data_bytes;
+}
+
+static
+void
+nci_sar_hal_handle_data_bytes(
+    NciSar* self,
+    guint cid,
+    GBytes* payload)
+{
+    NciSarClient* client = self->client;
+
+    client->fn->handle_data_bytes(client, cid, payload);
+    g_bytes_unref(payload);
+}
+
 static
 void
 nci_sar_hal_handle_control_segment(
@@ -547,14 +1103,24 @@ nci_sar_hal_handle_data_segment(
                  * invoke external code, zero data_in[cid] to ensure
                  * that data doesn't get modified. */
                 conn->in = NULL;
-                nci_sar_hal_handle_data_packet(self, cid,
-                    in->data + NCI_HDR_SIZE, in->len - NCI_HDR_SIZE);
-                g_byte_array_set_size(in, 0);
-                if (!conn->in) {
-                    /* Restore the pointer */
-                    conn->in = in;
+                if (nci_sar_hal_data_bytes(self)) {
+                    /* Hand the reassembly buffer over without copying */
+                    const guint size = in->len - NCI_HDR_SIZE;
+                    GBytes* all = g_byte_array_free_to_bytes(in);
+
+                    nci_sar_hal_handle_data_bytes(self, cid,
+                        g_bytes_new_from_bytes(all, NCI_HDR_SIZE, size));
+                    g_bytes_unref(all);
                 } else {
-                    g_byte_array_free(in, TRUE);
+                    nci_sar_hal_handle_data_packet(self, cid,
+                        in->data + NCI_HDR_SIZE, in->len - NCI_HDR_SIZE);
+                    g_byte_array_set_size(in, 0);
+                    if (!conn->in) {
+                        /* Restore the pointer */
+                        conn->in = in;
+                    } else {
+                        g_byte_array_free(in, TRUE);
+                    }
                 }
             }
         } else if (hdr & NCI_PBF) {
@@ -563,6 +1129,10 @@ nci_sar_hal_handle_data_segment(
                 in = conn->in = g_byte_array_new();
             }
             g_byte_array_append(in, packet, payload_len + NCI_HDR_SIZE);
+        } else if (nci_sar_hal_data_bytes(self)) {
+            /* Complete packet, the HAL buffer is referenced if possible */
+            nci_sar_hal_handle_data_bytes(self, cid,
+                nci_sar_hal_packet_bytes(self, payload, payload_len));
         } else {
             /* Complete packet */
             nci_sar_hal_handle_data_packet(self, cid, payload, payload_len);
@@ -583,6 +1153,14 @@ nci_sar_hal_handle_segment(
     const guint8 mt = packet[0] & NCI_MT_MASK;
     NciSarClient* client = self->client;
 
+    if (G_UNLIKELY(self->trace)) {
+        GUtilData data;
+
+        data.bytes = packet;
+        data.size = len;
+        nci_trace_packet(self->trace, NCI_TRACE_IN, &data, 1);
+    }
+
     switch (mt) {
     case NCI_MT_DATA_PKT:
         nci_sar_hal_handle_data_segment(self, packet, len);
@@ -626,31 +1204,99 @@ nci_sar_hal_client_read(
     NciSar* self = nci_sar_from_hal_client(hal_client);
     const guint8* bytes = data;
 
-    if (!self->read_buf || !self->read_buf->len) {
-        /* Optimal (and usual) case - full packets are coming in */
-        while (len > 2 && len >= (bytes[2] + NCI_HDR_SIZE)) {
-            const guint packet_len = bytes[2] + NCI_HDR_SIZE;
-
-            nci_sar_hal_handle_segment(self, bytes, packet_len);
-            bytes += packet_len;
-            len -= packet_len;
+    /*
+     * First complete the partial packet left over from the previous
+     * read (if any). read_buf never holds more than one packet, so
+     * nothing needs to be moved around after it has been handled.
+     */
+    while (self->read_len && len > 0) {
+        guint8* buf = self->read_buf;
+        const guint need = ((self->read_len < NCI_HDR_SIZE) ?
+            NCI_HDR_SIZE : (buf[2] + NCI_HDR_SIZE)) - self->read_len;
+        const guint n = MIN(need, len);
+
+        memcpy(buf + self->read_len, bytes, n);
+        self->read_len += n;
+        bytes += n;
+        len -= n;
+        if (self->read_len >= NCI_HDR_SIZE &&
+            self->read_len == (buf[2] + NCI_HDR_SIZE)) {
+            const guint packet_len = self->read_len;
+
+            self->read_len = 0;
+            if ((buf[0] & (NCI_MT_MASK | NCI_PBF)) == NCI_MT_DATA_PKT &&
+                nci_sar_hal_data_bytes(self)) {
+                /*
+                 * Complete data packet which is about to be delivered
+                 * as GBytes. Hand read_buf over to the payload slice,
+                 * a new one gets allocated when it's needed again.
+                 */
+                GBytes* prev = self->read_bytes;
+                GBytes* owner = g_bytes_new_take(buf, packet_len);
+
+                self->read_buf = NULL;
+                self->read_bytes = owner;
+                nci_sar_hal_handle_segment(self, buf, packet_len);
+                self->read_bytes = prev;
+                g_bytes_unref(owner);
+            } else {
+                nci_sar_hal_handle_segment(self, buf, packet_len);
+            }
         }
     }
 
-    if (len > 0) {
-        GByteArray* buf = self->read_buf;
+    /* Full packets are handled in place, without copying */
+    while (len > 2 && len >= (bytes[2] + NCI_HDR_SIZE)) {
+        const guint packet_len = bytes[2] + NCI_HDR_SIZE;
+
+        nci_sar_hal_handle_segment(self, bytes, packet_len);
+        bytes += packet_len;
+        len -= packet_len;
+    }
 
-        if (!buf) {
-            buf = self->read_buf = g_byte_array_new();
+    /* Whatever is left is shorter than a packet and fits into read_buf */
+    if (len > 0) {
+        GASSERT(!self->read_len);
+        if (!self->read_buf) {
+            self->read_buf = g_malloc(NCI_MAX_PACKET_SIZE);
         }
+        memcpy(self->read_buf, bytes, len);
+        self->read_len = len;
+    }
+}
 
-        /* This is something non-trivial (partial or fragmented packet) */
-        g_byte_array_append(buf, bytes, len);
-        while (buf->len > 2 && buf->len >= (buf->data[2] + NCI_HDR_SIZE)) {
-            const guint packet_len = buf->data[2] + NCI_HDR_SIZE;
+static
+void
+nci_sar_hal_client_read_bytes(
+    NciHalClient* hal_client,
+    GBytes* bytes)
+{
+    NciSar* self = nci_sar_from_hal_client(hal_client);
+    GBytes* prev = self->read_bytes;
+    gsize len;
+    const void* data = g_bytes_get_data(bytes, &len);
+
+    /* Packets found in this buffer may reference it */
+    self->read_bytes = bytes;
+    nci_sar_hal_client_read(hal_client, data, len);
+    self->read_bytes = prev;
+}
+
+void
+nci_hal_client_read_bytes(
+    NciHalClient* client,
+    GBytes* bytes) /* Since 1.1.34 */
+{
+    if (G_LIKELY(client) && G_LIKELY(bytes)) {
+        const NciHalClientFunctions* fn = client->fn;
+
+        if (fn->read_bytes) {
+            fn->read_bytes(client, bytes);
+        } else {
+            gsize size;
+            const void* data = g_bytes_get_data(bytes, &size);
 
-            nci_sar_hal_handle_segment(self, buf->data, packet_len);
-            g_byte_array_remove_range(buf, 0, packet_len);
+            fn->read(client, data, size);
         }
     }
 }
@@ -658,52 +1304,42 @@ nci_sar_hal_client_read(
 static
 void
 nci_sar_clear_queue(
+    NciSar* self,
     NciSarPacketOutQueue* queue)
 {
-    while (queue->first) {
-        NciSarPacketOut* out = queue->first;
+    NciSarPacketOut* out;
 
-        queue->first = out->next;
-        nci_sar_packet_out_free(out);
+    while ((out = nci_sar_queue_pop(queue)) != NULL) {
+        out->queued = FALSE;
+        nci_sar_packet_out_free(self, out);
     }
-    queue->last = NULL;
 }
 
 static
-gboolean
-nci_sar_cancel_queue(
+NciSarPacketOutQueue*
+nci_sar_packet_queue(
     NciSar* self,
-    NciSarPacketOutQueue* queue,
-    guint id)
+    NciSarPacketOut* out)
 {
-    if (queue->first) {
-        NciSarPacketOut* out = queue->first;
+    NciSarLogicalConnection* conn = nci_sar_packet_conn(self, out);
 
-        if (out->id == id) {
-            if (!(queue->first = out->next)) {
-                queue->last = NULL;
-            }
-            nci_sar_packet_out_free(out);
-            return TRUE;
-        } else {
-            NciSarPacketOut* prev = out;
-
-            out = out->next;
-            while (out) {
-                if (out->id == id) {
-                    prev->next = out->next;
-                    if (!prev->next) {
-                        queue->last = prev;
-                    }
-                    nci_sar_packet_out_free(out);
-                    return TRUE;
-                }
-                prev = out;
-                out = out->next;
-            }
-        }
+    return conn ? &conn->out : &self->cmd;
+}
+
+static
+void
+nci_sar_cancel_packet(
+    NciSar* self,
+    NciSarPacketOut* out)
+{
+    if (out->queued) {
+        nci_sar_queue_remove(nci_sar_packet_queue(self, out), out);
+        nci_sar_packet_out_free(self, out);
+    } else {
+        /* We can't really cancel the packet once we started
+         * writing it. Just clear the completion callback. */
+        out->complete = NULL;
     }
-    return FALSE;
 }
 
 /*==========================================================================*
@@ -718,7 +1354,8 @@ nci_sar_new(
     NciSar* self = g_slice_new0(NciSar);
     static const NciHalClientFunctions hal_functions = {
         .error = nci_sar_hal_client_error,
-        .read = nci_sar_hal_client_read
+        .read = nci_sar_hal_client_read,
+        .read_bytes = nci_sar_hal_client_read_bytes
     };
 
     self->hal_client.fn = &hal_functions;
@@ -727,7 +1364,9 @@ nci_sar_new(
     self->max_logical_conns = SAR_DEFAULT_MAX_LOGICAL_CONNECTIONS;
     self->control_payload_limit = SAR_MIN_CONTROL_PAYLOAD_LIMIT;
     self->data_payload_limit = SAR_MIN_DATA_PAYLOAD_LIMIT;
+    self->max_write_packets = 1;
     self->conn = g_new0(NciSarLogicalConnection, self->max_logical_conns);
+    self->packets = g_hash_table_new(g_direct_hash, g_direct_equal);
     return self;
 }
 
@@ -751,10 +1390,19 @@ nci_sar_free(
         if (self->control_in) {
             g_byte_array_free(self->control_in, TRUE);
         }
-        if (self->read_buf) {
-            g_byte_array_free(self->read_buf, TRUE);
+        while (self->free_packets) {
+            NciSarPacketOut* out = self->free_packets;
+
+            self->free_packets = out->next;
+            g_slice_free(NciSarPacketOut, out);
         }
+        GASSERT(!g_hash_table_size(self->packets));
+        g_hash_table_destroy(self->packets);
+        g_free(self->write_hdr);
+        g_free(self->write_chunks);
+        g_free(self->read_buf);
         g_free(self->conn);
+        nci_trace_free(self->trace);
         g_slice_free(NciSar, self);
     }
 }
@@ -780,11 +1428,11 @@ nci_sar_reset(
 {
     if (G_LIKELY(self)) {
         guint i;
-        NciSarPacketOut* cancel = self->writing;
+        NciSarPacketOutQueue cancel = self->writing;
 
         /* Cancel pending write */
-        if (cancel) {
-            self->writing = NULL;
+        if (cancel.first) {
+            memset(&self->writing, 0, sizeof(self->writing));
             if (self->write_pending) {
                 self->io->fn->cancel_write(self->io);
                 self->write_pending = FALSE;
@@ -802,7 +1450,7 @@ nci_sar_reset(
         for (i = 0; i < self->max_logical_conns; i++) {
             NciSarLogicalConnection* conn = self->conn + i;
 
-            nci_sar_clear_queue(&conn->out);
+            nci_sar_clear_queue(self, &conn->out);
             conn->credits = 0;
             if (conn->in) {
                 g_byte_array_set_size(conn->in, 0);
@@ -813,23 +1461,18 @@ nci_sar_reset(
             g_byte_array_set_size(self->control_in, 0);
         }
 
-        nci_sar_clear_queue(&self->cmd);
+        nci_sar_clear_queue(self, &self->cmd);
         if (self->start_write_id) {
             g_source_remove(self->start_write_id);
             self->start_write_id = 0;
         }
 
         /*
-         * Invoke the completion callback of the canceled packet after
+         * Invoke the completion callbacks of the canceled packets after
          * we're done with everything else, because we generally don't
          * know what's that callback is gpong to do.
          */
-        if (cancel) {
-            if (cancel->complete) {
-                cancel->complete(self->client, FALSE, cancel->user_data);
-            }
-            nci_sar_packet_out_free(cancel);
-        }
+        nci_sar_complete_queue(self, &cancel, FALSE);
     }
 }
 
@@ -853,7 +1496,7 @@ nci_sar_set_max_logical_connections(
             for (i = max; i < self->max_logical_conns; i++) {
                 NciSarLogicalConnection* conn = self->conn + i;
 
-                nci_sar_clear_queue(&conn->out);
+                nci_sar_clear_queue(self, &conn->out);
                 if (conn->in) {
                     g_byte_array_free(conn->in, TRUE);
                 }
@@ -892,6 +1535,17 @@ nci_sar_set_max_data_payload_size(
     }
 }
 
+void
+nci_sar_set_max_write_packets(
+    NciSar* self,
+    guint max)
+{
+    /* Takes effect when the next write is submitted */
+    if (G_LIKELY(self)) {
+        self->max_write_packets = MAX(MIN(max, SAR_MAX_WRITE_PACKETS), 1);
+    }
+}
+
 void
 nci_sar_set_initial_credits(
     NciSar* self,
@@ -934,8 +1588,9 @@ nci_sar_send_command(
 
         hdr[0] = NCI_MT_CMD_PKT | (gid & NCI_CONTROL_GID_MASK);
         hdr[1] = oid & NCI_CONTROL_OID_MASK;
-        return nci_sar_send(self, &self->cmd, NULL, hdr, payload, complete,
-            destroy, user_data);
+        return nci_sar_send(self, &self->cmd, NULL, hdr,
+            nci_sar_packet_out_new_bytes(self, payload),
+            complete, destroy, user_data);
     }
     return 0;
 }
@@ -951,13 +1606,48 @@ nci_sar_send_data_packet(
 {
     GASSERT(!(cid & ~NCI_DATA_CID_MASK));
     if (G_LIKELY(self) && cid < self->max_logical_conns) {
-        NciSarLogicalConnection* conn = self->conn + cid;
-        guint8 hdr[NCI_HDR_SIZE];
+        return nci_sar_send_data(self, cid,
+            nci_sar_packet_out_new_bytes(self, payload),
+            complete, destroy, user_data);
+    }
+    return 0;
+}
+
+guint
+nci_sar_send_data_packetv(
+    NciSar* self,
+    guint8 cid,
+    GBytes* const* frags,
+    guint count,
+    NciSarCompletionFunc complete,
+    GDestroyNotify destroy,
+    gpointer user_data)
+{
+    GASSERT(!(cid & ~NCI_DATA_CID_MASK));
+    if (G_LIKELY(self) && cid < self->max_logical_conns &&
+        (frags || !count)) {
+        return nci_sar_send_data(self, cid,
+            nci_sar_packet_out_new_frags(self, frags, count),
+            complete, destroy, user_data);
+    }
+    return 0;
+}
 
-        hdr[0] = cid & NCI_DATA_CID_MASK;
-        hdr[1] = 0;
-        return nci_sar_send(self, &conn->out, conn, hdr, payload, complete,
-            destroy, user_data);
+guint
+nci_sar_send_data_buf(
+    NciSar* self,
+    guint8 cid,
+    const void* data,
+    gsize size,
+    NciSarCompletionFunc complete,
+    GDestroyNotify destroy,
+    gpointer user_data)
+{
+    GASSERT(!(cid & ~NCI_DATA_CID_MASK));
+    if (G_LIKELY(self) && cid < self->max_logical_conns) {
+        return nci_sar_send_data(self, cid,
+            nci_sar_packet_out_new_buf(self, data, size),
+            complete, destroy, user_data);
     }
     return 0;
 }
@@ -968,25 +1658,127 @@ nci_sar_cancel(
     guint id)
 {
     if (G_LIKELY(self) && G_LIKELY(id)) {
-        if (self->writing && self->writing->id == id) {
-            /* We can't really cancel the packet once we started writing it.
-             * Just clear the completion callback. */
-            self->writing->complete = NULL;
-        } else if (!nci_sar_cancel_queue(self, &self->cmd, id)) {
-            guint i;
+        NciSarPacketOut* out = g_hash_table_lookup(self->packets,
+            GUINT_TO_POINTER(id));
 
-            for (i = 0; i < self->max_logical_conns; i++) {
-                NciSarLogicalConnection* conn = self->conn + i;
+        if (out) {
+            nci_sar_cancel_packet(self, out);
+        } else {
+            GWARN("Invalid packet id %u", id);
+        }
+    }
+}
 
-                if (nci_sar_cancel_queue(self, &conn->out, id)) {
-                    return;
-                }
+void
+nci_sar_cancel_data(
+    NciSar* self,
+    guint8 cid)
+{
+    if (G_LIKELY(self) && cid < self->max_logical_conns) {
+        NciSarLogicalConnection* conn = self->conn + cid;
+        NciSarPacketOutQueue cancel = conn->out;
+        NciSarPacketOut* out;
+
+        /* Packets being written can only lose their completion callbacks */
+        for (out = self->writing.first; out; out = out->next) {
+            if (nci_sar_packet_conn(self, out) == conn) {
+                out->complete = NULL;
             }
-            GWARN("Invalid packet id %u", id);
+        }
+
+        /*
+         * Detach the queue before invoking the destroy callbacks, so
+         * that whatever gets queued by those callbacks stays queued.
+         */
+        memset(&conn->out, 0, sizeof(conn->out));
+        for (out = cancel.first; out; out = out->next) {
+            out->queued = FALSE;
+        }
+        nci_sar_clear_queue(self, &cancel);
+    }
+}
+
+void
+nci_sar_set_data_scheduler(
+    NciSar* self,
+    NCI_DATA_SCHED sched)
+{
+    if (G_LIKELY(self)) {
+        guint i;
+
+        self->sched = sched;
+        self->sched_next = 0;
+        for (i = 0; i < self->max_logical_conns; i++) {
+            self->conn[i].deficit = 0;
         }
     }
 }
 
+void
+nci_sar_set_data_weight(
+    NciSar* self,
+    guint8 cid,
+    guint weight)
+{
+    if (G_LIKELY(self) && cid < self->max_logical_conns) {
+        self->conn[cid].weight = weight;
+    }
+}
+
+void
+nci_sar_set_data_bytes(
+    NciSar* self,
+    gboolean enable)
+{
+    if (G_LIKELY(self)) {
+        self->data_bytes = enable;
+    }
+}
+
+gboolean
+nci_sar_get_data_stats(
+    NciSar* self,
+    guint8 cid,
+    NciConnStats* stats)
+{
+    if (G_LIKELY(self) && cid < self->max_logical_conns) {
+        const NciSarLogicalConnection* conn = self->conn + cid;
+
+        if (stats) {
+            *stats = conn->stats;
+            stats->queued = conn->out.count;
+        }
+        return TRUE;
+    }
+    return FALSE;
+}
+
+void
+nci_sar_set_trace_size(
+    NciSar* self,
+    gsize size)
+{
+    if (G_LIKELY(self)) {
+        /* The trace isn't affected by nci_sar_reset() */
+        nci_trace_free(self->trace);
+        self->trace = size ? nci_trace_new(size) : NULL;
+    }
+}
+
+GBytes*
+nci_sar_get_trace(
+    NciSar* self)
+{
+    return G_LIKELY(self) ? nci_trace_pcapng(self->trace) : NULL;
+}
+
+guint
+nci_sar_packets_allocated(
+    NciSar* self)
+{
+    return G_LIKELY(self) ? self->packets_allocated : 0;
+}
+
 /*
  * Local Variables:
  * mode: C
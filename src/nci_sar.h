@@ -1,6 +1,6 @@
 /*
+ * Copyright (C) 2018-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2018-2020 Jolla Ltd.
- * Copyright (C) 2018-2020 Slava Monich <slava.monich@jolla.com>
  *
  * You may use this file under the terms of BSD license as follows:
  *
@@ -47,6 +47,9 @@ typedef struct nci_sar_client_functions {
         const void* payload, guint payload_len);
     void (*handle_data_packet)(NciSarClient* client, guint8 cid,
         const void* payload, guint payload_len);
+    /* Optional, used instead of handle_data_packet if enabled */
+    void (*handle_data_bytes)(NciSarClient* client, guint8 cid,
+        GBytes* payload);
 } NciSarClientFunctions;
 
 struct nci_sar_client {
@@ -99,6 +102,12 @@ nci_sar_set_max_data_payload_size(
     guint8 max)
     NCI_INTERNAL;
 
+void
+nci_sar_set_max_write_packets(
+    NciSar* sar,
+    guint max)
+    NCI_INTERNAL;
+
 void
 nci_sar_set_initial_credits(
     NciSar* sar,
@@ -134,12 +143,88 @@ nci_sar_send_data_packet(
     gpointer user_data)
     NCI_INTERNAL;
 
+/* Fragments are sent back to back as a single message */
+guint
+nci_sar_send_data_packetv(
+    NciSar* sar,
+    guint8 cid,
+    GBytes* const* frags,
+    guint count,
+    NciSarCompletionFunc complete,
+    GDestroyNotify destroy,
+    gpointer user_data)
+    NCI_INTERNAL;
+
+/* Data must stay valid until destroy is invoked */
+guint
+nci_sar_send_data_buf(
+    NciSar* sar,
+    guint8 cid,
+    const void* data,
+    gsize size,
+    NciSarCompletionFunc complete,
+    GDestroyNotify destroy,
+    gpointer user_data)
+    NCI_INTERNAL;
+
 void
 nci_sar_cancel(
     NciSar* sar,
     guint id)
     NCI_INTERNAL;
 
+void
+nci_sar_cancel_data(
+    NciSar* sar,
+    guint8 cid)
+    NCI_INTERNAL;
+
+void
+nci_sar_set_data_scheduler(
+    NciSar* sar,
+    NCI_DATA_SCHED sched)
+    NCI_INTERNAL;
+
+void
+nci_sar_set_data_weight(
+    NciSar* sar,
+    guint8 cid,
+    guint weight)
+    NCI_INTERNAL;
+
+/* Switches data delivery to handle_data_bytes */
+void
+nci_sar_set_data_bytes(
+    NciSar* sar,
+    gboolean enable)
+    NCI_INTERNAL;
+
+gboolean
+nci_sar_get_data_stats(
+    NciSar* sar,
+    guint8 cid,
+    NciConnStats* stats)
+    NCI_INTERNAL;
+
+/* Zero size turns tracing off */
+void
+nci_sar_set_trace_size(
+    NciSar* sar,
+    gsize size)
+    NCI_INTERNAL;
+
+/* pcapng dump of the trace, NULL if tracing is off */
+GBytes*
+nci_sar_get_trace(
+    NciSar* sar)
+    NCI_INTERNAL;
+
+/* Number of packet descriptors allocated so far (for unit tests) */
+guint
+nci_sar_packets_allocated(
+    NciSar* sar)
+    NCI_INTERNAL;
+
 #endif /* NFC_SAR_H */
 
 /*
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2019-2025 Slava Monich <slava@monich.com>
+ * Copyright (C) 2019-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2021 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -78,6 +78,23 @@ typedef struct nci_sm_object {
     guint32 pending_signals;
     NciNfcid1 default_la_nfcid1;
     NciAtsHb default_li_a_hb;
+    NciSelectPriority* select_priority; /* NULL for the default order */
+    guint select_priority_count;
+    NciSelectFunc select_filter;
+    void* select_user_data;
+    gint64 select_recent_usec;
+    NciIdCache* select_recent; /* Activated targets */
+    NciIdCache* activations; /* Activated targets and their params */
+    NciActivationInfo activation_info;
+    gboolean activation_info_valid;
+    NciActivation* activation; /* The last one */
+#if NCI_STATS
+    NciSmStats stats;
+    NciState* stats_state; /* Accumulating residency */
+    gint64 stats_state_since;
+    gint64 stats_transition_since;
+    gint64 stats_activated_since; /* Zero if nothing is activated */
+#endif
 } NciSmObject;
 
 typedef struct nci_sm_switch {
@@ -105,6 +122,9 @@ typedef enum nci_sm_signal {
 static guint nci_sm_signals[SIGNAL_COUNT] = { 0 };
 
 #define NCI_IS_INTERNAL_STATE(state) ((state) < NCI_RFST_IDLE)
+#define NCI_DISCOVERIES_BLOCK_SIZE (1024)
+#define NCI_IS_ACTIVATED_STATE(state) ((state) == NCI_RFST_POLL_ACTIVE || \
+    (state) == NCI_RFST_LISTEN_ACTIVE || (state) == NCI_RFST_LISTEN_SLEEP)
 
 #define NCI_TECH_DEFAULT (NCI_TECH_A|NCI_TECH_B|NCI_TECH_F)
 
@@ -136,6 +156,154 @@ typedef struct nci_tech_option {
 static inline NciSmObject* nci_sm_object_cast(NciSm* sm) /* NULL safe */
     { return G_LIKELY(sm) ? THIS(G_CAST(sm, NciSmObject, sm)) : NULL; }
 
+/*==========================================================================*
+ * Statistics
+ *==========================================================================*/
+
+#if NCI_STATS
+
+static
+void
+nci_sm_stats_state_left(
+    NciSmObject* self,
+    gint64 now)
+{
+    NciState* state = self->stats_state;
+
+    if (state) {
+        self->stats_state = NULL;
+        if (state->state < NCI_CORE_STATES) {
+            self->stats.state[state->state].residency +=
+                now - self->stats_state_since;
+        }
+    }
+}
+
+static
+void
+nci_sm_stats_deactivated(
+    NciSmObject* self,
+    gint64 now)
+{
+    if (self->stats_activated_since) {
+        nci_time_histogram_add(&self->stats.activation,
+            now - self->stats_activated_since);
+        self->stats_activated_since = 0;
+    }
+}
+
+static
+void
+nci_sm_stats_state_entered(
+    NciSmObject* self,
+    NciState* state)
+{
+    const gint64 now = g_get_monotonic_time();
+
+    nci_sm_stats_state_left(self, now);
+    self->stats_state = state;
+    self->stats_state_since = now;
+    if (state->state < NCI_CORE_STATES) {
+        self->stats.state[state->state].entered++;
+    }
+    if (!NCI_IS_ACTIVATED_STATE(state->state)) {
+        nci_sm_stats_deactivated(self, now);
+    }
+}
+
+static
+void
+nci_sm_stats_transition_started(
+    NciSmObject* self,
+    NciTransition* transition)
+{
+    const NCI_CORE_TRANSITION type = nci_transition_type(transition);
+    const gint64 now = g_get_monotonic_time();
+
+    /* The state has been left */
+    nci_sm_stats_state_left(self, now);
+    self->stats_transition_since = now;
+    if (type < NCI_CORE_TRANSITIONS) {
+        self->stats.transition[type].started++;
+    }
+}
+
+static
+void
+nci_sm_stats_transition_not_started(
+    NciSmObject* self,
+    NciTransition* transition)
+{
+    const NCI_CORE_TRANSITION type = nci_transition_type(transition);
+
+    /* Undo nci_sm_stats_transition_started(), the state is still there */
+    if (type < NCI_CORE_TRANSITIONS && self->stats.transition[type].started) {
+        self->stats.transition[type].started--;
+    }
+    if (!self->stats_state && self->active_state) {
+        self->stats_state = self->active_state;
+        self->stats_state_since = g_get_monotonic_time();
+    }
+}
+
+static
+void
+nci_sm_stats_transition_finished(
+    NciSmObject* self,
+    NciTransition* transition,
+    NciState* reached)
+{
+    const NCI_CORE_TRANSITION type = nci_transition_type(transition);
+
+    if (type < NCI_CORE_TRANSITIONS) {
+        NciTransitionStats* stats = self->stats.transition + type;
+
+        if (reached && reached == transition->dest) {
+            nci_time_histogram_add(&stats->duration,
+                g_get_monotonic_time() - self->stats_transition_since);
+        } else {
+            stats->failed++;
+        }
+    }
+}
+
+static
+void
+nci_sm_stats_stall(
+    NciSmObject* self,
+    NCI_STALL type)
+{
+    if (type == NCI_STALL_STOP) {
+        self->stats.stall_stop++;
+    } else {
+        self->stats.stall_error++;
+    }
+    nci_sm_stats_deactivated(self, g_get_monotonic_time());
+}
+
+static
+void
+nci_sm_stats_activated(
+    NciSmObject* self)
+{
+    const gint64 now = g_get_monotonic_time();
+
+    /* Reactivation from RFST_LISTEN_SLEEP starts a new one */
+    nci_sm_stats_deactivated(self, now);
+    self->stats_activated_since = now;
+}
+
+#else
+
+#define nci_sm_stats_state_entered(self,state) ((void)0)
+#define nci_sm_stats_transition_started(self,transition) ((void)0)
+#define nci_sm_stats_transition_not_started(self,transition) ((void)0)
+#define nci_sm_stats_transition_finished(self,transition,reached) ((void)0)
+#define nci_sm_stats_stall(self,type) ((void)0)
+#define nci_sm_stats_activated(self) ((void)0)
+
+#endif /* NCI_STATS */
+
 /*==========================================================================*
  * Implementation
  *==========================================================================*/
@@ -213,15 +381,18 @@ nci_sm_weak_pointer_notify(
     }
 }
 
+/* Reached state is NULL if the transition was interrupted */
 static
 void
 nci_sm_finish_active_transition(
-    NciSmObject* self)
+    NciSmObject* self,
+    NciState* reached)
 {
     if (self->active_transition) {
         NciTransition* finished = self->active_transition;
 
         self->active_transition = NULL;
+        nci_sm_stats_transition_finished(self, finished, reached);
         nci_transition_finished(finished);
         nci_transition_unref(finished);
     }
@@ -235,11 +406,16 @@ nci_sm_start_transition(
 {
     /* Caller checks that transition is not NULL */
     if (self->active_transition != transition) {
-        nci_sm_finish_active_transition(self);
+        nci_sm_finish_active_transition(self, NULL);
     }
 
-    /* Optimistically mark this transition as active */
+    /*
+     * Optimistically mark this transition as active. It may finish
+     * (or stall) before nci_transition_start() returns, so it has
+     * to be counted as started before it gets a chance to do so.
+     */
     self->active_transition = nci_transition_ref(transition);
+    nci_sm_stats_transition_started(self, transition);
     if (nci_transition_start(transition)) {
         /* Transition has started, deactivate the state */
         if (self->active_state) {
@@ -249,6 +425,7 @@ nci_sm_start_transition(
         return TRUE;
     } else if (self->active_transition == transition) {
         /* Ne need to finish it because it hasn't been started */
+        nci_sm_stats_transition_not_started(self, transition);
         nci_transition_unref(self->active_transition);
         self->active_transition = NULL;
     }
@@ -318,7 +495,11 @@ nci_sm_stall_internal(
     if (G_LIKELY(io)) {
         io->cancel(io);
     }
-    nci_sm_finish_active_transition(self);
+    /* Don't trust the cached configuration anymore */
+    self->sm.config_valid = FALSE;
+    self->sm.discover_map_applied = FALSE;
+    nci_sm_stats_stall(self, type);
+    nci_sm_finish_active_transition(self, state);
     nci_sm_set_last_state(self, state);
     nci_sm_set_next_state(self, state);
     if (self->active_state != state) {
@@ -326,6 +507,7 @@ nci_sm_stall_internal(
             nci_state_leave(self->active_state);
         }
         self->active_state = state;
+        nci_sm_stats_state_entered(self, state);
         nci_state_enter(state, NULL);
     }
 }
@@ -346,7 +528,7 @@ nci_sm_enter_state_internal(
     self->entering_state++;
 
     /* Entering any state terminates the transition */
-    nci_sm_finish_active_transition(self);
+    nci_sm_finish_active_transition(self, state);
 
     /* Activate the new state */
     if (state == self->active_state) {
@@ -356,6 +538,7 @@ nci_sm_enter_state_internal(
             nci_state_leave(self->active_state);
         }
         self->active_state = state;
+        nci_sm_stats_state_entered(self, state);
         nci_state_enter(state, param);
     }
 
@@ -576,6 +759,36 @@ nci_sm_restart(
     }
 }
 
+static
+NCI_TECH
+nci_sm_relevant_techs(
+    NCI_OP_MODE op_mode)
+{
+    /*
+     * Technologies which affect NFCC configuration in this mode.
+     * Listen mode routing (CE or Peer Listen) depends on both poll
+     * and listen technologies, otherwise only the technologies which
+     * end up in RF_DISCOVER_CMD and RF_DISCOVER_MAP_CMD matter.
+     */
+    if ((op_mode & NFC_OP_MODE_CE) ||
+        (op_mode & (NFC_OP_MODE_PEER | NFC_OP_MODE_LISTEN)) ==
+        (NFC_OP_MODE_PEER | NFC_OP_MODE_LISTEN)) {
+        return NCI_TECH_ALL;
+    } else {
+        NCI_TECH techs = NCI_TECH_NONE;
+
+        if (op_mode & NFC_OP_MODE_RW) {
+            techs |= NCI_TECH_A_POLL | NCI_TECH_B_POLL |
+                NCI_TECH_F_POLL | NCI_TECH_V_POLL;
+        }
+        if ((op_mode & (NFC_OP_MODE_PEER | NFC_OP_MODE_POLL)) ==
+            (NFC_OP_MODE_PEER | NFC_OP_MODE_POLL)) {
+            techs |= NCI_TECH_A_POLL | NCI_TECH_F_POLL;
+        }
+        return techs;
+    }
+}
+
 /*==========================================================================*
  * Interface
  *==========================================================================*/
@@ -602,6 +815,61 @@ nci_sm_enter_state(
     return NULL;
 }
 
+static
+NCI_SM_PATH
+nci_sm_plan_path(
+    NciSmObject* self,
+    NciState* from,
+    NciState* to,
+    NciTransition** first)
+{
+    NciTransition* transition = nci_state_get_transition(from, to->state);
+
+    /* The cheapest way is the direct transition, if there is one */
+    if (transition) {
+        *first = transition;
+        return NCI_SM_PATH_DIRECT;
+    } else if (NCI_IS_INTERNAL_STATE(to->state)) {
+        /* Internal states are entered without transition and
+         * take no parameters */
+        *first = NULL;
+        return NCI_SM_PATH_INTERNAL;
+    }
+
+    /* Otherwise switch to idle state first */
+    transition = nci_state_get_transition(from, NCI_RFST_IDLE);
+    if (transition) {
+        *first = transition;
+        return NCI_SM_PATH_IDLE;
+    }
+
+    /* No direct transition to IDLE, must reset */
+    *first = self->reset_transition;
+    return NCI_SM_PATH_RESET;
+}
+
+static
+void
+nci_sm_path_taken(
+    NciSmObject* self,
+    NciState* from,
+    NciState* to,
+    NCI_SM_PATH path)
+{
+#if GUTIL_LOG_DEBUG
+    static const char* path_names[] = {
+        "nothing to do",  /* NCI_SM_PATH_NONE */
+        "internal",       /* NCI_SM_PATH_INTERNAL */
+        "direct",         /* NCI_SM_PATH_DIRECT */
+        "via idle",       /* NCI_SM_PATH_IDLE */
+        "via reset"       /* NCI_SM_PATH_RESET */
+    };
+
+    GDEBUG("%s -> %s (%s)", from->name, to->name, path_names[path]);
+#endif
+    self->sm.last_path = path;
+}
+
 static
 void
 nci_sm_switch_internal(
@@ -611,6 +879,9 @@ nci_sm_switch_internal(
     NciSm* sm = &self->sm;
 
     if (sm->next_state != next) {
+        NciTransition* first = NULL;
+        NCI_SM_PATH path;
+
         if (self->next_transition) {
             nci_transition_unref(self->next_transition);
             self->next_transition = NULL;
@@ -619,14 +890,14 @@ nci_sm_switch_internal(
             NciState* dest = self->active_transition->dest;
 
             if (dest != next) {
-                self->next_transition =
-                    nci_state_get_transition(dest, next->state);
-                if (self->next_transition) {
-                    nci_transition_ref(self->next_transition);
+                /* Only one transition can be queued */
+                path = nci_sm_plan_path(self, dest, next, &first);
+                if (path == NCI_SM_PATH_DIRECT) {
+                    self->next_transition = nci_transition_ref(first);
+                    nci_sm_path_taken(self, dest, next, path);
                     nci_sm_set_next_state(self, next);
-                } else if (NCI_IS_INTERNAL_STATE(next->state)) {
-                    /* Internal states are entered without transition
-                     * and take no parameters */
+                } else if (path == NCI_SM_PATH_INTERNAL) {
+                    nci_sm_path_taken(self, dest, next, path);
                     nci_sm_enter_state_internal(self, next, NULL);
                 } else {
                     GERR("No transition %s -> %s", dest->name, next->name);
@@ -634,39 +905,35 @@ nci_sm_switch_internal(
                 }
             }
         } else {
-            NciTransition* direct_transition =
-                nci_state_get_transition(sm->last_state, next->state);
+            NciState* last = sm->last_state;
 
-            if (direct_transition) {
-                /* Found direct transition */
-                if (nci_sm_start_transition(self, direct_transition)) {
+            path = nci_sm_plan_path(self, last, next, &first);
+            switch (path) {
+            case NCI_SM_PATH_DIRECT:
+                if (nci_sm_start_transition(self, first)) {
+                    nci_sm_path_taken(self, last, next, path);
                     nci_sm_set_next_state(self, next);
                 } else {
                     nci_sm_stall_internal(self, NCI_STALL_ERROR);
                 }
-            } else if (NCI_IS_INTERNAL_STATE(next->state)) {
-                /* Internal states are entered without transition and
-                 * take no parameters. */
+                break;
+            case NCI_SM_PATH_INTERNAL:
+                nci_sm_path_taken(self, last, next, path);
                 nci_sm_enter_state_internal(self, next, NULL);
-            } else {
-                /* Switch to idle state first */
-                NciTransition* transition_to_idle =
-                    nci_state_get_transition(sm->last_state, NCI_RFST_IDLE);
-
-                if (!transition_to_idle) {
-                    /* No direct transition to IDLE, must reset */
-                    transition_to_idle = self->reset_transition;
-                }
-                if (nci_sm_start_transition(self, transition_to_idle)) {
+                break;
+            default:
+                if (nci_sm_start_transition(self, first)) {
                     NciState* idle = nci_sm_state_by_id(self, NCI_RFST_IDLE);
 
                     if (next->state == NCI_RFST_IDLE) {
+                        nci_sm_path_taken(self, last, next, path);
                         nci_sm_set_next_state(self, idle);
                     } else {
                         self->next_transition =
                             nci_state_get_transition(idle, next->state);
                         if (self->next_transition) {
                             nci_transition_ref(self->next_transition);
+                            nci_sm_path_taken(self, last, next, path);
                             nci_sm_set_next_state(self, next);
                         } else {
                             GERR("No transition %s -> %s", idle->name,
@@ -677,6 +944,7 @@ nci_sm_switch_internal(
                 } else {
                     nci_sm_stall_internal(self, NCI_STALL_ERROR);
                 }
+                break;
             }
         }
         nci_sm_emit_pending_signals(self);
@@ -877,9 +1145,18 @@ nci_sm_set_tech(
          * must be done in RFST_IDLE state. Therefore, we need to switch to
          * RFST_IDLE if we are not there yet.
          */
+        const NCI_TECH changed = sm->techs ^ valid_techs;
+
         GDEBUG("Tech 0x%04x => 0x%04x", sm->techs, valid_techs);
         sm->techs = valid_techs;
-        nci_sm_restart(sm);
+        if (changed & nci_sm_relevant_techs(sm->op_mode)) {
+            sm->config_valid = FALSE;
+            nci_sm_restart(sm);
+        } else {
+            /* Nothing that NFCC would see has changed */
+            GDEBUG("No need to reconfigure NFCC");
+            sm->last_path = NCI_SM_PATH_NONE;
+        }
         return valid_techs;
     }
     return NCI_TECH_NONE;
@@ -928,12 +1205,14 @@ nci_sm_set_la_nfcid1(
                     /* Clear the remaining part */
                     memset(out->bytes + out->len, 0,
                         sizeof(out->bytes) - out->len);
+                    sm->config_valid = FALSE;
                 }
             }
         } else {
             /* Reset to default */
             GDEBUG("LA_NFCID1 => (default)");
             *out = nci_sm_object_cast(sm)->default_la_nfcid1;
+            sm->config_valid = FALSE;
         }
     }
 }
@@ -966,10 +1245,12 @@ nci_sm_set_li_a_hb(
             if (out->len < sizeof(hb->bytes)) {
                 memset(out->bytes + out->len, 0, sizeof(hb->bytes) - out->len);
             }
+            sm->config_valid = FALSE;
         } else {
             /* Reset to default */
             GDEBUG("LI_A_HB => (default)");
             *out = nci_sm_object_cast(sm)->default_li_a_hb;
+            sm->config_valid = FALSE;
         }
     }
 }
@@ -1100,6 +1381,181 @@ nci_sm_remove_handlers(
     }
 }
 
+void
+nci_sm_set_select_policy(
+    NciSm* sm,
+    const NciSelectPolicy* policy)
+{
+    NciSmObject* self = nci_sm_object_cast(sm);
+
+    if (G_LIKELY(self)) {
+        g_free(self->select_priority);
+        nci_id_cache_free(self->select_recent);
+        self->select_priority = NULL;
+        self->select_priority_count = 0;
+        self->select_filter = NULL;
+        self->select_user_data = NULL;
+        self->select_recent_usec = 0;
+        self->select_recent = NULL;
+        if (policy) {
+            if (policy->priority_count && policy->priority) {
+                self->select_priority = gutil_memdup(policy->priority,
+                    sizeof(NciSelectPriority) * policy->priority_count);
+                self->select_priority_count = policy->priority_count;
+            }
+            self->select_filter = policy->filter;
+            self->select_user_data = policy->user_data;
+            if (policy->recent_sec && policy->recent_count) {
+                self->select_recent_usec = policy->recent_sec *
+                    G_GINT64_CONSTANT(1000000);
+                self->select_recent = nci_id_cache_new(policy->recent_count);
+            }
+        }
+    }
+}
+
+void
+nci_sm_set_activation_cache_size(
+    NciSm* sm,
+    guint size)
+{
+    NciSmObject* self = nci_sm_object_cast(sm);
+
+    if (G_LIKELY(self)) {
+        nci_id_cache_free(self->activations);
+        self->activations = nci_id_cache_new(size);
+        self->activation_info_valid = FALSE;
+    }
+}
+
+gboolean
+nci_sm_get_activation_info(
+    NciSm* sm,
+    NciActivationInfo* info)
+{
+    NciSmObject* self = nci_sm_object_cast(sm);
+
+    if (G_LIKELY(self) && self->activation_info_valid) {
+        if (info) {
+            *info = self->activation_info;
+        }
+        return TRUE;
+    }
+    return FALSE;
+}
+
+NciActivation*
+nci_sm_get_activation(
+    NciSm* sm)
+{
+    NciSmObject* self = nci_sm_object_cast(sm);
+
+    return G_LIKELY(self) ? self->activation : NULL;
+}
+
+gboolean
+nci_sm_get_stats(
+    NciSm* sm,
+    NciSmStats* stats)
+{
+#if NCI_STATS
+    NciSmObject* self = nci_sm_object_cast(sm);
+
+    if (G_LIKELY(self) && G_LIKELY(stats)) {
+        const NciState* state = self->stats_state;
+
+        *stats = self->stats;
+        /* Include the time spent in the current state */
+        if (state && state->state < NCI_CORE_STATES) {
+            stats->state[state->state].residency +=
+                g_get_monotonic_time() - self->stats_state_since;
+        }
+        return TRUE;
+    }
+#endif
+    return FALSE;
+}
+
+void
+nci_sm_reset_stats(
+    NciSm* sm)
+{
+#if NCI_STATS
+    NciSmObject* self = nci_sm_object_cast(sm);
+
+    if (G_LIKELY(self)) {
+        const gint64 now = g_get_monotonic_time();
+
+        memset(&self->stats, 0, sizeof(self->stats));
+        if (self->stats_state) {
+            self->stats_state_since = now;
+        }
+        if (self->active_transition) {
+            self->stats_transition_since = now;
+        }
+        if (self->stats_activated_since) {
+            self->stats_activated_since = now;
+        }
+    }
+#endif
+}
+
+void
+nci_sm_log_stats(
+    NciSm* sm)
+{
+#if NCI_STATS
+    NciSmObject* self = nci_sm_object_cast(sm);
+
+    if (G_LIKELY(self)) {
+        static const char* transition_names[] = {
+            "reset",
+            "idle_to_discovery",
+            "deactivate_to_idle",
+            "deactivate_to_discovery",
+            "poll_active_to_idle",
+            "listen_active_to_idle"
+        };
+        NciSmStats stats;
+        guint i;
+
+        G_STATIC_ASSERT(G_N_ELEMENTS(transition_names) ==
+            NCI_CORE_TRANSITIONS);
+        nci_sm_get_stats(sm, &stats);
+        for (i = 0; i < NCI_CORE_STATES; i++) {
+            const NciStateStats* s = stats.state + i;
+
+            if (s->entered) {
+                GINFO("%s: entered %u, %" G_GUINT64_FORMAT " ms",
+                    nci_sm_state_by_id(self, i)->name, s->entered,
+                    s->residency / 1000);
+            }
+        }
+        for (i = 0; i < NCI_CORE_TRANSITIONS; i++) {
+            const NciTransitionStats* t = stats.transition + i;
+
+            if (t->started) {
+                const NciTimeHistogram* d = &t->duration;
+
+                GINFO("%s: started %u, failed %u, avg %" G_GUINT64_FORMAT
+                    " us, max %" G_GUINT64_FORMAT " us", transition_names[i],
+                    t->started, t->failed, d->count ? (d->total / d->count) :
+                    0, d->max);
+            }
+        }
+        if (stats.activation.count) {
+            GINFO("activations: %u, avg %" G_GUINT64_FORMAT " ms",
+                stats.activation.count, stats.activation.total /
+                stats.activation.count / 1000);
+        }
+        if (stats.stall_stop || stats.stall_error) {
+            GINFO("stalls: %u stop, %u error", stats.stall_stop,
+                stats.stall_error);
+        }
+    }
+#endif
+}
+
 /*==========================================================================*
  * Interface for states and transitions
  *==========================================================================*/
@@ -1138,6 +1594,106 @@ nci_sm_remove_weak_pointer(
     }
 }
 
+gboolean
+nci_sm_config_cached(
+    NciSm* sm,
+    const NciSmConfig* config)
+{
+    if (G_LIKELY(sm)) {
+        const NciSmConfig* cached = &sm->config;
+
+        if (sm->config_valid &&
+            cached->la_sens_res_1 == config->la_sens_res_1 &&
+            cached->la_sel_info == config->la_sel_info &&
+            cached->lf_protocol_type == config->lf_protocol_type &&
+            nci_nfcid1_equal(&cached->la_nfcid1, &config->la_nfcid1) &&
+            cached->li_a_hb.len == config->li_a_hb.len &&
+            !memcmp(cached->li_a_hb.bytes, config->li_a_hb.bytes,
+                config->li_a_hb.len)) {
+            sm->config_hits++;
+            GDEBUG("Configuration is up to date (%u hit(s), %u miss(es))",
+                sm->config_hits, sm->config_misses);
+            return TRUE;
+        }
+        sm->config_misses++;
+    }
+    return FALSE;
+}
+
+void
+nci_sm_config_validated(
+    NciSm* sm,
+    const NciSmConfig* config)
+{
+    if (G_LIKELY(sm)) {
+        sm->config = *config;
+        sm->config_valid = TRUE;
+    }
+}
+
+void
+nci_sm_invalidate_config(
+    NciSm* sm)
+{
+    if (G_LIKELY(sm)) {
+        sm->config_valid = FALSE;
+    }
+}
+
+void
+nci_sm_set_routing(
+    NciSm* sm,
+    NCI_NFCC_ROUTING type,
+    GBytes* routing)
+{
+    if (G_LIKELY(sm)) {
+        if (routing) {
+            g_bytes_ref(routing);
+        }
+        if (sm->routing) {
+            g_bytes_unref(sm->routing);
+        }
+        sm->routing = routing;
+        sm->routing_type = routing ? type : NCI_NFCC_ROUTING_NONE;
+    }
+}
+
+void
+nci_sm_set_discovery_payloads(
+    NciSm* sm,
+    GBytes* discover_map,
+    GBytes* discover)
+{
+    if (G_LIKELY(sm)) {
+        g_bytes_ref(discover_map);
+        g_bytes_ref(discover);
+        if (sm->discover_map) {
+            /* NFCC doesn't have this mapping yet, unless it's the same */
+            if (!g_bytes_equal(sm->discover_map, discover_map)) {
+                sm->discover_map_applied = FALSE;
+            }
+            g_bytes_unref(sm->discover_map);
+        }
+        if (sm->discover) {
+            g_bytes_unref(sm->discover);
+        }
+        sm->discover_map = discover_map;
+        sm->discover = discover;
+        sm->discovery_techs = sm->techs;
+        sm->discovery_op_mode = sm->op_mode;
+    }
+}
+
+void
+nci_sm_discover_map_applied(
+    NciSm* sm,
+    gboolean applied)
+{
+    if (G_LIKELY(sm)) {
+        sm->discover_map_applied = applied;
+    }
+}
+
 gboolean
 nci_sm_supports_protocol(
     NciSm* sm,
@@ -1160,6 +1716,96 @@ nci_sm_supports_protocol(
     return FALSE;
 }
 
+static
+guint
+nci_sm_select_rank(
+    NciSmObject* self,
+    const NciDiscoveryNtf* ntf)
+{
+    guint i;
+
+    if (self->select_priority) {
+        for (i = 0; i < self->select_priority_count; i++) {
+            const NciSelectPriority* prio = self->select_priority + i;
+
+            if (prio->protocol == ntf->protocol &&
+                (prio->any_mode || prio->mode == ntf->mode)) {
+                break;
+            }
+        }
+    } else {
+        static const NCI_PROTOCOL protocol_order[] = {
+            NCI_PROTOCOL_NFC_DEP,
+            NCI_PROTOCOL_ISO_DEP,
+            NCI_PROTOCOL_T2T
+        };
+
+        for (i = 0; i < G_N_ELEMENTS(protocol_order); i++) {
+            if (protocol_order[i] == ntf->protocol) {
+                break;
+            }
+        }
+    }
+    return i;
+}
+
+static
+gboolean
+nci_sm_select_recent(
+    NciSmObject* self,
+    const NciDiscoveryNtf* ntf,
+    gint64 now)
+{
+    GUtilData id;
+
+    if (self->select_recent && nci_mode_param_id(ntf->mode, ntf->param,
+        &id)) {
+        const gint64 last = nci_id_cache_lookup(self->select_recent, &id);
+
+        return last && (now - last) < self->select_recent_usec;
+    }
+    return FALSE;
+}
+
+const NciDiscoveryNtf*
+nci_sm_select_target(
+    NciSm* sm,
+    const NciDiscoveryNtf* const* ntfs,
+    guint count)
+{
+    NciSmObject* self = nci_sm_object_cast(sm);
+    const NciDiscoveryNtf* best = NULL;
+
+    if (G_LIKELY(self)) {
+        const gint64 now = g_get_monotonic_time();
+        guint i, best_rank = 0;
+
+        for (i = 0; i < count; i++) {
+            const NciDiscoveryNtf* ntf = ntfs[i];
+
+            if (!nci_sm_supports_protocol(sm, ntf->protocol)) {
+                GDEBUG("Protocol 0x%02x is not supported", ntf->protocol);
+            } else if (nci_sm_select_recent(self, ntf, now)) {
+                GDEBUG("Skipping recently activated target 0x%02x",
+                    ntf->discovery_id);
+            } else if (self->select_filter &&
+                !self->select_filter(ntf, self->select_user_data)) {
+                GDEBUG("Target 0x%02x is filtered out", ntf->discovery_id);
+            } else {
+                const guint rank = nci_sm_select_rank(self, ntf);
+
+                /* Lower rank wins, otherwise sort by discovery ID */
+                if (!best || rank < best_rank || (rank == best_rank &&
+                    ntf->discovery_id < best->discovery_id)) {
+                    best = ntf;
+                    best_rank = rank;
+                }
+            }
+        }
+    }
+    return best;
+}
+
 gboolean
 nci_sm_active_transition(
     NciSm* sm,
@@ -1225,19 +1871,68 @@ nci_sm_send_command_static(
     return ok;
 }
 
+gboolean
+nci_sm_queue_command(
+    NciSm* sm,
+    guint8 gid,
+    guint8 oid,
+    GBytes* payload,
+    NciSmResponseFunc resp,
+    gpointer user_data)
+{
+    if (G_LIKELY(sm)) {
+        NciSmIo* io = sm->io;
+
+        if (G_LIKELY(io) && io->queue) {
+            return io->queue(io, gid, oid, payload, resp, user_data);
+        }
+    }
+    return FALSE;
+}
+
 void
 nci_sm_intf_activated(
     NciSm* sm,
-    const NciIntfActivationNtf* ntf)
+    NciActivation* act)
 {
     NciSmObject* self = nci_sm_object_cast(sm);
 
-    if (G_LIKELY(self)) {
+    if (G_LIKELY(self) && G_LIKELY(act)) {
+        const NciIntfActivationNtf* ntf = &act->ntf;
         NciSar* sar = nci_sm_sar(sm);
 
+        nci_util_activation_ref(act);
+        nci_util_activation_unref(self->activation);
+        self->activation = act;
+
         nci_sar_set_max_data_payload_size(sar, ntf->max_data_packet_size);
         nci_sar_set_initial_credits(sar, NCI_STATIC_RF_CONN_ID,
             ntf->num_credits);
+        if (self->select_recent) {
+            GUtilData id;
+
+            if (nci_mode_param_id(ntf->mode, ntf->mode_param, &id)) {
+                nci_id_cache_update(self->select_recent, &id,
+                    g_get_monotonic_time());
+            }
+        }
+        self->activation_info_valid = FALSE;
+        if (self->activations) {
+            guint8 key[NCI_ID_CACHE_MAX_ID];
+            GUtilData id;
+
+            id.bytes = key;
+            id.size = nci_intf_activation_key(ntf, key);
+            if (id.size) {
+                NciActivationInfo* info = &self->activation_info;
+
+                info->last_seen = nci_id_cache_update(self->activations, &id,
+                    g_get_monotonic_time());
+                info->repeat = (info->last_seen != 0);
+                self->activation_info_valid = TRUE;
+            }
+        }
+        nci_sm_stats_activated(self);
         g_signal_emit(self, nci_sm_signals[SIGNAL_INTF_ACTIVATED], 0, ntf);
     }
 }
@@ -1327,6 +2022,7 @@ nci_sm_object_init(
     /* Only poll modes by default */
     sm->op_mode = NFC_OP_MODE_RW | NFC_OP_MODE_POLL;
     sm->techs = NCI_TECH_DEFAULT;
+    sm->discoveries = nci_arena_new(NCI_DISCOVERIES_BLOCK_SIZE);
     self->transitions = g_ptr_array_new_with_free_func((GDestroyNotify)
         nci_transition_unref);
     self->states = g_ptr_array_new_full(NCI_CORE_STATES, (GDestroyNotify)
@@ -1339,6 +2035,7 @@ nci_sm_object_init(
     nci_sm_add_new_state(sm, nci_state_stop_new);
 
     /* Enter the initial state */
+    nci_sm_stats_state_entered(self, self->active_state);
     nci_state_enter(self->active_state, NULL);
 }
 
@@ -1354,15 +2051,29 @@ nci_sm_object_finalize(
         g_source_remove(self->pending_switch_id);
         self->pending_switch_id = 0;
     }
-    nci_sm_finish_active_transition(self);
+    nci_sm_finish_active_transition(self, NULL);
     nci_state_leave(self->active_state);
     if (sm->rf_interfaces) {
         g_bytes_unref(sm->rf_interfaces);
     }
+    if (sm->routing) {
+        g_bytes_unref(sm->routing);
+    }
+    if (sm->discover_map) {
+        g_bytes_unref(sm->discover_map);
+    }
+    if (sm->discover) {
+        g_bytes_unref(sm->discover);
+    }
     nci_transition_unref(self->next_transition);
     g_ptr_array_free(self->transitions, TRUE);
     g_ptr_array_free(self->states, TRUE);
     nci_transition_unref(self->reset_transition);
+    nci_arena_free(sm->discoveries);
+    g_free(self->select_priority);
+    nci_id_cache_free(self->select_recent);
+    nci_id_cache_free(self->activations);
+    nci_util_activation_unref(self->activation);
     G_OBJECT_CLASS(PARENT_CLASS)->finalize(object);
 }
 
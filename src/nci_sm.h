@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2019-2025 Slava Monich <slava@monich.com>
+ * Copyright (C) 2019-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2021 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -51,8 +51,29 @@ struct nci_sm_io {
     gboolean (*send)(NciSmIo* io, guint8 gid, guint8 oid,
         GBytes* payload, NciSmResponseFunc resp, gpointer user_data);
     void (*cancel)(NciSmIo* io);
+    /* Unlike send, doesn't cancel the commands issued earlier */
+    gboolean (*queue)(NciSmIo* io, guint8 gid, guint8 oid,
+        GBytes* payload, NciSmResponseFunc resp, gpointer user_data);
 };
 
+/* NFCC configuration which is known to be in effect */
+typedef struct nci_sm_config {
+    guint8 la_sens_res_1;
+    guint8 la_sel_info;
+    guint8 lf_protocol_type;
+    NciNfcid1 la_nfcid1;
+    NciAtsHb li_a_hb;
+} NciSmConfig;
+
+/* How the state machine is getting to the next state */
+typedef enum nci_sm_path {
+    NCI_SM_PATH_NONE,       /* Nothing had to be done */
+    NCI_SM_PATH_INTERNAL,   /* Internal state, entered directly */
+    NCI_SM_PATH_DIRECT,     /* Direct transition */
+    NCI_SM_PATH_IDLE,       /* Through NCI_RFST_IDLE */
+    NCI_SM_PATH_RESET       /* Through CORE_RESET */
+} NCI_SM_PATH;
+
 struct nci_sm {
     NciSmIo* io;
     NciState* last_state;
@@ -69,6 +90,19 @@ struct nci_sm {
     guint16 llc_wks;
     NciNfcid1 la_nfcid1; /* NFCID1 in Listen A mode */
     NciAtsHb li_a_hb; /* ATS Historical Bytes in Listen A mode */
+    gboolean config_valid; /* TRUE if config matches NFCC */
+    NciSmConfig config;
+    guint config_hits; /* CORE_GET_CONFIG skipped */
+    guint config_misses; /* CORE_GET_CONFIG sent */
+    GBytes* routing; /* Last applied RF_SET_LISTEN_MODE_ROUTING payload */
+    NCI_NFCC_ROUTING routing_type; /* Routing type which worked */
+    GBytes* discover_map; /* RF_DISCOVER_MAP_CMD payload */
+    GBytes* discover; /* RF_DISCOVER_CMD payload */
+    NCI_TECH discovery_techs; /* Techs the above were built for */
+    NCI_OP_MODE discovery_op_mode; /* Op mode the above were built for */
+    gboolean discover_map_applied; /* TRUE if NFCC has discover_map */
+    NCI_SM_PATH last_path; /* The path taken by the last switch */
+    NciArena* discoveries; /* RF_DISCOVER_NTF storage, one cycle at a time */
 };
 
 typedef
@@ -163,6 +197,45 @@ nci_sm_add_state(
     NciState* state)
     NCI_INTERNAL;
 
+void
+nci_sm_set_select_policy(
+    NciSm* sm,
+    const NciSelectPolicy* policy)
+    NCI_INTERNAL;
+
+void
+nci_sm_set_activation_cache_size(
+    NciSm* sm,
+    guint size)
+    NCI_INTERNAL;
+
+gboolean
+nci_sm_get_activation_info(
+    NciSm* sm,
+    NciActivationInfo* info)
+    NCI_INTERNAL;
+
+NciActivation*
+nci_sm_get_activation(
+    NciSm* sm)
+    NCI_INTERNAL;
+
+gboolean
+nci_sm_get_stats(
+    NciSm* sm,
+    NciSmStats* stats)
+    NCI_INTERNAL;
+
+void
+nci_sm_reset_stats(
+    NciSm* sm)
+    NCI_INTERNAL;
+
+void
+nci_sm_log_stats(
+    NciSm* sm)
+    NCI_INTERNAL;
+
 void
 nci_sm_add_transition(
     NciSm* sm,
@@ -230,12 +303,57 @@ nci_sm_sar(
     NciSm* sm)
     NCI_INTERNAL;
 
+gboolean
+nci_sm_config_cached(
+    NciSm* sm,
+    const NciSmConfig* config)
+    NCI_INTERNAL;
+
+void
+nci_sm_config_validated(
+    NciSm* sm,
+    const NciSmConfig* config)
+    NCI_INTERNAL;
+
+void
+nci_sm_invalidate_config(
+    NciSm* sm)
+    NCI_INTERNAL;
+
+void
+nci_sm_set_routing(
+    NciSm* sm,
+    NCI_NFCC_ROUTING type,
+    GBytes* routing)
+    NCI_INTERNAL;
+
+void
+nci_sm_set_discovery_payloads(
+    NciSm* sm,
+    GBytes* discover_map,
+    GBytes* discover)
+    NCI_INTERNAL;
+
+void
+nci_sm_discover_map_applied(
+    NciSm* sm,
+    gboolean applied)
+    NCI_INTERNAL;
+
 gboolean
 nci_sm_supports_protocol(
     NciSm* sm,
     NCI_PROTOCOL protocol)
     NCI_INTERNAL;
 
+/* Picks the target according to the selection policy, NULL if none */
+const NciDiscoveryNtf*
+nci_sm_select_target(
+    NciSm* sm,
+    const NciDiscoveryNtf* const* ntfs,
+    guint count)
+    NCI_INTERNAL;
+
 gboolean
 nci_sm_active_transition(
     NciSm* sm,
@@ -263,10 +381,20 @@ nci_sm_send_command_static(
     gpointer user_data)
     NCI_INTERNAL;
 
+gboolean
+nci_sm_queue_command(
+    NciSm* sm,
+    guint8 gid,
+    guint8 oid,
+    GBytes* payload,
+    NciSmResponseFunc resp,
+    gpointer user_data)
+    NCI_INTERNAL;
+
 void
 nci_sm_intf_activated(
     NciSm* sm,
-    const NciIntfActivationNtf* ntf)
+    NciActivation* act)
     NCI_INTERNAL;
 
 void
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2019-2023 Slava Monich <slava@monich.com>
+ * Copyright (C) 2019-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2020 Jolla Ltd.
  *
  * You may use this file under the terms of BSD license as follows:
@@ -56,12 +56,8 @@ nci_state_discovery_intf_activated_ntf(
     NciState* self,
     const GUtilData* payload)
 {
-    NciIntfActivationNtf ntf;
-    NciModeParam mode_param;
-    NciActivationParam activation_param;
     NciSm* sm = nci_state_sm(self);
-    gboolean ok = nci_parse_intf_activated_ntf(&ntf, &mode_param,
-        &activation_param, payload->bytes, payload->size);
+    NciActivation* act = nci_activation_new(payload->bytes, payload->size);
 
     /*
      * 5.2.2 State RFST_DISCOVERY
@@ -81,15 +77,16 @@ nci_state_discovery_intf_activated_ntf(
      * and send RF_INTF_ACTIVATED_NTF (Poll Mode) to the DH. At this point,
      * the state is changed to RFST_POLL_ACTIVE.
      */
-    nci_sm_enter_state(sm, nci_listen_mode(ntf.mode) ?
+    nci_sm_enter_state(sm, (act && nci_listen_mode(act->ntf.mode)) ?
         NCI_RFST_LISTEN_ACTIVE : NCI_RFST_POLL_ACTIVE, NULL);
 
-    if (ok) {
+    if (act) {
         /*
          * Note that RF_INTF_ACTIVATED_NTF handler may want to change the
          * state again (e.g. if configuration is unsupported).
          */
-        nci_sm_intf_activated(sm, &ntf);
+        nci_sm_intf_activated(sm, act);
+        nci_util_activation_unref(act);
     } else {
         /* Deactivate this target */
         nci_sm_switch_to(sm, NCI_RFST_IDLE);
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2020-2024 Slava Monich <slava@monich.com>
+ * Copyright (C) 2020-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2020 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -61,10 +61,8 @@ nci_state_listen_sleep_intf_activated_ntf(
     NciState* self,
     const GUtilData* payload)
 {
-    NciIntfActivationNtf ntf;
-    NciModeParam mode_param;
-    NciActivationParam activation_param;
     NciSm* sm = nci_state_sm(self);
+    NciActivation* act = nci_activation_new(payload->bytes, payload->size);
 
     /*
      * [NFCForum-TS-NCI-1.0]
@@ -76,19 +74,20 @@ nci_state_listen_sleep_intf_activated_ntf(
      * RF_INTF_ACTIVATED_NTF (Listen mode) to the DH. At that point,
      * the state is changed back to RFST_LISTEN_ACTIVE.
      */
-    if (nci_parse_intf_activated_ntf(&ntf, &mode_param, &activation_param,
-        payload->bytes, payload->size)) {
-        if (nci_listen_mode(ntf.mode)) {
+    if (act) {
+        if (nci_listen_mode(act->ntf.mode)) {
             /*
              * Switch the state first because RF_INTF_ACTIVATED_NTF handler
              * may want to change the state again (e.g. if configuration is
              * unsupported).
              */
             nci_sm_enter_state(sm, NCI_RFST_LISTEN_ACTIVE, NULL);
-            nci_sm_intf_activated(sm, &ntf);
+            nci_sm_intf_activated(sm, act);
+            nci_util_activation_unref(act);
             return;
         } else {
-            GDEBUG("Unexpected activation mode 0x%02x", ntf.mode);
+            GDEBUG("Unexpected activation mode 0x%02x", act->ntf.mode);
+            nci_util_activation_unref(act);
         }
     }
     /* Oops */
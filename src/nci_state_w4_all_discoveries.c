@@ -1,4 +1,5 @@
 /*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019 Jolla Ltd.
  * Copyright (C) 2019 Slava Monich <slava.monich@jolla.com>
  *
@@ -39,7 +40,7 @@
 typedef NciStateClass NciStateW4AllDiscoveriesClass;
 typedef struct nci_state_w4_all_discoveries {
     NciState state;
-    GPtrArray* discoveries;
+    GPtrArray* discoveries; /* Point to the discovery arena */
 } NciStateW4AllDiscoveries;
 
 G_DEFINE_TYPE(NciStateW4AllDiscoveries, nci_state_w4_all_discoveries,
@@ -59,8 +60,11 @@ nci_state_w4_all_discoveries_handle_discovery(
     NciStateW4AllDiscoveries* self,
     const NciDiscoveryNtf* ntf)
 {
+    NciSm* sm = nci_state_sm(&self->state);
+
     /* Store discovery info in self->discoveries */
-    g_ptr_array_add(self->discoveries, nci_discovery_ntf_copy(ntf));
+    g_ptr_array_add(self->discoveries, (gpointer)
+        nci_discovery_ntf_arena_copy(sm->discoveries, ntf));
 
     /*
      * 5.2.3 State RFST_W4_ALL_DISCOVERIES
@@ -72,10 +76,18 @@ nci_state_w4_all_discoveries_handle_discovery(
      * changed to RFST_W4_HOST_SELECT.
      */
     if (ntf->last) {
-        NciSm* sm = nci_state_sm(&self->state);
-        NciParam* param = NCI_PARAM(nci_param_w4_host_select_new(
-            (const NciDiscoveryNtf**)self->discoveries->pdata,
-            self->discoveries->len));
+        /*
+         * The list is handed over by reference, it only has to survive
+         * our leave() which happens before W4_HOST_SELECT gets entered.
+         * The arena is reset when W4_HOST_SELECT is left.
+         */
+        const guint count = self->discoveries->len;
+        const NciDiscoveryNtf** list = nci_arena_alloc0(sm->discoveries,
+            sizeof(list[0]) * count);
+        NciParam* param;
+
+        memcpy(list, self->discoveries->pdata, sizeof(list[0]) * count);
+        param = NCI_PARAM(nci_param_w4_host_select_new(list, count));
 
         nci_sm_enter_state(sm, NCI_RFST_W4_HOST_SELECT, param);
         nci_param_unref(param);
@@ -88,6 +100,8 @@ nci_state_w4_all_discoveries_start(
     NciStateW4AllDiscoveries* self,
     NciParam* param)
 {
+    /* New discovery cycle, drop whatever is left from the previous one */
+    nci_arena_reset(nci_state_sm(&self->state)->discoveries);
     g_ptr_array_set_size(self->discoveries, 0);
     if (NCI_IS_PARAM_W4_ALL_DISCOVERIES(param)) {
         nci_param_ref(param);
@@ -161,7 +175,7 @@ nci_state_w4_all_discoveries_leave(
 {
     NciStateW4AllDiscoveries* self = NCI_STATE_W4_ALL_DISCOVERIES(state);
 
-    /* Release the memory */
+    /* The notifications themselves stay in the arena */
     g_ptr_array_set_size(self->discoveries, 0);
     NCI_STATE_CLASS(PARENT_CLASS)->leave(state);
 }
@@ -196,7 +210,7 @@ void
 nci_state_w4_all_discoveries_init(
     NciStateW4AllDiscoveries* self)
 {
-    self->discoveries = g_ptr_array_new_with_free_func(g_free);
+    self->discoveries = g_ptr_array_new();
 }
 
 static
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2019-2023 Slava Monich <slava@monich.com>
+ * Copyright (C) 2019-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2020 Jolla Ltd.
  *
  * You may use this file under the terms of BSD license as follows:
@@ -49,41 +49,6 @@ G_DEFINE_TYPE(NciStateW4HostSelect, nci_state_w4_host_select, NCI_TYPE_STATE)
  * Implementation
  *==========================================================================*/
 
-static
-gint
-nci_state_w4_host_select_sort(
-    gconstpointer a,
-    gconstpointer b)
-{
-    const NciDiscoveryNtf* ntf_a = a;
-    const NciDiscoveryNtf* ntf_b = b;
-
-    /*
-     * Return 0 if elements are equal, a negative value if the
-     * first element comes before the second, or a positive value if
-     * the first element comes after the second.
-     */
-    if (ntf_a->protocol != ntf_b->protocol) {
-        static const NCI_PROTOCOL protocol_order[] = {
-            NCI_PROTOCOL_NFC_DEP,
-            NCI_PROTOCOL_ISO_DEP,
-            NCI_PROTOCOL_T2T
-        };
-        guint i;
-
-        for (i = 0; i < G_N_ELEMENTS(protocol_order); i++) {
-            if (ntf_a->protocol == protocol_order[i]) {
-                return -1;
-            } else if (ntf_b->protocol == protocol_order[i]) {
-                return 1;
-            }
-        }
-    }
-
-    /* Otherwise sort by discovery ID */
-    return (gint)(ntf_a->discovery_id) - (gint)(ntf_b->discovery_id);
-}
-
 static
 void
 nci_state_w4_host_select_rsp(
@@ -129,25 +94,14 @@ nci_state_w4_host_select_entered(
     if (NCI_IS_PARAM_W4_HOST_SELECT(param)) {
         NciSm* sm = nci_state_sm(self);
         NciParamW4HostSelect* select = NCI_PARAM_W4_HOST_SELECT(param);
-        GSList* selected = NULL;
-        guint i;
-
-        /* Select a supported protocol */
-        for (i = 0; i < select->count; i++) {
-            NciDiscoveryNtf* ntf = select->ntf + i;
-
-            if (nci_sm_supports_protocol(sm, ntf->protocol)) {
-                selected = g_slist_insert_sorted(selected, ntf,
-                    nci_state_w4_host_select_sort);
-            }
-        }
+        const NciDiscoveryNtf* ntf = nci_sm_select_target(sm, select->ntf,
+            select->count);
 
         /*
          * We may want to store the list and selected the next protocol
          * if the best one gets rejected.
          */
-        if (selected) {
-            const NciDiscoveryNtf* ntf = selected->data;
+        if (ntf) {
             GBytes* payload;
 
             /*
@@ -193,7 +147,6 @@ nci_state_w4_host_select_entered(
             nci_sm_send_command(sm, NCI_GID_RF, NCI_OID_RF_DISCOVER_SELECT,
                 payload, nci_state_w4_host_select_rsp, self);
             g_bytes_unref(payload);
-            g_slist_free(selected);
         } else {
             /* We haven't found anything suitable */
             GDEBUG("Nothing to select");
@@ -208,10 +161,8 @@ nci_state_w4_host_select_handle_intf_activated_ntf(
     NciState* self,
     const GUtilData* payload)
 {
-    NciIntfActivationNtf ntf;
-    NciModeParam mode_param;
-    NciActivationParam activation_param;
     NciSm* sm = nci_state_sm(self);
+    NciActivation* act = nci_activation_new(payload->bytes, payload->size);
 
     /*
      * 5.2.4 State RFST_W4_HOST_SELECT
@@ -226,15 +177,15 @@ nci_state_w4_host_select_handle_intf_activated_ntf(
      * the RF Interface and send RF_INTF_ACTIVATED_NTF (Poll Mode) to
      * the DH. At this point, the state is changed to RFST_POLL_ACTIVE.
      */
-    if (nci_parse_intf_activated_ntf(&ntf, &mode_param, &activation_param,
-        payload->bytes, payload->size)) {
+    if (act) {
         /*
          * Switch the state first because RF_INTF_ACTIVATED_NTF handler
          * may want to change the state again (e.g. if configuration is
          * unsupported).
          */
         nci_sm_enter_state(sm, NCI_RFST_POLL_ACTIVE, NULL);
-        nci_sm_intf_activated(sm, &ntf);
+        nci_sm_intf_activated(sm, act);
+        nci_util_activation_unref(act);
     } else {
         /* Deactivate this target */
         nci_sm_enter_state(sm, NCI_RFST_POLL_ACTIVE, NULL);
@@ -321,6 +272,16 @@ nci_state_w4_host_select_reenter(
     NCI_STATE_CLASS(PARENT_CLASS)->reenter(self, param);
 }
 
+static
+void
+nci_state_w4_host_select_leave(
+    NciState* self)
+{
+    /* Discovery cycle is over, release the notifications */
+    nci_arena_reset(nci_state_sm(self)->discoveries);
+    NCI_STATE_CLASS(PARENT_CLASS)->leave(self);
+}
+
 static
 void
 nci_state_w4_host_select_handle_ntf(
@@ -367,6 +328,7 @@ nci_state_w4_host_select_class_init(
 {
     klass->enter = nci_state_w4_host_select_enter;
     klass->reenter = nci_state_w4_host_select_reenter;
+    klass->leave = nci_state_w4_host_select_leave;
     klass->handle_ntf = nci_state_w4_host_select_handle_ntf;
 }
 
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+
+#include "nci_trace.h"
+#include "nci_log.h"
+
+#include <gutil_macros.h>
+
+/*
+ * Records are 8-byte aligned and stored back to back. A record which
+ * doesn't fit into the space left at the end of the buffer goes to the
+ * beginning and the wrap is marked with NCI_TRACE_WRAP length (unless
+ * there's not enough room left even for the marker). Everything gets
+ * done on the caller's thread, the ring doesn't need any locking.
+ */
+
+typedef struct nci_trace_record {
+    gint64 time; /* Monotonic, microseconds */
+    guint16 len;
+    guint8 dir;
+} NciTraceRecord;
+
+#define NCI_TRACE_WRAP (0xffff)
+#define NCI_TRACE_MAX_PACKET (3 + 0xff)
+#define NCI_TRACE_RECORD_SIZE(len) G_ALIGN8(sizeof(NciTraceRecord) + (len))
+
+struct nci_trace {
+    guint8* buf;
+    gsize size;
+    gsize first; /* The oldest record */
+    gsize next; /* Where the next record goes */
+    guint count;
+};
+
+/* pcapng blocks */
+#define PCAPNG_SHB (0x0a0d0d0a)
+#define PCAPNG_IDB (0x00000001)
+#define PCAPNG_EPB (0x00000006)
+#define PCAPNG_BYTE_ORDER_MAGIC (0x1a2b3c4d)
+#define PCAPNG_OPT_ENDOFOPT (0)
+#define PCAPNG_OPT_EPB_FLAGS (2)
+#define PCAPNG_EPB_FLAGS_INBOUND (0x01)
+#define PCAPNG_EPB_FLAGS_OUTBOUND (0x02)
+
+/* LINKTYPE_NFC_LINUX pseudo-header */
+#define NFC_LINUX_HEADER_SIZE (2)
+#define NFC_LINUX_DIRECTION_RX (0x00)
+#define NFC_LINUX_DIRECTION_TX (0x01)
+#define NFC_LINUX_PAYLOAD_NCI (0x01 << 1)
+
+static inline
+NciTraceRecord*
+nci_trace_record(
+    NciTrace* self,
+    gsize pos)
+{
+    return (NciTraceRecord*)(self->buf + pos);
+}
+
+static
+gsize
+nci_trace_skip(
+    NciTrace* self,
+    gsize pos)
+{
+    pos += NCI_TRACE_RECORD_SIZE(nci_trace_record(self, pos)->len);
+    if (pos + sizeof(NciTraceRecord) > self->size ||
+        nci_trace_record(self, pos)->len == NCI_TRACE_WRAP) {
+        pos = 0;
+    }
+    return pos;
+}
+
+static
+void
+nci_trace_append_u16(
+    GByteArray* out,
+    guint16 value)
+{
+    g_byte_array_append(out, (const guint8*)&value, sizeof(value));
+}
+
+static
+void
+nci_trace_append_u32(
+    GByteArray* out,
+    guint32 value)
+{
+    g_byte_array_append(out, (const guint8*)&value, sizeof(value));
+}
+
+static
+void
+nci_trace_append_pcapng_headers(
+    GByteArray* out)
+{
+    /* Section Header Block */
+    nci_trace_append_u32(out, PCAPNG_SHB);
+    nci_trace_append_u32(out, 28);
+    nci_trace_append_u32(out, PCAPNG_BYTE_ORDER_MAGIC);
+    nci_trace_append_u16(out, 1); /* Major version */
+    nci_trace_append_u16(out, 0); /* Minor version */
+    nci_trace_append_u32(out, 0xffffffff); /* Section length unknown */
+    nci_trace_append_u32(out, 0xffffffff);
+    nci_trace_append_u32(out, 28);
+
+    /* Interface Description Block, microsecond resolution by default */
+    nci_trace_append_u32(out, PCAPNG_IDB);
+    nci_trace_append_u32(out, 20);
+    nci_trace_append_u16(out, NCI_TRACE_LINKTYPE);
+    nci_trace_append_u16(out, 0); /* Reserved */
+    nci_trace_append_u32(out, NFC_LINUX_HEADER_SIZE + /* SnapLen */
+        NCI_TRACE_MAX_PACKET);
+    nci_trace_append_u32(out, 20);
+}
+
+static
+void
+nci_trace_append_pcapng_packet(
+    GByteArray* out,
+    const NciTraceRecord* rec,
+    gint64 time_offset)
+{
+    static const guint8 pad[3] = { 0, 0, 0 };
+    const guint64 ts = rec->time + time_offset;
+    const guint len = NFC_LINUX_HEADER_SIZE + rec->len;
+    const guint padded = (len + 3) & ~3;
+    const guint32 total = 32 + padded + 12;
+    guint8 hdr[NFC_LINUX_HEADER_SIZE];
+
+    hdr[0] = 0; /* Adapter index */
+    hdr[1] = NFC_LINUX_PAYLOAD_NCI | ((rec->dir == NCI_TRACE_IN) ?
+        NFC_LINUX_DIRECTION_RX : NFC_LINUX_DIRECTION_TX);
+
+    /* Enhanced Packet Block with the direction flags */
+    nci_trace_append_u32(out, PCAPNG_EPB);
+    nci_trace_append_u32(out, total);
+    nci_trace_append_u32(out, 0); /* Interface ID */
+    nci_trace_append_u32(out, (guint32)(ts >> 32));
+    nci_trace_append_u32(out, (guint32)ts);
+    nci_trace_append_u32(out, len); /* Captured */
+    nci_trace_append_u32(out, len); /* Original */
+    g_byte_array_append(out, hdr, sizeof(hdr));
+    g_byte_array_append(out, (const guint8*)(rec + 1), rec->len);
+    g_byte_array_append(out, pad, padded - len);
+    nci_trace_append_u16(out, PCAPNG_OPT_EPB_FLAGS);
+    nci_trace_append_u16(out, 4);
+    nci_trace_append_u32(out, (rec->dir == NCI_TRACE_IN) ?
+        PCAPNG_EPB_FLAGS_INBOUND : PCAPNG_EPB_FLAGS_OUTBOUND);
+    nci_trace_append_u16(out, PCAPNG_OPT_ENDOFOPT);
+    nci_trace_append_u16(out, 0);
+    nci_trace_append_u32(out, total);
+}
+
+/*==========================================================================*
+ * Interface
+ *==========================================================================*/
+
+NciTrace*
+nci_trace_new(
+    gsize size)
+{
+    NciTrace* self = g_slice_new0(NciTrace);
+
+    /* At least one packet of the maximum size has to fit */
+    self->size = MAX(G_ALIGN8(size),
+        NCI_TRACE_RECORD_SIZE(NCI_TRACE_MAX_PACKET));
+    self->buf = g_malloc(self->size);
+    return self;
+}
+
+void
+nci_trace_free(
+    NciTrace* self)
+{
+    if (G_LIKELY(self)) {
+        g_free(self->buf);
+        g_slice_free(NciTrace, self);
+    }
+}
+
+void
+nci_trace_packet(
+    NciTrace* self,
+    NCI_TRACE_DIR dir,
+    const GUtilData* chunks,
+    guint count)
+{
+    gsize len = 0, rec_size, pos, wrap_at = 0;
+    NciTraceRecord* rec;
+    guint8* ptr;
+    guint i;
+
+    for (i = 0; i < count; i++) {
+        len += chunks[i].size;
+    }
+    len = MIN(len, NCI_TRACE_MAX_PACKET);
+    rec_size = NCI_TRACE_RECORD_SIZE(len);
+    pos = self->next;
+    if (pos + rec_size > self->size) {
+        /* Abandon the tail of the buffer and start from the beginning */
+        wrap_at = pos;
+        pos = 0;
+    }
+
+    /* Drop the oldest records which are about to get overwritten */
+    while (self->count && ((self->first >= pos &&
+        self->first < pos + rec_size) || (wrap_at &&
+        self->first >= wrap_at))) {
+        self->first = nci_trace_skip(self, self->first);
+        self->count--;
+    }
+    if (wrap_at && wrap_at + sizeof(NciTraceRecord) <= self->size) {
+        nci_trace_record(self, wrap_at)->len = NCI_TRACE_WRAP;
+    }
+    if (!self->count) {
+        self->first = pos;
+    }
+
+    /* Store the packet */
+    rec = nci_trace_record(self, pos);
+    rec->time = g_get_monotonic_time();
+    rec->len = (guint16)len;
+    rec->dir = (guint8)dir;
+    ptr = (guint8*)(rec + 1);
+    for (i = 0; i < count && len; i++) {
+        const gsize n = MIN(chunks[i].size, len);
+
+        memcpy(ptr, chunks[i].bytes, n);
+        ptr += n;
+        len -= n;
+    }
+    self->next = pos + rec_size;
+    self->count++;
+}
+
+guint
+nci_trace_count(
+    NciTrace* self)
+{
+    return G_LIKELY(self) ? self->count : 0;
+}
+
+GBytes*
+nci_trace_pcapng(
+    NciTrace* self)
+{
+    if (G_LIKELY(self)) {
+        GByteArray* out = g_byte_array_new();
+        /* Timestamps are converted to the wall clock time */
+        const gint64 time_offset = g_get_real_time() - g_get_monotonic_time();
+        gsize pos = self->first;
+        guint i;
+
+        nci_trace_append_pcapng_headers(out);
+        for (i = 0; i < self->count; i++) {
+            nci_trace_append_pcapng_packet(out, nci_trace_record(self, pos),
+                time_offset);
+            pos = nci_trace_skip(self, pos);
+        }
+        return g_byte_array_free_to_bytes(out);
+    }
+    return NULL;
+}
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+
+#ifndef NCI_TRACE_H
+#define NCI_TRACE_H
+
+#include "nci_types_p.h"
+
+/*
+ * Packet trace, a ring of the most recent NCI packets which can be
+ * dumped in pcapng format. Once the ring is full, the oldest packets
+ * get overwritten by the new ones.
+ */
+
+typedef struct nci_trace NciTrace;
+
+typedef enum nci_trace_dir {
+    NCI_TRACE_IN,   /* NFCC => DH */
+    NCI_TRACE_OUT   /* DH => NFCC */
+} NCI_TRACE_DIR;
+
+/*
+ * Packets are written the way Linux NFC raw sockets capture them, each
+ * one prefixed with a 2-byte pseudo-header (adapter index and flags).
+ */
+#define NCI_TRACE_LINKTYPE (249) /* LINKTYPE_NFC_LINUX */
+
+NciTrace*
+nci_trace_new(
+    gsize size)
+    NCI_INTERNAL;
+
+void
+nci_trace_free(
+    NciTrace* trace)
+    NCI_INTERNAL;
+
+/* The packet is gathered from one or more chunks */
+void
+nci_trace_packet(
+    NciTrace* trace,
+    NCI_TRACE_DIR dir,
+    const GUtilData* chunks,
+    guint count)
+    NCI_INTERNAL;
+
+guint
+nci_trace_count(
+    NciTrace* trace)
+    NCI_INTERNAL;
+
+GBytes*
+nci_trace_pcapng(
+    NciTrace* trace)
+    NCI_INTERNAL;
+
+#endif /* NCI_TRACE_H */
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
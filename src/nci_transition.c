@@ -148,6 +148,13 @@ nci_transition_finish(
     }
 }
 
+NCI_CORE_TRANSITION
+nci_transition_type(
+    NciTransition* self)
+{
+    return G_LIKELY(self) ? GET_THIS_CLASS(self)->type : NCI_CORE_TRANSITIONS;
+}
+
 gboolean
 nci_transition_start(
     NciTransition* self)
@@ -328,6 +335,7 @@ nci_transition_class_init(
     NciTransitionClass* klass)
 {
     g_type_class_add_private(klass, sizeof(NciTransitionPriv));
+    klass->type = NCI_CORE_TRANSITIONS;
     klass->start = nci_transition_default_start;
     klass->finished = nci_transition_default_finished;
     klass->handle_ntf = nci_transition_default_handle_ntf;
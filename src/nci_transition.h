@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2019-2024 Slava Monich <slava@monich.com>
+ * Copyright (C) 2019-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2020 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -93,6 +93,11 @@ nci_transition_handle_ntf(
     const GUtilData* payload)
     NCI_INTERNAL;
 
+NCI_CORE_TRANSITION
+nci_transition_type(
+    NciTransition* transition)
+    NCI_INTERNAL;
+
 /* Specific transitions */
 
 NciTransition*
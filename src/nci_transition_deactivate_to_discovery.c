@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2019-2024 Slava Monich <slava@monich.com>
+ * Copyright (C) 2019-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2020 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -205,6 +205,7 @@ void
 nci_transition_deactivate_to_discovery_class_init(
     NciTransitionDeactivateToDiscoveryClass* klass)
 {
+    klass->type = NCI_CORE_TRANSITION_DEACTIVATE_TO_DISCOVERY;
     klass->start = nci_transition_deactivate_to_discovery_start;
     klass->handle_ntf = nci_transition_deactivate_to_discovery_handle_ntf;
 }
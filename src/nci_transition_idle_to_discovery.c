@@ -116,14 +116,34 @@
  *                                    +-----------------+
  *                                    | RF_DISCOVER_CMD |
  *                                    +-----------------+
+ *
+ * CORE_GET_CONFIG_CMD is skipped (as if all parameters were OK) if the
+ * configuration has already been validated and nothing has changed since
+ * then. The cached configuration is dropped by CORE_RESET, by any change
+ * of the parameters or technologies and by errors.
+ *
+ * Likewise, RF_SET_LISTEN_MODE_ROUTING is skipped if NFCC already has the
+ * same routing table. Once a certain kind of routing has worked, it's used
+ * right away until the next CORE_RESET, without trying the kinds that have
+ * failed.
+ *
+ * RF_DISCOVER_MAP_CMD and RF_DISCOVER_CMD payloads are built once and then
+ * reused until the technologies or the operation mode change. The former
+ * is only sent once per NFCC session unless the mapping changes.
  *==========================================================================*/
 
-typedef NciTransition NciTransitionIdleToDiscovery;
 typedef NciTransitionClass NciTransitionIdleToDiscoveryClass;
+typedef struct nci_transition_idle_to_discovery {
+    NciTransition transition;
+    GBytes* routing; /* RF_SET_LISTEN_MODE_ROUTING being applied */
+    NCI_NFCC_ROUTING routing_type;
+} NciTransitionIdleToDiscovery;
 
 #define THIS_TYPE nci_transition_idle_to_discovery_get_type()
 #define PARENT_CLASS nci_transition_idle_to_discovery_parent_class
 #define PARENT_CLASS_CALL(method) (NCI_TRANSITION_CLASS(PARENT_CLASS)->method)
+#define THIS(obj) G_TYPE_CHECK_INSTANCE_CAST(obj, THIS_TYPE, \
+    NciTransitionIdleToDiscovery)
 
 GType THIS_TYPE NCI_INTERNAL;
 G_DEFINE_TYPE(NciTransitionIdleToDiscovery, nci_transition_idle_to_discovery,
@@ -150,6 +170,17 @@ typedef enum core_set_config_flags {
  * Implementation
  *==========================================================================*/
 
+static
+void
+nci_transition_idle_to_discovery_expected_config(
+    NciSm* sm,
+    NciSmConfig* config);
+
+static
+void
+nci_transition_idle_to_discovery_discover(
+    NciTransition* self);
+
 static
 gboolean
 nci_transition_idle_to_discovery_send_byte_array(
@@ -209,11 +240,10 @@ nci_transition_idle_to_discovery_discover_rsp(
 }
 
 static
-void
-nci_transition_idle_to_discovery_discover(
-    NciTransition* self)
+GBytes*
+nci_transition_idle_to_discovery_discover_payload(
+    NciSm* sm)
 {
-    NciSm* sm = nci_transition_sm(self);
     GByteArray* cmd = g_byte_array_sized_new(9);
     NCI_TECH techs = NCI_TECH_NONE;
     guint i;
@@ -321,7 +351,7 @@ nci_transition_idle_to_discovery_discover(
     techs &= sm->techs;
 
     /* Build the payload */
-    GDEBUG("%c RF_DISCOVER_CMD", DIR_OUT);
+    GDEBUG("RF_DISCOVER_CMD");
     g_byte_array_append(cmd, ARRAY_AND_SIZE(cmd_header));
     for (i = 0; i < G_N_ELEMENTS(tech_modes) && techs; i++) {
         const NciCoreTechMode* tm = tech_modes + i;
@@ -337,10 +367,7 @@ nci_transition_idle_to_discovery_discover(
             techs &= ~tm->tech;
         }
     }
-
-    nci_transition_idle_to_discovery_send_byte_array(self,
-        NCI_GID_RF, NCI_OID_RF_DISCOVER, cmd,
-        nci_transition_idle_to_discovery_discover_rsp);
+    return g_byte_array_free_to_bytes(cmd);
 }
 
 static
@@ -373,6 +400,7 @@ nci_transition_idle_to_discover_map_rsp(
          */
         if (len > 0 && pkt[0] == NCI_STATUS_OK) {
             GDEBUG("%c RF_DISCOVER_MAP_RSP ok", DIR_IN);
+            nci_sm_discover_map_applied(nci_transition_sm(self), TRUE);
             nci_transition_idle_to_discovery_discover(self);
         } else {
             if (len > 0) {
@@ -386,11 +414,10 @@ nci_transition_idle_to_discover_map_rsp(
 }
 
 static
-gboolean
-nci_transition_idle_to_discover_map(
-    NciTransition* self)
+GBytes*
+nci_transition_idle_to_discover_map_payload(
+    NciSm* sm)
 {
-    NciSm* sm = nci_transition_sm(self);
     GByteArray* cmd = g_byte_array_sized_new(22);
 
     /*
@@ -422,7 +449,7 @@ nci_transition_idle_to_discover_map(
      * NfcDep: Poll/Listen A/F
      */
 
-    GDEBUG("%c RF_DISCOVER_MAP_CMD", DIR_OUT);
+    GDEBUG("RF_DISCOVER_MAP_CMD");
     g_byte_array_append(cmd, ARRAY_AND_SIZE(cmd_header));
     if (sm->op_mode & NFC_OP_MODE_RW) {
         if (sm->techs & NCI_TECH_A_POLL) {
@@ -516,9 +543,62 @@ nci_transition_idle_to_discover_map(
         g_byte_array_append(cmd, ARRAY_AND_SIZE(entries));
     }
 
-    return nci_transition_idle_to_discovery_send_byte_array(self,
-        NCI_GID_RF, NCI_OID_RF_DISCOVER_MAP, cmd,
-        nci_transition_idle_to_discover_map_rsp);
+    return g_byte_array_free_to_bytes(cmd);
+}
+
+static
+void
+nci_transition_idle_to_discovery_update_payloads(
+    NciSm* sm)
+{
+    /*
+     * Both RF_DISCOVER_MAP_CMD and RF_DISCOVER_CMD payloads only depend
+     * on the enabled technologies and the operation mode. Rebuild them
+     * only when either of those changes.
+     */
+    if (!sm->discover_map || !sm->discover ||
+        sm->discovery_techs != sm->techs ||
+        sm->discovery_op_mode != sm->op_mode) {
+        GBytes* map = nci_transition_idle_to_discover_map_payload(sm);
+        GBytes* discover = nci_transition_idle_to_discovery_discover_payload(sm);
+
+        nci_sm_set_discovery_payloads(sm, map, discover);
+        g_bytes_unref(map);
+        g_bytes_unref(discover);
+    }
+}
+
+static
+void
+nci_transition_idle_to_discovery_discover(
+    NciTransition* self)
+{
+    NciSm* sm = nci_transition_sm(self);
+
+    nci_transition_idle_to_discovery_update_payloads(sm);
+    GDEBUG("%c RF_DISCOVER_CMD", DIR_OUT);
+    nci_transition_send_command(self, NCI_GID_RF, NCI_OID_RF_DISCOVER,
+        sm->discover, nci_transition_idle_to_discovery_discover_rsp);
+}
+
+static
+void
+nci_transition_idle_to_discover_map(
+    NciTransition* self)
+{
+    NciSm* sm = nci_transition_sm(self);
+
+    nci_transition_idle_to_discovery_update_payloads(sm);
+    if (sm->discover_map_applied) {
+        /* NFCC remembers the mapping until the next CORE_RESET */
+        GDEBUG("RF_DISCOVER_MAP is up to date");
+        nci_transition_idle_to_discovery_discover(self);
+    } else {
+        GDEBUG("%c RF_DISCOVER_MAP_CMD", DIR_OUT);
+        nci_transition_send_command(self, NCI_GID_RF,
+            NCI_OID_RF_DISCOVER_MAP, sm->discover_map,
+            nci_transition_idle_to_discover_map_rsp);
+    }
 }
 
 static
@@ -675,6 +755,32 @@ nci_transition_idle_to_discovery_mixed_routing_entries(
     nci_transition_idle_to_discovery_tech_routing_entries(sm, cmd);
 }
 
+static
+void
+nci_transition_idle_to_discovery_routing_done(
+    NciTransition* transition,
+    gboolean ok)
+{
+    NciTransitionIdleToDiscovery* self = THIS(transition);
+    NciSm* sm = nci_transition_sm(transition);
+
+    /*
+     * Remember what has worked for the current NFCC session (and
+     * forget what hasn't) so that the next time we could start with
+     * the right type of routing, or skip it altogether.
+     */
+    if (ok) {
+        nci_sm_set_routing(sm, self->routing_type, self->routing);
+    } else if (sm->routing_type == self->routing_type) {
+        nci_sm_set_routing(sm, NCI_NFCC_ROUTING_NONE, NULL);
+    }
+    if (self->routing) {
+        g_bytes_unref(self->routing);
+        self->routing = NULL;
+    }
+    self->routing_type = NCI_NFCC_ROUTING_NONE;
+}
+
 static
 void
 nci_transition_idle_to_discovery_last_set_routing_rsp(
@@ -694,10 +800,14 @@ nci_transition_idle_to_discovery_last_set_routing_rsp(
 
         if (len > 0 && pkt[0] == NCI_STATUS_OK) {
             GDEBUG("%c %s ok", DIR_IN, name);
-        } else if (len > 0) {
-            GDEBUG("%c %s error %u", DIR_IN, name, pkt[0]);
+            nci_transition_idle_to_discovery_routing_done(self, TRUE);
         } else {
-            GDEBUG("%c Broken %s", DIR_IN, name);
+            if (len > 0) {
+                GDEBUG("%c %s error %u", DIR_IN, name, pkt[0]);
+            } else {
+                GDEBUG("%c Broken %s", DIR_IN, name);
+            }
+            nci_transition_idle_to_discovery_routing_done(self, FALSE);
         }
         /* Ignore errors */
         nci_transition_idle_to_discover_map(self);
@@ -729,12 +839,16 @@ nci_transition_idle_to_discovery_last_protocol_routing_rsp(
 static
 void
 nci_transition_idle_to_discovery_set_routing(
-    NciTransition* self,
+    NciTransition* transition,
+    NCI_NFCC_ROUTING type,
     const char* name,
     void (*add_routing_entries)(NciSm* sm, GByteArray* cmd),
     NciTransitionResponseFunc rsp)
 {
+    NciTransitionIdleToDiscovery* self = THIS(transition);
+    NciSm* sm = nci_transition_sm(transition);
     GByteArray* cmd = g_byte_array_sized_new(64);
+    GBytes* bytes;
 
     /*
      * [NFCForum-TS-NCI-1.0]
@@ -760,11 +874,25 @@ nci_transition_idle_to_discovery_set_routing(
 
     GDEBUG("%c RF_SET_LISTEN_MODE_ROUTING_CMD (%s)", DIR_OUT, name);
     g_byte_array_append(cmd, ARRAY_AND_SIZE(cmd_header));
-    add_routing_entries(nci_transition_sm(self), cmd);
-
-    /* Takes ownership of the cmd array */
-    nci_transition_idle_to_discovery_send_byte_array(self,
-        NCI_GID_RF, NCI_OID_RF_SET_LISTEN_MODE_ROUTING, cmd, rsp);
+    add_routing_entries(sm, cmd);
+    bytes = g_byte_array_free_to_bytes(cmd);
+
+    if (sm->routing && sm->routing_type == type &&
+        g_bytes_equal(sm->routing, bytes)) {
+        /* NFCC already has this routing table */
+        GDEBUG("RF_SET_LISTEN_MODE_ROUTING (%s) is up to date", name);
+        g_bytes_unref(bytes);
+        nci_transition_idle_to_discover_map(transition);
+    } else {
+        /* Keep the payload until we know whether it worked */
+        if (self->routing) {
+            g_bytes_unref(self->routing);
+        }
+        self->routing = bytes;
+        self->routing_type = type;
+        nci_transition_send_command(transition, NCI_GID_RF,
+            NCI_OID_RF_SET_LISTEN_MODE_ROUTING, bytes, rsp);
+    }
 }
 
 static
@@ -789,6 +917,7 @@ nci_transition_idle_to_discovery_set_protocol_routing_rsp(
 
         if (len > 0 && pkt[0] == NCI_STATUS_OK) {
             GDEBUG("%c %s ok", DIR_IN, cmd);
+            nci_transition_idle_to_discovery_routing_done(self, TRUE);
             nci_transition_idle_to_discover_map(self);
         } else {
             if (len > 0) {
@@ -796,8 +925,10 @@ nci_transition_idle_to_discovery_set_protocol_routing_rsp(
             } else {
                 GDEBUG("%c Broken %s", DIR_IN, cmd);
             }
+            nci_transition_idle_to_discovery_routing_done(self, FALSE);
             /* Try technology based routing */
-            nci_transition_idle_to_discovery_set_routing(self, "Technology",
+            nci_transition_idle_to_discovery_set_routing(self,
+                NCI_NFCC_ROUTING_TECHNOLOGY_BASED, "Technology",
                 nci_transition_idle_to_discovery_tech_routing_entries,
                 nci_transition_idle_to_discovery_set_tech_routing_rsp);
         }
@@ -826,6 +957,7 @@ nci_transition_idle_to_discovery_set_mixed_routing_rsp(
 
         if (len > 0 && pkt[0] == NCI_STATUS_OK) {
             GDEBUG("%c %s ok", DIR_IN, cmd);
+            nci_transition_idle_to_discovery_routing_done(self, TRUE);
             nci_transition_idle_to_discover_map(self);
         } else {
             if (len > 0) {
@@ -833,8 +965,10 @@ nci_transition_idle_to_discovery_set_mixed_routing_rsp(
             } else {
                 GDEBUG("%c Broken %s", DIR_IN, cmd);
             }
+            nci_transition_idle_to_discovery_routing_done(self, FALSE);
             /* Try protocol based routing */
-            nci_transition_idle_to_discovery_set_routing(self, "Protocol",
+            nci_transition_idle_to_discovery_set_routing(self,
+                NCI_NFCC_ROUTING_PROTOCOL_BASED, "Protocol",
                 nci_transition_idle_to_discovery_protocol_routing_entries,
                 nci_transition_idle_to_discovery_set_protocol_routing_rsp);
         }
@@ -860,25 +994,40 @@ nci_transition_idle_to_discovery_configure_routing(
         ((sm->op_mode & NFC_OP_MODE_CE) ||
          (sm->op_mode & (NFC_OP_MODE_PEER|NFC_OP_MODE_LISTEN)) ==
          (NFC_OP_MODE_PEER|NFC_OP_MODE_LISTEN))) {
-        switch (sm->nfcc_routing &
+        const guint supported = sm->nfcc_routing &
             (NCI_NFCC_ROUTING_PROTOCOL_BASED |
-             NCI_NFCC_ROUTING_TECHNOLOGY_BASED)) {
+             NCI_NFCC_ROUTING_TECHNOLOGY_BASED);
+        guint type = supported;
+
+        /* Don't repeat the attempts which have failed before */
+        if (sm->routing_type && (sm->routing_type & supported) ==
+            sm->routing_type) {
+            type = sm->routing_type;
+        }
+
+        switch (type) {
         case NCI_NFCC_ROUTING_PROTOCOL_BASED |
             NCI_NFCC_ROUTING_TECHNOLOGY_BASED:
-            nci_transition_idle_to_discovery_set_routing(self, "Mixed",
+            nci_transition_idle_to_discovery_set_routing(self, type, "Mixed",
                 nci_transition_idle_to_discovery_mixed_routing_entries,
                 nci_transition_idle_to_discovery_set_mixed_routing_rsp);
             return;
         case NCI_NFCC_ROUTING_PROTOCOL_BASED:
-            nci_transition_idle_to_discovery_set_routing(self, "Protocol",
+            nci_transition_idle_to_discovery_set_routing(self, type,
+                "Protocol",
                 nci_transition_idle_to_discovery_protocol_routing_entries,
+                (supported & NCI_NFCC_ROUTING_TECHNOLOGY_BASED) ?
+                nci_transition_idle_to_discovery_set_protocol_routing_rsp :
                 nci_transition_idle_to_discovery_last_protocol_routing_rsp);
             return;
         case NCI_NFCC_ROUTING_TECHNOLOGY_BASED:
-            nci_transition_idle_to_discovery_set_routing(self, "Technology",
+            nci_transition_idle_to_discovery_set_routing(self, type,
+                "Technology",
                 nci_transition_idle_to_discovery_tech_routing_entries,
                 nci_transition_idle_to_discovery_set_tech_routing_rsp);
             return;
+        default:
+            break;
         }
     }
     nci_transition_idle_to_discover_map(self);
@@ -916,7 +1065,11 @@ nci_transition_idle_to_discovery_set_config_rsp(
         if (status == NCI_REQUEST_SUCCESS &&
             payload->size >= 2 &&
             payload->bytes[0] == NCI_STATUS_OK) {
+            NciSmConfig config;
+
             GDEBUG("%c CORE_SET_CONFIG_RSP ok", DIR_IN);
+            nci_transition_idle_to_discovery_expected_config(sm, &config);
+            nci_sm_config_validated(sm, &config);
         } else {
             GWARN("CORE_SET_CONFIG_CMD failed (continuing anyway)");
         }
@@ -1300,6 +1453,24 @@ nci_transition_idle_to_discovery_hb_ok(
     }
 }
 
+static
+void
+nci_transition_idle_to_discovery_expected_config(
+    NciSm* sm,
+    NciSmConfig* config)
+{
+    memset(config, 0, sizeof(*config));
+    config->la_sens_res_1 =
+        nci_transition_idle_to_discovery_la_sens_res_1_expected(sm);
+    config->la_sel_info =
+        nci_transition_idle_to_discovery_la_sel_info_expected(sm);
+    config->lf_protocol_type =
+        nci_transition_idle_to_discovery_lf_protocol_type_expected(sm);
+    config->la_nfcid1 =
+        nci_transition_idle_to_discovery_la_nfcid1_expected(sm);
+    config->li_a_hb = sm->li_a_hb;
+}
+
 static
 void
 nci_transition_idle_to_discovery_get_config_rsp(
@@ -1322,14 +1493,15 @@ nci_transition_idle_to_discovery_get_config_rsp(
             CORE_SET_CONFIG_LA_NFCID1 |
             CORE_SET_CONFIG_LI_A_HB |
             CORE_SET_CONFIG_LF_PROTOCOL_TYPE;
-        guint8 la_sens_res_1 =
-            nci_transition_idle_to_discovery_la_sens_res_1_expected(sm);
-        guint8 la_sel_info =
-            nci_transition_idle_to_discovery_la_sel_info_expected(sm);
-        guint8 lf_protocol_type =
-            nci_transition_idle_to_discovery_lf_protocol_type_expected(sm);
-        NciNfcid1 la_nfcid1 =
-            nci_transition_idle_to_discovery_la_nfcid1_expected(sm);
+        NciSmConfig config;
+        guint8 la_sens_res_1, la_sel_info, lf_protocol_type;
+        NciNfcid1 la_nfcid1;
+
+        nci_transition_idle_to_discovery_expected_config(sm, &config);
+        la_sens_res_1 = config.la_sens_res_1;
+        la_sel_info = config.la_sel_info;
+        lf_protocol_type = config.lf_protocol_type;
+        la_nfcid1 = config.la_nfcid1;
 
         /*
          * [NFCForum-TS-NCI-1.0]
@@ -1380,6 +1552,7 @@ nci_transition_idle_to_discovery_get_config_rsp(
                 }
                 if (!set_config) {
                     /* No need to set parameters */
+                    nci_sm_config_validated(sm, &config);
                     nci_transition_idle_to_discovery_configure_routing(self);
                     return;
                 }
@@ -1449,6 +1622,16 @@ nci_transition_idle_to_discovery_start(
     };
 
     if (PARENT_CLASS_CALL(start)(self)) {
+        NciSm* sm = nci_transition_sm(self);
+        NciSmConfig config;
+
+        /* Skip CORE_GET_CONFIG if nothing has changed since last time */
+        nci_transition_idle_to_discovery_expected_config(sm, &config);
+        if (nci_sm_config_cached(sm, &config)) {
+            nci_transition_idle_to_discovery_configure_routing(self);
+            return TRUE;
+        }
+
         GDEBUG("%c CORE_GET_CONFIG_CMD", DIR_OUT);
         return nci_transition_send_command_static(self,
             NCI_GID_CORE, NCI_OID_CORE_GET_CONFIG, ARRAY_AND_SIZE(cmd),
@@ -1461,6 +1644,19 @@ nci_transition_idle_to_discovery_start(
  * Internals
  *==========================================================================*/
 
+static
+void
+nci_transition_idle_to_discovery_finalize(
+    GObject* object)
+{
+    NciTransitionIdleToDiscovery* self = THIS(object);
+
+    if (self->routing) {
+        g_bytes_unref(self->routing);
+    }
+    G_OBJECT_CLASS(PARENT_CLASS)->finalize(object);
+}
+
 static
 void
 nci_transition_idle_to_discovery_init(
@@ -1473,7 +1669,9 @@ void
 nci_transition_idle_to_discovery_class_init(
     NciTransitionIdleToDiscoveryClass* klass)
 {
+    klass->type = NCI_CORE_TRANSITION_IDLE_TO_DISCOVERY;
     klass->start = nci_transition_idle_to_discovery_start;
+    G_OBJECT_CLASS(klass)->finalize = nci_transition_idle_to_discovery_finalize;
 }
 
 /*
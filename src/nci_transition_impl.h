@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2019-2024 Slava Monich <slava@monich.com>
+ * Copyright (C) 2019-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2020 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -46,6 +46,7 @@
 
 typedef struct nci_transition_class {
     GObjectClass parent;
+    NCI_CORE_TRANSITION type; /* NCI_CORE_TRANSITIONS if none of those */
     gboolean (*start)(NciTransition* self);
     void (*finished)(NciTransition* self);
     void (*handle_ntf)(NciTransition* self, guint8 gid, guint8 oid,
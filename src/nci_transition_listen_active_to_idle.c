@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2019-2024 Slava Monich <slava@monich.com>
+ * Copyright (C) 2019-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2020 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -267,6 +267,7 @@ void
 nci_transition_listen_active_to_idle_class_init(
     NciTransitionListenActiveToIdleClass* klass)
 {
+    klass->type = NCI_CORE_TRANSITION_LISTEN_ACTIVE_TO_IDLE;
     G_OBJECT_CLASS(klass)->finalize =
         nci_transition_listen_active_to_idle_finalize;
     klass->start = nci_transition_listen_active_to_idle_start;
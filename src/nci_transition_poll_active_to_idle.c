@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2019-2024 Slava Monich <slava@monich.com>
+ * Copyright (C) 2019-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2020 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -167,6 +167,7 @@ void
 nci_transition_poll_active_to_idle_class_init(
     NciTransitionPollActiveToIdleClass* klass)
 {
+    klass->type = NCI_CORE_TRANSITION_POLL_ACTIVE_TO_IDLE;
     klass->start = nci_transition_poll_active_to_idle_start;
     klass->handle_ntf = nci_transition_poll_active_to_idle_handle_ntf;
 }
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2019-2024 Slava Monich <slava@monich.com>
+ * Copyright (C) 2019-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2021 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -39,6 +39,7 @@
 
 #include "nci_transition_impl.h"
 #include "nci_util_p.h"
+#include "nci_layout.h"
 #include "nci_sar.h"
 #include "nci_sm.h"
 #include "nci_log.h"
@@ -243,6 +244,64 @@ nci_transition_reset_set_config(
     g_bytes_unref(cmd_bytes);
 }
 
+typedef struct nci_core_init_v1_rsp_view {
+    guint status;
+    const guint8* features;
+    GUtilData rf_interfaces;
+    guint max_logical_conns;
+    guint max_routing_table_size;
+    guint max_control_payload;
+    guint max_large_params;
+    guint manufacturer;
+    const guint8* manufacturer_info;
+} NciCoreInitV1RspView;
+
+static const NciField nci_core_init_v1_rsp_fields[] = {
+    NCI_FIELD(U8, NciCoreInitV1RspView, status),
+    NCI_FIELD_N(BYTES, 4, NciCoreInitV1RspView, features),
+    NCI_FIELD(DATA, NciCoreInitV1RspView, rf_interfaces),
+    NCI_FIELD(U8, NciCoreInitV1RspView, max_logical_conns),
+    NCI_FIELD(U16, NciCoreInitV1RspView, max_routing_table_size),
+    NCI_FIELD(U8, NciCoreInitV1RspView, max_control_payload),
+    NCI_FIELD(U16, NciCoreInitV1RspView, max_large_params),
+    NCI_FIELD(U8, NciCoreInitV1RspView, manufacturer),
+    NCI_FIELD_N(BYTES, 4, NciCoreInitV1RspView, manufacturer_info)
+};
+
+static const NciLayout nci_core_init_v1_rsp_layout =
+    NCI_LAYOUT("CORE_INIT_RSP (v1)", nci_core_init_v1_rsp_fields,
+        NCI_LAYOUT_EXACT);
+
+typedef struct nci_core_init_v2_rsp_view {
+    guint status;
+    const guint8* features;
+    guint max_logical_conns;
+    guint max_routing_table_size;
+    guint max_control_payload;
+    guint max_hci_payload;
+    guint hci_credits;
+    guint max_nfcv_frame;
+    guint rf_interface_count;
+    GUtilData rf_interfaces;
+} NciCoreInitV2RspView;
+
+static const NciField nci_core_init_v2_rsp_fields[] = {
+    NCI_FIELD(U8, NciCoreInitV2RspView, status),
+    NCI_FIELD_N(BYTES, 4, NciCoreInitV2RspView, features),
+    NCI_FIELD(U8, NciCoreInitV2RspView, max_logical_conns),
+    NCI_FIELD(U16, NciCoreInitV2RspView, max_routing_table_size),
+    NCI_FIELD(U8, NciCoreInitV2RspView, max_control_payload),
+    NCI_FIELD(U8, NciCoreInitV2RspView, max_hci_payload),
+    NCI_FIELD(U8, NciCoreInitV2RspView, hci_credits),
+    NCI_FIELD(U16, NciCoreInitV2RspView, max_nfcv_frame),
+    NCI_FIELD(U8, NciCoreInitV2RspView, rf_interface_count),
+    NCI_FIELD(REST, NciCoreInitV2RspView, rf_interfaces)
+};
+
+static const NciLayout nci_core_init_v2_rsp_layout =
+    NCI_LAYOUT("CORE_INIT_RSP (v2)", nci_core_init_v2_rsp_fields,
+        NCI_LAYOUT_FLAGS_NONE);
+
 static
 void
 nci_transition_reset_init_v1_rsp(
@@ -259,9 +318,7 @@ nci_transition_reset_init_v1_rsp(
         GDEBUG("%c CORE_INIT (v1) timed out", DIR_IN);
         nci_sm_error(sm);
     } else if (sar && status == NCI_REQUEST_SUCCESS) {
-        const guint8* pkt = payload->bytes;
-        const guint len = payload->size;
-        guint n; /* Number of Supported RF Interfaces */
+        NciCoreInitV1RspView rsp;
 
         /*
          * [NFCForum-TS-NCI-1.0]
@@ -284,11 +341,14 @@ nci_transition_reset_init_v1_rsp(
          * | 13 + n | 4    | Manufacturer Specific Information       |
          * +=========================================================+
          */
-        if (len >= 17 && pkt[0] == NCI_STATUS_OK &&
-            len == ((n = pkt[5]) + 17)) {
-            const guint8* rf_interfaces = pkt + 6;
-            guint8 max_logical_conns = pkt[6 + n];
-            guint8 max_control_payload = pkt[9 + n];
+        if (nci_layout_decode(&nci_core_init_v1_rsp_layout, payload->bytes,
+            payload->size, &rsp) && rsp.status == NCI_STATUS_OK) {
+            const guint8* rf_interfaces = rsp.rf_interfaces.bytes;
+            const guint n = rsp.rf_interfaces.size;
+            const guint8* features = rsp.features;
+            const guint8* info = rsp.manufacturer_info;
+            guint8 max_logical_conns = rsp.max_logical_conns;
+            guint8 max_control_payload = rsp.max_control_payload;
 
             if (sm->rf_interfaces) {
                 g_bytes_unref(sm->rf_interfaces);
@@ -298,14 +358,14 @@ nci_transition_reset_init_v1_rsp(
                 sm->rf_interfaces = g_bytes_new(rf_interfaces, n);
             }
 
-            sm->nfcc_discovery = pkt[1];
-            sm->nfcc_routing = pkt[2];
-            sm->nfcc_power = pkt[3];
-            sm->max_routing_table_size = ((guint)pkt[8 + n] << 8) + pkt[7 + n];
+            sm->nfcc_discovery = features[0];
+            sm->nfcc_routing = features[1];
+            sm->nfcc_power = features[2];
+            sm->max_routing_table_size = rsp.max_routing_table_size;
 
             GDEBUG("%c CORE_INIT_RSP (v1) ok", DIR_IN);
             GDEBUG("  Features = %02x %02x %02x %02x",
-                pkt[1], pkt[2], pkt[3], pkt[4]);
+                features[0], features[1], features[2], features[3]);
 #if GUTIL_LOG_DEBUG
             if (GLOG_ENABLED(GLOG_LEVEL_DEBUG)) {
                 GString* buf = g_string_new(NULL);
@@ -321,9 +381,9 @@ nci_transition_reset_init_v1_rsp(
             GDEBUG("  Max Logical Connections = %u", max_logical_conns);
             GDEBUG("  Max Routing Table Size = %u", sm->max_routing_table_size);
             GDEBUG("  Max Control Packet Size = %u", max_control_payload);
-            GDEBUG("  Manufacturer = 0x%02x", pkt[12 + n]);
+            GDEBUG("  Manufacturer = 0x%02x", rsp.manufacturer);
             GDEBUG("  Manufacturer Info = %02x %02x %02x %02x",
-                pkt[13 + n], pkt[14 + n], pkt[15 + n], pkt[16 + n]);
+                info[0], info[1], info[2], info[3]);
 
             nci_sar_set_max_logical_connections(sar, max_logical_conns);
             nci_sar_set_max_control_payload_size(sar, max_control_payload);
@@ -352,9 +412,7 @@ nci_transition_reset_init_v2_rsp(
     } else if (status == NCI_REQUEST_TIMEOUT) {
         GDEBUG("CORE_INIT (v2) timed out");
     } else if (sar && status == NCI_REQUEST_SUCCESS) {
-        const guint8* pkt = payload->bytes;
-        const guint len = payload->size;
-        guint n; /* Number of Supported RF Interfaces */
+        NciCoreInitV2RspView rsp;
 
         /*
          * NFC Controller Interface (NCI), Version 2.0, Section 4.2
@@ -380,10 +438,13 @@ nci_transition_reset_init_v2_rsp(
          * |        |      | Extensions | x | Supported extensions   |
          * +=========================================================+
          */
-        if (len >= 14 && pkt[0] == NCI_STATUS_OK &&
-            len >= (2 * (n = pkt[13]) + 14)) {
-            guint8 max_logical_conns = pkt[5];
-            guint8 max_control_payload = pkt[8];
+        if (nci_layout_decode(&nci_core_init_v2_rsp_layout, payload->bytes,
+            payload->size, &rsp) && rsp.status == NCI_STATUS_OK &&
+            rsp.rf_interfaces.size >= 2 * rsp.rf_interface_count) {
+            const guint n = rsp.rf_interface_count;
+            const guint8* features = rsp.features;
+            guint8 max_logical_conns = rsp.max_logical_conns;
+            guint8 max_control_payload = rsp.max_control_payload;
             guint i;
 
             if (sm->rf_interfaces) {
@@ -392,8 +453,8 @@ nci_transition_reset_init_v2_rsp(
             }
 
             if (n > 0) {
-                const guint8* ptr = pkt + 14;
-                const guint8* end = pkt + len;
+                const guint8* ptr = rsp.rf_interfaces.bytes;
+                const guint8* end = ptr + rsp.rf_interfaces.size;
                 GByteArray* ifs = g_byte_array_sized_new(n/2);
 
                 /* Respect both interface count and packet boundaries */
@@ -405,14 +466,14 @@ nci_transition_reset_init_v2_rsp(
                 sm->rf_interfaces = g_byte_array_free_to_bytes(ifs);
             }
 
-            sm->nfcc_discovery = pkt[1];
-            sm->nfcc_routing = pkt[2];
-            sm->nfcc_power = pkt[3];
-            sm->max_routing_table_size = ((guint)pkt[7] << 8) + pkt[6];
+            sm->nfcc_discovery = features[0];
+            sm->nfcc_routing = features[1];
+            sm->nfcc_power = features[2];
+            sm->max_routing_table_size = rsp.max_routing_table_size;
 
             GDEBUG("%c CORE_INIT_RSP (v2) ok", DIR_IN);
             GDEBUG("  Features = %02x %02x %02x %02x",
-                pkt[1], pkt[2], pkt[3], pkt[4]);
+                features[0], features[1], features[2], features[3]);
 #if GUTIL_LOG_DEBUG
             if (GLOG_ENABLED(GLOG_LEVEL_DEBUG)) {
                 GString* buf = g_string_new(NULL);
@@ -629,6 +690,9 @@ nci_transition_reset_start(
         sm->nfcc_discovery = NCI_NFCC_DISCOVERY_NONE;
         sm->nfcc_routing = NCI_NFCC_ROUTING_NONE;
         sm->nfcc_power = NCI_NFCC_POWER_NONE;
+        nci_sm_invalidate_config(sm);
+        nci_sm_set_routing(sm, NCI_NFCC_ROUTING_NONE, NULL);
+        nci_sm_discover_map_applied(sm, FALSE);
 
         GDEBUG("%c CORE_RESET_CMD", DIR_OUT);
         return nci_transition_send_command_static(self,
@@ -654,6 +718,7 @@ void
 nci_transition_reset_class_init(
     NciTransitionResetClass* klass)
 {
+    klass->type = NCI_CORE_TRANSITION_RESET;
     klass->start = nci_transition_reset_start;
     klass->handle_ntf = nci_transition_reset_handle_ntf;
 }
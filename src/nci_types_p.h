@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2018-2024 Slava Monich <slava@monich.com>
+ * Copyright (C) 2018-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2018-2020 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -44,6 +44,13 @@
 
 #define NCI_INTERNAL G_GNUC_INTERNAL
 
+/* Statistics can be compiled out with -DNCI_STATS=0 */
+#ifndef NCI_STATS
+#  define NCI_STATS 1
+#endif
+
+typedef struct nci_arena NciArena;
+typedef struct nci_id_cache NciIdCache;
 typedef struct nci_param NciParam;
 typedef struct nci_sar NciSar;
 typedef struct nci_sm NciSm;
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2019-2025 Slava Monich <slava@monich.com>
+ * Copyright (C) 2019-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2021 Jolla Ltd.
  * Copyright (C) 2020 Open Mobile Platform LLC.
  *
@@ -39,6 +39,7 @@
  */
 
 #include "nci_util_p.h"
+#include "nci_layout.h"
 #include "nci_log.h"
 
 #include <gutil_macros.h>
@@ -434,6 +435,26 @@ nci_parse_mode_param(
     return NULL;
 }
 
+typedef struct nci_discover_ntf_view {
+    guint discovery_id;
+    guint protocol;
+    guint mode;
+    GUtilData param;
+    guint type;
+} NciDiscoverNtfView;
+
+static const NciField nci_discover_ntf_fields[] = {
+    NCI_FIELD(U8, NciDiscoverNtfView, discovery_id),
+    NCI_FIELD(U8, NciDiscoverNtfView, protocol),
+    NCI_FIELD(U8, NciDiscoverNtfView, mode),
+    NCI_FIELD(DATA, NciDiscoverNtfView, param),
+    NCI_FIELD(U8, NciDiscoverNtfView, type)
+};
+
+static const NciLayout nci_discover_ntf_layout =
+    NCI_LAYOUT("RF_DISCOVER_NTF", nci_discover_ntf_fields,
+        NCI_LAYOUT_FLAGS_NONE);
+
 gboolean
 nci_parse_discover_ntf(
     NciDiscoveryNtf* ntf,
@@ -462,43 +483,43 @@ nci_parse_discover_ntf(
      * |        |      | 2 | More Notification to follow         |
      * +=========================================================+
      */
-    if (len >= 5) {
-        const guint n = pkt[3];
+    NciDiscoverNtfView view;
+
+    if (nci_layout_decode(&nci_discover_ntf_layout, pkt, len, &view)) {
+        const guint n = view.param.size;
 
-        if (len >= 5 + n) {
-            ntf->discovery_id = pkt[0];
-            ntf->protocol = pkt[1];
-            ntf->mode = pkt[2];
-            ntf->param_len = n;
-            ntf->param_bytes = n ? (pkt + 4) : NULL;
-            ntf->last = (pkt[4 + n] != 2 /* More to follow */);
+        ntf->discovery_id = view.discovery_id;
+        ntf->protocol = view.protocol;
+        ntf->mode = view.mode;
+        ntf->param_len = n;
+        ntf->param_bytes = view.param.bytes;
+        ntf->last = (view.type != 2 /* More to follow */);
 
 #if GUTIL_LOG_DEBUG
-            GDEBUG("RF_DISCOVER_NTF%s", ntf->last ? " (Last)" : "");
-            GDEBUG("  RF Discovery ID = 0x%02x", ntf->discovery_id);
-            GDEBUG("  RF Protocol = 0x%02x", ntf->protocol);
-            GDEBUG("  Activation RF Mode = 0x%02x", ntf->mode);
-            if (n && GLOG_ENABLED(GLOG_LEVEL_DEBUG)) {
-                const guint8* bytes = ntf->param_bytes;
-                GString* buf = g_string_new(NULL);
-                guint i;
+        GDEBUG("RF_DISCOVER_NTF%s", ntf->last ? " (Last)" : "");
+        GDEBUG("  RF Discovery ID = 0x%02x", ntf->discovery_id);
+        GDEBUG("  RF Protocol = 0x%02x", ntf->protocol);
+        GDEBUG("  Activation RF Mode = 0x%02x", ntf->mode);
+        if (n && GLOG_ENABLED(GLOG_LEVEL_DEBUG)) {
+            const guint8* bytes = ntf->param_bytes;
+            GString* buf = g_string_new(NULL);
+            guint i;
 
-                for (i = 0; i < n; i++) {
-                    g_string_append_printf(buf, " %02x", bytes[i]);
-                }
-                GDEBUG("  RF Tech Parameters =%s", buf->str);
-                g_string_free(buf, TRUE);
+            for (i = 0; i < n; i++) {
+                g_string_append_printf(buf, " %02x", bytes[i]);
             }
+            GDEBUG("  RF Tech Parameters =%s", buf->str);
+            g_string_free(buf, TRUE);
+        }
 #endif /* GUTIL_LOG_DEBUG */
 
-            if (ntf->param_bytes && param) {
-                ntf->param = nci_parse_mode_param(param, ntf->mode,
-                    ntf->param_bytes, n);
-            } else {
-                ntf->param = NULL;
-            }
-            return TRUE;
+        if (ntf->param_bytes && param) {
+            ntf->param = nci_parse_mode_param(param, ntf->mode,
+                ntf->param_bytes, n);
+        } else {
+            ntf->param = NULL;
         }
+        return TRUE;
     }
     GDEBUG("Failed to parse RF_DISCOVER_NTF");
     return FALSE;
@@ -756,6 +777,70 @@ nci_parse_iso_dep_listen_b_param(
     return FALSE;
 }
 
+typedef struct nci_nfc_dep_param_view {
+    GUtilData atr;
+} NciNfcDepParamView;
+
+typedef struct nci_atr_res_view {
+    const guint8* nfcid3;
+    guint did;
+    guint bs;
+    guint br;
+    guint to;
+    guint pp;
+    GUtilData g;
+} NciAtrResView;
+
+typedef struct nci_atr_req_view {
+    const guint8* nfcid3;
+    guint did;
+    guint bs;
+    guint br;
+    guint pp;
+    GUtilData g;
+} NciAtrReqView;
+
+static const NciField nci_nfc_dep_poll_param_fields[] = {
+    NCI_FIELD_N(DATA, 15, NciNfcDepParamView, atr)
+};
+
+static const NciLayout nci_nfc_dep_poll_param_layout =
+    NCI_LAYOUT("NFC-DEP Poll", nci_nfc_dep_poll_param_fields,
+        NCI_LAYOUT_FLAGS_NONE);
+
+static const NciField nci_atr_res_fields[] = {
+    NCI_FIELD_N(BYTES, 10, NciAtrResView, nfcid3),
+    NCI_FIELD(U8, NciAtrResView, did),
+    NCI_FIELD(U8, NciAtrResView, bs),
+    NCI_FIELD(U8, NciAtrResView, br),
+    NCI_FIELD(U8, NciAtrResView, to),
+    NCI_FIELD(U8, NciAtrResView, pp),
+    NCI_FIELD(REST, NciAtrResView, g)
+};
+
+static const NciLayout nci_atr_res_layout =
+    NCI_LAYOUT("ATR_RES", nci_atr_res_fields, NCI_LAYOUT_FLAGS_NONE);
+
+static const NciField nci_nfc_dep_listen_param_fields[] = {
+    NCI_FIELD_N(DATA, 14, NciNfcDepParamView, atr)
+};
+
+static const NciLayout nci_nfc_dep_listen_param_layout =
+    NCI_LAYOUT("NFC-DEP Listen", nci_nfc_dep_listen_param_fields,
+        NCI_LAYOUT_FLAGS_NONE);
+
+static const NciField nci_atr_req_fields[] = {
+    NCI_FIELD_N(BYTES, 10, NciAtrReqView, nfcid3),
+    NCI_FIELD(U8, NciAtrReqView, did),
+    NCI_FIELD(U8, NciAtrReqView, bs),
+    NCI_FIELD(U8, NciAtrReqView, br),
+    NCI_FIELD(U8, NciAtrReqView, pp),
+    NCI_FIELD(REST, NciAtrReqView, g)
+};
+
+static const NciLayout nci_atr_req_layout =
+    NCI_LAYOUT("ATR_REQ", nci_atr_req_fields, NCI_LAYOUT_FLAGS_NONE);
+
 static
 gboolean
 nci_parse_nfc_dep_poll_param(
@@ -763,8 +848,8 @@ nci_parse_nfc_dep_poll_param(
     const guint8* bytes,
     guint len)
 {
-    /* ATR_RES Length */
-    const guint8 atr_res_len = bytes[0];
+    NciNfcDepParamView view;
+    NciAtrResView atr_res;
 
     /*
      * [NFCForum-TS-NCI-1.0]
@@ -777,23 +862,20 @@ nci_parse_nfc_dep_poll_param(
      * | 1      | n    | ATR_RES bytes from and including Byte 3 |
      * +=========================================================+
      */
-    if (atr_res_len >= 15 && len >= atr_res_len + 1) {
-        const guint8* atr_res = bytes + 1;
-
+    if (nci_layout_decode(&nci_nfc_dep_poll_param_layout, bytes, len,
+        &view) && nci_layout_decode(&nci_atr_res_layout, view.atr.bytes,
+        view.atr.size, &atr_res)) {
         /*
          * [NFCForum-TS-DigitalProtocol-1.0]
          * 14.6.3 ATR_RES Response
          */
-        memcpy(param->nfcid3, atr_res, sizeof(param->nfcid3));
-        param->did = atr_res[10];
-        param->bs = atr_res[11];
-        param->br = atr_res[12];
-        param->to = atr_res[13];
-        param->pp = atr_res[14];
-        if (atr_res_len > 15) {
-            param->g.bytes = atr_res + 15;
-            param->g.size = atr_res_len - 15;
-        }
+        memcpy(param->nfcid3, atr_res.nfcid3, sizeof(param->nfcid3));
+        param->did = atr_res.did;
+        param->bs = atr_res.bs;
+        param->br = atr_res.br;
+        param->to = atr_res.to;
+        param->pp = atr_res.pp;
+        param->g = atr_res.g;
 #if GUTIL_LOG_DEBUG
         if (GLOG_ENABLED(GLOG_LEVEL_DEBUG)) {
             GString* buf = g_string_new(NULL);
@@ -829,8 +911,8 @@ nci_parse_nfc_dep_listen_param(
     const guint8* bytes,
     guint len)
 {
-    /* ATR_REQ Length */
-    const guint8 atr_req_len = bytes[0];
+    NciNfcDepParamView view;
+    NciAtrReqView atr_req;
 
     /*
      * [NFCForum-TS-NCI-1.0]
@@ -843,22 +925,19 @@ nci_parse_nfc_dep_listen_param(
      * | 1      | n    | ATR_REQ bytes from and including Byte 3 |
      * +=========================================================+
      */
-    if (atr_req_len >= 14 && len >= atr_req_len + 1) {
-        const guint8* atr_req = bytes + 1;
-
+    if (nci_layout_decode(&nci_nfc_dep_listen_param_layout, bytes, len,
+        &view) && nci_layout_decode(&nci_atr_req_layout, view.atr.bytes,
+        view.atr.size, &atr_req)) {
         /*
          * [NFCForum-TS-DigitalProtocol-1.0]
          * 14.6.2 ATR_REQ Command
          */
-        memcpy(param->nfcid3, atr_req, sizeof(param->nfcid3));
-        param->did = atr_req[10];
-        param->bs = atr_req[11];
-        param->br = atr_req[12];
-        param->pp = atr_req[13];
-        if (atr_req_len > 14) {
-            param->g.bytes = atr_req + 14;
-            param->g.size = atr_req_len - 14;
-        }
+        memcpy(param->nfcid3, atr_req.nfcid3, sizeof(param->nfcid3));
+        param->did = atr_req.did;
+        param->bs = atr_req.bs;
+        param->br = atr_req.br;
+        param->pp = atr_req.pp;
+        param->g = atr_req.g;
 #if GUTIL_LOG_DEBUG
         if (GLOG_ENABLED(GLOG_LEVEL_DEBUG)) {
             GString* buf = g_string_new(NULL);
@@ -977,6 +1056,38 @@ nci_parse_activation_param(
     return NULL;
 }
 
+typedef struct nci_intf_activated_ntf_view {
+    guint discovery_id;
+    guint rf_intf;
+    guint protocol;
+    guint mode;
+    guint max_data_packet_size;
+    guint num_credits;
+    GUtilData mode_param;
+    guint data_exchange_mode;
+    guint transmit_rate;
+    guint receive_rate;
+    GUtilData activation_param;
+} NciIntfActivatedNtfView;
+
+static const NciField nci_intf_activated_ntf_fields[] = {
+    NCI_FIELD(U8, NciIntfActivatedNtfView, discovery_id),
+    NCI_FIELD(U8, NciIntfActivatedNtfView, rf_intf),
+    NCI_FIELD(U8, NciIntfActivatedNtfView, protocol),
+    NCI_FIELD(U8, NciIntfActivatedNtfView, mode),
+    NCI_FIELD(U8, NciIntfActivatedNtfView, max_data_packet_size),
+    NCI_FIELD(U8, NciIntfActivatedNtfView, num_credits),
+    NCI_FIELD(DATA, NciIntfActivatedNtfView, mode_param),
+    NCI_FIELD(U8, NciIntfActivatedNtfView, data_exchange_mode),
+    NCI_FIELD(U8, NciIntfActivatedNtfView, transmit_rate),
+    NCI_FIELD(U8, NciIntfActivatedNtfView, receive_rate),
+    NCI_FIELD(DATA, NciIntfActivatedNtfView, activation_param)
+};
+
+static const NciLayout nci_intf_activated_ntf_layout =
+    NCI_LAYOUT("RF_INTF_ACTIVATED_NTF", nci_intf_activated_ntf_fields,
+        NCI_LAYOUT_FLAGS_NONE);
+
 gboolean
 nci_parse_intf_activated_ntf(
     NciIntfActivationNtf* ntf,
@@ -1010,90 +1121,117 @@ nci_parse_intf_activated_ntf(
      * +=========================================================+
      */
 
+    NciIntfActivatedNtfView view;
+
     memset(ntf, 0, sizeof(*ntf));
-    if (len > 6) {
-        const guint n = pkt[6];
-        const guint m = (len > (10 + n)) ? pkt[10 + n] : 0;
-
-        if (len >= 11 + n + m) {
-            ntf->discovery_id = pkt[0];
-            ntf->rf_intf = pkt[1];
-            ntf->protocol = pkt[2];
-            ntf->mode = pkt[3];
-            ntf->max_data_packet_size = pkt[4];
-            ntf->num_credits = pkt[5];
-            if ((ntf->mode_param_len = n) > 0) {
-                ntf->mode_param_bytes = pkt + 7;
-            }
-            ntf->data_exchange_mode = pkt[7 + n];
-            ntf->transmit_rate = pkt[8 + n];
-            ntf->receive_rate = pkt[9 + n];
-            if ((ntf->activation_param_len = m) > 0) {
-                ntf->activation_param_bytes = pkt + (11 + n);
-            }
+    if (nci_layout_decode(&nci_intf_activated_ntf_layout, pkt, len, &view)) {
+        const guint n = view.mode_param.size;
+        const guint m = view.activation_param.size;
+
+        ntf->discovery_id = view.discovery_id;
+        ntf->rf_intf = view.rf_intf;
+        ntf->protocol = view.protocol;
+        ntf->mode = view.mode;
+        ntf->max_data_packet_size = view.max_data_packet_size;
+        ntf->num_credits = view.num_credits;
+        ntf->mode_param_len = n;
+        ntf->mode_param_bytes = view.mode_param.bytes;
+        ntf->data_exchange_mode = view.data_exchange_mode;
+        ntf->transmit_rate = view.transmit_rate;
+        ntf->receive_rate = view.receive_rate;
+        ntf->activation_param_len = m;
+        ntf->activation_param_bytes = view.activation_param.bytes;
 
 #if GUTIL_LOG_DEBUG
-            GDEBUG("RF_INTF_ACTIVATED_NTF");
-            GDEBUG("  RF Discovery ID = 0x%02x", ntf->discovery_id);
-            GDEBUG("  RF Interface = 0x%02x", ntf->rf_intf);
-            if (ntf->rf_intf != NCI_RF_INTERFACE_NFCEE_DIRECT) {
-                GDEBUG("  RF Protocol = 0x%02x", ntf->protocol);
-                GDEBUG("  Activation RF Mode = 0x%02x", ntf->mode);
-                GDEBUG("  Max Data Packet Size = %u",
-                    ntf->max_data_packet_size);
-                GDEBUG("  Initial Credits = %u", ntf->num_credits);
-                if (n || m) {
-                    if (GLOG_ENABLED(GLOG_LEVEL_DEBUG)) {
-                        GString* buf = g_string_new(NULL);
-                        guint i;
-
-                        if (ntf->mode_param_len) {
-                            const guint8* bytes = ntf->mode_param_bytes;
-
-                            for (i = 0; i < ntf->mode_param_len; i++) {
-                                g_string_append_printf(buf, " %02x", bytes[i]);
-                            }
-                            GDEBUG("  RF Tech Parameters =%s", buf->str);
-                        }
-                        GDEBUG("  Data Exchange RF Tech = 0x%02x",
-                            ntf->data_exchange_mode);
-                        if (ntf->activation_param_len) {
-                            const guint8* bytes = ntf->activation_param_bytes;
-
-                            g_string_set_size(buf, 0);
-                            for (i = 0; i < ntf->activation_param_len; i++) {
-                                g_string_append_printf(buf, " %02x", bytes[i]);
-                            }
-                            GDEBUG("  Activation Parameters =%s", buf->str);
+        GDEBUG("RF_INTF_ACTIVATED_NTF");
+        GDEBUG("  RF Discovery ID = 0x%02x", ntf->discovery_id);
+        GDEBUG("  RF Interface = 0x%02x", ntf->rf_intf);
+        if (ntf->rf_intf != NCI_RF_INTERFACE_NFCEE_DIRECT) {
+            GDEBUG("  RF Protocol = 0x%02x", ntf->protocol);
+            GDEBUG("  Activation RF Mode = 0x%02x", ntf->mode);
+            GDEBUG("  Max Data Packet Size = %u",
+                ntf->max_data_packet_size);
+            GDEBUG("  Initial Credits = %u", ntf->num_credits);
+            if (n || m) {
+                if (GLOG_ENABLED(GLOG_LEVEL_DEBUG)) {
+                    GString* buf = g_string_new(NULL);
+                    guint i;
+
+                    if (ntf->mode_param_len) {
+                        const guint8* bytes = ntf->mode_param_bytes;
+
+                        for (i = 0; i < ntf->mode_param_len; i++) {
+                            g_string_append_printf(buf, " %02x", bytes[i]);
                         }
-                        g_string_free(buf, TRUE);
+                        GDEBUG("  RF Tech Parameters =%s", buf->str);
                     }
-                } else {
                     GDEBUG("  Data Exchange RF Tech = 0x%02x",
                         ntf->data_exchange_mode);
+                    if (ntf->activation_param_len) {
+                        const guint8* bytes = ntf->activation_param_bytes;
+
+                        g_string_set_size(buf, 0);
+                        for (i = 0; i < ntf->activation_param_len; i++) {
+                            g_string_append_printf(buf, " %02x", bytes[i]);
+                        }
+                        GDEBUG("  Activation Parameters =%s", buf->str);
+                    }
+                    g_string_free(buf, TRUE);
                 }
+            } else {
+                GDEBUG("  Data Exchange RF Tech = 0x%02x",
+                    ntf->data_exchange_mode);
             }
+        }
 #endif /* GUTIL_LOG_DEBUG */
 
-            if (ntf->mode_param_bytes) {
-                memset(mp, 0, sizeof(*mp));
-                ntf->mode_param = nci_parse_mode_param(mp, ntf->mode,
-                    ntf->mode_param_bytes, ntf->mode_param_len);
-            }
+        if (ntf->mode_param_bytes) {
+            memset(mp, 0, sizeof(*mp));
+            ntf->mode_param = nci_parse_mode_param(mp, ntf->mode,
+                ntf->mode_param_bytes, ntf->mode_param_len);
+        }
 
-            if (ntf->activation_param_bytes) {
-                memset(ap, 0, sizeof(*ap));
-                ntf->activation_param = nci_parse_activation_param(ap,
-                    ntf->rf_intf, ntf->mode, ntf->activation_param_bytes,
-                    ntf->activation_param_len);
-            }
-            return TRUE;
+        if (ntf->activation_param_bytes) {
+            memset(ap, 0, sizeof(*ap));
+            ntf->activation_param = nci_parse_activation_param(ap,
+                ntf->rf_intf, ntf->mode, ntf->activation_param_bytes,
+                ntf->activation_param_len);
         }
+        return TRUE;
     }
     GDEBUG("Failed to parse RF_INTF_ACTIVATED_NTF");
     return FALSE;
 }
 
+typedef struct nci_activation_priv {
+    NciActivation pub;
+    NciModeParam mode_param;
+    NciActivationParam activation_param;
+    gint ref_count; /* Atomic, may be shared between threads */
+} NciActivationPriv;
+
+NciActivation*
+nci_activation_new(
+    const guint8* pkt,
+    guint len)
+{
+    /* The raw payload follows the parsed structures */
+    NciActivationPriv* priv = g_malloc(sizeof(NciActivationPriv) + len);
+    NciActivation* act = &priv->pub;
+    guint8* raw = (guint8*)(priv + 1);
+
+    memcpy(raw, pkt, len);
+    if (nci_parse_intf_activated_ntf(&act->ntf, &priv->mode_param,
+        &priv->activation_param, raw, len)) {
+        act->raw.bytes = raw;
+        act->raw.size = len;
+        priv->ref_count = 1;
+        return act;
+    }
+    g_free(priv);
+    return NULL;
+}
+
 static
 gsize
 nci_mode_param_copy_impl(
@@ -1152,6 +1290,20 @@ nci_mode_param_copy_impl(
     return 0;
 }
 
+typedef struct nci_rf_deactivate_ntf_view {
+    guint type;
+    guint reason;
+} NciRfDeactivateNtfView;
+
+static const NciField nci_rf_deactivate_ntf_fields[] = {
+    NCI_FIELD(U8, NciRfDeactivateNtfView, type),
+    NCI_FIELD(U8, NciRfDeactivateNtfView, reason)
+};
+
+static const NciLayout nci_rf_deactivate_ntf_layout =
+    NCI_LAYOUT("RF_DEACTIVATE_NTF", nci_rf_deactivate_ntf_fields,
+        NCI_LAYOUT_FLAGS_NONE);
+
 gboolean
 nci_parse_rf_deactivate_ntf(
     NciRfDeactivateNtf* ntf,
@@ -1170,9 +1322,12 @@ nci_parse_rf_deactivate_ntf(
      * | 1      | 1    | Deactivation Reason                     |
      * +=========================================================+
      */
-    if (pkt->size >= 2) {
-        const guint8 type = pkt->bytes[0];
-        const guint8 reason = pkt->bytes[1];
+    NciRfDeactivateNtfView view;
+
+    if (nci_layout_decode(&nci_rf_deactivate_ntf_layout, pkt->bytes,
+        pkt->size, &view)) {
+        const guint type = view.type;
+        const guint reason = view.reason;
 
         switch (type) {
         case NCI_DEACTIVATE_TYPE_IDLE:
@@ -1248,58 +1403,75 @@ nci_mode_param_size(
     return size;
 }
 
-NciDiscoveryNtf*
-nci_discovery_ntf_copy_array(
+static
+gsize
+nci_discovery_ntf_copy_size(
     const NciDiscoveryNtf* const* ntfs,
     guint count)
 {
-    if (G_LIKELY(count)) {
-        guint i;
-        gsize size = G_ALIGN8(sizeof(NciDiscoveryNtf)*count);
-        NciDiscoveryNtf* copy;
-        guint8* ptr;
+    gsize size = G_ALIGN8(sizeof(NciDiscoveryNtf)*count);
+    guint i;
 
-        /* Calculate total size */
-        for (i = 0; i < count; i++) {
-            const NciDiscoveryNtf* src = ntfs[i];
+    for (i = 0; i < count; i++) {
+        const NciDiscoveryNtf* src = ntfs[i];
 
-            if (src->param_len) {
-                size += G_ALIGN8(src->param_len);
-                if (src->param) {
-                    size += G_ALIGN8(nci_mode_param_size(src->param,
-                        src->mode));
-                }
+        if (src->param_len) {
+            size += G_ALIGN8(src->param_len);
+            if (src->param) {
+                size += G_ALIGN8(nci_mode_param_size(src->param, src->mode));
             }
         }
+    }
+    return size;
+}
 
-        /* Deep copy of NciDiscoveryNtf */
-        copy = g_malloc0(size);
-        ptr = (void*)copy;
-        ptr += G_ALIGN8(sizeof(NciDiscoveryNtf)*count);
-        for (i = 0; i < count; i++) {
-            const NciDiscoveryNtf* src = ntfs[i];
-            NciDiscoveryNtf* dest = copy + i;
-
-            *dest = *src;
-            if (src->param_len) {
-                dest->param_bytes = ptr;
-                memcpy(ptr, src->param_bytes, src->param_len);
-                ptr += G_ALIGN8(src->param_len);
-                if (src->param) {
-                    NciModeParam* dest_param = (NciModeParam*)ptr;
-                    const gsize copied = nci_mode_param_copy_impl(dest_param,
-                        src->param, src->mode);
-
-                    if (copied) {
-                        dest->param = dest_param;
-                        ptr += G_ALIGN8(copied);
-                    } else {
-                        GWARN("ModeParam is not NULL but non copyable");
-                        dest->param = NULL;
-                    }
+/* Deep copy of NciDiscoveryNtf into zeroed memory of the right size */
+static
+void
+nci_discovery_ntf_copy_to(
+    NciDiscoveryNtf* copy,
+    const NciDiscoveryNtf* const* ntfs,
+    guint count)
+{
+    guint8* ptr = ((guint8*)copy) + G_ALIGN8(sizeof(NciDiscoveryNtf)*count);
+    guint i;
+
+    for (i = 0; i < count; i++) {
+        const NciDiscoveryNtf* src = ntfs[i];
+        NciDiscoveryNtf* dest = copy + i;
+
+        *dest = *src;
+        if (src->param_len) {
+            dest->param_bytes = ptr;
+            memcpy(ptr, src->param_bytes, src->param_len);
+            ptr += G_ALIGN8(src->param_len);
+            if (src->param) {
+                NciModeParam* dest_param = (NciModeParam*)ptr;
+                const gsize copied = nci_mode_param_copy_impl(dest_param,
+                    src->param, src->mode);
+
+                if (copied) {
+                    dest->param = dest_param;
+                    ptr += G_ALIGN8(copied);
+                } else {
+                    GWARN("ModeParam is not NULL but non copyable");
+                    dest->param = NULL;
                 }
             }
         }
+    }
+}
+
+NciDiscoveryNtf*
+nci_discovery_ntf_copy_array(
+    const NciDiscoveryNtf* const* ntfs,
+    guint count)
+{
+    if (G_LIKELY(count)) {
+        NciDiscoveryNtf* copy = g_malloc0(nci_discovery_ntf_copy_size(ntfs,
+            count));
+
+        nci_discovery_ntf_copy_to(copy, ntfs, count);
         /* The result can be deallocated with a single g_free call */
         return copy;
     } else {
@@ -1318,6 +1490,334 @@ nci_discovery_ntf_copy(
     }
 }
 
+/* The copy stays valid until the arena is reset */
+const NciDiscoveryNtf*
+nci_discovery_ntf_arena_copy(
+    NciArena* arena,
+    const NciDiscoveryNtf* ntf)
+{
+    if (G_LIKELY(arena) && G_LIKELY(ntf)) {
+        NciDiscoveryNtf* copy = nci_arena_alloc0(arena,
+            nci_discovery_ntf_copy_size(&ntf, 1));
+
+        nci_discovery_ntf_copy_to(copy, &ntf, 1);
+        return copy;
+    } else {
+        return NULL;
+    }
+}
+
+/* Arena is a list of blocks, allocations are made from the first one */
+typedef struct nci_arena_block NciArenaBlock;
+struct nci_arena_block {
+    NciArenaBlock* next;
+    gsize size; /* Usable size */
+};
+
+struct nci_arena {
+    NciArenaBlock* block; /* The current one, followed by the full ones */
+    gsize used; /* In the current block */
+    gsize block_size;
+};
+
+#define NCI_ARENA_BLOCK_HEADER G_ALIGN8(sizeof(NciArenaBlock))
+
+static
+NciArenaBlock*
+nci_arena_block_new(
+    gsize size)
+{
+    NciArenaBlock* block = g_malloc(NCI_ARENA_BLOCK_HEADER + size);
+
+    block->next = NULL;
+    block->size = size;
+    return block;
+}
+
+NciArena*
+nci_arena_new(
+    gsize block_size)
+{
+    NciArena* arena = g_slice_new0(NciArena);
+
+    arena->block_size = G_ALIGN8(MAX(block_size, 1));
+    return arena;
+}
+
+void
+nci_arena_free(
+    NciArena* arena)
+{
+    if (G_LIKELY(arena)) {
+        while (arena->block) {
+            NciArenaBlock* block = arena->block;
+
+            arena->block = block->next;
+            g_free(block);
+        }
+        g_slice_free(NciArena, arena);
+    }
+}
+
+gpointer
+nci_arena_alloc0(
+    NciArena* arena,
+    gsize size)
+{
+    if (G_LIKELY(arena)) {
+        NciArenaBlock* block = arena->block;
+        guint8* ptr;
+
+        size = G_ALIGN8(size);
+        if (!block || arena->used + size > block->size) {
+            NciArenaBlock* full = block;
+
+            /* Oversized allocations get a block of their own */
+            block = nci_arena_block_new(MAX(size, arena->block_size));
+            block->next = full;
+            arena->block = block;
+            arena->used = 0;
+        }
+        ptr = ((guint8*)block) + NCI_ARENA_BLOCK_HEADER + arena->used;
+        arena->used += size;
+        memset(ptr, 0, size);
+        return ptr;
+    }
+    return NULL;
+}
+
+void
+nci_arena_reset(
+    NciArena* arena)
+{
+    if (G_LIKELY(arena)) {
+        NciArenaBlock* block = arena->block;
+
+        if (block && block->next) {
+            gsize total = 0;
+
+            /* Replace the blocks with a single one big enough for all */
+            while (block) {
+                NciArenaBlock* next = block->next;
+
+                total += block->size;
+                g_free(block);
+                block = next;
+            }
+            arena->block = nci_arena_block_new(total);
+        }
+        arena->used = 0;
+    }
+}
+
+gboolean
+nci_mode_param_id(
+    NCI_MODE mode,
+    const NciModeParam* param,
+    GUtilData* id)
+{
+    if (param) {
+        switch (mode) {
+        case NCI_MODE_PASSIVE_POLL_A:
+        case NCI_MODE_ACTIVE_POLL_A:
+            if (param->poll_a.nfcid1_len) {
+                id->bytes = param->poll_a.nfcid1;
+                id->size = param->poll_a.nfcid1_len;
+                return TRUE;
+            }
+            break;
+        case NCI_MODE_PASSIVE_POLL_B:
+            id->bytes = param->poll_b.nfcid0;
+            id->size = sizeof(param->poll_b.nfcid0);
+            return TRUE;
+        case NCI_MODE_PASSIVE_POLL_F:
+        case NCI_MODE_ACTIVE_POLL_F:
+            id->bytes = param->poll_f.nfcid2;
+            id->size = sizeof(param->poll_f.nfcid2);
+            return TRUE;
+        case NCI_MODE_PASSIVE_POLL_V:
+            id->bytes = param->poll_v.uid;
+            id->size = sizeof(param->poll_v.uid);
+            return TRUE;
+        case NCI_MODE_PASSIVE_LISTEN_A:
+        case NCI_MODE_PASSIVE_LISTEN_B:
+        case NCI_MODE_PASSIVE_LISTEN_F:
+        case NCI_MODE_ACTIVE_LISTEN_A:
+        case NCI_MODE_ACTIVE_LISTEN_F:
+        case NCI_MODE_PASSIVE_LISTEN_V:
+            break;
+        }
+    }
+    return FALSE;
+}
+
+guint
+nci_intf_activation_key(
+    const NciIntfActivationNtf* ntf,
+    guint8* key)
+{
+    GUtilData id;
+
+    /* Target id followed by FNV-1a hash of the activation parameters */
+    if (G_LIKELY(ntf) && nci_mode_param_id(ntf->mode, ntf->mode_param, &id) &&
+        id.size + 4 <= NCI_ID_CACHE_MAX_ID) {
+        const guint8* ptr = ntf->activation_param_bytes;
+        guint32 hash = 0x811c9dc5;
+        guint i;
+
+        hash = (hash ^ ntf->rf_intf) * 0x01000193;
+        hash = (hash ^ ntf->protocol) * 0x01000193;
+        hash = (hash ^ ntf->mode) * 0x01000193;
+        for (i = 0; i < ntf->activation_param_len; i++) {
+            hash = (hash ^ ptr[i]) * 0x01000193;
+        }
+        memcpy(key, id.bytes, id.size);
+        key[id.size] = (guint8)(hash >> 24);
+        key[id.size + 1] = (guint8)(hash >> 16);
+        key[id.size + 2] = (guint8)(hash >> 8);
+        key[id.size + 3] = (guint8)hash;
+        return id.size + 4;
+    }
+    return 0;
+}
+
+typedef struct nci_id_cache_entry {
+    gint64 time;
+    guint8 len;
+    guint8 id[NCI_ID_CACHE_MAX_ID];
+} NciIdCacheEntry;
+
+struct nci_id_cache {
+    guint size;
+    guint count;
+    NciIdCacheEntry* entries;
+};
+
+/* Linear search is fine, the cache is expected to be small */
+static
+NciIdCacheEntry*
+nci_id_cache_find(
+    NciIdCache* cache,
+    const GUtilData* id)
+{
+    if (id->size <= NCI_ID_CACHE_MAX_ID) {
+        guint i;
+
+        for (i = 0; i < cache->count; i++) {
+            NciIdCacheEntry* entry = cache->entries + i;
+
+            if (entry->len == id->size &&
+                !memcmp(entry->id, id->bytes, id->size)) {
+                return entry;
+            }
+        }
+    }
+    return NULL;
+}
+
+NciIdCache*
+nci_id_cache_new(
+    guint size)
+{
+    if (G_LIKELY(size)) {
+        NciIdCache* cache = g_slice_new0(NciIdCache);
+
+        cache->size = size;
+        cache->entries = g_new0(NciIdCacheEntry, size);
+        return cache;
+    }
+    return NULL;
+}
+
+void
+nci_id_cache_free(
+    NciIdCache* cache)
+{
+    if (G_LIKELY(cache)) {
+        g_free(cache->entries);
+        g_slice_free(NciIdCache, cache);
+    }
+}
+
+gint64
+nci_id_cache_lookup(
+    NciIdCache* cache,
+    const GUtilData* id)
+{
+    if (G_LIKELY(cache) && G_LIKELY(id)) {
+        const NciIdCacheEntry* entry = nci_id_cache_find(cache, id);
+
+        if (entry) {
+            return entry->time;
+        }
+    }
+    return 0;
+}
+
+gint64
+nci_id_cache_update(
+    NciIdCache* cache,
+    const GUtilData* id,
+    gint64 now)
+{
+    if (G_LIKELY(cache) && G_LIKELY(id) && id->size &&
+        id->size <= NCI_ID_CACHE_MAX_ID) {
+        NciIdCacheEntry* entry = nci_id_cache_find(cache, id);
+        gint64 prev = 0;
+
+        if (entry) {
+            prev = entry->time;
+        } else if (cache->count < cache->size) {
+            entry = cache->entries + (cache->count++);
+        } else {
+            guint i;
+
+            /* Replace the least recently seen one */
+            entry = cache->entries;
+            for (i = 1; i < cache->count; i++) {
+                if (cache->entries[i].time < entry->time) {
+                    entry = cache->entries + i;
+                }
+            }
+        }
+        entry->time = now;
+        entry->len = (guint8)id->size;
+        memcpy(entry->id, id->bytes, id->size);
+        return prev;
+    }
+    return 0;
+}
+
+/*
+ * Bucket n counts the samples which are at least 2^n but less than
+ * 2^(n+1) microseconds long, the first and the last ones are open.
+ */
+guint
+nci_time_bucket(
+    guint64 usec,
+    guint nbuckets)
+{
+    guint bucket = 0;
+
+    while (bucket + 1 < nbuckets && (usec >> (bucket + 1))) {
+        bucket++;
+    }
+    return bucket;
+}
+
+void
+nci_time_histogram_add(
+    NciTimeHistogram* hist,
+    guint64 usec)
+{
+    hist->count++;
+    hist->total += usec;
+    if (hist->max < usec) {
+        hist->max = usec;
+    }
+    hist->bucket[nci_time_bucket(usec, NCI_TIME_BUCKETS)]++;
+}
+
 /* Free the result with g_free() */
 NciModeParam*
 nci_util_copy_mode_param(
@@ -1488,6 +1988,33 @@ nci_util_copy_activation_param(
     return NULL;
 }
 
+NciActivation*
+nci_util_activation_ref(
+    NciActivation* act) /* Since 1.1.34 */
+{
+    if (G_LIKELY(act)) {
+        NciActivationPriv* priv = G_CAST(act, NciActivationPriv, pub);
+
+        GASSERT(g_atomic_int_get(&priv->ref_count) > 0);
+        g_atomic_int_inc(&priv->ref_count);
+    }
+    return act;
+}
+
+void
+nci_util_activation_unref(
+    NciActivation* act) /* Since 1.1.34 */
+{
+    if (G_LIKELY(act)) {
+        NciActivationPriv* priv = G_CAST(act, NciActivationPriv, pub);
+
+        GASSERT(g_atomic_int_get(&priv->ref_count) > 0);
+        if (g_atomic_int_dec_and_test(&priv->ref_count)) {
+            g_free(priv);
+        }
+    }
+}
+
 /*
  * Local Variables:
  * mode: C
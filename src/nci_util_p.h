@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2019-2025 Slava Monich <slava@monich.com>
+ * Copyright (C) 2019-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2021 Jolla Ltd.
  * Copyright (C) 2020 Open Mobile Platform LLC.
  *
@@ -114,6 +114,13 @@ nci_parse_intf_activated_ntf(
     guint len)
     NCI_INTERNAL;
 
+/* Parses RF_INTF_ACTIVATED_NTF into a new NciActivation */
+NciActivation*
+nci_activation_new(
+    const guint8* pkt,
+    guint len)
+    NCI_INTERNAL;
+
 gboolean
 nci_parse_rf_deactivate_ntf(
     NciRfDeactivateNtf* ntf,
@@ -131,6 +138,105 @@ nci_discovery_ntf_copy(
     const NciDiscoveryNtf* ntf)
     NCI_INTERNAL;
 
+const NciDiscoveryNtf*
+nci_discovery_ntf_arena_copy(
+    NciArena* arena,
+    const NciDiscoveryNtf* ntf)
+    NCI_INTERNAL;
+
+/*
+ * Bump allocator for short-lived data. Memory is allocated in blocks
+ * and released all at once by nci_arena_reset(). After the reset, the
+ * arena keeps a single block, large enough to hold everything which
+ * was allocated since the previous reset.
+ */
+
+NciArena*
+nci_arena_new(
+    gsize block_size)
+    NCI_INTERNAL;
+
+void
+nci_arena_free(
+    NciArena* arena)
+    NCI_INTERNAL;
+
+/* Returns zeroed 8-byte aligned memory */
+gpointer
+nci_arena_alloc0(
+    NciArena* arena,
+    gsize size)
+    NCI_INTERNAL;
+
+void
+nci_arena_reset(
+    NciArena* arena)
+    NCI_INTERNAL;
+
+/* Identifies the remote target in poll mode */
+gboolean
+nci_mode_param_id(
+    NCI_MODE mode,
+    const NciModeParam* param,
+    GUtilData* id)
+    NCI_INTERNAL;
+
+/*
+ * Identifies the remote target together with its activation parameters.
+ * Returns the key length (at most NCI_ID_CACHE_MAX_ID bytes) or zero if
+ * the target can't be identified.
+ */
+guint
+nci_intf_activation_key(
+    const NciIntfActivationNtf* ntf,
+    guint8* key)
+    NCI_INTERNAL;
+
+/*
+ * Fixed size cache of target ids (up to NCI_ID_CACHE_MAX_ID bytes long)
+ * with the time when each id was last seen. When the cache is full, the
+ * least recently seen id gets replaced.
+ */
+
+#define NCI_ID_CACHE_MAX_ID (16)
+
+NciIdCache*
+nci_id_cache_new(
+    guint size)
+    NCI_INTERNAL;
+
+void
+nci_id_cache_free(
+    NciIdCache* cache)
+    NCI_INTERNAL;
+
+/* Returns zero if the id is not in the cache */
+gint64
+nci_id_cache_lookup(
+    NciIdCache* cache,
+    const GUtilData* id)
+    NCI_INTERNAL;
+
+/* Returns the previous time (or zero if the id is new) */
+gint64
+nci_id_cache_update(
+    NciIdCache* cache,
+    const GUtilData* id,
+    gint64 now)
+    NCI_INTERNAL;
+
+guint
+nci_time_bucket(
+    guint64 usec,
+    guint nbuckets)
+    NCI_INTERNAL;
+
+void
+nci_time_histogram_add(
+    NciTimeHistogram* hist,
+    guint64 usec)
+    NCI_INTERNAL;
+
 #endif /* NCI_UTIL_PRIVATE_H */
 
 /*
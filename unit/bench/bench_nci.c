@@ -0,0 +1,708 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the names of the copyright holders nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test_common.h"
+#include "test_nfcc.h"
+
+#include "nci_types_p.h"
+#include "nci_core_p.h"
+#include "nci_sar.h"
+#include "nci_sm.h"
+#include "nci_util_p.h"
+#include "nci_version.h"
+
+#include <gutil_macros.h>
+#include <gutil_log.h>
+
+/*
+ * Prints results as a JSON object, one entry per measurement:
+ *
+ * {
+ *   "version": "1.1.33",
+ *   "benchmarks": [
+ *     { "name": "sar_rx", "mode": "read", "chunk": 1, ... },
+ *     ...
+ *   ]
+ * }
+ *
+ * Numbers are meant to be compared between runs on the same machine.
+ */
+
+static TestOpt bench_opt;
+static guint bench_count;
+
+#define BENCH_NS(t0,t1,n) (((t1) - (t0)) * 1000.0 / MAX(n, 1))
+
+static
+void
+bench_result(
+    const char* name,
+    const char* format,
+    ...) G_GNUC_PRINTF(2,3);
+
+static
+void
+bench_result(
+    const char* name,
+    const char* format,
+    ...)
+{
+    va_list va;
+
+    printf("%s\n    { \"name\": \"%s\", ", bench_count ? "," : "", name);
+    va_start(va, format);
+    vprintf(format, va);
+    va_end(va);
+    printf(" }");
+    fflush(stdout);
+    bench_count++;
+}
+
+/*==========================================================================*
+ * HAL
+ *
+ * Completes writes synchronously from bench_hal_pump() and optionally
+ * replies to every command with a successful response.
+ *==========================================================================*/
+
+typedef struct bench_hal {
+    NciHalIo io;
+    NciHalClient* client;
+    NciHalClientFunc complete;
+    gboolean respond;
+    gboolean rsp_pending;
+    guint8 rsp[4];
+    guint writes;
+    guint64 bytes;
+} BenchHal;
+
+static
+gboolean
+bench_hal_start(
+    NciHalIo* io,
+    NciHalClient* client)
+{
+    BenchHal* hal = G_CAST(io, BenchHal, io);
+
+    hal->client = client;
+    return TRUE;
+}
+
+static
+void
+bench_hal_stop(
+    NciHalIo* io)
+{
+    BenchHal* hal = G_CAST(io, BenchHal, io);
+
+    hal->client = NULL;
+    hal->complete = NULL;
+    hal->rsp_pending = FALSE;
+}
+
+static
+gboolean
+bench_hal_write(
+    NciHalIo* io,
+    const GUtilData* chunks,
+    guint count,
+    NciHalClientFunc complete)
+{
+    BenchHal* hal = G_CAST(io, BenchHal, io);
+    const guint8* hdr = chunks[0].bytes;
+    guint i;
+
+    g_assert(!hal->complete);
+    for (i = 0; i < count; i++) {
+        hal->bytes += chunks[i].size;
+    }
+    if (hal->respond && (hdr[0] & NCI_MT_MASK) == NCI_MT_CMD_PKT) {
+        hal->rsp[0] = NCI_MT_RSP_PKT | (hdr[0] & 0x0f);
+        hal->rsp[1] = hdr[1] & 0x3f;
+        hal->rsp[2] = 1;
+        hal->rsp[3] = NCI_STATUS_OK;
+        hal->rsp_pending = TRUE;
+    }
+    hal->complete = complete;
+    hal->writes++;
+    return TRUE;
+}
+
+static
+void
+bench_hal_cancel_write(
+    NciHalIo* io)
+{
+    G_CAST(io, BenchHal, io)->complete = NULL;
+}
+
+static
+void
+bench_hal_init(
+    BenchHal* hal,
+    gboolean respond)
+{
+    static const NciHalIoFunctions bench_hal_fn = {
+        .start = bench_hal_start,
+        .stop = bench_hal_stop,
+        .write = bench_hal_write,
+        .cancel_write = bench_hal_cancel_write
+    };
+
+    memset(hal, 0, sizeof(*hal));
+    hal->io.fn = &bench_hal_fn;
+    hal->respond = respond;
+}
+
+/* Runs until there's nothing left to do */
+static
+void
+bench_hal_pump(
+    BenchHal* hal)
+{
+    for (;;) {
+        if (hal->complete) {
+            NciHalClientFunc complete = hal->complete;
+
+            hal->complete = NULL;
+            complete(hal->client, TRUE);
+        } else if (hal->rsp_pending) {
+            hal->rsp_pending = FALSE;
+            hal->client->fn->read(hal->client, hal->rsp, sizeof(hal->rsp));
+        } else if (!g_main_context_iteration(NULL, FALSE)) {
+            break;
+        }
+    }
+}
+
+/*==========================================================================*
+ * SAR client
+ *==========================================================================*/
+
+typedef struct bench_sar_client {
+    NciSarClient client;
+    guint packets;
+    guint64 bytes;
+} BenchSarClient;
+
+static
+void
+bench_sar_client_error(
+    NciSarClient* client)
+{
+    g_assert_not_reached();
+}
+
+static
+void
+bench_sar_client_handle_packet(
+    NciSarClient* client,
+    guint8 gid,
+    guint8 oid,
+    const void* payload,
+    guint len)
+{
+    BenchSarClient* self = G_CAST(client, BenchSarClient, client);
+
+    self->packets++;
+    self->bytes += len;
+}
+
+static
+void
+bench_sar_client_handle_data_packet(
+    NciSarClient* client,
+    guint8 cid,
+    const void* payload,
+    guint len)
+{
+    BenchSarClient* self = G_CAST(client, BenchSarClient, client);
+
+    self->packets++;
+    self->bytes += len;
+}
+
+static
+void
+bench_sar_client_handle_data_bytes(
+    NciSarClient* client,
+    guint8 cid,
+    GBytes* payload)
+{
+    BenchSarClient* self = G_CAST(client, BenchSarClient, client);
+
+    self->packets++;
+    self->bytes += g_bytes_get_size(payload);
+}
+
+static
+void
+bench_sar_client_init(
+    BenchSarClient* self)
+{
+    static const NciSarClientFunctions bench_sar_client_fn = {
+        .error = bench_sar_client_error,
+        .handle_response = bench_sar_client_handle_packet,
+        .handle_notification = bench_sar_client_handle_packet,
+        .handle_data_packet = bench_sar_client_handle_data_packet,
+        .handle_data_bytes = bench_sar_client_handle_data_bytes
+    };
+
+    memset(self, 0, sizeof(*self));
+    self->client.fn = &bench_sar_client_fn;
+}
+
+/*==========================================================================*
+ * sar_rx
+ *
+ * Inbound stream of full size data packets, fed to SAR in chunks of
+ * various sizes, through both read and read_bytes.
+ *==========================================================================*/
+
+#define BENCH_SAR_RX_PACKETS (1000)
+#define BENCH_SAR_RX_PAYLOAD (0xff)
+#define BENCH_SAR_RX_TOTAL (16 * 1024 * 1024)
+
+static
+void
+bench_sar_rx_run(
+    const guint8* stream,
+    gsize size,
+    guint chunk,
+    gboolean bytes_mode)
+{
+    const guint passes = MAX(BENCH_SAR_RX_TOTAL / size, 1);
+    BenchHal hal;
+    BenchSarClient client;
+    NciSar* sar;
+    gint64 t0, t1;
+    guint i;
+
+    bench_hal_init(&hal, FALSE);
+    bench_sar_client_init(&client);
+    sar = nci_sar_new(&hal.io, &client.client);
+    nci_sar_set_data_bytes(sar, bytes_mode);
+    g_assert(nci_sar_start(sar));
+
+    t0 = g_get_monotonic_time();
+    for (i = 0; i < passes; i++) {
+        gsize off = 0;
+
+        while (off < size) {
+            const guint n = MIN(chunk, size - off);
+
+            if (bytes_mode) {
+                GBytes* bytes = g_bytes_new_static(stream + off, n);
+
+                nci_hal_client_read_bytes(hal.client, bytes);
+                g_bytes_unref(bytes);
+            } else {
+                hal.client->fn->read(hal.client, stream + off, n);
+            }
+            off += n;
+        }
+    }
+    t1 = g_get_monotonic_time();
+
+    g_assert_cmpuint(client.packets, == ,passes * BENCH_SAR_RX_PACKETS);
+    bench_result("sar_rx", "\"mode\": \"%s\", \"chunk\": %u, "
+        "\"packets\": %u, \"bytes\": %" G_GUINT64_FORMAT ", "
+        "\"usec\": %" G_GINT64_FORMAT ", \"ns_per_packet\": %.1f, "
+        "\"mb_per_sec\": %.2f", bytes_mode ? "read_bytes" : "read",
+        chunk, client.packets, (guint64)size * passes, t1 - t0,
+        BENCH_NS(t0, t1, client.packets),
+        (gdouble)size * passes / MAX(t1 - t0, 1));
+    nci_sar_free(sar);
+}
+
+static
+void
+bench_sar_rx(
+    void)
+{
+    static const guint chunks[] = { 1, 3, 16, 64, 258, 1024, 4096 };
+    const gsize pkt_size = 3 + BENCH_SAR_RX_PAYLOAD; /* NCI_HDR_SIZE */
+    const gsize size = pkt_size * BENCH_SAR_RX_PACKETS;
+    guint8* stream = g_malloc(size);
+    guint i;
+
+    for (i = 0; i < BENCH_SAR_RX_PACKETS; i++) {
+        guint8* pkt = stream + pkt_size * i;
+
+        pkt[0] = NCI_MT_DATA_PKT | NCI_STATIC_RF_CONN_ID;
+        pkt[1] = 0;
+        pkt[2] = BENCH_SAR_RX_PAYLOAD;
+        memset(pkt + 3, i, BENCH_SAR_RX_PAYLOAD);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(chunks); i++) {
+        bench_sar_rx_run(stream, size, chunks[i], FALSE);
+        bench_sar_rx_run(stream, size, chunks[i], TRUE);
+    }
+    bench_sar_rx_run(stream, size, size, FALSE);
+    bench_sar_rx_run(stream, size, size, TRUE);
+    g_free(stream);
+}
+
+/*==========================================================================*
+ * sar_tx
+ *
+ * Outbound segmentation of the same message at every possible data
+ * payload limit. Credits are unlimited, writes complete immediately.
+ *==========================================================================*/
+
+#define BENCH_SAR_TX_MESSAGES (2000)
+#define BENCH_SAR_TX_SIZE (1024)
+
+static
+void
+bench_sar_tx_complete(
+    NciSarClient* client,
+    gboolean success,
+    gpointer user_data)
+{
+    g_assert(success);
+    (*((guint*)user_data))++;
+}
+
+static
+void
+bench_sar_tx(
+    void)
+{
+    guint8* msg = g_malloc0(BENCH_SAR_TX_SIZE);
+    guint limit;
+
+    for (limit = 1; limit <= 0xff; limit++) {
+        BenchHal hal;
+        BenchSarClient client;
+        NciSar* sar;
+        guint i, done = 0, writes;
+        gint64 t0, t1;
+
+        bench_hal_init(&hal, FALSE);
+        bench_sar_client_init(&client);
+        sar = nci_sar_new(&hal.io, &client.client);
+        nci_sar_set_max_data_payload_size(sar, limit);
+        nci_sar_set_initial_credits(sar, NCI_STATIC_RF_CONN_ID, 0xff);
+        g_assert(nci_sar_start(sar));
+
+        t0 = g_get_monotonic_time();
+        for (i = 0; i < BENCH_SAR_TX_MESSAGES; i++) {
+            g_assert(nci_sar_send_data_buf(sar, NCI_STATIC_RF_CONN_ID,
+                msg, BENCH_SAR_TX_SIZE, bench_sar_tx_complete, NULL, &done));
+        }
+        bench_hal_pump(&hal);
+        t1 = g_get_monotonic_time();
+
+        writes = hal.writes;
+        g_assert_cmpuint(done, == ,BENCH_SAR_TX_MESSAGES);
+        g_assert_cmpuint(writes, == ,BENCH_SAR_TX_MESSAGES *
+            ((BENCH_SAR_TX_SIZE + limit - 1) / limit));
+        bench_result("sar_tx", "\"limit\": %u, \"message\": %u, "
+            "\"messages\": %u, \"segments\": %u, \"usec\": %"
+            G_GINT64_FORMAT ", \"ns_per_message\": %.1f, "
+            "\"ns_per_segment\": %.1f", limit, BENCH_SAR_TX_SIZE,
+            BENCH_SAR_TX_MESSAGES, writes, t1 - t0,
+            BENCH_NS(t0, t1, BENCH_SAR_TX_MESSAGES),
+            BENCH_NS(t0, t1, writes));
+        nci_sar_free(sar);
+    }
+    g_free(msg);
+}
+
+/*==========================================================================*
+ * cmd_roundtrip
+ *
+ * Command => response through the state machine I/O interface, i.e.
+ * nci_core_io_send() with its command queue and timeout handling.
+ * Repeated with the packet trace enabled to show what it costs.
+ *==========================================================================*/
+
+#define BENCH_CMD_ROUNDTRIPS (100000)
+
+static
+void
+bench_cmd_roundtrip_resp(
+    NCI_REQUEST_STATUS status,
+    const GUtilData* payload,
+    gpointer user_data)
+{
+    g_assert_cmpint(status, == ,NCI_REQUEST_SUCCESS);
+    (*((guint*)user_data))++;
+}
+
+static
+void
+bench_cmd_roundtrip(
+    const char* name,
+    gsize trace_size)
+{
+    static const guint8 cmd[] = { 0x01, NCI_CONFIG_TOTAL_DURATION };
+    GBytes* payload = g_bytes_new_static(cmd, sizeof(cmd));
+    BenchHal hal;
+    NciCore* nci;
+    NciSmIo* io;
+    guint i, done = 0;
+    gint64 t0, t1;
+
+    bench_hal_init(&hal, TRUE);
+    nci = nci_core_new(&hal.io);
+    nci_core_set_trace_size(nci, trace_size);
+    io = nci_core_sm(nci)->io;
+
+    t0 = g_get_monotonic_time();
+    for (i = 0; i < BENCH_CMD_ROUNDTRIPS; i++) {
+        g_assert(io->send(io, NCI_GID_CORE, NCI_OID_CORE_GET_CONFIG, payload,
+            bench_cmd_roundtrip_resp, &done));
+        bench_hal_pump(&hal);
+    }
+    t1 = g_get_monotonic_time();
+
+    g_assert_cmpuint(done, == ,BENCH_CMD_ROUNDTRIPS);
+    bench_result(name, "\"commands\": %u, \"usec\": %"
+        G_GINT64_FORMAT ", \"ns_per_command\": %.1f", done, t1 - t0,
+        BENCH_NS(t0, t1, done));
+    nci_core_free(nci);
+    g_bytes_unref(payload);
+}
+
+/*==========================================================================*
+ * reset_discovery
+ *
+ * CORE_RESET all the way to RFST_DISCOVERY against the virtual NFCC.
+ * Simulated time only depends on the NFCC latencies and the number
+ * of round trips, the wall clock time is what it costs to get there.
+ *==========================================================================*/
+
+#define BENCH_RESET_DISCOVERY_RUNS (1000)
+
+typedef struct bench_reset_discovery {
+    GMainLoop* loop;
+} BenchResetDiscovery;
+
+static
+void
+bench_reset_discovery_state_changed(
+    NciCore* nci,
+    void* user_data)
+{
+    BenchResetDiscovery* test = user_data;
+
+    if (nci->current_state == NCI_RFST_DISCOVERY) {
+        g_main_loop_quit(test->loop);
+    }
+}
+
+static
+void
+bench_reset_discovery_run(
+    const char* name,
+    const TestNfccConfig* config)
+{
+    BenchResetDiscovery test;
+    guint64 sim_time = 0;
+    guint i, commands = 0;
+    gint64 t0, t1;
+
+    test.loop = g_main_loop_new(NULL, TRUE);
+    t0 = g_get_monotonic_time();
+    for (i = 0; i < BENCH_RESET_DISCOVERY_RUNS; i++) {
+        TestNfcc* nfcc = test_nfcc_new(config);
+        NciCore* nci = nci_core_new(test_nfcc_io(nfcc));
+        gulong id = nci_core_add_current_state_changed_handler(nci,
+            bench_reset_discovery_state_changed, &test);
+
+        nci_core_set_op_mode(nci, NFC_OP_MODE_RW | NFC_OP_MODE_POLL);
+        nci_core_set_state(nci, NCI_RFST_DISCOVERY);
+        test_run_loop(&bench_opt, test.loop);
+        g_assert_cmpint(nci->current_state, == ,NCI_RFST_DISCOVERY);
+
+        /* Every run is the same, remember the last one */
+        sim_time = test_nfcc_time(nfcc);
+        commands = test_nfcc_stats(nfcc)->commands;
+        nci_core_remove_handler(nci, id);
+        nci_core_free(nci);
+        test_nfcc_free(nfcc);
+    }
+    t1 = g_get_monotonic_time();
+
+    bench_result("reset_discovery", "\"nfcc\": \"%s\", \"runs\": %u, "
+        "\"commands\": %u, \"sim_usec\": %" G_GUINT64_FORMAT ", "
+        "\"usec\": %" G_GINT64_FORMAT ", \"ns_per_run\": %.1f", name,
+        BENCH_RESET_DISCOVERY_RUNS, commands, sim_time, t1 - t0,
+        BENCH_NS(t0, t1, BENCH_RESET_DISCOVERY_RUNS));
+    g_main_loop_unref(test.loop);
+}
+
+static
+void
+bench_reset_discovery(
+    void)
+{
+    static const TestNfccConfig nci_1 = {
+        TEST_NFCC_NCI_1, 1000, 500, 100000, 2000, 0xff, 1, FALSE
+    };
+    static const TestNfccConfig nci_2 = {
+        TEST_NFCC_NCI_2, 500, 100, 50000, 1000, 0x80, 2, FALSE
+    };
+
+    bench_reset_discovery_run("nci_1", &nci_1);
+    bench_reset_discovery_run("nci_2", &nci_2);
+}
+
+/*==========================================================================*
+ * intf_activated
+ *==========================================================================*/
+
+#define BENCH_INTF_ACTIVATED_PARSES (1000000)
+
+typedef struct bench_intf_activated_ntf {
+    const char* name;
+    GUtilData data;
+} BenchIntfActivatedNtf;
+
+static const guint8 bench_intf_activated_ntf_mifare[] = {
+    0x01, 0x80, 0x80, 0x00, 0xff, 0x01, 0x0c, 0x44,
+    0x00, 0x07, 0x04, 0x47, 0x8a, 0x92, 0x7f, 0x51,
+    0x80, 0x01, 0x08, 0x00, 0x00, 0x00, 0x00
+};
+static const guint8 bench_intf_activated_ntf_isodep_poll_a[] = {
+    0x01, 0x02, 0x04, 0x00, 0xff, 0x01, 0x09, 0x04,
+    0x00, 0x04, 0x08, 0x46, 0x91, 0xde, 0x01, 0x20,
+    0x00, 0x00, 0x00, 0x14, 0x13, 0x78, 0x77, 0x95,
+    0x02, 0x80, 0x31, 0xb8, 0x65, 0xb0, 0x85, 0x03,
+    0x00, 0xef, 0x12, 0x00, 0xf6, 0x82, 0x90, 0x00
+};
+static const guint8 bench_intf_activated_ntf_isodep_poll_b[] = {
+    0x01, 0x02, 0x04, 0x01, 0xff, 0x01, 0x0c, 0x0b,
+    0xdb, 0xa2, 0xa2, 0x2b, 0x52, 0x74, 0x4d, 0x43,
+    0x00, 0x81, 0xc1, 0x01, 0x00, 0x00, 0x05, 0x04,
+    0x00, 0x01, 0x02, 0x03
+};
+static const guint8 bench_intf_activated_ntf_isodep_listen_a[] = {
+    0x01, 0x02, 0x04, 0x81, 0xff, 0x01, 0x01, 0x00,
+    0x81, 0x00, 0x00, 0x0c, 0x0b, 0x64, 0x84, 0x7c,
+    0x9c, 0x00, 0x05, 0x01, 0x00, 0x01, 0x02, 0x03
+};
+static const guint8 bench_intf_activated_ntf_nfcdep_poll_a[] = {
+    0x01, 0x03, 0x05, 0x00, 0xfb, 0x01, 0x09, 0x08,
+    0x00, 0x04, 0x08, 0x50, 0xad, 0x0e, 0x01, 0x40,
+    0x00, 0x02, 0x02, 0x21, 0x20, 0xc2, 0x40, 0x83,
+    0x1b, 0xe1, 0x22, 0x5d, 0xfe, 0xb7, 0xe9, 0x00,
+    0x00, 0x00, 0x0e, 0x32, 0x46, 0x66, 0x6d, 0x01,
+    0x01, 0x11, 0x02, 0x02, 0x07, 0xff, 0x03, 0x02,
+    0x00, 0x03, 0x04, 0x01, 0xff
+};
+static const guint8 bench_intf_activated_ntf_nfcdep_listen_f[] = {
+    0x01, 0x03, 0x05, 0x83, 0xfb, 0x01, 0x00, 0x83,
+    0x00, 0x00, 0x20, 0x1f, 0xc5, 0x47, 0xe4, 0x98,
+    0x4d, 0x88, 0x04, 0xb4, 0x92, 0xe5, 0x00, 0x00,
+    0x00, 0x32, 0x46, 0x66, 0x6d, 0x01, 0x01, 0x11,
+    0x02, 0x02, 0x07, 0xff, 0x03, 0x02, 0x00, 0x13,
+    0x04, 0x01, 0xff
+};
+
+static
+void
+bench_intf_activated(
+    void)
+{
+    static const BenchIntfActivatedNtf ntfs[] = {
+        { "mifare", { TEST_ARRAY_AND_SIZE
+            (bench_intf_activated_ntf_mifare) } },
+        { "isodep_poll_a", { TEST_ARRAY_AND_SIZE
+            (bench_intf_activated_ntf_isodep_poll_a) } },
+        { "isodep_poll_b", { TEST_ARRAY_AND_SIZE
+            (bench_intf_activated_ntf_isodep_poll_b) } },
+        { "isodep_listen_a", { TEST_ARRAY_AND_SIZE
+            (bench_intf_activated_ntf_isodep_listen_a) } },
+        { "nfcdep_poll_a", { TEST_ARRAY_AND_SIZE
+            (bench_intf_activated_ntf_nfcdep_poll_a) } },
+        { "nfcdep_listen_f", { TEST_ARRAY_AND_SIZE
+            (bench_intf_activated_ntf_nfcdep_listen_f) } }
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(ntfs); i++) {
+        const BenchIntfActivatedNtf* ntf = ntfs + i;
+        const guint8* pkt = ntf->data.bytes;
+        const guint len = ntf->data.size;
+        NciIntfActivationNtf parsed;
+        NciModeParam mode_param;
+        NciActivationParam activation_param;
+        guint k, ok = 0;
+        gint64 t0, t1;
+
+        t0 = g_get_monotonic_time();
+        for (k = 0; k < BENCH_INTF_ACTIVATED_PARSES; k++) {
+            if (nci_parse_intf_activated_ntf(&parsed, &mode_param,
+                &activation_param, pkt, len)) {
+                ok++;
+            }
+        }
+        t1 = g_get_monotonic_time();
+
+        g_assert_cmpuint(ok, == ,BENCH_INTF_ACTIVATED_PARSES);
+        bench_result("intf_activated", "\"ntf\": \"%s\", \"size\": %u, "
+            "\"parses\": %u, \"usec\": %" G_GINT64_FORMAT ", "
+            "\"ns_per_parse\": %.1f", ntf->name, len, ok, t1 - t0,
+            BENCH_NS(t0, t1, ok));
+    }
+}
+
+/*==========================================================================*
+ * Common
+ *==========================================================================*/
+
+int main(int argc, char* argv[])
+{
+    test_init(&bench_opt, argc, argv);
+    printf("{\n  \"version\": \"%d.%d.%d\",\n  \"benchmarks\": [",
+        NCI_CORE_VERSION_MAJOR, NCI_CORE_VERSION_MINOR,
+        NCI_CORE_VERSION_RELEASE);
+    bench_sar_rx();
+    bench_sar_tx();
+    bench_cmd_roundtrip("cmd_roundtrip", 0);
+    bench_cmd_roundtrip("cmd_roundtrip_traced", 0x10000);
+    bench_reset_discovery();
+    bench_intf_activated();
+    printf("\n  ]\n}\n");
+    return 0;
+}
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
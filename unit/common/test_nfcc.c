@@ -0,0 +1,1120 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the names of the copyright holders nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test_nfcc.h"
+
+#include "nci_types_p.h"
+
+#include <gutil_macros.h>
+#include <gutil_log.h>
+
+#define NFCC_HDR_SIZE (3)
+#define NFCC_DEFAULT_RSP_LATENCY (1000)
+#define NFCC_DEFAULT_NTF_LATENCY (500)
+#define NFCC_DEFAULT_DISCOVERY_LATENCY (100000)
+#define NFCC_DEFAULT_DATA_LATENCY (2000)
+#define NFCC_MAX_CANDIDATES (8)
+
+/* GID */
+#define NFCC_GID_CORE (0x00)
+#define NFCC_GID_RF (0x01)
+
+/* OID */
+#define NFCC_CORE_RESET (0x00)
+#define NFCC_CORE_INIT (0x01)
+#define NFCC_CORE_SET_CONFIG (0x02)
+#define NFCC_CORE_GET_CONFIG (0x03)
+#define NFCC_CORE_CONN_CREDITS (0x06)
+#define NFCC_RF_DISCOVER_MAP (0x00)
+#define NFCC_RF_SET_LISTEN_MODE_ROUTING (0x01)
+#define NFCC_RF_DISCOVER (0x03)
+#define NFCC_RF_DISCOVER_SELECT (0x04)
+#define NFCC_RF_INTF_ACTIVATED (0x05)
+#define NFCC_RF_DEACTIVATE (0x06)
+
+typedef struct test_nfcc_event TestNfccEvent;
+
+typedef
+void
+(*TestNfccEventFunc)(
+    TestNfcc* self,
+    TestNfccEvent* event);
+
+struct test_nfcc_event {
+    TestNfccEvent* next;
+    guint64 due;
+    TestNfccEventFunc fn;
+    GBytes* packet;
+    NciHalClientFunc complete;
+};
+
+struct test_nfcc {
+    NciHalIo io;
+    TestNfccConfig config;
+    TestNfccStats stats;
+    NciHalClient* client;
+    TestNfccEvent* events; /* Sorted by due time */
+    TestNfccEvent* write; /* Pending write completion */
+    guint event_id;
+    guint64 now;
+    NCI_STATE rf_state;
+    GHashTable* params; /* id => GBytes */
+    GBytes* routing;
+    GPtrArray* tags; /* Tags in the field */
+    const TestNfccTag* candidates[NFCC_MAX_CANDIDATES];
+    guint n_candidates;
+    const TestNfccTag* active;
+    guint32 discover_modes;
+    GByteArray* cmd_in;
+    GByteArray* data_in;
+};
+
+typedef struct test_nfcc_cmd {
+    guint8 gid;
+    guint8 oid;
+    void (*handle)(TestNfcc* self, const guint8* payload, guint len);
+} TestNfccCmd;
+
+/* Default discovery configuration, as if nothing has been stored */
+static const guint8 test_nfcc_default_params[] = {
+    NCI_CONFIG_LA_SENS_RES_1, 0x01, 0x04,
+    NCI_CONFIG_LA_SEL_INFO, 0x01, 0x00,
+    NCI_CONFIG_LA_NFCID1, 0x04, 0x08, 0x00, 0x00, 0x00,
+    NCI_CONFIG_LF_PROTOCOL_TYPE, 0x01, 0x00
+};
+
+/* Payloads of CORE_RESET_NTF and CORE_INIT_RSP */
+static const guint8 test_nfcc_core_reset_v2_ntf[] = {
+    0x02, 0x01, 0x20, 0x02, 0x1a, 0x04, 0x04, 0x01,
+    0x03, 0x63, 0x94, 0x02, 0x02, 0x00, 0x59, 0xc0,
+    0xc0, 0x1b, 0x59, 0xc0, 0x89, 0x7f, 0x00, 0x00,
+    0x00, 0x02, 0x00, 0x00, 0x42, 0x22, 0x01
+};
+static const guint8 test_nfcc_core_init_v1_rsp[] = {
+    0x00, 0x03, 0x0e, 0x02, 0x00, 0x08, 0x00, 0x01,
+    0x02, 0x03, 0x80, 0x82, 0x83, 0x84, 0x02, 0x5c,
+    0x03, 0xff, 0x02, 0x00, 0x04, 0x41, 0x11, 0x01,
+    0x18
+};
+static const guint8 test_nfcc_core_init_v2_rsp[] = {
+    0x00, 0x1a, 0x7e, 0x06, 0x00, 0x02, 0x00, 0x02,
+    0xff, 0xff, 0x00, 0x0c, 0x01, 0x05, 0x01, 0x00,
+    0x02, 0x00, 0x03, 0x00, 0x00, 0x00, 0x90, 0x00
+};
+
+static
+void
+test_nfcc_discovery(
+    TestNfcc* self,
+    TestNfccEvent* event);
+
+static
+inline
+TestNfcc*
+test_nfcc_cast(
+    NciHalIo* io)
+{
+    return G_CAST(io, TestNfcc, io);
+}
+
+/*==========================================================================*
+ * Events
+ *==========================================================================*/
+
+static
+void
+test_nfcc_event_free(
+    TestNfccEvent* event)
+{
+    if (event->packet) {
+        g_bytes_unref(event->packet);
+    }
+    g_slice_free(TestNfccEvent, event);
+}
+
+static
+gboolean
+test_nfcc_event_cb(
+    gpointer user_data);
+
+static
+void
+test_nfcc_schedule(
+    TestNfcc* self)
+{
+    TestNfccEvent* next = self->events;
+
+    if (next && !self->event_id) {
+        if (self->config.realtime && next->due > self->now) {
+            self->event_id = g_timeout_add((guint)
+                ((next->due - self->now + 999) / 1000),
+                test_nfcc_event_cb, self);
+        } else {
+            self->event_id = g_idle_add(test_nfcc_event_cb, self);
+        }
+    }
+}
+
+static
+gboolean
+test_nfcc_event_cb(
+    gpointer user_data)
+{
+    TestNfcc* self = user_data;
+    TestNfccEvent* event = self->events;
+
+    self->event_id = 0;
+    self->events = event->next;
+    if (self->now < event->due) {
+        self->now = event->due;
+    }
+    if (self->write == event) {
+        self->write = NULL;
+    }
+    event->fn(self, event);
+    test_nfcc_event_free(event);
+    test_nfcc_schedule(self);
+    return G_SOURCE_REMOVE;
+}
+
+static
+TestNfccEvent*
+test_nfcc_event_new(
+    TestNfcc* self,
+    guint64 delay,
+    TestNfccEventFunc fn)
+{
+    TestNfccEvent* event = g_slice_new0(TestNfccEvent);
+    TestNfccEvent* prev = NULL;
+    TestNfccEvent* ptr = self->events;
+
+    /* Events due at the same time are handled in FIFO order */
+    event->due = self->now + delay;
+    event->fn = fn;
+    while (ptr && ptr->due <= event->due) {
+        prev = ptr;
+        ptr = ptr->next;
+    }
+    event->next = ptr;
+    if (prev) {
+        prev->next = event;
+    } else {
+        self->events = event;
+    }
+    test_nfcc_schedule(self);
+    return event;
+}
+
+static
+void
+test_nfcc_event_remove(
+    TestNfcc* self,
+    TestNfccEvent* event)
+{
+    TestNfccEvent* prev = NULL;
+    TestNfccEvent* ptr = self->events;
+
+    while (ptr && ptr != event) {
+        prev = ptr;
+        ptr = ptr->next;
+    }
+    if (ptr) {
+        if (prev) {
+            prev->next = ptr->next;
+        } else {
+            self->events = ptr->next;
+        }
+        test_nfcc_event_free(ptr);
+    }
+}
+
+static
+void
+test_nfcc_clear_events(
+    TestNfcc* self)
+{
+    while (self->events) {
+        TestNfccEvent* event = self->events;
+
+        self->events = event->next;
+        test_nfcc_event_free(event);
+    }
+    self->write = NULL;
+    if (self->event_id) {
+        g_source_remove(self->event_id);
+        self->event_id = 0;
+    }
+}
+
+static
+void
+test_nfcc_deliver_packet(
+    TestNfcc* self,
+    TestNfccEvent* event)
+{
+    if (self->client) {
+        nci_hal_client_read_bytes(self->client, event->packet);
+    }
+}
+
+static
+void
+test_nfcc_write_done(
+    TestNfcc* self,
+    TestNfccEvent* event)
+{
+    if (self->client) {
+        event->complete(self->client, TRUE);
+    }
+}
+
+/*==========================================================================*
+ * Outgoing packets
+ *==========================================================================*/
+
+static
+void
+test_nfcc_queue_packet(
+    TestNfcc* self,
+    guint64 delay,
+    guint8 hdr0,
+    guint8 hdr1,
+    const void* payload,
+    guint len)
+{
+    TestNfccEvent* event = test_nfcc_event_new(self, delay,
+        test_nfcc_deliver_packet);
+    guint8* packet = g_malloc(len + NFCC_HDR_SIZE);
+
+    GASSERT(len <= 0xff);
+    packet[0] = hdr0;
+    packet[1] = hdr1;
+    packet[2] = (guint8) len;
+    memcpy(packet + NFCC_HDR_SIZE, payload, len);
+    event->packet = g_bytes_new_take(packet, len + NFCC_HDR_SIZE);
+}
+
+static
+void
+test_nfcc_rsp(
+    TestNfcc* self,
+    guint8 gid,
+    guint8 oid,
+    const void* payload,
+    guint len)
+{
+    test_nfcc_queue_packet(self, self->config.rsp_latency,
+        NCI_MT_RSP_PKT | gid, oid, payload, len);
+}
+
+static
+void
+test_nfcc_rsp_status(
+    TestNfcc* self,
+    guint8 gid,
+    guint8 oid,
+    guint8 status)
+{
+    test_nfcc_rsp(self, gid, oid, &status, 1);
+}
+
+/* Notifications triggered by a command follow the response */
+static
+void
+test_nfcc_ntf(
+    TestNfcc* self,
+    guint8 gid,
+    guint8 oid,
+    const void* payload,
+    guint len)
+{
+    test_nfcc_queue_packet(self, (guint64) self->config.rsp_latency +
+        self->config.ntf_latency, NCI_MT_NTF_PKT | gid, oid, payload, len);
+}
+
+static
+void
+test_nfcc_send_data(
+    TestNfcc* self,
+    guint8 cid,
+    const guint8* data,
+    gsize len)
+{
+    const guint max = MAX(self->config.max_data_payload, 1);
+
+    /* Segment the message according to the advertised payload size */
+    do {
+        const guint n = MIN(len, max);
+
+        test_nfcc_queue_packet(self, self->config.data_latency,
+            NCI_MT_DATA_PKT | ((len > n) ? NCI_PBF : 0) | cid, 0, data, n);
+        self->stats.data_packets_out++;
+        data += n;
+        len -= n;
+    } while (len > 0);
+}
+
+/*==========================================================================*
+ * RF
+ *==========================================================================*/
+
+static
+guint32
+test_nfcc_mode_bit(
+    NCI_MODE mode)
+{
+    return 1 << ((mode & 0x0f) + ((mode & 0x80) ? 16 : 0));
+}
+
+static
+void
+test_nfcc_start_discovery(
+    TestNfcc* self,
+    guint64 delay)
+{
+    self->rf_state = NCI_RFST_DISCOVERY;
+    self->active = NULL;
+    self->n_candidates = 0;
+    test_nfcc_event_new(self, delay + self->config.discovery_latency,
+        test_nfcc_discovery);
+}
+
+static
+void
+test_nfcc_activate(
+    TestNfcc* self,
+    guint8 id,
+    const TestNfccTag* tag,
+    NCI_RF_INTERFACE rf_intf)
+{
+    GByteArray* ntf = g_byte_array_new();
+    guint8 hdr[7];
+    guint8 tail[4];
+
+    hdr[0] = id;
+    hdr[1] = rf_intf;
+    hdr[2] = tag->protocol;
+    hdr[3] = tag->mode;
+    hdr[4] = self->config.max_data_payload;
+    hdr[5] = self->config.initial_credits;
+    hdr[6] = (guint8) tag->mode_param.size;
+    g_byte_array_append(ntf, hdr, sizeof(hdr));
+    g_byte_array_append(ntf, tag->mode_param.bytes, tag->mode_param.size);
+    tail[0] = tag->mode; /* Data Exchange RF Technology and Mode */
+    tail[1] = NFC_BIT_RATE_106; /* Data Exchange Transmit Bit Rate */
+    tail[2] = NFC_BIT_RATE_106; /* Data Exchange Receive Bit Rate */
+    tail[3] = (guint8) tag->activation_param.size;
+    g_byte_array_append(ntf, tail, sizeof(tail));
+    g_byte_array_append(ntf, tag->activation_param.bytes,
+        tag->activation_param.size);
+    test_nfcc_ntf(self, NFCC_GID_RF, NFCC_RF_INTF_ACTIVATED,
+        ntf->data, ntf->len);
+    g_byte_array_free(ntf, TRUE);
+
+    self->active = tag;
+    self->rf_state = (tag->mode & 0x80) ? NCI_RFST_LISTEN_ACTIVE :
+        NCI_RFST_POLL_ACTIVE;
+    g_byte_array_set_size(self->data_in, 0);
+    self->stats.activations++;
+}
+
+static
+void
+test_nfcc_discovery(
+    TestNfcc* self,
+    TestNfccEvent* event)
+{
+    if (self->rf_state == NCI_RFST_DISCOVERY) {
+        guint i, n = 0;
+
+        for (i = 0; i < self->tags->len && n < NFCC_MAX_CANDIDATES; i++) {
+            const TestNfccTag* tag = self->tags->pdata[i];
+
+            if (self->discover_modes & test_nfcc_mode_bit(tag->mode)) {
+                self->candidates[n++] = tag;
+            }
+        }
+
+        self->n_candidates = n;
+        if (n == 1) {
+            /* Response latency has already passed */
+            self->now -= self->config.rsp_latency;
+            test_nfcc_activate(self, 1, self->candidates[0],
+                self->candidates[0]->rf_intf);
+            self->now += self->config.rsp_latency;
+        } else if (n > 1) {
+            self->rf_state = NCI_RFST_W4_HOST_SELECT;
+            for (i = 0; i < n; i++) {
+                const TestNfccTag* tag = self->candidates[i];
+                GByteArray* ntf = g_byte_array_new();
+                guint8 hdr[4];
+                guint8 type = (i + 1 < n) ? 0x02 : 0x00; /* More/Last */
+
+                hdr[0] = i + 1;
+                hdr[1] = tag->protocol;
+                hdr[2] = tag->mode;
+                hdr[3] = (guint8) tag->mode_param.size;
+                g_byte_array_append(ntf, hdr, sizeof(hdr));
+                g_byte_array_append(ntf, tag->mode_param.bytes,
+                    tag->mode_param.size);
+                g_byte_array_append(ntf, &type, 1);
+                test_nfcc_queue_packet(self, self->config.ntf_latency,
+                    NCI_MT_NTF_PKT | NFCC_GID_RF, NFCC_RF_DISCOVER,
+                    ntf->data, ntf->len);
+                g_byte_array_free(ntf, TRUE);
+            }
+        }
+    }
+}
+
+/*==========================================================================*
+ * Commands
+ *==========================================================================*/
+
+static
+void
+test_nfcc_set_params(
+    TestNfcc* self,
+    const guint8* tlv,
+    guint len)
+{
+    while (len >= 2 && len >= (guint)(tlv[1] + 2)) {
+        g_hash_table_insert(self->params, GUINT_TO_POINTER(tlv[0]),
+            g_bytes_new(tlv + 2, tlv[1]));
+        len -= tlv[1] + 2;
+        tlv += tlv[1] + 2;
+    }
+}
+
+static
+void
+test_nfcc_cmd_core_reset(
+    TestNfcc* self,
+    const guint8* payload,
+    guint len)
+{
+    const guint8 reset_type = len ? payload[0] : 0x00;
+
+    if (reset_type == 0x01) {
+        /* Reset configuration */
+        g_hash_table_remove_all(self->params);
+        test_nfcc_set_params(self, test_nfcc_default_params,
+            sizeof(test_nfcc_default_params));
+        if (self->routing) {
+            g_bytes_unref(self->routing);
+            self->routing = NULL;
+        }
+    }
+    self->rf_state = NCI_RFST_IDLE;
+    self->active = NULL;
+    self->n_candidates = 0;
+    g_byte_array_set_size(self->data_in, 0);
+    if (self->config.version == TEST_NFCC_NCI_1) {
+        guint8 rsp[3];
+
+        rsp[0] = NCI_STATUS_OK;
+        rsp[1] = 0x10; /* NCI Version 1.0 */
+        rsp[2] = reset_type; /* Configuration Status */
+        test_nfcc_rsp(self, NFCC_GID_CORE, NFCC_CORE_RESET, rsp, sizeof(rsp));
+    } else {
+        guint8 ntf[sizeof(test_nfcc_core_reset_v2_ntf)];
+
+        memcpy(ntf, test_nfcc_core_reset_v2_ntf, sizeof(ntf));
+        ntf[1] = reset_type; /* Configuration Status */
+        test_nfcc_rsp_status(self, NFCC_GID_CORE, NFCC_CORE_RESET,
+            NCI_STATUS_OK);
+        test_nfcc_ntf(self, NFCC_GID_CORE, NFCC_CORE_RESET, ntf, sizeof(ntf));
+    }
+}
+
+static
+void
+test_nfcc_cmd_core_init(
+    TestNfcc* self,
+    const guint8* payload,
+    guint len)
+{
+    if (self->config.version == TEST_NFCC_NCI_1) {
+        test_nfcc_rsp(self, NFCC_GID_CORE, NFCC_CORE_INIT,
+            TEST_ARRAY_AND_SIZE(test_nfcc_core_init_v1_rsp));
+    } else {
+        test_nfcc_rsp(self, NFCC_GID_CORE, NFCC_CORE_INIT,
+            TEST_ARRAY_AND_SIZE(test_nfcc_core_init_v2_rsp));
+    }
+}
+
+static
+void
+test_nfcc_cmd_core_set_config(
+    TestNfcc* self,
+    const guint8* payload,
+    guint len)
+{
+    static const guint8 rsp[] = { NCI_STATUS_OK, 0x00 };
+
+    if (len > 0) {
+        test_nfcc_set_params(self, payload + 1, len - 1);
+    }
+    test_nfcc_rsp(self, NFCC_GID_CORE, NFCC_CORE_SET_CONFIG,
+        TEST_ARRAY_AND_SIZE(rsp));
+}
+
+static
+void
+test_nfcc_cmd_core_get_config(
+    TestNfcc* self,
+    const guint8* payload,
+    guint len)
+{
+    GByteArray* found = g_byte_array_new();
+    GByteArray* missing = g_byte_array_new();
+    GByteArray* rsp = g_byte_array_new();
+    guint8 status = NCI_STATUS_OK;
+    guint8 count = 0;
+    guint i, n = len ? MIN(payload[0], len - 1) : 0;
+
+    for (i = 0; i < n; i++) {
+        const guint8 id = payload[i + 1];
+        GBytes* value = g_hash_table_lookup(self->params,
+            GUINT_TO_POINTER(id));
+
+        if (value) {
+            gsize size;
+            const void* data = g_bytes_get_data(value, &size);
+            const guint8 size8 = (guint8) size;
+
+            g_byte_array_append(found, &id, 1);
+            g_byte_array_append(found, &size8, 1);
+            g_byte_array_append(found, data, size);
+        } else {
+            static const guint8 zero = 0;
+
+            g_byte_array_append(missing, &id, 1);
+            g_byte_array_append(missing, &zero, 1);
+        }
+    }
+
+    /* Only the invalid parameters are returned in case of failure */
+    g_byte_array_append(rsp, &status, 1);
+    g_byte_array_append(rsp, &count, 1);
+    if (missing->len) {
+        rsp->data[0] = NCI_STATUS_INVALID_PARAM;
+        rsp->data[1] = missing->len / 2;
+        g_byte_array_append(rsp, missing->data, missing->len);
+    } else {
+        rsp->data[1] = n;
+        g_byte_array_append(rsp, found->data, found->len);
+    }
+    test_nfcc_rsp(self, NFCC_GID_CORE, NFCC_CORE_GET_CONFIG,
+        rsp->data, rsp->len);
+    g_byte_array_free(found, TRUE);
+    g_byte_array_free(missing, TRUE);
+    g_byte_array_free(rsp, TRUE);
+}
+
+static
+void
+test_nfcc_cmd_rf_discover_map(
+    TestNfcc* self,
+    const guint8* payload,
+    guint len)
+{
+    test_nfcc_rsp_status(self, NFCC_GID_RF, NFCC_RF_DISCOVER_MAP,
+        NCI_STATUS_OK);
+}
+
+static
+void
+test_nfcc_cmd_rf_set_listen_mode_routing(
+    TestNfcc* self,
+    const guint8* payload,
+    guint len)
+{
+    if (self->routing) {
+        g_bytes_unref(self->routing);
+    }
+    self->routing = g_bytes_new(payload, len);
+    test_nfcc_rsp_status(self, NFCC_GID_RF, NFCC_RF_SET_LISTEN_MODE_ROUTING,
+        NCI_STATUS_OK);
+}
+
+static
+void
+test_nfcc_cmd_rf_discover(
+    TestNfcc* self,
+    const guint8* payload,
+    guint len)
+{
+    if (self->rf_state != NCI_RFST_IDLE) {
+        test_nfcc_rsp_status(self, NFCC_GID_RF, NFCC_RF_DISCOVER,
+            NCI_STATUS_SEMANTIC_ERROR);
+    } else if (!len || len < (guint)(1 + 2 * payload[0])) {
+        test_nfcc_rsp_status(self, NFCC_GID_RF, NFCC_RF_DISCOVER,
+            NCI_STATUS_SYNTAX_ERROR);
+    } else {
+        guint i;
+
+        self->discover_modes = 0;
+        for (i = 0; i < payload[0]; i++) {
+            self->discover_modes |= test_nfcc_mode_bit(payload[1 + 2 * i]);
+        }
+        test_nfcc_rsp_status(self, NFCC_GID_RF, NFCC_RF_DISCOVER,
+            NCI_STATUS_OK);
+        test_nfcc_start_discovery(self, self->config.rsp_latency);
+    }
+}
+
+static
+void
+test_nfcc_cmd_rf_discover_select(
+    TestNfcc* self,
+    const guint8* payload,
+    guint len)
+{
+    if (self->rf_state != NCI_RFST_W4_HOST_SELECT) {
+        test_nfcc_rsp_status(self, NFCC_GID_RF, NFCC_RF_DISCOVER_SELECT,
+            NCI_STATUS_SEMANTIC_ERROR);
+    } else if (len < 3 || !payload[0] || payload[0] > self->n_candidates) {
+        test_nfcc_rsp_status(self, NFCC_GID_RF, NFCC_RF_DISCOVER_SELECT,
+            NCI_STATUS_INVALID_PARAM);
+    } else {
+        test_nfcc_rsp_status(self, NFCC_GID_RF, NFCC_RF_DISCOVER_SELECT,
+            NCI_STATUS_OK);
+        test_nfcc_activate(self, payload[0],
+            self->candidates[payload[0] - 1], payload[2]);
+    }
+}
+
+static
+void
+test_nfcc_cmd_rf_deactivate(
+    TestNfcc* self,
+    const guint8* payload,
+    guint len)
+{
+    const guint8 type = len ? payload[0] : NCI_DEACTIVATE_TYPE_IDLE;
+
+    switch (self->rf_state) {
+    case NCI_RFST_DISCOVERY:
+        /* No notification in this case */
+        test_nfcc_rsp_status(self, NFCC_GID_RF, NFCC_RF_DEACTIVATE,
+            NCI_STATUS_OK);
+        self->rf_state = NCI_RFST_IDLE;
+        break;
+    case NCI_RFST_W4_HOST_SELECT:
+    case NCI_RFST_POLL_ACTIVE:
+    case NCI_RFST_LISTEN_ACTIVE:
+    case NCI_RFST_LISTEN_SLEEP:
+        {
+            guint8 ntf[2];
+
+            ntf[0] = type;
+            ntf[1] = NCI_DEACTIVATION_REASON_DH_REQUEST;
+            test_nfcc_rsp_status(self, NFCC_GID_RF, NFCC_RF_DEACTIVATE,
+                NCI_STATUS_OK);
+            test_nfcc_ntf(self, NFCC_GID_RF, NFCC_RF_DEACTIVATE,
+                ntf, sizeof(ntf));
+            if (type == NCI_DEACTIVATE_TYPE_DISCOVERY) {
+                test_nfcc_start_discovery(self, (guint64)
+                    self->config.rsp_latency + self->config.ntf_latency);
+            } else if (type == NCI_DEACTIVATE_TYPE_IDLE) {
+                self->rf_state = NCI_RFST_IDLE;
+                self->active = NULL;
+            } else if (self->active) {
+                /* Sleep, the tag stays selectable */
+                self->candidates[0] = self->active;
+                self->n_candidates = 1;
+                self->active = NULL;
+                self->rf_state = NCI_RFST_W4_HOST_SELECT;
+            }
+        }
+        break;
+    default:
+        test_nfcc_rsp_status(self, NFCC_GID_RF, NFCC_RF_DEACTIVATE,
+            NCI_STATUS_SEMANTIC_ERROR);
+        break;
+    }
+}
+
+static const TestNfccCmd test_nfcc_cmds[] = {
+    { NFCC_GID_CORE, NFCC_CORE_RESET, test_nfcc_cmd_core_reset },
+    { NFCC_GID_CORE, NFCC_CORE_INIT, test_nfcc_cmd_core_init },
+    { NFCC_GID_CORE, NFCC_CORE_SET_CONFIG, test_nfcc_cmd_core_set_config },
+    { NFCC_GID_CORE, NFCC_CORE_GET_CONFIG, test_nfcc_cmd_core_get_config },
+    { NFCC_GID_RF, NFCC_RF_DISCOVER_MAP, test_nfcc_cmd_rf_discover_map },
+    { NFCC_GID_RF, NFCC_RF_SET_LISTEN_MODE_ROUTING,
+      test_nfcc_cmd_rf_set_listen_mode_routing },
+    { NFCC_GID_RF, NFCC_RF_DISCOVER, test_nfcc_cmd_rf_discover },
+    { NFCC_GID_RF, NFCC_RF_DISCOVER_SELECT,
+      test_nfcc_cmd_rf_discover_select },
+    { NFCC_GID_RF, NFCC_RF_DEACTIVATE, test_nfcc_cmd_rf_deactivate }
+};
+
+static
+void
+test_nfcc_handle_cmd(
+    TestNfcc* self,
+    guint8 gid,
+    guint8 oid,
+    const guint8* payload,
+    guint len)
+{
+    guint i;
+
+    self->stats.commands++;
+    for (i = 0; i < G_N_ELEMENTS(test_nfcc_cmds); i++) {
+        const TestNfccCmd* cmd = test_nfcc_cmds + i;
+
+        if (cmd->gid == gid && cmd->oid == oid) {
+            cmd->handle(self, payload, len);
+            return;
+        }
+    }
+    GDEBUG("Unsupported command %02x/%02x", gid, oid);
+    test_nfcc_rsp_status(self, gid, oid, NCI_STATUS_SYNTAX_ERROR);
+}
+
+static
+void
+test_nfcc_handle_data(
+    TestNfcc* self,
+    const guint8* packet,
+    guint len)
+{
+    const guint8 cid = packet[0] & 0x0f;
+    const TestNfccTag* tag = self->active;
+
+    self->stats.data_packets_in++;
+    if (tag && !cid) {
+        guint8 credits[3];
+
+        /* Every packet returns a credit */
+        credits[0] = 1;
+        credits[1] = cid;
+        credits[2] = 1;
+        test_nfcc_queue_packet(self, self->config.data_latency,
+            NCI_MT_NTF_PKT | NFCC_GID_CORE, NFCC_CORE_CONN_CREDITS,
+            credits, sizeof(credits));
+        g_byte_array_append(self->data_in, packet + NFCC_HDR_SIZE,
+            len - NFCC_HDR_SIZE);
+        if (!(packet[0] & NCI_PBF)) {
+            GByteArray* in = self->data_in;
+
+            if (tag->respond) {
+                GBytes* reply = tag->respond(tag, in->data, in->len);
+
+                if (reply) {
+                    gsize size;
+                    const guint8* data = g_bytes_get_data(reply, &size);
+
+                    test_nfcc_send_data(self, cid, data, size);
+                    g_bytes_unref(reply);
+                }
+            } else {
+                test_nfcc_send_data(self, cid, in->data, in->len);
+            }
+            g_byte_array_set_size(in, 0);
+        }
+    } else {
+        GDEBUG("Dropping data packet for cid %u", cid);
+    }
+}
+
+static
+void
+test_nfcc_handle_packet(
+    TestNfcc* self,
+    const guint8* packet,
+    guint len)
+{
+    const guint8 mt = packet[0] & NCI_MT_MASK;
+
+    if (mt == NCI_MT_CMD_PKT) {
+        GByteArray* in = self->cmd_in;
+
+        if (in->len) {
+            /* Continuation of a segmented command */
+            g_byte_array_append(in, packet + NFCC_HDR_SIZE,
+                len - NFCC_HDR_SIZE);
+        } else {
+            g_byte_array_append(in, packet, len);
+        }
+        if (!(packet[0] & NCI_PBF)) {
+            test_nfcc_handle_cmd(self, in->data[0] & 0x0f,
+                in->data[1] & 0x3f, in->data + NFCC_HDR_SIZE,
+                in->len - NFCC_HDR_SIZE);
+            g_byte_array_set_size(in, 0);
+        }
+    } else if (mt == NCI_MT_DATA_PKT) {
+        test_nfcc_handle_data(self, packet, len);
+    } else {
+        GDEBUG("Unexpected message type 0x%02x", mt);
+    }
+}
+
+/*==========================================================================*
+ * NciHalIo
+ *==========================================================================*/
+
+static
+gboolean
+test_nfcc_io_start(
+    NciHalIo* io,
+    NciHalClient* client)
+{
+    TestNfcc* self = test_nfcc_cast(io);
+
+    g_assert(!self->client);
+    self->client = client;
+    return TRUE;
+}
+
+static
+void
+test_nfcc_io_stop(
+    NciHalIo* io)
+{
+    TestNfcc* self = test_nfcc_cast(io);
+
+    test_nfcc_clear_events(self);
+    self->client = NULL;
+}
+
+static
+gboolean
+test_nfcc_io_write(
+    NciHalIo* io,
+    const GUtilData* chunks,
+    guint count,
+    NciHalClientFunc complete)
+{
+    TestNfcc* self = test_nfcc_cast(io);
+    GByteArray* buf = g_byte_array_new();
+    const guint8* ptr;
+    guint i, len;
+
+    g_assert(!self->write);
+    for (i = 0; i < count; i++) {
+        g_byte_array_append(buf, chunks[i].bytes, chunks[i].size);
+    }
+
+    /* Write completes before anything which it may trigger */
+    self->write = test_nfcc_event_new(self, 0, test_nfcc_write_done);
+    self->write->complete = complete;
+
+    /* The buffer may contain several packets */
+    ptr = buf->data;
+    len = buf->len;
+    while (len >= NFCC_HDR_SIZE && len >= (guint)(ptr[2] + NFCC_HDR_SIZE)) {
+        const guint packet_len = ptr[2] + NFCC_HDR_SIZE;
+
+        test_nfcc_handle_packet(self, ptr, packet_len);
+        ptr += packet_len;
+        len -= packet_len;
+    }
+    g_assert(!len);
+    g_byte_array_free(buf, TRUE);
+    return TRUE;
+}
+
+static
+void
+test_nfcc_io_cancel_write(
+    NciHalIo* io)
+{
+    TestNfcc* self = test_nfcc_cast(io);
+
+    if (self->write) {
+        test_nfcc_event_remove(self, self->write);
+        self->write = NULL;
+    }
+}
+
+/*==========================================================================*
+ * Interface
+ *==========================================================================*/
+
+TestNfcc*
+test_nfcc_new(
+    const TestNfccConfig* config)
+{
+    static const NciHalIoFunctions test_nfcc_io_fn = {
+        .start = test_nfcc_io_start,
+        .stop = test_nfcc_io_stop,
+        .write = test_nfcc_io_write,
+        .cancel_write = test_nfcc_io_cancel_write
+    };
+    TestNfcc* self = g_new0(TestNfcc, 1);
+
+    if (config) {
+        self->config = *config;
+    } else {
+        TestNfccConfig* defaults = &self->config;
+
+        defaults->version = TEST_NFCC_NCI_1;
+        defaults->rsp_latency = NFCC_DEFAULT_RSP_LATENCY;
+        defaults->ntf_latency = NFCC_DEFAULT_NTF_LATENCY;
+        defaults->discovery_latency = NFCC_DEFAULT_DISCOVERY_LATENCY;
+        defaults->data_latency = NFCC_DEFAULT_DATA_LATENCY;
+        defaults->max_data_payload = 0xff;
+        defaults->initial_credits = 1;
+    }
+    self->io.fn = &test_nfcc_io_fn;
+    self->rf_state = NCI_RFST_IDLE;
+    self->params = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+        NULL, (GDestroyNotify) g_bytes_unref);
+    self->tags = g_ptr_array_new();
+    self->cmd_in = g_byte_array_new();
+    self->data_in = g_byte_array_new();
+    test_nfcc_set_params(self, test_nfcc_default_params,
+        sizeof(test_nfcc_default_params));
+    return self;
+}
+
+void
+test_nfcc_free(
+    TestNfcc* self)
+{
+    if (self) {
+        test_nfcc_clear_events(self);
+        g_hash_table_destroy(self->params);
+        if (self->routing) {
+            g_bytes_unref(self->routing);
+        }
+        g_ptr_array_free(self->tags, TRUE);
+        g_byte_array_free(self->cmd_in, TRUE);
+        g_byte_array_free(self->data_in, TRUE);
+        g_free(self);
+    }
+}
+
+NciHalIo*
+test_nfcc_io(
+    TestNfcc* self)
+{
+    return &self->io;
+}
+
+void
+test_nfcc_add_tags(
+    TestNfcc* self,
+    const TestNfccTag* tags,
+    guint count)
+{
+    guint i;
+
+    for (i = 0; i < count; i++) {
+        g_ptr_array_add(self->tags, (gpointer) (tags + i));
+    }
+    if (count && self->rf_state == NCI_RFST_DISCOVERY) {
+        /* Newcomers get noticed in the next polling loop */
+        test_nfcc_event_new(self, self->config.discovery_latency,
+            test_nfcc_discovery);
+    }
+}
+
+void
+test_nfcc_remove_tags(
+    TestNfcc* self)
+{
+    g_ptr_array_set_size(self->tags, 0);
+    if (self->active) {
+        static const guint8 ntf[] = {
+            NCI_DEACTIVATE_TYPE_DISCOVERY,
+            NCI_DEACTIVATION_REASON_RF_LINK_LOSS
+        };
+
+        test_nfcc_queue_packet(self, self->config.ntf_latency,
+            NCI_MT_NTF_PKT | NFCC_GID_RF, NFCC_RF_DEACTIVATE,
+            TEST_ARRAY_AND_SIZE(ntf));
+        test_nfcc_start_discovery(self, self->config.ntf_latency);
+    }
+}
+
+NCI_STATE
+test_nfcc_rf_state(
+    TestNfcc* self)
+{
+    return self->rf_state;
+}
+
+const TestNfccTag*
+test_nfcc_active_tag(
+    TestNfcc* self)
+{
+    return self->active;
+}
+
+gboolean
+test_nfcc_get_config(
+    TestNfcc* self,
+    guint8 id,
+    GUtilData* value)
+{
+    GBytes* bytes = g_hash_table_lookup(self->params, GUINT_TO_POINTER(id));
+
+    if (bytes) {
+        if (value) {
+            value->bytes = g_bytes_get_data(bytes, &value->size);
+        }
+        return TRUE;
+    }
+    return FALSE;
+}
+
+GBytes*
+test_nfcc_routing(
+    TestNfcc* self)
+{
+    return self->routing;
+}
+
+guint64
+test_nfcc_time(
+    TestNfcc* self)
+{
+    return self->now;
+}
+
+const TestNfccStats*
+test_nfcc_stats(
+    TestNfcc* self)
+{
+    return &self->stats;
+}
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the names of the copyright holders nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TEST_NFCC_H
+#define TEST_NFCC_H
+
+#include "test_common.h"
+
+#include <nci_hal.h>
+
+/*
+ * Virtual NFCC, an NciHalIo implementation backed by a simple model
+ * of the controller: NCI 1.0 and 2.0 reset and initialization, config
+ * storage, listen mode routing, RF discovery of a programmable tag
+ * population, credits of the static RF connection and data exchange.
+ *
+ * Packets produced by the model are delivered from the main loop in
+ * the order of their due time. The time is simulated, which makes runs
+ * deterministic and independent of the machine load, unless realtime
+ * is requested in which case the latencies are actually waited out
+ * (with millisecond resolution).
+ */
+
+typedef struct test_nfcc TestNfcc;
+typedef struct test_nfcc_tag TestNfccTag;
+
+typedef enum test_nfcc_version {
+    TEST_NFCC_NCI_1,
+    TEST_NFCC_NCI_2
+} TEST_NFCC_VERSION;
+
+/* Latencies are in microseconds */
+typedef struct test_nfcc_config {
+    TEST_NFCC_VERSION version;
+    guint rsp_latency;          /* Command => response */
+    guint ntf_latency;          /* Response => notification */
+    guint discovery_latency;    /* RF_DISCOVER_RSP => tag discovery */
+    guint data_latency;         /* Data packet => credits and reply */
+    guint8 max_data_payload;    /* Reported in RF_INTF_ACTIVATED_NTF */
+    guint8 initial_credits;     /* Ditto */
+    gboolean realtime;
+} TestNfccConfig;
+
+/* Returns the reply, or NULL to send nothing back */
+typedef
+GBytes*
+(*TestNfccTagRespondFunc)(
+    const TestNfccTag* tag,
+    const void* data,
+    guint len);
+
+/* Tags are usually defined as static tables */
+struct test_nfcc_tag {
+    NCI_RF_INTERFACE rf_intf;
+    NCI_PROTOCOL protocol;
+    NCI_MODE mode;
+    GUtilData mode_param;       /* RF Technology Specific Parameters */
+    GUtilData activation_param; /* Activation Parameters */
+    TestNfccTagRespondFunc respond; /* NULL to echo the data back */
+};
+
+typedef struct test_nfcc_stats {
+    guint commands;             /* Control packets (messages) received */
+    guint data_packets_in;      /* Data packets (segments) received */
+    guint data_packets_out;     /* Data packets (segments) sent */
+    guint activations;
+} TestNfccStats;
+
+/* NULL config means defaults */
+TestNfcc*
+test_nfcc_new(
+    const TestNfccConfig* config);
+
+void
+test_nfcc_free(
+    TestNfcc* nfcc);
+
+NciHalIo*
+test_nfcc_io(
+    TestNfcc* nfcc);
+
+/* Tags must stay alive while they are in the field */
+void
+test_nfcc_add_tags(
+    TestNfcc* nfcc,
+    const TestNfccTag* tags,
+    guint count);
+
+/* Active tag (if any) is deactivated with RF_LINK_LOSS */
+void
+test_nfcc_remove_tags(
+    TestNfcc* nfcc);
+
+NCI_STATE
+test_nfcc_rf_state(
+    TestNfcc* nfcc);
+
+const TestNfccTag*
+test_nfcc_active_tag(
+    TestNfcc* nfcc);
+
+gboolean
+test_nfcc_get_config(
+    TestNfcc* nfcc,
+    guint8 id,
+    GUtilData* value);
+
+/* Payload of the last RF_SET_LISTEN_MODE_ROUTING_CMD, NULL if none */
+GBytes*
+test_nfcc_routing(
+    TestNfcc* nfcc);
+
+/* Simulated time, in microseconds */
+guint64
+test_nfcc_time(
+    TestNfcc* nfcc);
+
+const TestNfccStats*
+test_nfcc_stats(
+    TestNfcc* nfcc);
+
+#endif /* TEST_NFCC_H */
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -38,10 +38,13 @@
  */
 
 #include "test_common.h"
+#include "test_nfcc.h"
 
-#include "nci_core.h"
+#include "nci_core_p.h"
 #include "nci_hal.h"
+#include "nci_sar.h"
 #include "nci_sm.h"
+#include "nci_util.h"
 
 #include <gutil_macros.h>
 #include <gutil_misc.h>
@@ -280,6 +283,10 @@ static const guint8 CORE_SET_CONFIG_CMD_DISCOVERY_PEER[] = {
     0x32, 0x01, 0x40, /* LA_SEL_INFO = 0x40 */
     0x50, 0x01, 0x02  /* LF_PROTOCOL_TYPE = 0x02 */
 };
+static const guint8 CORE_SET_CONFIG_CMD_DISCOVERY_PEER_A_B[] = {
+    0x20, 0x02, 0x04, 0x01,
+    0x50, 0x01, 0x00  /* LF_PROTOCOL_TYPE = 0 */
+};
 static const guint8 CORE_SET_CONFIG_CMD_DISCOVERY_CE[] = {
     0x20, 0x02, 0x04, 0x01,
     0x32, 0x01, 0x20  /* LA_SEL_INFO = 0x20 */
@@ -398,6 +405,14 @@ static const guint8 RF_DISCOVER_MAP_CMD_RW_F[] = {
     0x21, 0x00, 0x04, 0x01,
     0x03, 0x01, 0x01  /* T3T/Poll/Frame */
 };
+static const guint8 RF_DISCOVER_MAP_CMD_RW_PEER_A_B[] = {
+    0x21, 0x00, 0x10, 0x05,
+    0x01, 0x01, 0x01, /* T1T/Poll/Frame */
+    0x02, 0x01, 0x01, /* T2T/Poll/Frame */
+    0x04, 0x01, 0x02, /* IsoDep/Poll/IsoDep */
+    0x05, 0x01, 0x03, /* NfcDep/Poll/NfcDep */
+    0x05, 0x02, 0x03  /* NfcDep/Listen/NfcDep */
+};
 static const guint8 RF_DISCOVER_MAP_CMD_RW_PEER[] = {
     0x21, 0x00, 0x13, 0x06,
     0x01, 0x01, 0x01, /* T1T/Poll/Frame */
@@ -506,6 +521,14 @@ static const guint8 RF_DISCOVER_CMD_RW_A_B_V[] = {
     0x01, 0x01, /* PassivePollB */
     0x06, 0x01  /* PassivePollV */
 };
+static const guint8 RF_DISCOVER_CMD_RW_PEER_A_B[] = {
+    0x21, 0x03, 0x0b, 0x05,
+    0x03, 0x01, /* ActivePollA */
+    0x00, 0x01, /* PassivePollA */
+    0x01, 0x01, /* PassivePollB */
+    0x83, 0x01, /* ActiveListenA */
+    0x80, 0x01  /* PassiveListenA */
+};
 static const guint8 RF_DISCOVER_CMD_RW_PEER_A_B_F[] = {
     0x21, 0x03, 0x13, 0x09,
     0x03, 0x01, /* ActivePollA */
@@ -1007,6 +1030,10 @@ test_hal_io_read_cb(
         hal->rsp_expected--;
         test_hal_io_read_one(hal);
         test_hal_io_flush_ntf(hal);
+        /* There may be more than one command waiting for a response */
+        if (hal->rsp_expected && !hal->read_id && test_hal_io_next_rsp(hal)) {
+            hal->read_id = g_idle_add(test_hal_io_read_cb, hal);
+        }
     }
     return G_SOURCE_REMOVE;
 }
@@ -1224,10 +1251,14 @@ test_null(
 
     g_assert(!nci_core_new(NULL));
     g_assert(!nci_core_send_data_msg(NULL, 0, NULL, NULL, NULL, NULL));
+    g_assert(!nci_core_send_data_buf(NULL, 0, NULL, 0, NULL, NULL, NULL));
+    g_assert(!nci_core_send_data_msgv(NULL, 0, NULL, 0, NULL, NULL, NULL));
     g_assert(!nci_core_add_current_state_changed_handler(NULL, NULL, NULL));
     g_assert(!nci_core_add_next_state_changed_handler(NULL, NULL, NULL));
     g_assert(!nci_core_add_intf_activated_handler(NULL, NULL, NULL));
     g_assert(!nci_core_add_data_packet_handler(NULL, NULL, NULL));
+    g_assert(!nci_core_add_data_sink(NULL, 0, NULL, NULL));
+    g_assert(!nci_core_add_data_bytes_sink(NULL, 0, NULL, NULL));
     g_assert(!nci_core_add_params_change_handler(NULL, NULL, NULL));
     g_assert(!nci_core_add_param_change_handler(NULL, 0, NULL, NULL));
 
@@ -1241,6 +1272,19 @@ test_null(
         NULL, NULL));
     nci_core_remove_handler(nci, 0);
     nci_core_cancel(nci, 0);
+    nci_core_cancel_data(nci, 0);
+    nci_core_set_data_scheduler(nci, NCI_DATA_SCHED_ROUND_ROBIN);
+    nci_core_set_data_weight(nci, 0, 2);
+    g_assert(nci_core_get_data_stats(nci, 0, NULL));
+    g_assert(!nci_core_get_data_stats(nci, 0xff, NULL));
+    g_assert(nci_core_get_data_rx_status(nci, 0, NULL));
+    g_assert(!nci_core_get_data_rx_status(nci, 0xff, NULL));
+    nci_core_data_consumed(nci, 0, 1); /* No window yet */
+    nci_core_set_data_rx_window(nci, 0, 0); /* Doesn't allocate anything */
+    nci_core_set_data_rx_window(nci, 0xff, 1); /* Invalid cid */
+    nci_core_set_max_write_packets(nci, 0);
+    g_assert(!nci_core_get_stats(nci));
+    nci_core_reset_stats(nci);
 
     g_assert_cmpint(nci_core_get_tech(NULL), == ,NCI_TECH_NONE);
     g_assert_cmpint(nci_core_set_tech(NULL, NCI_TECH_A), == ,NCI_TECH_NONE);
@@ -1250,7 +1294,28 @@ test_null(
     nci_core_set_params(NULL, NULL, FALSE);
     nci_core_set_state(NULL, NCI_STATE_INIT);
     nci_core_set_op_mode(NULL, NFC_OP_MODE_NONE);
+    nci_core_set_max_write_packets(NULL, 0);
     nci_core_cancel(NULL, 0);
+    nci_core_cancel_data(NULL, 0);
+    nci_core_remove_data_sink(NULL, 0);
+    nci_core_set_data_rx_window(NULL, 0, 0);
+    nci_core_data_consumed(NULL, 0, 0);
+    g_assert(!nci_core_get_data_rx_status(NULL, 0, NULL));
+    nci_core_set_data_scheduler(NULL, NCI_DATA_SCHED_PRIORITY);
+    nci_core_set_data_weight(NULL, 0, 0);
+    g_assert(!nci_core_get_data_stats(NULL, 0, NULL));
+    g_assert(!nci_core_get_stats(NULL));
+    g_assert(!nci_core_get_sm_stats(NULL, NULL));
+    nci_core_reset_stats(NULL);
+    nci_core_set_stats_log_interval(NULL, 0);
+    nci_core_set_trace_size(NULL, 0);
+    nci_core_set_select_policy(NULL, NULL);
+    nci_core_set_activation_cache_size(NULL, 0);
+    nci_core_set_data_rx_limit(NULL, 0, 0);
+    g_assert(!nci_core_get_activation_info(NULL, NULL));
+    g_assert(!nci_core_get_activation(NULL));
+    g_assert(!nci_core_get_trace(NULL));
+    g_assert(!nci_core_save_trace(NULL, NULL));
     nci_core_remove_handler(NULL, 0);
     nci_core_restart(NULL);
     nci_core_free(NULL);
@@ -1348,52 +1413,1379 @@ test_restart_done(
 
 static
 void
-test_restart(
-    void)
+test_restart(
+    void)
+{
+    TestHalIo* hal = test_hal_io_new();
+    NciCore* nci = nci_core_new(&hal->io);
+    GMainLoop* loop = g_main_loop_new(NULL, TRUE);
+    gulong id;
+
+    nci->cmd_timeout = (test_opt.flags & TEST_FLAG_DEBUG) ? 0 :
+        TEST_DEFAULT_CMD_TIMEOUT;
+
+    /* Responses */
+    test_hal_io_queue_rsp(hal, CORE_RESET_RSP);
+    test_hal_io_queue_ntf(hal, CORE_IGNORED_NTF);
+    test_hal_io_queue_rsp(hal, CORE_INIT_RSP);
+    test_hal_io_queue_rsp(hal, CORE_SET_CONFIG_RSP);
+
+    id = nci_core_add_current_state_changed_handler(nci,
+        test_restart_done, loop);
+    nci_core_restart(nci);
+    test_run_loop(&test_opt, loop);
+    nci_core_remove_handler(nci, id);
+
+    g_assert(nci->current_state == NCI_RFST_IDLE);
+    g_assert(nci->next_state == NCI_RFST_IDLE);
+
+    /* Again with a cancel */
+    nci_core_set_state(nci, NCI_RFST_DISCOVERY);
+    GDEBUG("Starting all over again");
+    nci_core_restart(nci); /* Cancels the above request */
+    test_hal_io_queue_rsp(hal, CORE_RESET_RSP);
+    test_hal_io_queue_ntf(hal, CORE_IGNORED_NTF);
+    test_hal_io_queue_rsp(hal, CORE_INIT_RSP);
+    test_hal_io_queue_rsp(hal, CORE_SET_CONFIG_RSP);
+
+    id = nci_core_add_current_state_changed_handler(nci,
+        test_restart_done, loop);
+    test_run_loop(&test_opt, loop);
+    nci_core_remove_handler(nci, id);
+
+    g_assert(nci->current_state == NCI_RFST_IDLE);
+    g_assert(nci->next_state == NCI_RFST_IDLE);
+
+    nci_core_free(nci);
+    test_hal_io_free(hal);
+    g_main_loop_unref(loop);
+}
+
+/*==========================================================================*
+ * cmd_window
+ *==========================================================================*/
+
+typedef struct test_cmd_window_data {
+    TestHalIo* hal;
+    GMainLoop* loop;
+    GString* order;
+    guint pending;
+} TestCmdWindowData;
+
+#define TEST_PROP_GID (0x0f)
+
+static const guint8 TEST_PROP_CMD_1[] = { 0x2f, 0x01, 0x00 };
+static const guint8 TEST_PROP_CMD_2[] = { 0x2f, 0x02, 0x00 };
+static const guint8 TEST_PROP_CMD_3[] = { 0x2f, 0x02, 0x01, 0x03 };
+static const guint8 TEST_PROP_RSP_1[] = { 0x4f, 0x01, 0x01, 0x00 };
+static const guint8 TEST_PROP_RSP_2[] = { 0x4f, 0x02, 0x01, 0x00 };
+static const guint8 TEST_PROP_RSP_3[] = { 0x4f, 0x02, 0x01, 0x03 };
+
+static
+void
+test_cmd_window_rsp(
+    TestCmdWindowData* test,
+    char id,
+    NCI_REQUEST_STATUS status,
+    const GUtilData* payload)
+{
+    g_assert_cmpuint(status, == ,NCI_REQUEST_SUCCESS);
+    g_assert_cmpuint(payload->size, == ,1);
+    g_string_append_c(test->order, id);
+    g_string_append_printf(test->order, "%u",
+        test->hal->cmd_expected->len);
+    g_assert(test->pending > 0);
+    if (!--test->pending) {
+        test_quit_later(test->loop);
+    }
+}
+
+static
+void
+test_cmd_window_rsp1(
+    NCI_REQUEST_STATUS status,
+    const GUtilData* payload,
+    gpointer user_data)
+{
+    g_assert_cmpuint(payload->bytes[0], == ,0);
+    test_cmd_window_rsp(user_data, 'a', status, payload);
+}
+
+static
+void
+test_cmd_window_rsp2(
+    NCI_REQUEST_STATUS status,
+    const GUtilData* payload,
+    gpointer user_data)
+{
+    g_assert_cmpuint(payload->bytes[0], == ,0);
+    test_cmd_window_rsp(user_data, 'b', status, payload);
+}
+
+static
+void
+test_cmd_window_rsp3(
+    NCI_REQUEST_STATUS status,
+    const GUtilData* payload,
+    gpointer user_data)
+{
+    g_assert_cmpuint(payload->bytes[0], == ,3);
+    test_cmd_window_rsp(user_data, 'c', status, payload);
+}
+
+static
+void
+test_cmd_window_cancelled(
+    NCI_REQUEST_STATUS status,
+    const GUtilData* payload,
+    gpointer user_data)
+{
+    g_assert_cmpuint(status, == ,NCI_REQUEST_CANCELLED);
+    g_assert_cmpuint(payload->size, == ,0);
+    (*((int*)user_data))++;
+}
+
+static
+void
+test_cmd_window_queue(
+    NciSm* sm,
+    guint8 oid,
+    const void* data,
+    gsize len,
+    NciSmResponseFunc resp,
+    TestCmdWindowData* test)
+{
+    GBytes* payload = g_bytes_new(data, len);
+
+    test->pending++;
+    g_assert(nci_sm_queue_command(sm, TEST_PROP_GID, oid, payload,
+        resp, test));
+    g_bytes_unref(payload);
+}
+
+static
+void
+test_cmd_window(
+    gconstpointer test_data)
+{
+    const guint window = GPOINTER_TO_UINT(test_data);
+    static const guint8 param3[] = { 0x03 };
+    TestCmdWindowData test;
+    NciCore* nci;
+    NciSm* sm;
+
+    memset(&test, 0, sizeof(test));
+    test.hal = test_hal_io_new();
+    test.loop = g_main_loop_new(NULL, TRUE);
+    test.order = g_string_new(NULL);
+    nci = nci_core_new(&test.hal->io);
+    nci->cmd_timeout = (test_opt.flags & TEST_FLAG_DEBUG) ? 0 :
+        TEST_DEFAULT_CMD_TIMEOUT;
+    nci->cmd_window = window;
+    sm = nci_core_sm(nci);
+
+    /* The last two commands have the same GID/OID */
+    g_ptr_array_add(test.hal->cmd_expected,
+        g_bytes_new_static(TEST_ARRAY_AND_SIZE(TEST_PROP_CMD_1)));
+    g_ptr_array_add(test.hal->cmd_expected,
+        g_bytes_new_static(TEST_ARRAY_AND_SIZE(TEST_PROP_CMD_2)));
+    g_ptr_array_add(test.hal->cmd_expected,
+        g_bytes_new_static(TEST_ARRAY_AND_SIZE(TEST_PROP_CMD_3)));
+    test_hal_io_queue_rsp(test.hal, TEST_PROP_RSP_1);
+    test_hal_io_queue_rsp(test.hal, TEST_PROP_RSP_2);
+    test_hal_io_queue_rsp(test.hal, TEST_PROP_RSP_3);
+
+    test_cmd_window_queue(sm, 0x01, NULL, 0, test_cmd_window_rsp1, &test);
+    test_cmd_window_queue(sm, 0x02, NULL, 0, test_cmd_window_rsp2, &test);
+    test_cmd_window_queue(sm, 0x02, TEST_ARRAY_AND_SIZE(param3),
+        test_cmd_window_rsp3, &test);
+    test_run_loop(&test_opt, test.loop);
+
+    /*
+     * Each response is followed by the number of commands which
+     * haven't been written by the time the response is received.
+     */
+    if (window < 2) {
+        g_assert_cmpstr(test.order->str, == ,"a2b1c0");
+    } else {
+        g_assert_cmpstr(test.order->str, == ,"a1b1c0");
+    }
+
+    nci_core_free(nci);
+    test_hal_io_free(test.hal);
+    g_string_free(test.order, TRUE);
+    g_main_loop_unref(test.loop);
+}
+
+static
+void
+test_cmd_window_cancel(
+    void)
+{
+    TestCmdWindowData test;
+    NciCore* nci;
+    NciSm* sm;
+    int cancelled = 0;
+
+    memset(&test, 0, sizeof(test));
+    test.hal = test_hal_io_new();
+    test.loop = g_main_loop_new(NULL, TRUE);
+    test.order = g_string_new(NULL);
+    nci = nci_core_new(&test.hal->io);
+    nci->cmd_timeout = (test_opt.flags & TEST_FLAG_DEBUG) ? 0 :
+        TEST_DEFAULT_CMD_TIMEOUT;
+    nci->cmd_window = 2;
+    sm = nci_core_sm(nci);
+
+    /* Neither of these two gets written */
+    g_assert(nci_sm_queue_command(sm, TEST_PROP_GID, 0x01, NULL,
+        test_cmd_window_cancelled, &cancelled));
+    g_assert(nci_sm_queue_command(sm, TEST_PROP_GID, 0x02, NULL,
+        test_cmd_window_cancelled, &cancelled));
+
+    /* Sending a command cancels the queued ones */
+    g_ptr_array_add(test.hal->cmd_expected,
+        g_bytes_new_static(TEST_ARRAY_AND_SIZE(TEST_PROP_CMD_2)));
+    test_hal_io_queue_rsp(test.hal, TEST_PROP_RSP_2);
+    test.pending++;
+    g_assert(nci_sm_send_command(sm, TEST_PROP_GID, 0x02, NULL,
+        test_cmd_window_rsp2, &test));
+    g_assert_cmpint(cancelled, == ,2);
+    test_run_loop(&test_opt, test.loop);
+    g_assert_cmpstr(test.order->str, == ,"b0");
+
+    nci_core_free(nci);
+    test_hal_io_free(test.hal);
+    g_string_free(test.order, TRUE);
+    g_main_loop_unref(test.loop);
+}
+
+/*==========================================================================*
+ * cmd_stats
+ *==========================================================================*/
+
+#if NCI_STATS
+
+static
+void
+test_cmd_stats_timeout(
+    NCI_REQUEST_STATUS status,
+    const GUtilData* payload,
+    gpointer user_data)
+{
+    g_assert_cmpuint(status, == ,NCI_REQUEST_TIMEOUT);
+    g_main_loop_quit(user_data);
+}
+
+static
+void
+test_cmd_stats_check(
+    const NciCmdStats* cmd,
+    guint8 oid,
+    guint sent,
+    guint responses,
+    guint errors,
+    guint timeouts,
+    guint cancelled)
+{
+    guint i, n = 0;
+
+    g_assert_cmpuint(cmd->gid, == ,TEST_PROP_GID);
+    g_assert_cmpuint(cmd->oid, == ,oid);
+    g_assert_cmpuint(cmd->sent, == ,sent);
+    g_assert_cmpuint(cmd->responses, == ,responses);
+    g_assert_cmpuint(cmd->errors, == ,errors);
+    g_assert_cmpuint(cmd->timeouts, == ,timeouts);
+    g_assert_cmpuint(cmd->cancelled, == ,cancelled);
+    g_assert_cmpuint(cmd->latency_max, <= ,cmd->latency_total);
+    for (i = 0; i < NCI_CMD_LATENCY_BUCKETS; i++) {
+        n += cmd->latency[i];
+    }
+    g_assert_cmpuint(n, == ,responses);
+}
+
+static
+void
+test_cmd_stats(
+    void)
+{
+    static const guint8 param3[] = { 0x03 };
+    TestCmdWindowData test;
+    NciCoreStats* stats;
+    NciCore* nci;
+    NciSm* sm;
+    int cancelled = 0;
+
+    memset(&test, 0, sizeof(test));
+    test.hal = test_hal_io_new();
+    test.loop = g_main_loop_new(NULL, TRUE);
+    test.order = g_string_new(NULL);
+    nci = nci_core_new(&test.hal->io);
+    nci->cmd_timeout = (test_opt.flags & TEST_FLAG_DEBUG) ? 0 :
+        TEST_DEFAULT_CMD_TIMEOUT;
+    sm = nci_core_sm(nci);
+    g_assert(!nci_core_get_stats(nci));
+
+    /* The last response carries an error status */
+    g_ptr_array_add(test.hal->cmd_expected,
+        g_bytes_new_static(TEST_ARRAY_AND_SIZE(TEST_PROP_CMD_1)));
+    g_ptr_array_add(test.hal->cmd_expected,
+        g_bytes_new_static(TEST_ARRAY_AND_SIZE(TEST_PROP_CMD_2)));
+    g_ptr_array_add(test.hal->cmd_expected,
+        g_bytes_new_static(TEST_ARRAY_AND_SIZE(TEST_PROP_CMD_3)));
+    test_hal_io_queue_rsp(test.hal, TEST_PROP_RSP_1);
+    test_hal_io_queue_rsp(test.hal, TEST_PROP_RSP_2);
+    test_hal_io_queue_rsp(test.hal, TEST_PROP_RSP_3);
+    test_cmd_window_queue(sm, 0x01, NULL, 0, test_cmd_window_rsp1, &test);
+    test_cmd_window_queue(sm, 0x02, NULL, 0, test_cmd_window_rsp2, &test);
+    test_cmd_window_queue(sm, 0x02, TEST_ARRAY_AND_SIZE(param3),
+        test_cmd_window_rsp3, &test);
+    test_run_loop(&test_opt, test.loop);
+
+    stats = nci_core_get_stats(nci);
+    g_assert(stats);
+    g_assert_cmpuint(stats->count, == ,2);
+    test_cmd_stats_check(stats->cmd + 0, 0x01, 1, 1, 0, 0, 0);
+    test_cmd_stats_check(stats->cmd + 1, 0x02, 2, 2, 1, 0, 0);
+    g_assert_cmpuint(stats->cmd[1].last_error, == ,0x03);
+    g_free(stats);
+
+    nci_core_reset_stats(nci);
+    g_assert(!nci_core_get_stats(nci));
+
+    /* Submitted but cancelled before being written */
+    nci->cmd_window = 2;
+    g_assert(nci_sm_queue_command(sm, TEST_PROP_GID, 0x01, NULL,
+        test_cmd_window_cancelled, &cancelled));
+
+    /* This one doesn't get any response */
+    nci->cmd_timeout = 10;
+    g_ptr_array_add(test.hal->cmd_expected,
+        g_bytes_new_static(TEST_ARRAY_AND_SIZE(TEST_PROP_CMD_2)));
+    g_assert(nci_sm_send_command(sm, TEST_PROP_GID, 0x02, NULL,
+        test_cmd_stats_timeout, test.loop));
+    g_assert_cmpint(cancelled, == ,1);
+    test_run_loop(&test_opt, test.loop);
+
+    stats = nci_core_get_stats(nci);
+    g_assert(stats);
+    g_assert_cmpuint(stats->count, == ,2);
+    test_cmd_stats_check(stats->cmd + 0, 0x01, 1, 0, 0, 0, 1);
+    test_cmd_stats_check(stats->cmd + 1, 0x02, 1, 0, 0, 1, 0);
+    g_free(stats);
+
+    nci_core_free(nci);
+    test_hal_io_free(test.hal);
+    g_string_free(test.order, TRUE);
+    g_main_loop_unref(test.loop);
+}
+
+#endif /* NCI_STATS */
+
+/*==========================================================================*
+ * data_sink
+ *==========================================================================*/
+
+typedef struct test_data_sink {
+    NciCore* nci;
+    GString* log;
+    gulong self_removing_id;
+    gulong added_id;
+} TestDataSink;
+
+static
+void
+test_data_sink_log(
+    TestDataSink* test,
+    char who,
+    guint8 cid,
+    const void* payload,
+    guint len)
+{
+    g_assert_cmpuint(len, == ,1);
+    g_assert_cmpuint(((const guint8*)payload)[0], == ,cid);
+    g_string_append_printf(test->log, "%c%u", who, cid);
+}
+
+static
+void
+test_data_sink_any(
+    NciCore* nci,
+    guint8 cid,
+    const void* payload,
+    guint len,
+    void* user_data)
+{
+    test_data_sink_log(user_data, 'a', cid, payload, len);
+}
+
+static
+void
+test_data_sink_cid1(
+    NciCore* nci,
+    guint8 cid,
+    const void* payload,
+    guint len,
+    void* user_data)
+{
+    g_assert_cmpuint(cid, == ,1);
+    test_data_sink_log(user_data, 'c', cid, payload, len);
+}
+
+static
+void
+test_data_sink_added(
+    NciCore* nci,
+    guint8 cid,
+    const void* payload,
+    guint len,
+    void* user_data)
+{
+    test_data_sink_log(user_data, 'n', cid, payload, len);
+}
+
+static
+void
+test_data_sink_self_removing(
+    NciCore* nci,
+    guint8 cid,
+    const void* payload,
+    guint len,
+    void* user_data)
+{
+    TestDataSink* test = user_data;
+
+    test_data_sink_log(test, 'r', cid, payload, len);
+
+    /* This one doesn't get the current packet */
+    nci_core_remove_data_sink(nci, test->self_removing_id);
+    test->self_removing_id = 0;
+    test->added_id = nci_core_add_data_sink(nci, NCI_CORE_ANY_CID,
+        test_data_sink_added, test);
+    g_assert(test->added_id);
+}
+
+static
+void
+test_data_sink_handler(
+    NciCore* nci,
+    guint8 cid,
+    const void* payload,
+    guint len,
+    void* user_data)
+{
+    test_data_sink_log(user_data, 'h', cid, payload, len);
+}
+
+static
+void
+test_data_sink_read(
+    TestHalIo* hal,
+    guint8 cid)
+{
+    guint8 packet[4];
+
+    packet[0] = NCI_MT_DATA_PKT | cid;
+    packet[1] = 0;
+    packet[2] = 1;
+    packet[3] = cid;
+    hal->sar->fn->read(hal->sar, packet, sizeof(packet));
+}
+
+static
+void
+test_data_sink(
+    void)
+{
+    TestHalIo* hal = test_hal_io_new();
+    NciCore* nci = nci_core_new(&hal->io);
+    NciSar* sar = nci_sm_sar(nci_core_sm(nci));
+    TestDataSink test;
+    gulong id[3];
+
+    memset(&test, 0, sizeof(test));
+    test.nci = nci;
+    test.log = g_string_new(NULL);
+    nci_sar_set_max_logical_connections(sar, 2);
+    g_assert(nci_sar_start(sar));
+    g_assert(hal->sar);
+
+    g_assert(!nci_core_add_data_sink(nci, 0, NULL, NULL));
+    g_assert(!nci_core_add_data_bytes_sink(nci, 0, NULL, NULL));
+    id[0] = nci_core_add_data_packet_handler(nci, test_data_sink_handler,
+        &test);
+    id[1] = nci_core_add_data_sink(nci, NCI_CORE_ANY_CID,
+        test_data_sink_any, &test);
+    id[2] = nci_core_add_data_sink(nci, 1, test_data_sink_cid1, &test);
+    test.self_removing_id = nci_core_add_data_sink(nci, NCI_CORE_ANY_CID,
+        test_data_sink_self_removing, &test);
+    g_assert(id[0]);
+    g_assert(id[1]);
+    g_assert(id[2]);
+    g_assert(test.self_removing_id);
+
+    /* Sinks go first, in the order they have been added */
+    test_data_sink_read(hal, 0);
+    g_assert_cmpstr(test.log->str, == ,"a0r0h0");
+    g_assert(!test.self_removing_id);
+    g_string_truncate(test.log, 0);
+    test_data_sink_read(hal, 1);
+    g_assert_cmpstr(test.log->str, == ,"a1c1n1h1");
+    g_string_truncate(test.log, 0);
+
+    /* Remove the ones in the middle */
+    nci_core_remove_data_sink(nci, id[2]);
+    nci_core_remove_data_sink(nci, id[2]); /* Does nothing */
+    nci_core_remove_data_sink(nci, 0); /* Does nothing */
+    nci_core_remove_data_sink(nci, test.added_id);
+    test_data_sink_read(hal, 1);
+    g_assert_cmpstr(test.log->str, == ,"a1h1");
+
+    nci_core_remove_data_sink(nci, id[1]);
+    nci_core_remove_handler(nci, id[0]);
+    nci_core_free(nci);
+    test_hal_io_free(hal);
+    g_string_free(test.log, TRUE);
+}
+
+/*==========================================================================*
+ * data_sink_bytes
+ *==========================================================================*/
+
+static
+void
+test_data_sink_bytes_cb(
+    NciCore* nci,
+    guint8 cid,
+    GBytes* payload,
+    void* user_data)
+{
+    GPtrArray* packets = user_data;
+
+    g_ptr_array_add(packets, g_bytes_ref(payload));
+}
+
+static
+void
+test_data_sink_bytes(
+    void)
+{
+    static const guint8 packet[] = {
+        NCI_MT_DATA_PKT | 1, 0, 2, 0x01, 0x02,
+        NCI_MT_DATA_PKT | NCI_PBF | 1, 0, 1, 0x03,
+        NCI_MT_DATA_PKT | 1, 0, 1, 0x04
+    };
+    TestHalIo* hal = test_hal_io_new();
+    NciCore* nci = nci_core_new(&hal->io);
+    NciSar* sar = nci_sm_sar(nci_core_sm(nci));
+    GPtrArray* packets = g_ptr_array_new_with_free_func((GDestroyNotify)
+        g_bytes_unref);
+    GBytes* bytes = g_bytes_new(packet, sizeof(packet));
+    const guint8* hal_data = g_bytes_get_data(bytes, NULL);
+    TestDataSink test;
+    gulong id[3];
+    gsize size;
+    const guint8* data;
+
+    memset(&test, 0, sizeof(test));
+    test.log = g_string_new(NULL);
+    nci_sar_set_max_logical_connections(sar, 2);
+    g_assert(nci_sar_start(sar));
+    g_assert(hal->sar);
+
+    id[0] = nci_core_add_data_bytes_sink(nci, 1, test_data_sink_bytes_cb,
+        packets);
+    id[1] = nci_core_add_data_bytes_sink(nci, 0, test_data_sink_bytes_cb,
+        packets);
+    id[2] = nci_core_add_data_sink(nci, 0, test_data_sink_any, &test);
+    g_assert(id[0]);
+    g_assert(id[1]);
+    g_assert(id[2]);
+
+    /* Unsegmented packet references the buffer provided by HAL */
+    hal->sar->fn->read_bytes(hal->sar, bytes);
+    g_bytes_unref(bytes);
+    g_assert_cmpuint(packets->len, == ,2);
+    data = g_bytes_get_data(packets->pdata[0], &size);
+    g_assert_cmpuint(size, == ,2);
+    g_assert(data == hal_data + 3); /* Right after the header */
+    data = g_bytes_get_data(packets->pdata[1], &size);
+    g_assert_cmpuint(size, == ,2);
+    g_assert_cmpuint(data[0], == ,0x03);
+    g_assert_cmpuint(data[1], == ,0x04);
+
+    /* Raw pointer sinks still work */
+    test_data_sink_read(hal, 0);
+    g_assert_cmpuint(packets->len, == ,3);
+    g_assert_cmpstr(test.log->str, == ,"a0");
+    data = g_bytes_get_data(packets->pdata[2], &size);
+    g_assert_cmpuint(size, == ,1);
+    g_assert_cmpuint(data[0], == ,0);
+
+    /* No more bytes sinks, no more GBytes */
+    nci_core_remove_data_sink(nci, id[0]);
+    nci_core_remove_data_sink(nci, id[1]);
+    test_data_sink_read(hal, 0);
+    g_assert_cmpuint(packets->len, == ,3);
+    g_assert_cmpstr(test.log->str, == ,"a0a0");
+
+    nci_core_remove_data_sink(nci, id[2]);
+    nci_core_free(nci);
+    test_hal_io_free(hal);
+    g_ptr_array_free(packets, TRUE);
+    g_string_free(test.log, TRUE);
+}
+
+/*==========================================================================*
+ * data_rx_window
+ *==========================================================================*/
+
+static
+void
+test_data_rx_window_consume(
+    NciCore* nci,
+    guint8 cid,
+    const void* payload,
+    guint len,
+    void* user_data)
+{
+    test_data_sink_log(user_data, 'c', cid, payload, len);
+    nci_core_data_consumed(nci, cid, len);
+}
+
+static
+void
+test_data_rx_window_check(
+    NciCore* nci,
+    guint8 cid,
+    guint window,
+    guint outstanding,
+    guint queued)
+{
+    NciConnRxStatus status;
+
+    memset(&status, 0xaa, sizeof(status));
+    g_assert(nci_core_get_data_rx_status(nci, cid, &status));
+    g_assert_cmpuint(status.window, == ,window);
+    g_assert_cmpuint(status.outstanding, == ,outstanding);
+    g_assert_cmpuint(status.queued, == ,queued);
+    g_assert_cmpuint(status.queued_bytes, == ,queued); /* 1 byte each */
+}
+
+static
+void
+test_data_rx_window(
+    void)
+{
+    TestHalIo* hal = test_hal_io_new();
+    NciCore* nci = nci_core_new(&hal->io);
+    NciSar* sar = nci_sm_sar(nci_core_sm(nci));
+    NciConnRxStatus status;
+    TestDataSink test;
+    gulong id[2];
+
+    memset(&test, 0, sizeof(test));
+    test.log = g_string_new(NULL);
+    nci_sar_set_max_logical_connections(sar, 3);
+    g_assert(nci_sar_start(sar));
+    g_assert(hal->sar);
+
+    /* Nothing is tracked by default */
+    test_data_rx_window_check(nci, 1, 0, 0, 0);
+    g_assert(nci_core_get_data_rx_status(nci, 1, &status));
+    g_assert_cmpuint(status.limit, == ,0x10000);
+    g_assert_cmpuint(status.dropped, == ,0);
+    id[0] = nci_core_add_data_packet_handler(nci, test_data_sink_handler,
+        &test);
+    nci_core_set_data_rx_window(nci, 1, 2);
+    test_data_rx_window_check(nci, 1, 2, 0, 0);
+    test_data_rx_window_check(nci, 0, 0, 0, 0);
+
+    /* Third packet doesn't fit into the window */
+    test_data_sink_read(hal, 1);
+    test_data_sink_read(hal, 1);
+    test_data_sink_read(hal, 1);
+    test_data_sink_read(hal, 0); /* Other connections are not affected */
+    g_assert_cmpstr(test.log->str, == ,"h1h1h0");
+    test_data_rx_window_check(nci, 1, 2, 2, 1);
+    g_string_truncate(test.log, 0);
+
+    /* Acknowledging one byte lets the held packet through */
+    nci_core_data_consumed(nci, 1, 1);
+    g_assert_cmpstr(test.log->str, == ,"h1");
+    test_data_rx_window_check(nci, 1, 2, 2, 0);
+    nci_core_data_consumed(nci, 1, 100); /* Too much */
+    test_data_rx_window_check(nci, 1, 2, 0, 0);
+    g_string_truncate(test.log, 0);
+
+    /* Consumer acknowledging from the callback never falls behind */
+    nci_core_remove_handler(nci, id[0]);
+    id[1] = nci_core_add_data_sink(nci, 2, test_data_rx_window_consume,
+        &test);
+    nci_core_set_data_rx_window(nci, 2, 1);
+    test_data_sink_read(hal, 2);
+    test_data_sink_read(hal, 2);
+    g_assert_cmpstr(test.log->str, == ,"c2c2");
+    test_data_rx_window_check(nci, 2, 1, 0, 0);
+    g_string_truncate(test.log, 0);
+
+    /* Held packets are released when the window is removed */
+    nci_core_remove_data_sink(nci, id[1]);
+    id[0] = nci_core_add_data_packet_handler(nci, test_data_sink_handler,
+        &test);
+    nci_core_set_data_rx_window(nci, 1, 1);
+    test_data_sink_read(hal, 1);
+    test_data_sink_read(hal, 1);
+    test_data_sink_read(hal, 1);
+    g_assert_cmpstr(test.log->str, == ,"h1");
+    test_data_rx_window_check(nci, 1, 1, 1, 2);
+    nci_core_set_data_rx_window(nci, 1, 0);
+    g_assert_cmpstr(test.log->str, == ,"h1h1h1");
+    test_data_rx_window_check(nci, 1, 0, 0, 0);
+
+    /* Packets which don't fit under the limit are dropped */
+    nci_core_set_data_rx_window(nci, 1, 1);
+    nci_core_set_data_rx_limit(nci, 1, 2);
+    g_string_truncate(test.log, 0);
+    test_data_sink_read(hal, 1);
+    test_data_sink_read(hal, 1);
+    test_data_sink_read(hal, 1);
+    test_data_sink_read(hal, 1);
+    g_assert_cmpstr(test.log->str, == ,"h1");
+    test_data_rx_window_check(nci, 1, 1, 1, 2);
+    memset(&status, 0, sizeof(status));
+    g_assert(nci_core_get_data_rx_status(nci, 1, &status));
+    g_assert_cmpuint(status.limit, == ,2);
+    g_assert_cmpuint(status.dropped, == ,1);
+
+    /* And so is everything else until the queue drains */
+    nci_core_data_consumed(nci, 1, 1);
+    g_assert_cmpstr(test.log->str, == ,"h1h1");
+    test_data_rx_window_check(nci, 1, 1, 1, 1);
+    test_data_sink_read(hal, 1);
+    test_data_rx_window_check(nci, 1, 1, 1, 1);
+    g_assert(nci_core_get_data_rx_status(nci, 1, &status));
+    g_assert_cmpuint(status.dropped, == ,2);
+    nci_core_data_consumed(nci, 1, 1);
+    g_assert_cmpstr(test.log->str, == ,"h1h1h1");
+    test_data_rx_window_check(nci, 1, 1, 1, 0);
+
+    /* The queue has drained, packets are held again */
+    test_data_sink_read(hal, 1);
+    test_data_sink_read(hal, 1);
+    test_data_sink_read(hal, 1);
+    test_data_rx_window_check(nci, 1, 1, 1, 2);
+    g_assert(nci_core_get_data_rx_status(nci, 1, &status));
+    g_assert_cmpuint(status.dropped, == ,3);
+
+    /* Restart discards everything, including the overflow */
+    nci_core_restart(nci);
+    test_data_rx_window_check(nci, 1, 1, 0, 0);
+    g_assert_cmpstr(test.log->str, == ,"h1h1h1");
+
+    /* Whatever is still held gets freed along with NciCore */
+    g_assert(nci_sar_start(sar));
+    nci_core_set_data_rx_limit(nci, 1, 0);
+    test_data_sink_read(hal, 1);
+    test_data_sink_read(hal, 1);
+    test_data_rx_window_check(nci, 1, 1, 1, 1);
+    g_assert(nci_core_get_data_rx_status(nci, 1, &status));
+    g_assert_cmpuint(status.limit, == ,0x10000);
+
+    nci_core_remove_handler(nci, id[0]);
+    nci_core_free(nci);
+    test_hal_io_free(hal);
+    g_string_free(test.log, TRUE);
+}
+
+/*==========================================================================*
+ * nfcc
+ *==========================================================================*/
+
+static const guint8 test_nfcc_t2_poll_a[] = {
+    0x44, 0x00, 0x07, 0x04, 0x9b, 0xfb, 0x4a, 0xeb, 0x2b, 0x80, 0x01, 0x00
+};
+static const guint8 test_nfcc_isodep_poll_a[] = {
+    0x04, 0x00, 0x04, 0x4f, 0x01, 0x74, 0x01, 0x01, 0x20
+};
+static const guint8 test_nfcc_isodep_act[] = {
+    0x0a, 0x78, 0x80, 0x81, 0x02, 0x4b, 0x4f, 0x4e, 0x41, 0x14, 0x11
+};
+
+static
+GBytes*
+test_nfcc_t2_respond(
+    const TestNfccTag* tag,
+    const void* data,
+    guint len)
+{
+    /* Any command gets 16 bytes of zeros and status */
+    static const guint8 reply[17] = { 0 };
+
+    return g_bytes_new_static(reply, sizeof(reply));
+}
+
+static const TestNfccTag test_nfcc_tags[] = {
+    {
+        NCI_RF_INTERFACE_FRAME, NCI_PROTOCOL_T2T, NCI_MODE_PASSIVE_POLL_A,
+        { TEST_ARRAY_AND_SIZE(test_nfcc_t2_poll_a) }, { NULL, 0 },
+        test_nfcc_t2_respond
+    },{
+        NCI_RF_INTERFACE_ISO_DEP, NCI_PROTOCOL_ISO_DEP,
+        NCI_MODE_PASSIVE_POLL_A,
+        { TEST_ARRAY_AND_SIZE(test_nfcc_isodep_poll_a) },
+        { TEST_ARRAY_AND_SIZE(test_nfcc_isodep_act) },
+        NULL /* Echo */
+    }
+};
+
+typedef struct test_nfcc_data {
+    GMainLoop* loop;
+    NCI_STATE wait_state;
+    const NciIntfActivationNtf* wait_ntf;
+    NCI_PROTOCOL protocol;
+    NciActivationInfo info;
+    gboolean info_valid;
+    GByteArray* received;
+    guint expect_bytes;
+    gboolean sent;
+} TestNfccData;
+
+static
+void
+test_nfcc_state_changed(
+    NciCore* nci,
+    void* user_data)
+{
+    TestNfccData* test = user_data;
+
+    GDEBUG("State %d", nci->current_state);
+    if (nci->current_state == test->wait_state) {
+        g_main_loop_quit(test->loop);
+    }
+}
+
+static
+void
+test_nfcc_activated(
+    NciCore* nci,
+    const NciIntfActivationNtf* ntf,
+    void* user_data)
+{
+    TestNfccData* test = user_data;
+
+    g_assert(&nci_core_get_activation(nci)->ntf == ntf);
+    test->protocol = ntf->protocol;
+    test->info_valid = nci_core_get_activation_info(nci, &test->info);
+    g_main_loop_quit(test->loop);
+}
+
+static
+void
+test_nfcc_data_packet(
+    NciCore* nci,
+    guint8 cid,
+    const void* payload,
+    guint len,
+    void* user_data)
+{
+    TestNfccData* test = user_data;
+
+    g_byte_array_append(test->received, payload, len);
+    if (test->received->len >= test->expect_bytes) {
+        g_main_loop_quit(test->loop);
+    }
+}
+
+static
+void
+test_nfcc_data_sent(
+    NciCore* nci,
+    gboolean success,
+    void* user_data)
+{
+    TestNfccData* test = user_data;
+
+    g_assert(success);
+    test->sent = TRUE;
+}
+
+static
+void
+test_nfcc_wait_state(
+    NciCore* nci,
+    TestNfccData* test,
+    NCI_STATE state)
+{
+    if (nci->current_state != state) {
+        test->wait_state = state;
+        test_run_loop(&test_opt, test->loop);
+        test->wait_state = NCI_STATE_INIT;
+    }
+    g_assert_cmpint(nci->current_state, == ,state);
+}
+
+static
+void
+test_nfcc_exchange(
+    NciCore* nci,
+    TestNfccData* test,
+    GBytes* data,
+    guint expect_bytes)
+{
+    g_byte_array_set_size(test->received, 0);
+    test->expect_bytes = expect_bytes;
+    test->sent = FALSE;
+    g_assert(nci_core_send_data_msg(nci, NCI_STATIC_RF_CONN_ID, data,
+        test_nfcc_data_sent, NULL, test));
+    test_run_loop(&test_opt, test->loop);
+    g_assert(test->sent);
+    g_assert_cmpuint(test->received->len, == ,expect_bytes);
+}
+
+static
+void
+test_nfcc_check_sm_stats(
+    NciCore* nci)
+{
+#if NCI_STATS
+    NciSmStats stats;
+    guint i;
+
+    g_assert(!nci_core_get_sm_stats(nci, NULL));
+    g_assert(nci_core_get_sm_stats(nci, &stats));
+    for (i = 0; i < NCI_CORE_TRANSITIONS; i++) {
+        const NciTransitionStats* t = stats.transition + i;
+        const NciTimeHistogram* d = &t->duration;
+        guint j, n = 0;
+
+        GDEBUG("Transition %u: %u/%u", i, t->started, t->failed);
+        for (j = 0; j < NCI_TIME_BUCKETS; j++) {
+            n += d->bucket[j];
+        }
+        g_assert_cmpuint(n, == ,d->count);
+        g_assert_cmpuint(t->started, == ,d->count + t->failed);
+        g_assert(d->max <= d->total);
+    }
+    g_assert_cmpuint(stats.transition[NCI_CORE_TRANSITION_RESET].
+        duration.count, == ,1);
+    g_assert_cmpuint(stats.transition[NCI_CORE_TRANSITION_IDLE_TO_DISCOVERY].
+        duration.count, == ,1);
+    g_assert_cmpuint(stats.transition[NCI_CORE_TRANSITION_POLL_ACTIVE_TO_IDLE].
+        duration.count, == ,1);
+    g_assert_cmpuint(stats.state[NCI_STATE_INIT].entered, == ,1);
+    g_assert_cmpuint(stats.state[NCI_RFST_IDLE].entered, == ,2);
+    g_assert_cmpuint(stats.state[NCI_RFST_POLL_ACTIVE].entered, == ,2);
+    g_assert(stats.state[NCI_RFST_IDLE].residency > 0);
+    g_assert_cmpuint(stats.activation.count, == ,2);
+    g_assert(!stats.stall_stop);
+    g_assert(!stats.stall_error);
+
+    /* Periodic logging can be turned on and off */
+    nci_core_set_stats_log_interval(nci, 1);
+    nci_core_set_stats_log_interval(nci, 0);
+    nci_core_set_stats_log_interval(nci, 60); /* Removed by finalize */
+
+    nci_core_reset_stats(nci);
+    g_assert(nci_core_get_sm_stats(nci, &stats));
+    g_assert(!stats.transition[NCI_CORE_TRANSITION_RESET].started);
+    g_assert(!stats.activation.count);
+#else
+    g_assert(!nci_core_get_sm_stats(nci, NULL));
+#endif
+}
+
+static
+void
+test_nfcc_check_trace(
+    NciCore* nci)
+{
+    GBytes* trace = nci_core_get_trace(nci);
+    char* dir = g_dir_make_tmp(TMP_DIR_TEMPLATE, NULL);
+    char* file = g_build_filename(dir, "trace.pcapng", NULL);
+    gsize size, saved_size;
+    const guint8* data = g_bytes_get_data(trace, &size);
+    char* saved = NULL;
+
+    /*
+     * Headers (48 bytes) followed by the first command (CORE_RESET_CMD)
+     * with the Linux NFC pseudo-header (adapter 0, outgoing NCI packet)
+     */
+    g_assert_cmpuint(size, > ,48 + 32);
+    g_assert_cmpuint(data[48 + 28], == ,0x00);
+    g_assert_cmpuint(data[48 + 29], == ,0x03);
+    g_assert_cmpuint(data[48 + 30], == ,0x20);
+    g_assert_cmpuint(data[48 + 31], == ,0x00);
+
+    g_assert(nci_core_save_trace(nci, file));
+    g_assert(g_file_get_contents(file, &saved, &saved_size, NULL));
+    g_assert_cmpuint(saved_size, == ,size);
+    g_assert(!memcmp(saved, data, 48));
+    g_assert(!nci_core_save_trace(nci, NULL));
+    g_free(saved);
+    g_unlink(file);
+
+    /* Directory is not a file */
+    g_assert(!nci_core_save_trace(nci, dir));
+    g_rmdir(dir);
+    g_free(file);
+    g_free(dir);
+    g_bytes_unref(trace);
+
+    /* Turn it off */
+    nci_core_set_trace_size(nci, 0);
+    g_assert(!nci_core_get_trace(nci));
+}
+
+static
+void
+test_nfcc(
+    gconstpointer test_data)
+{
+    const TestNfccConfig* config = test_data;
+    TestNfcc* nfcc = test_nfcc_new(config);
+    NciCore* nci = nci_core_new(test_nfcc_io(nfcc));
+    guint8 buf[600];
+    GBytes* data;
+    GUtilData value;
+    NciActivation* act;
+    TestNfccData test;
+    gulong id[3];
+    guint i;
+
+    for (i = 0; i < sizeof(buf); i++) {
+        buf[i] = (guint8) i;
+    }
+
+    memset(&test, 0, sizeof(test));
+    test.loop = g_main_loop_new(NULL, TRUE);
+    test.received = g_byte_array_new();
+    id[0] = nci_core_add_current_state_changed_handler(nci,
+        test_nfcc_state_changed, &test);
+    id[1] = nci_core_add_intf_activated_handler(nci,
+        test_nfcc_activated, &test);
+    id[2] = nci_core_add_data_packet_handler(nci,
+        test_nfcc_data_packet, &test);
+
+    /* Reset and initialization */
+    g_assert(!nci_core_get_trace(nci));
+    nci_core_set_trace_size(nci, 0x10000);
+    nci_core_set_op_mode(nci, NFC_OP_MODE_RW | NFC_OP_MODE_POLL);
+    nci_core_set_state(nci, NCI_RFST_IDLE);
+    test_nfcc_wait_state(nci, &test, NCI_RFST_IDLE);
+    g_assert_cmpint(test_nfcc_rf_state(nfcc), == ,NCI_RFST_IDLE);
+
+    /* Nothing in the field yet */
+    nci_core_set_state(nci, NCI_RFST_DISCOVERY);
+    test_nfcc_wait_state(nci, &test, NCI_RFST_DISCOVERY);
+    g_assert_cmpint(test_nfcc_rf_state(nfcc), == ,NCI_RFST_DISCOVERY);
+    g_assert(test_nfcc_get_config(nfcc, NCI_CONFIG_TOTAL_DURATION, &value));
+    g_assert(!test_nfcc_get_config(nfcc, 0xff, NULL));
+
+    /* Type 2 tag shows up */
+    test_nfcc_add_tags(nfcc, test_nfcc_tags, 1);
+    test_run_loop(&test_opt, test.loop);
+    g_assert_cmpint(test.protocol, == ,NCI_PROTOCOL_T2T);
+    g_assert(test_nfcc_active_tag(nfcc) == test_nfcc_tags);
+    test_nfcc_wait_state(nci, &test, NCI_RFST_POLL_ACTIVE);
+    act = nci_util_activation_ref(nci_core_get_activation(nci));
+    g_assert(act);
+    data = g_bytes_new(buf, 2);
+    test_nfcc_exchange(nci, &test, data, 17);
+    g_bytes_unref(data);
+
+    /* And goes away */
+    test_nfcc_remove_tags(nfcc);
+    test_nfcc_wait_state(nci, &test, NCI_RFST_DISCOVERY);
+    g_assert(!test_nfcc_active_tag(nfcc));
+
+    /* Two tags at once, ISO-DEP one gets selected */
+    test.protocol = NCI_PROTOCOL_UNDETERMINED;
+    test_nfcc_add_tags(nfcc, TEST_ARRAY_AND_COUNT(test_nfcc_tags));
+    test_run_loop(&test_opt, test.loop);
+    g_assert_cmpint(test.protocol, == ,NCI_PROTOCOL_ISO_DEP);
+    g_assert(test_nfcc_active_tag(nfcc) == test_nfcc_tags + 1);
+    test_nfcc_wait_state(nci, &test, NCI_RFST_POLL_ACTIVE);
+
+    /* The first activation is still there */
+    g_assert(nci_core_get_activation(nci) != act);
+    g_assert_cmpint(act->ntf.protocol, == ,NCI_PROTOCOL_T2T);
+    g_assert(act->ntf.mode_param);
+    g_assert_cmpuint(act->ntf.mode_param->poll_a.nfcid1_len, == ,7);
+    nci_util_activation_unref(act);
+
+    /* Long message gets segmented in both directions */
+    data = g_bytes_new(buf, sizeof(buf));
+    test_nfcc_exchange(nci, &test, data, sizeof(buf));
+    g_assert(!memcmp(test.received->data, buf, sizeof(buf)));
+    g_bytes_unref(data);
+
+    /* Back to idle */
+    nci_core_set_state(nci, NCI_RFST_IDLE);
+    test_nfcc_wait_state(nci, &test, NCI_RFST_IDLE);
+    g_assert_cmpint(test_nfcc_rf_state(nfcc), == ,NCI_RFST_IDLE);
+    g_assert(test_nfcc_stats(nfcc)->commands > 0);
+    g_assert_cmpuint(test_nfcc_stats(nfcc)->activations, == ,2);
+    g_assert(test_nfcc_time(nfcc) > 0);
+    GDEBUG("Simulated time %u ms", (guint)(test_nfcc_time(nfcc) / 1000));
+    test_nfcc_check_sm_stats(nci);
+    test_nfcc_check_trace(nci);
+
+    nci_core_remove_all_handlers(nci, id);
+    nci_core_free(nci);
+    test_nfcc_free(nfcc);
+    g_byte_array_free(test.received, TRUE);
+    g_main_loop_unref(test.loop);
+}
+
+static
+void
+test_nfcc_rx_flush(
+    gconstpointer test_data)
+{
+    static const guint8 cmd[] = { 0x30, 0x00 };
+    const TestNfccConfig* config = test_data;
+    TestNfcc* nfcc = test_nfcc_new(config);
+    NciCore* nci = nci_core_new(test_nfcc_io(nfcc));
+    GBytes* data = g_bytes_new_static(cmd, sizeof(cmd));
+    NciConnRxStatus status;
+    TestNfccData test;
+    gulong id[3];
+
+    memset(&test, 0, sizeof(test));
+    test.loop = g_main_loop_new(NULL, TRUE);
+    test.received = g_byte_array_new();
+    id[0] = nci_core_add_current_state_changed_handler(nci,
+        test_nfcc_state_changed, &test);
+    id[1] = nci_core_add_intf_activated_handler(nci,
+        test_nfcc_activated, &test);
+    id[2] = nci_core_add_data_packet_handler(nci,
+        test_nfcc_data_packet, &test);
+
+    nci_core_set_op_mode(nci, NFC_OP_MODE_RW | NFC_OP_MODE_POLL);
+    nci_core_set_state(nci, NCI_RFST_DISCOVERY);
+    test_nfcc_wait_state(nci, &test, NCI_RFST_DISCOVERY);
+    test_nfcc_add_tags(nfcc, test_nfcc_tags, 1);
+    test_run_loop(&test_opt, test.loop);
+    g_assert_cmpint(test.protocol, == ,NCI_PROTOCOL_T2T);
+    test_nfcc_wait_state(nci, &test, NCI_RFST_POLL_ACTIVE);
+
+    /* The first response is delivered, the second one is held */
+    nci_core_set_data_rx_window(nci, NCI_STATIC_RF_CONN_ID, 1);
+    test.expect_bytes = 17;
+    g_assert(nci_core_send_data_msg(nci, NCI_STATIC_RF_CONN_ID, data,
+        NULL, NULL, NULL));
+    test_run_loop(&test_opt, test.loop);
+    g_assert(nci_core_send_data_msg(nci, NCI_STATIC_RF_CONN_ID, data,
+        NULL, NULL, NULL));
+    do {
+        g_main_context_iteration(NULL, TRUE);
+        g_assert(nci_core_get_data_rx_status(nci, NCI_STATIC_RF_CONN_ID,
+            &status));
+    } while (!status.queued);
+    g_assert_cmpuint(status.outstanding, == ,17);
+    g_assert_cmpuint(status.queued_bytes, == ,17);
+
+    /* The tag goes away, nothing is left for the next one */
+    test_nfcc_remove_tags(nfcc);
+    test_nfcc_wait_state(nci, &test, NCI_RFST_DISCOVERY);
+    g_assert(nci_core_get_data_rx_status(nci, NCI_STATIC_RF_CONN_ID,
+        &status));
+    g_assert_cmpuint(status.window, == ,1);
+    g_assert_cmpuint(status.outstanding, == ,0);
+    g_assert_cmpuint(status.queued, == ,0);
+    g_assert_cmpuint(status.queued_bytes, == ,0);
+    g_assert_cmpuint(test.received->len, == ,17);
+
+    g_bytes_unref(data);
+    nci_core_remove_all_handlers(nci, id);
+    nci_core_free(nci);
+    test_nfcc_free(nfcc);
+    g_byte_array_free(test.received, TRUE);
+    g_main_loop_unref(test.loop);
+}
+
+static
+gboolean
+test_nfcc_select_no_t2t(
+    const NciDiscoveryNtf* ntf,
+    void* user_data)
+{
+    guint* count = user_data;
+
+    (*count)++;
+    return ntf->protocol != NCI_PROTOCOL_T2T;
+}
+
+static
+void
+test_nfcc_select_tags(
+    NciCore* nci,
+    TestNfcc* nfcc,
+    TestNfccData* test,
+    NCI_PROTOCOL expected)
+{
+    test->protocol = NCI_PROTOCOL_UNDETERMINED;
+    test_nfcc_add_tags(nfcc, TEST_ARRAY_AND_COUNT(test_nfcc_tags));
+    test_run_loop(&test_opt, test->loop);
+    g_assert_cmpint(test->protocol, == ,expected);
+    test_nfcc_wait_state(nci, test, NCI_RFST_POLL_ACTIVE);
+    test_nfcc_remove_tags(nfcc);
+    test_nfcc_wait_state(nci, test, NCI_RFST_DISCOVERY);
+}
+
+static
+void
+test_nfcc_select(
+    gconstpointer test_data)
+{
+    static const NciSelectPriority t2t_first[] = {
+        { NCI_PROTOCOL_T2T, NCI_MODE_PASSIVE_POLL_A, FALSE },
+        { NCI_PROTOCOL_ISO_DEP, NCI_MODE_PASSIVE_POLL_A, TRUE }
+    };
+    const TestNfccConfig* config = test_data;
+    TestNfcc* nfcc = test_nfcc_new(config);
+    NciCore* nci = nci_core_new(test_nfcc_io(nfcc));
+    NciSelectPolicy policy;
+    TestNfccData test;
+    guint filtered = 0;
+    gulong id[2];
+
+    memset(&test, 0, sizeof(test));
+    test.loop = g_main_loop_new(NULL, TRUE);
+    id[0] = nci_core_add_current_state_changed_handler(nci,
+        test_nfcc_state_changed, &test);
+    id[1] = nci_core_add_intf_activated_handler(nci,
+        test_nfcc_activated, &test);
+
+    nci_core_set_op_mode(nci, NFC_OP_MODE_RW | NFC_OP_MODE_POLL);
+    nci_core_set_activation_cache_size(nci, 4);
+    nci_core_set_state(nci, NCI_RFST_DISCOVERY);
+    test_nfcc_wait_state(nci, &test, NCI_RFST_DISCOVERY);
+
+    /* Type 2 tag is preferred over ISO-DEP */
+    memset(&policy, 0, sizeof(policy));
+    policy.priority = t2t_first;
+    policy.priority_count = G_N_ELEMENTS(t2t_first);
+    nci_core_set_select_policy(nci, &policy);
+    test_nfcc_select_tags(nci, nfcc, &test, NCI_PROTOCOL_T2T);
+    g_assert(test.info_valid);
+    g_assert(!test.info.repeat);
+    g_assert(!test.info.last_seen);
+
+    /* Recently activated Type 2 tag gets skipped */
+    policy.recent_sec = 60;
+    policy.recent_count = 4;
+    nci_core_set_select_policy(nci, &policy);
+    test_nfcc_select_tags(nci, nfcc, &test, NCI_PROTOCOL_T2T);
+    g_assert(test.info_valid);
+    g_assert(test.info.repeat);
+    g_assert(test.info.last_seen);
+    test_nfcc_select_tags(nci, nfcc, &test, NCI_PROTOCOL_ISO_DEP);
+    g_assert(test.info_valid);
+    g_assert(!test.info.repeat);
+
+    /* Filter rejects Type 2 tag */
+    policy.recent_sec = 0;
+    policy.filter = test_nfcc_select_no_t2t;
+    policy.user_data = &filtered;
+    nci_core_set_select_policy(nci, &policy);
+    test_nfcc_select_tags(nci, nfcc, &test, NCI_PROTOCOL_ISO_DEP);
+    g_assert_cmpuint(filtered, == ,2);
+
+    g_assert(test.info_valid);
+    g_assert(test.info.repeat);
+
+    /* Back to default, without the activation cache */
+    nci_core_set_select_policy(nci, NULL);
+    nci_core_set_activation_cache_size(nci, 0);
+    g_assert(!nci_core_get_activation_info(nci, NULL));
+    test_nfcc_select_tags(nci, nfcc, &test, NCI_PROTOCOL_ISO_DEP);
+    g_assert_cmpuint(filtered, == ,2);
+    g_assert(!test.info_valid);
+
+    nci_core_remove_all_handlers(nci, id);
+    nci_core_free(nci);
+    test_nfcc_free(nfcc);
+    g_main_loop_unref(test.loop);
+}
+
+/*==========================================================================*
+ * data_sink_bench
+ *==========================================================================*/
+
+#define TEST_DATA_SINK_BENCH_PACKETS (100000)
+
+static
+void
+test_data_sink_bench_count(
+    NciCore* nci,
+    guint8 cid,
+    const void* payload,
+    guint len,
+    void* user_data)
+{
+    (*((guint*)user_data))++;
+}
+
+static
+gdouble
+test_data_sink_bench_run(
+    TestHalIo* hal)
+{
+    guint i;
+
+    g_test_timer_start();
+    for (i = 0; i < TEST_DATA_SINK_BENCH_PACKETS; i++) {
+        test_data_sink_read(hal, 0);
+    }
+    return g_test_timer_elapsed();
+}
+
+static
+void
+test_data_sink_bench(
+    gconstpointer test_data)
 {
+    const guint n = GPOINTER_TO_UINT(test_data);
     TestHalIo* hal = test_hal_io_new();
     NciCore* nci = nci_core_new(&hal->io);
-    GMainLoop* loop = g_main_loop_new(NULL, TRUE);
-    gulong id;
-
-    nci->cmd_timeout = (test_opt.flags & TEST_FLAG_DEBUG) ? 0 :
-        TEST_DEFAULT_CMD_TIMEOUT;
-
-    /* Responses */
-    test_hal_io_queue_rsp(hal, CORE_RESET_RSP);
-    test_hal_io_queue_ntf(hal, CORE_IGNORED_NTF);
-    test_hal_io_queue_rsp(hal, CORE_INIT_RSP);
-    test_hal_io_queue_rsp(hal, CORE_SET_CONFIG_RSP);
-
-    id = nci_core_add_current_state_changed_handler(nci,
-        test_restart_done, loop);
-    nci_core_restart(nci);
-    test_run_loop(&test_opt, loop);
-    nci_core_remove_handler(nci, id);
-
-    g_assert(nci->current_state == NCI_RFST_IDLE);
-    g_assert(nci->next_state == NCI_RFST_IDLE);
+    gulong* ids = g_new(gulong, n);
+    guint i, count = 0;
+    gdouble signal_time, sink_time;
 
-    /* Again with a cancel */
-    nci_core_set_state(nci, NCI_RFST_DISCOVERY);
-    GDEBUG("Starting all over again");
-    nci_core_restart(nci); /* Cancels the above request */
-    test_hal_io_queue_rsp(hal, CORE_RESET_RSP);
-    test_hal_io_queue_ntf(hal, CORE_IGNORED_NTF);
-    test_hal_io_queue_rsp(hal, CORE_INIT_RSP);
-    test_hal_io_queue_rsp(hal, CORE_SET_CONFIG_RSP);
+    g_assert(nci_sar_start(nci_sm_sar(nci_core_sm(nci))));
 
-    id = nci_core_add_current_state_changed_handler(nci,
-        test_restart_done, loop);
-    test_run_loop(&test_opt, loop);
-    nci_core_remove_handler(nci, id);
+    /* Signal handlers */
+    for (i = 0; i < n; i++) {
+        ids[i] = nci_core_add_data_packet_handler(nci,
+            test_data_sink_bench_count, &count);
+    }
+    signal_time = test_data_sink_bench_run(hal);
+    g_assert_cmpuint(count, == ,n * TEST_DATA_SINK_BENCH_PACKETS);
+    nci_core_remove_handlers(nci, ids, n);
+
+    /* Data sinks */
+    count = 0;
+    for (i = 0; i < n; i++) {
+        ids[i] = nci_core_add_data_sink(nci, NCI_CORE_ANY_CID,
+            test_data_sink_bench_count, &count);
+    }
+    sink_time = test_data_sink_bench_run(hal);
+    g_assert_cmpuint(count, == ,n * TEST_DATA_SINK_BENCH_PACKETS);
+    for (i = 0; i < n; i++) {
+        nci_core_remove_data_sink(nci, ids[i]);
+    }
 
-    g_assert(nci->current_state == NCI_RFST_IDLE);
-    g_assert(nci->next_state == NCI_RFST_IDLE);
+    g_test_message("%u handler(s): signal %.0f ns, sink %.0f ns per packet",
+        n, signal_time * 1e9 / TEST_DATA_SINK_BENCH_PACKETS,
+        sink_time * 1e9 / TEST_DATA_SINK_BENCH_PACKETS);
+    g_test_minimized_result(sink_time, "%.0f packets/sec",
+        sink_time > 0 ? (TEST_DATA_SINK_BENCH_PACKETS / sink_time) : 0);
 
     nci_core_free(nci);
     test_hal_io_free(hal);
-    g_main_loop_unref(loop);
+    g_free(ids);
 }
 
 /*==========================================================================*
@@ -1667,6 +3059,9 @@ struct test_nci_sm_entry {
         struct test_nci_sm_entry_tech {
             NCI_TECH tech;
         } tech;
+        struct test_nci_sm_entry_path {
+            NCI_SM_PATH path;
+        } path;
         struct test_nci_sm_entry_activation {
             NCI_RF_INTERFACE rf_intf;
             NCI_PROTOCOL protocol;
@@ -1689,6 +3084,14 @@ struct test_nci_sm_entry {
     .func = test_nci_sm_send_data, \
     .data.send_data = { .data = bytes, .len = sizeof(bytes), \
         .cid = NCI_STATIC_RF_CONN_ID } }
+#define TEST_NCI_SM_RF_SEND_BUF(bytes) { \
+    .func = test_nci_sm_send_data_buf, \
+    .data.send_data = { .data = bytes, .len = sizeof(bytes), \
+        .cid = NCI_STATIC_RF_CONN_ID } }
+#define TEST_NCI_SM_RF_SENDV(bytes) { \
+    .func = test_nci_sm_send_datav, \
+    .data.send_data = { .data = bytes, .len = sizeof(bytes), \
+        .cid = NCI_STATIC_RF_CONN_ID } }
 #define TEST_NCI_SM_QUEUE_RSP(bytes) { \
     .func = test_nci_sm_queue_read, \
     .data.queue_read = { .data = bytes, .len = sizeof(bytes), .ntf = FALSE } }
@@ -1716,6 +3119,9 @@ struct test_nci_sm_entry {
 #define TEST_NCI_SM_ASSERT_TECH(t) { \
     .func = test_nci_sm_assert_tech, \
     .data.tech = { .tech = t } }
+#define TEST_NCI_SM_ASSERT_PATH(p) { \
+    .func = test_nci_sm_assert_path, \
+    .data.path = { .path = p } }
 #define TEST_NCI_SM_SYNC() { \
     .func = test_nci_sm_sync }
 #define TEST_NCI_SM_WAIT_STATE(wait_state) { \
@@ -1784,6 +3190,16 @@ test_nci_sm_assert_tech(
     g_assert_cmpint(nci_core_get_tech(nci), == ,tech);
 }
 
+static
+void
+test_nci_sm_assert_path(
+    TestNciSm* test)
+{
+    NciSm* sm = nci_core_sm(test->nci);
+
+    g_assert_cmpint(sm->last_path, == ,test->entry->data.path.path);
+}
+
 static
 void
 test_nci_sm_send_data_cb(
@@ -1806,6 +3222,37 @@ test_nci_sm_send_data(
         test_nci_sm_send_data_cb, test_bytes_unref, bytes));
 }
 
+static
+void
+test_nci_sm_send_data_buf(
+    TestNciSm* test)
+{
+    const TestSmEntrySendData* send = &test->entry->data.send_data;
+
+    /* Test data is static, no need to copy it */
+    g_assert(nci_core_send_data_buf(test->nci, send->cid, send->data,
+        send->len, test_nci_sm_send_data_cb, NULL, NULL));
+}
+
+static
+void
+test_nci_sm_send_datav(
+    TestNciSm* test)
+{
+    const TestSmEntrySendData* send = &test->entry->data.send_data;
+    const guint8* data = send->data;
+    const guint split = send->len / 2;
+    GBytes* frags[2];
+
+    /* Send it in two pieces */
+    frags[0] = g_bytes_new(data, split);
+    frags[1] = g_bytes_new(data + split, send->len - split);
+    g_assert(nci_core_send_data_msgv(test->nci, send->cid, frags,
+        G_N_ELEMENTS(frags), test_nci_sm_send_data_cb, NULL, NULL));
+    g_bytes_unref(frags[0]);
+    g_bytes_unref(frags[1]);
+}
+
 static
 void
 test_nci_sm_queue_read(
@@ -2515,6 +3962,55 @@ static const TestSmEntry test_nci_sm_discovery_v2_mixed_error[] = {
     TEST_NCI_SM_END()
 };
 
+static const TestSmEntry test_nci_sm_discovery_v2_routing_cache[] = {
+    TEST_NCI_SM_SET_OP_MODE(NFC_OP_MODE_RW|NFC_OP_MODE_PEER|
+                            NFC_OP_MODE_POLL|NFC_OP_MODE_LISTEN),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_ASSERT_STATES(NCI_STATE_INIT, NCI_RFST_DISCOVERY),
+    TEST_NCI_DEFAULT_RESET_V2(),
+
+    TEST_NCI_SM_ASSERT_STATES(NCI_RFST_IDLE, NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_EXPECT_CMD(CORE_GET_CONFIG_CMD_DISCOVERY),
+    TEST_NCI_SM_QUEUE_RSP(CORE_GET_CONFIG_RSP_DISCOVERY_PEER),
+    TEST_NCI_SM_EXPECT_CMD(RF_SET_LISTEN_MODE_ROUTING_CMD_MIXED_RW_PEER),
+    TEST_NCI_SM_QUEUE_RSP(RF_SET_LISTEN_MODE_ROUTING_RSP_ERROR),
+    TEST_NCI_SM_EXPECT_CMD(RF_SET_LISTEN_MODE_ROUTING_CMD_PROTOCOL_RW_PEER),
+    TEST_NCI_SM_QUEUE_RSP(RF_SET_LISTEN_MODE_ROUTING_RSP),
+    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_MAP_CMD_RW_PEER),
+    TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_MAP_RSP),
+    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_CMD_RW_PEER_A_B_F),
+    TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_IDLE),
+    TEST_NCI_SM_EXPECT_CMD(RF_DEACTIVATE_IDLE_CMD),
+    TEST_NCI_SM_QUEUE_RSP(RF_DEACTIVATE_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_IDLE),
+
+    /* Routing table hasn't changed, nothing to configure */
+    TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_CMD_RW_PEER_A_B_F),
+    TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_IDLE),
+    TEST_NCI_SM_EXPECT_CMD(RF_DEACTIVATE_IDLE_CMD),
+    TEST_NCI_SM_QUEUE_RSP(RF_DEACTIVATE_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_IDLE),
+
+    /* Mixed routing isn't retried, protocol table is the same */
+    TEST_NCI_SM_SET_TECH(NCI_TECH_A|NCI_TECH_B),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_EXPECT_CMD(CORE_GET_CONFIG_CMD_DISCOVERY),
+    TEST_NCI_SM_QUEUE_RSP(CORE_GET_CONFIG_RSP_DISCOVERY_PEER),
+    TEST_NCI_SM_EXPECT_CMD(CORE_SET_CONFIG_CMD_DISCOVERY_PEER_A_B),
+    TEST_NCI_SM_QUEUE_RSP(CORE_SET_CONFIG_RSP),
+    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_MAP_CMD_RW_PEER_A_B),
+    TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_MAP_RSP),
+    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_CMD_RW_PEER_A_B),
+    TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_END()
+};
+
 static const TestSmEntry test_nci_sm_discovery_v2_protocol_error[] = {
     TEST_NCI_SM_SET_OP_MODE(NFC_OP_MODE_RW|NFC_OP_MODE_PEER|
                             NFC_OP_MODE_POLL|NFC_OP_MODE_LISTEN),
@@ -2722,14 +4218,8 @@ static const TestSmEntry test_nci_sm_discovery_idle_discovery[] = {
     TEST_NCI_SM_QUEUE_NTF(CORE_IGNORED_NTF),
     TEST_NCI_SM_WAIT_STATE(NCI_RFST_IDLE),
 
-    /* And again to DISCOVERY */
+    /* And again to DISCOVERY (configuration, routing and map are cached) */
     TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
-    TEST_NCI_SM_EXPECT_CMD(CORE_GET_CONFIG_CMD_DISCOVERY),
-    TEST_NCI_SM_QUEUE_RSP(CORE_GET_CONFIG_RSP_DISCOVERY_PEER),
-    TEST_NCI_SM_EXPECT_CMD(RF_SET_LISTEN_MODE_ROUTING_CMD_MIXED_RW_PEER),
-    TEST_NCI_SM_QUEUE_RSP(RF_SET_LISTEN_MODE_ROUTING_RSP),
-    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_MAP_CMD_RW_PEER),
-    TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_MAP_RSP),
     TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_CMD_RW_PEER_A_B_F),
     TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_RSP),
     TEST_NCI_SM_ASSERT_STATES(NCI_RFST_IDLE, NCI_RFST_DISCOVERY),
@@ -2785,11 +4275,165 @@ static const TestSmEntry test_nci_sm_discovery_idle_discovery2[] = {
 #define TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F() \
     TEST_NCI_SM_EXPECT_CMD(CORE_GET_CONFIG_CMD_DISCOVERY),\
     TEST_NCI_SM_QUEUE_RSP(CORE_GET_CONFIG_RSP_DISCOVERY_RW),\
+    TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F_CACHED()
+
+/* Configuration is known to be up to date, CORE_GET_CONFIG is skipped */
+#define TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F_CACHED() \
     TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_MAP_CMD_RW),\
     TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_MAP_RSP),\
+    TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F_MAPPED()
+
+/* RF_DISCOVER_MAP has already been applied, it's skipped too */
+#define TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F_MAPPED() \
     TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_CMD_RW_A_B_F),\
     TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_RSP)
 
+static const TestSmEntry test_nci_sm_discovery_config_cache[] = {
+    TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_ASSERT_STATES(NCI_STATE_INIT, NCI_RFST_DISCOVERY),
+    TEST_NCI_DEFAULT_RESET_V1(),
+
+    /* Failed CORE_SET_CONFIG doesn't validate the configuration */
+    TEST_NCI_SM_ASSERT_STATES(NCI_RFST_IDLE, NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_EXPECT_CMD(CORE_GET_CONFIG_CMD_DISCOVERY),
+    TEST_NCI_SM_QUEUE_RSP(CORE_GET_CONFIG_RSP_DISCOVERY_PEER),
+    TEST_NCI_SM_EXPECT_CMD(CORE_SET_CONFIG_CMD_DISCOVERY_RW),
+    TEST_NCI_SM_QUEUE_RSP(CORE_SET_CONFIG_RSP_ERROR),
+    TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F_CACHED(),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_IDLE),
+    TEST_NCI_SM_EXPECT_CMD(RF_DEACTIVATE_IDLE_CMD),
+    TEST_NCI_SM_QUEUE_RSP(RF_DEACTIVATE_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_IDLE),
+
+    /* But successful one does */
+    TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_EXPECT_CMD(CORE_GET_CONFIG_CMD_DISCOVERY),
+    TEST_NCI_SM_QUEUE_RSP(CORE_GET_CONFIG_RSP_DISCOVERY_PEER),
+    TEST_NCI_SM_EXPECT_CMD(CORE_SET_CONFIG_CMD_DISCOVERY_RW),
+    TEST_NCI_SM_QUEUE_RSP(CORE_SET_CONFIG_RSP),
+    TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F_MAPPED(),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_IDLE),
+    TEST_NCI_SM_EXPECT_CMD(RF_DEACTIVATE_IDLE_CMD),
+    TEST_NCI_SM_QUEUE_RSP(RF_DEACTIVATE_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_IDLE),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F_MAPPED(),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_IDLE),
+    TEST_NCI_SM_EXPECT_CMD(RF_DEACTIVATE_IDLE_CMD),
+    TEST_NCI_SM_QUEUE_RSP(RF_DEACTIVATE_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_IDLE),
+
+    /* Changing technologies invalidates the cache */
+    TEST_NCI_SM_SET_TECH(NCI_TECH_A|NCI_TECH_B),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_EXPECT_CMD(CORE_GET_CONFIG_CMD_DISCOVERY),
+    TEST_NCI_SM_QUEUE_RSP(CORE_GET_CONFIG_RSP_DISCOVERY_RW),
+    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_MAP_CMD_RW_A_B),
+    TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_MAP_RSP),
+    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_CMD_RW_A_B),
+    TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_END()
+};
+
+static const TestSmEntry test_nci_sm_discovery_map_cache[] = {
+    TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_ASSERT_STATES(NCI_STATE_INIT, NCI_RFST_DISCOVERY),
+    TEST_NCI_DEFAULT_RESET_V1(),
+
+    TEST_NCI_SM_ASSERT_STATES(NCI_RFST_IDLE, NCI_RFST_DISCOVERY),
+    TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F(),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_IDLE),
+    TEST_NCI_SM_EXPECT_CMD(RF_DEACTIVATE_IDLE_CMD),
+    TEST_NCI_SM_QUEUE_RSP(RF_DEACTIVATE_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_IDLE),
+
+    /* RF_DISCOVER_MAP is sent once per NFCC session */
+    TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F_MAPPED(),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_IDLE),
+    TEST_NCI_SM_EXPECT_CMD(RF_DEACTIVATE_IDLE_CMD),
+    TEST_NCI_SM_QUEUE_RSP(RF_DEACTIVATE_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_IDLE),
+
+    /* Unless the operation mode changes */
+    TEST_NCI_SM_SET_OP_MODE(NFC_OP_MODE_RW|NFC_OP_MODE_PEER|
+                            NFC_OP_MODE_POLL|NFC_OP_MODE_LISTEN),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_EXPECT_CMD(CORE_GET_CONFIG_CMD_DISCOVERY),
+    TEST_NCI_SM_QUEUE_RSP(CORE_GET_CONFIG_RSP_DISCOVERY_PEER),
+    TEST_NCI_SM_EXPECT_CMD(RF_SET_LISTEN_MODE_ROUTING_CMD_MIXED_RW_PEER),
+    TEST_NCI_SM_QUEUE_RSP(RF_SET_LISTEN_MODE_ROUTING_RSP),
+    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_MAP_CMD_RW_PEER),
+    TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_MAP_RSP),
+    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_CMD_RW_PEER_A_B_F),
+    TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_IDLE),
+    TEST_NCI_SM_EXPECT_CMD(RF_DEACTIVATE_IDLE_CMD),
+    TEST_NCI_SM_QUEUE_RSP(RF_DEACTIVATE_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_IDLE),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_CMD_RW_PEER_A_B_F),
+    TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_END()
+};
+
+static const TestSmEntry test_nci_sm_discovery_set_tech[] = {
+    TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_ASSERT_STATES(NCI_STATE_INIT, NCI_RFST_DISCOVERY),
+    TEST_NCI_DEFAULT_RESET_V1(),
+    TEST_NCI_SM_ASSERT_PATH(NCI_SM_PATH_RESET),
+
+    TEST_NCI_SM_ASSERT_STATES(NCI_RFST_IDLE, NCI_RFST_DISCOVERY),
+    TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F(),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
+
+    /* Listen technologies don't matter in poll-only RW mode */
+    TEST_NCI_SM_SET_TECH(NCI_TECH_A_POLL|NCI_TECH_B_POLL|NCI_TECH_F_POLL),
+    TEST_NCI_SM_ASSERT_TECH(NCI_TECH_A_POLL|NCI_TECH_B_POLL|NCI_TECH_F_POLL),
+    TEST_NCI_SM_ASSERT_PATH(NCI_SM_PATH_NONE),
+    TEST_NCI_SM_ASSERT_STATE(NCI_RFST_DISCOVERY),
+
+    /* But poll technologies do */
+    TEST_NCI_SM_SET_TECH(NCI_TECH_A_POLL|NCI_TECH_B_POLL),
+    TEST_NCI_SM_ASSERT_PATH(NCI_SM_PATH_DIRECT),
+    TEST_NCI_SM_ASSERT_STATES(NCI_RFST_DISCOVERY, NCI_RFST_IDLE),
+    TEST_NCI_SM_EXPECT_CMD(RF_DEACTIVATE_IDLE_CMD),
+    TEST_NCI_SM_QUEUE_RSP(RF_DEACTIVATE_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_IDLE),
+    TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_EXPECT_CMD(CORE_GET_CONFIG_CMD_DISCOVERY),
+    TEST_NCI_SM_QUEUE_RSP(CORE_GET_CONFIG_RSP_DISCOVERY_RW),
+    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_MAP_CMD_RW_A_B),
+    TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_MAP_RSP),
+    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_CMD_RW_A_B),
+    TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
+
+    /* W4_HOST_SELECT -> DISCOVERY goes through IDLE */
+    TEST_NCI_SM_QUEUE_NTF(RF_DISCOVER_NTF_1_ISODEP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_W4_ALL_DISCOVERIES),
+    TEST_NCI_SM_QUEUE_NTF(RF_DISCOVER_NTF_2_PROPRIETARY_LAST),
+    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_SELECT_1_ISODEP_CMD),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_W4_HOST_SELECT),
+    TEST_NCI_SM_SYNC(),
+    TEST_NCI_SM_QUEUE_NTF(CORE_GENERIC_TARGET_ACTIVATION_FAILED_ERROR_NTF),
+    TEST_NCI_SM_EXPECT_CMD(RF_DEACTIVATE_IDLE_CMD),
+    TEST_NCI_SM_QUEUE_RSP(RF_DEACTIVATE_RSP),
+    TEST_NCI_SM_EXPECT_CMD(RF_DISCOVER_CMD_RW_A_B),
+    TEST_NCI_SM_QUEUE_RSP(RF_DISCOVER_RSP),
+    TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
+    TEST_NCI_SM_ASSERT_PATH(NCI_SM_PATH_IDLE),
+    TEST_NCI_SM_END()
+};
+
 static const TestSmEntry test_nci_sm_discovery_idle_failed[] = {
     TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
     TEST_NCI_SM_ASSERT_STATES(NCI_STATE_INIT, NCI_RFST_DISCOVERY),
@@ -3135,6 +4779,10 @@ static const guint8 READ_CMD[] = {
     0x00, 0x00, 0x02, 0x30, 0x00
 };
 
+static const guint8 READ_CMD_PACKET[] = {
+    0x00, 0x00, 0x05, 0x00, 0x00, 0x02, 0x30, 0x00
+};
+
 static const guint8 READ_RESP[] = {
     0x00, 0x00, 0x11, 0x04, 0x9b, 0xfb, 0xec, 0x4a,
     0xeb, 0x2b, 0x80, 0x0a, 0x48, 0x00, 0x00, 0xe1,
@@ -3162,6 +4810,22 @@ static const TestSmEntry test_nci_sm_dscvr_poll_read_dscvr[] = {
     TEST_NCI_SM_QUEUE_NTF(CORE_CONN_CREDITS_NTF),
     TEST_NCI_SM_QUEUE_NTF(READ_RESP),
 
+    /* And again, straight from the static buffer */
+    TEST_NCI_SM_RF_SEND_BUF(READ_CMD),
+    TEST_NCI_SM_QUEUE_NTF(CORE_CONN_CREDITS_NTF),
+    TEST_NCI_SM_QUEUE_NTF(READ_RESP),
+
+    /* And once more, in two fragments */
+    TEST_NCI_SM_RF_SENDV(READ_CMD),
+    TEST_NCI_SM_QUEUE_NTF(CORE_CONN_CREDITS_NTF),
+    TEST_NCI_SM_QUEUE_NTF(READ_RESP),
+
+    /* Make sure that all three have been sent */
+    TEST_NCI_SM_EXPECT_CMD(READ_CMD_PACKET),
+    TEST_NCI_SM_EXPECT_CMD(READ_CMD_PACKET),
+    TEST_NCI_SM_EXPECT_CMD(READ_CMD_PACKET),
+    TEST_NCI_SM_SYNC(),
+
     /* Deactivate to DISCOVERY */
     TEST_NCI_SM_SET_STATE(NCI_RFST_DISCOVERY),
     TEST_NCI_SM_EXPECT_CMD(RF_DEACTIVATE_DISCOVERY_CMD),
@@ -3491,7 +5155,7 @@ static const TestSmEntry test_nci_sm_discovery_ntf_isodep_fail[] = {
     TEST_NCI_SM_QUEUE_NTF(CORE_GENERIC_TARGET_ACTIVATION_FAILED_ERROR_NTF),
     TEST_NCI_SM_EXPECT_CMD(RF_DEACTIVATE_IDLE_CMD),
     TEST_NCI_SM_QUEUE_RSP(RF_DEACTIVATE_RSP),
-    TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F(),
+    TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F_MAPPED(),
     TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
     TEST_NCI_SM_END()
 };
@@ -3516,7 +5180,7 @@ static const TestSmEntry test_nci_sm_discovery_ntf_noselect[] = {
     TEST_NCI_SM_EXPECT_CMD(RF_DEACTIVATE_IDLE_CMD),
     TEST_NCI_SM_QUEUE_RSP(RF_DEACTIVATE_RSP),
     TEST_NCI_SM_WAIT_STATE(NCI_RFST_IDLE),
-    TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F(),
+    TEST_NCI_TRANSITION_TO_DISCOVERY_RW_A_B_F_MAPPED(),
     TEST_NCI_SM_WAIT_STATE(NCI_RFST_DISCOVERY),
     TEST_NCI_SM_END()
 };
@@ -4291,11 +5955,13 @@ static const TestNciSmData nci_sm_tests[] = {
     { "discovery-invalid-param", test_nci_sm_discovery_invalid_param },
     { "discovery-get-config-error", test_nci_sm_discovery_get_config_error },
     { "discovery-set-config-error", test_nci_sm_discovery_set_config_error },
+    { "discovery-config-cache", test_nci_sm_discovery_config_cache },
     { "discovery-failed", test_nci_sm_discovery_failed },
     { "discovery-broken", test_nci_sm_discovery_broken },
     { "discovery-v2", test_nci_sm_discovery_v2 },
     { "discovery-v2-protocol", test_nci_sm_discovery_v2_protocol },
     { "discovery-v2-mixed-error", test_nci_sm_discovery_v2_mixed_error },
+    { "discovery-v2-routing-cache", test_nci_sm_discovery_v2_routing_cache },
     { "discovery-v2-protocol-error", test_nci_sm_discovery_v2_protocol_error },
     { "discovery-v2-technology1", test_nci_sm_discovery_v2_technology1 },
     { "discovery-v2-technology2", test_nci_sm_discovery_v2_technology2 },
@@ -4305,6 +5971,8 @@ static const TestNciSmData nci_sm_tests[] = {
     { "discovery-discover-map-broken", test_nci_sm_discover_map_broken },
     { "discovery-idle-discovery", test_nci_sm_discovery_idle_discovery },
     { "discovery-idle-discovery2", test_nci_sm_discovery_idle_discovery2 },
+    { "discovery-map-cache", test_nci_sm_discovery_map_cache },
+    { "discovery-set-tech", test_nci_sm_discovery_set_tech },
     { "discovery-idle-failed", test_nci_sm_discovery_idle_failed },
     { "discovery-idle-broken", test_nci_sm_discovery_idle_broken },
     { "discovery-idle-timeout", test_nci_sm_discovery_idle_timeout },
@@ -4380,6 +6048,12 @@ static const TestNciSmData nci_sm_tests[] = {
 
 int main(int argc, char* argv[])
 {
+    static const TestNfccConfig test_nfcc_v1 = {
+        TEST_NFCC_NCI_1, 1000, 500, 100000, 2000, 0xff, 1, FALSE
+    };
+    static const TestNfccConfig test_nfcc_v2 = {
+        TEST_NFCC_NCI_2, 500, 100, 50000, 1000, 0x80, 2, FALSE
+    };
     guint i;
 
     G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
@@ -4389,6 +6063,32 @@ int main(int argc, char* argv[])
     g_test_add_func(TEST_("null"), test_null);
     g_test_add_func(TEST_("param"), test_param);
     g_test_add_func(TEST_("restart"), test_restart);
+    g_test_add_data_func(TEST_("cmd_window/1"), GUINT_TO_POINTER(1),
+        test_cmd_window);
+    g_test_add_data_func(TEST_("cmd_window/2"), GUINT_TO_POINTER(2),
+        test_cmd_window);
+    g_test_add_func(TEST_("cmd_window/cancel"), test_cmd_window_cancel);
+#if NCI_STATS
+    g_test_add_func(TEST_("cmd_stats"), test_cmd_stats);
+#endif
+    g_test_add_func(TEST_("data_sink"), test_data_sink);
+    g_test_add_func(TEST_("data_sink/bytes"), test_data_sink_bytes);
+    g_test_add_func(TEST_("data_rx_window"), test_data_rx_window);
+    g_test_add_data_func(TEST_("nfcc/v1"), &test_nfcc_v1, test_nfcc);
+    g_test_add_data_func(TEST_("nfcc/v2"), &test_nfcc_v2, test_nfcc);
+    g_test_add_data_func(TEST_("nfcc/select"), &test_nfcc_v2,
+        test_nfcc_select);
+    g_test_add_data_func(TEST_("nfcc/rx_flush"), &test_nfcc_v2,
+        test_nfcc_rx_flush);
+    if (g_test_perf()) {
+        /* Timing loops, only with -m perf */
+        g_test_add_data_func(TEST_("data_sink/bench/1"),
+            GUINT_TO_POINTER(1), test_data_sink_bench);
+        g_test_add_data_func(TEST_("data_sink/bench/4"),
+            GUINT_TO_POINTER(4), test_data_sink_bench);
+        g_test_add_data_func(TEST_("data_sink/bench/16"),
+            GUINT_TO_POINTER(16), test_data_sink_bench);
+    }
     g_test_add_func(TEST_("init_ok"), test_init_ok);
     g_test_add_func(TEST_("init_failed/1"), test_init_failed1);
     g_test_add_func(TEST_("init_failed/2"), test_init_failed2);
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+#include "test_common.h"
+
+#include "nci_layout.h"
+
+static TestOpt test_opt;
+
+typedef struct test_view {
+    guint u8;
+    guint u16;
+    const guint8* bytes;
+    GUtilData data;
+    GUtilData rest;
+} TestView;
+
+static const NciField test_fields[] = {
+    NCI_FIELD(U8, TestView, u8),
+    NCI_FIELD(U16, TestView, u16),
+    NCI_FIELD_N(BYTES, 3, TestView, bytes),
+    NCI_FIELD_N(DATA, 1, TestView, data),
+    NCI_FIELD(REST, TestView, rest)
+};
+
+static const NciLayout test_layout =
+    NCI_LAYOUT("TEST", test_fields, NCI_LAYOUT_FLAGS_NONE);
+
+static const guint8 test_pkt[] = {
+    0x01,                   /* u8 */
+    0x34, 0x12,             /* u16 */
+    0x0a, 0x0b, 0x0c,       /* bytes */
+    0x02, 0x0d, 0x0e,       /* data */
+    0x0f, 0x10              /* rest */
+};
+
+/*==========================================================================*
+ * basic
+ *==========================================================================*/
+
+static
+void
+test_basic(
+    void)
+{
+    TestView view;
+
+    memset(&view, 0, sizeof(view));
+    g_assert(nci_layout_decode(&test_layout, TEST_ARRAY_AND_SIZE(test_pkt),
+        &view));
+    g_assert_cmpuint(view.u8, == ,0x01);
+    g_assert_cmpuint(view.u16, == ,0x1234);
+    g_assert(view.bytes == test_pkt + 3);
+    g_assert(view.data.bytes == test_pkt + 7);
+    g_assert_cmpuint(view.data.size, == ,2);
+    g_assert(view.rest.bytes == test_pkt + 9);
+    g_assert_cmpuint(view.rest.size, == ,2);
+
+    /* Nothing left for the REST field */
+    g_assert(nci_layout_decode(&test_layout, test_pkt, 9, &view));
+    g_assert(!view.rest.bytes);
+    g_assert(!view.rest.size);
+}
+
+/*==========================================================================*
+ * short
+ *==========================================================================*/
+
+static
+void
+test_short(
+    void)
+{
+    TestView view;
+    guint len;
+
+    /* Every packet shorter than 9 bytes is too short */
+    for (len = 0; len < 9; len++) {
+        g_assert(!nci_layout_decode(&test_layout, test_pkt, len, &view));
+    }
+}
+
+/*==========================================================================*
+ * data
+ *==========================================================================*/
+
+static
+void
+test_data(
+    void)
+{
+    static const NciField empty_fields[] = {
+        NCI_FIELD(DATA, TestView, data)
+    };
+    static const NciField min_fields[] = {
+        NCI_FIELD_N(DATA, 2, TestView, data)
+    };
+    static const NciLayout empty_layout =
+        NCI_LAYOUT("EMPTY", empty_fields, NCI_LAYOUT_FLAGS_NONE);
+    static const NciLayout min_layout =
+        NCI_LAYOUT("MIN", min_fields, NCI_LAYOUT_FLAGS_NONE);
+    static const guint8 empty[] = { 0x00 };
+    static const guint8 one[] = { 0x01, 0x02 };
+    static const guint8 two[] = { 0x02, 0x03, 0x04 };
+    TestView view;
+
+    /* Zero-length data */
+    memset(&view, 0xff, sizeof(view));
+    g_assert(nci_layout_decode(&empty_layout, TEST_ARRAY_AND_SIZE(empty),
+        &view));
+    g_assert(!view.data.bytes);
+    g_assert(!view.data.size);
+
+    /* Shorter than the minimum */
+    g_assert(!nci_layout_decode(&min_layout, TEST_ARRAY_AND_SIZE(empty),
+        &view));
+    g_assert(!nci_layout_decode(&min_layout, TEST_ARRAY_AND_SIZE(one),
+        &view));
+    g_assert(nci_layout_decode(&min_layout, TEST_ARRAY_AND_SIZE(two),
+        &view));
+    g_assert(view.data.bytes == two + 1);
+    g_assert_cmpuint(view.data.size, == ,2);
+
+    /* Length byte points beyond the end of the packet */
+    g_assert(!nci_layout_decode(&min_layout, two, 2, &view));
+}
+
+/*==========================================================================*
+ * rest
+ *==========================================================================*/
+
+static
+void
+test_rest(
+    void)
+{
+    static const NciField fields[] = {
+        NCI_FIELD_N(REST, 2, TestView, rest)
+    };
+    static const NciLayout layout =
+        NCI_LAYOUT("REST", fields, NCI_LAYOUT_FLAGS_NONE);
+    TestView view;
+
+    g_assert(!nci_layout_decode(&layout, test_pkt, 0, &view));
+    g_assert(!nci_layout_decode(&layout, test_pkt, 1, &view));
+    g_assert(nci_layout_decode(&layout, test_pkt, 2, &view));
+    g_assert(view.rest.bytes == test_pkt);
+    g_assert_cmpuint(view.rest.size, == ,2);
+}
+
+/*==========================================================================*
+ * exact
+ *==========================================================================*/
+
+static
+void
+test_exact(
+    void)
+{
+    static const NciField fields[] = {
+        NCI_FIELD(U8, TestView, u8),
+        NCI_FIELD(U16, TestView, u16)
+    };
+    static const NciLayout layout =
+        NCI_LAYOUT("EXACT", fields, NCI_LAYOUT_EXACT);
+    static const NciLayout loose_layout =
+        NCI_LAYOUT("LOOSE", fields, NCI_LAYOUT_FLAGS_NONE);
+    TestView view;
+
+    g_assert(nci_layout_decode(&layout, test_pkt, 3, &view));
+    g_assert_cmpuint(view.u8, == ,0x01);
+    g_assert_cmpuint(view.u16, == ,0x1234);
+    g_assert(!nci_layout_decode(&layout, test_pkt, 2, &view));
+    g_assert(!nci_layout_decode(&layout, test_pkt, 4, &view));
+    g_assert(nci_layout_decode(&loose_layout, test_pkt, 4, &view));
+}
+
+/*==========================================================================*
+ * Common
+ *==========================================================================*/
+
+#define TEST_(name) "/nci_layout/" name
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    test_init(&test_opt, argc, argv);
+    g_test_add_func(TEST_("basic"), test_basic);
+    g_test_add_func(TEST_("short"), test_short);
+    g_test_add_func(TEST_("data"), test_data);
+    g_test_add_func(TEST_("rest"), test_rest);
+    g_test_add_func(TEST_("exact"), test_exact);
+    return g_test_run();
+}
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
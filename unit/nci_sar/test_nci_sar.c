@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2018-2025 Slava Monich <slava@monich.com>
+ * Copyright (C) 2018-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2018-2020 Jolla Ltd.
  *
  * You may use this file under the terms of the BSD license as follows:
@@ -44,6 +44,7 @@
 #include "nci_sar.h"
 
 #include <gutil_macros.h>
+#include <gutil_misc.h>
 #include <gutil_log.h>
 
 static TestOpt test_opt;
@@ -59,6 +60,20 @@ test_bytes_unref(
     g_bytes_unref(bytes);
 }
 
+static
+void
+test_assert_bytes(
+    GBytes* bytes,
+    const void* expected,
+    gsize expected_size)
+{
+    gsize size;
+    const void* data = g_bytes_get_data(bytes, &size);
+
+    g_assert_cmpuint(size, == ,expected_size);
+    g_assert(!memcmp(data, expected, size));
+}
+
 static
 void
 test_client_unexpected_completion(
@@ -386,11 +401,19 @@ test_null(
     nci_sar_set_max_data_payload_size(NULL, 0);
     g_assert(!nci_sar_send_command(NULL, 0, 0, NULL, NULL, NULL, NULL));
     g_assert(!nci_sar_send_data_packet(NULL, 0, NULL, NULL, NULL, NULL));
+    g_assert(!nci_sar_send_data_buf(NULL, 0, NULL, 0, NULL, NULL, NULL));
+    g_assert(!nci_sar_packets_allocated(NULL));
     g_assert(!nci_sar_start(NULL));
     nci_sar_set_initial_credits(NULL, 0, 1);
     nci_sar_add_credits(NULL, 0, 1);
     nci_sar_reset(NULL);
     nci_sar_cancel(NULL, 0);
+    nci_sar_cancel_data(NULL, 0);
+    g_assert(!nci_sar_send_data_packetv(NULL, 0, NULL, 0, NULL, NULL, NULL));
+    nci_sar_set_data_scheduler(NULL, NCI_DATA_SCHED_PRIORITY);
+    nci_sar_set_data_weight(NULL, 0, 0);
+    g_assert(!nci_sar_get_data_stats(NULL, 0, NULL));
+    nci_hal_client_read_bytes(NULL, NULL);
     nci_sar_free(NULL);
 }
 
@@ -1001,268 +1024,1094 @@ test_send_data_seg3(
 }
 
 /*==========================================================================*
- * send_err
+ * send_datav
  *==========================================================================*/
 
-typedef struct test_send_err_hal_io {
-    NciHalIo io;
-    NciHalClient* sar;
-} TestSendErrHalIo;
-
-typedef struct test_send_err_hal_io_write {
-    NciHalClient* sar;
-    NciHalClientFunc complete;
-} TestSendErrHalIoWrite;
-
-static
-gboolean
-test_send_err_hal_io_start(
-    NciHalIo* io,
-    NciHalClient* sar)
-{
-    TestSendErrHalIo* hal = G_CAST(io, TestSendErrHalIo, io);
-
-    g_assert(!hal->sar);
-    hal->sar = sar;
-    return TRUE;
-}
-
-static
-gboolean
-test_send_err_hal_io_write_cb(
-    gpointer user_data)
-{
-    TestSendErrHalIoWrite* write = user_data;
-
-    write->complete(write->sar, FALSE);
-    return G_SOURCE_REMOVE;
-}
-
 static
 gboolean
-test_send_err_hal_io_write(
+test_send_datav_hal_io_write(
     NciHalIo* io,
     const GUtilData* chunks,
     guint count,
     NciHalClientFunc complete)
 {
-    TestSendErrHalIo* hal = G_CAST(io, TestSendErrHalIo, io);
-    TestSendErrHalIoWrite* write = g_new0(TestSendErrHalIoWrite, 1);
+    TestHalIo* hal = G_CAST(io, TestHalIo, io);
+    GString* counts = hal->test_data;
 
-    write->complete = complete;
-    write->sar = hal->sar;
-    g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, test_send_err_hal_io_write_cb,
-        write, g_free);
-    return TRUE;
+    /* Remember number of chunks per write */
+    g_string_append_c(counts, '0' + count);
+    return test_hal_io_write(io, chunks, count, complete);
 }
 
 static
-TestSendErrHalIo*
-test_send_err_hal_io_new(
+void
+test_send_datav(
     void)
 {
-    static const NciHalIoFunctions test_dummy_hal_io_fn = {
-        .start = test_send_err_hal_io_start,
-        .stop = test_dummy_hal_io_stop,
-        .write = test_send_err_hal_io_write,
-        .cancel_write = test_dummy_hal_io_cancel_write
+    static const NciHalIoFunctions test_send_datav_hal_io_fn = {
+        .start = test_hal_io_start,
+        .stop = test_hal_io_stop,
+        .write = test_send_datav_hal_io_write,
+        .cancel_write = test_hal_io_cancel_write
     };
-    TestSendErrHalIo* hal = g_new0(TestSendErrHalIo, 1);
+    static const guint8 a[] = { 0x01, 0x02, 0x03 };
+    static const guint8 c[] = { 0x04, 0x05, 0x06, 0x07, 0x08 };
+    static const guint8 d[] = { 0x09, 0x0a };
+    static const guint8 packet1[] = { 0x10, 0x00, 0x04,
+        0x01, 0x02, 0x03, 0x04 };
+    static const guint8 packet2[] = { 0x10, 0x00, 0x04,
+        0x05, 0x06, 0x07, 0x08 };
+    static const guint8 packet3[] = { 0x00, 0x00, 0x02,
+        0x09, 0x0a };
+    static const guint8 packet4[] = { 0x00, 0x00, 0x00 };
+    NciSarClient client;
+    TestHalIo* test_io = test_hal_io_new_with_functions
+        (&test_send_datav_hal_io_fn);
+    NciSar* sar = nci_sar_new(&test_io->io, &client);
+    GMainLoop* loop = g_main_loop_new(NULL, TRUE);
+    GString* counts = g_string_new(NULL);
+    GBytes* frags[4];
+    guint i;
 
-    hal->io.fn = &test_dummy_hal_io_fn;
-    return hal;
+    client.fn = &test_dummy_sar_client_fn;
+    test_io->test_data = counts;
+    nci_sar_set_max_data_payload_size(sar, 4);
+    nci_sar_set_initial_credits(sar, NCI_STATIC_RF_CONN_ID, 0xff);
+
+    /* Empty fragment is skipped, the rest stay separate chunks */
+    frags[0] = g_bytes_new(a, sizeof(a));
+    frags[1] = g_bytes_new(NULL, 0);
+    frags[2] = g_bytes_new(c, sizeof(c));
+    frags[3] = g_bytes_new(d, sizeof(d));
+    g_assert(!nci_sar_send_data_packetv(sar, NCI_STATIC_RF_CONN_ID,
+        NULL, 1, NULL, NULL, NULL));
+    g_assert(!nci_sar_send_data_packetv(sar, 0x0f, frags,
+        G_N_ELEMENTS(frags), NULL, NULL, NULL));
+    g_assert(nci_sar_send_data_packetv(sar, NCI_STATIC_RF_CONN_ID,
+        frags, G_N_ELEMENTS(frags), NULL, NULL, NULL));
+    g_assert(nci_sar_send_data_packetv(sar, NCI_STATIC_RF_CONN_ID,
+        NULL, 0, test_send_data_seg_expect_success_and_quit, NULL, loop));
+
+    /* SAR keeps its own references */
+    for (i = 0; i < G_N_ELEMENTS(frags); i++) {
+        g_bytes_unref(frags[i]);
+    }
+
+    test_run_loop(&test_opt, loop);
+    g_assert_cmpstr(counts->str, == ,"3221");
+    g_assert_cmpuint(test_io->written->len, == ,4);
+    test_assert_bytes(test_io->written->pdata[0],
+        TEST_ARRAY_AND_SIZE(packet1));
+    test_assert_bytes(test_io->written->pdata[1],
+        TEST_ARRAY_AND_SIZE(packet2));
+    test_assert_bytes(test_io->written->pdata[2],
+        TEST_ARRAY_AND_SIZE(packet3));
+    test_assert_bytes(test_io->written->pdata[3],
+        TEST_ARRAY_AND_SIZE(packet4));
+
+    nci_sar_free(sar);
+    test_hal_io_free(test_io);
+    g_main_loop_unref(loop);
+    g_string_free(counts, TRUE);
 }
 
+/*==========================================================================*
+ * send_batch
+ *==========================================================================*/
+
+typedef struct test_send_batch {
+    GMainLoop* loop;
+    int cmd_done;
+    int data_done;
+} TestSendBatch;
+
 static
 void
-test_send_err_hal_io(
-    TestSendErrHalIo* hal)
+test_send_batch_cmd_complete(
+    NciSarClient* client,
+    gboolean success,
+    gpointer user_data)
 {
-    g_free(hal);
-}
+    TestSendBatch* test = user_data;
 
-typedef struct test_send_err_sar_client {
-    NciSarClient client;
-    GMainLoop* loop;
-    gboolean completed;
-} TestSendErrSarClient;
+    g_assert(success);
+    g_assert(!test->data_done);
+    test->cmd_done++;
+}
 
 static
 void
-test_send_err_sar_send_complete(
+test_send_batch_data_complete(
     NciSarClient* client,
     gboolean success,
     gpointer user_data)
 {
-    TestSendErrSarClient* test = user_data;
+    TestSendBatch* test = user_data;
 
-    g_assert(&test->client == client);
-    g_assert(!success);
-    g_assert(!test->completed);
-    test->completed = TRUE;
+    g_assert(success);
+    test->data_done++;
+    g_main_loop_quit(test->loop);
 }
 
 static
 void
-test_send_err_sar_client_error(
-    NciSarClient* client)
+test_send_batch_check(
+    TestHalIo* test_io,
+    guint i,
+    const void* data,
+    gsize size)
 {
-    TestSendErrSarClient* test = G_CAST(client, TestSendErrSarClient, client);
+    const GUtilData expected = { data, size };
+    GUtilData written;
 
-    g_main_loop_quit(test->loop);
+    g_assert_cmpuint(test_io->written->len, > ,i);
+    written.bytes = g_bytes_get_data(test_io->written->pdata[i],
+        &written.size);
+    g_assert(gutil_data_equal(&written, &expected));
 }
 
 static
 void
-test_send_err(
+test_send_batch(
     void)
 {
-    static const NciSarClientFunctions test_send_err_sar_client_fn = {
-        .error = test_send_err_sar_client_error,
-        .handle_response = test_dummy_sar_client_handle_response,
-        .handle_notification = test_dummy_sar_client_handle_notification,
-        .handle_data_packet = test_dummy_sar_client_handle_data_packet
+    static const guint8 payload[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 };
+    static const guint8 cmd_payload[] = { 0x07 };
+    static const guint8 write1[] = {
+        NCI_MT_CMD_PKT | TEST_GID, TEST_OID, 1, 0x07,
+        NCI_MT_DATA_PKT | NCI_PBF, 0, 1, 0x01,
+        NCI_MT_DATA_PKT | NCI_PBF, 0, 1, 0x02,
+        NCI_MT_DATA_PKT | NCI_PBF, 0, 1, 0x03
     };
-    TestSendErrHalIo* test_io = test_send_err_hal_io_new();
-    TestSendErrSarClient test;
-    NciSar* sar;
+    static const guint8 write2[] = {
+        NCI_MT_DATA_PKT | NCI_PBF, 0, 1, 0x04,
+        NCI_MT_DATA_PKT | NCI_PBF, 0, 1, 0x05
+    };
+    static const guint8 write3[] = {
+        NCI_MT_DATA_PKT, 0, 1, 0x06
+    };
+    GBytes* payload_bytes = g_bytes_new_static(payload, sizeof(payload));
+    GBytes* cmd_bytes = g_bytes_new_static(cmd_payload, sizeof(cmd_payload));
+    NciSarClient client;
+    TestHalIo* test_io = test_hal_io_new();
+    NciSar* sar = nci_sar_new(&test_io->io, &client);
+    TestSendBatch test;
 
     memset(&test, 0, sizeof(test));
-    test.client.fn = &test_send_err_sar_client_fn;
     test.loop = g_main_loop_new(NULL, TRUE);
+    client.fn = &test_dummy_sar_client_fn;
+    nci_sar_set_max_write_packets(NULL, 0); /* Does nothing */
+    nci_sar_set_max_write_packets(sar, 4);
+    nci_sar_set_max_data_payload_size(sar, 0 /* Default is 1 byte */);
 
-    sar = nci_sar_new(&test_io->io, &test.client);
-    g_assert(nci_sar_start(sar));
-    g_assert(test_io->sar);
-
-    /* This send fails asynchronously */
-    g_assert(nci_sar_send_command(sar, TEST_GID, TEST_OID, NULL,
-        NULL, NULL, NULL));
+    /* 5 credits for 6 segments */
+    nci_sar_add_credits(sar, NCI_STATIC_RF_CONN_ID, 5);
+    g_assert(nci_sar_send_data_packet(sar, NCI_STATIC_RF_CONN_ID,
+        payload_bytes, test_send_batch_data_complete, NULL, &test));
+    g_assert(nci_sar_send_command(sar, TEST_GID, TEST_OID, cmd_bytes,
+        test_send_batch_cmd_complete, NULL, &test));
 
+    /* Command goes first, then as many data segments as fit */
+    test_quit_later_n(test.loop, 10);
     test_run_loop(&test_opt, test.loop);
+    g_assert_cmpuint(test_io->written->len, == ,2);
+    test_send_batch_check(test_io, 0, TEST_ARRAY_AND_SIZE(write1));
+    test_send_batch_check(test_io, 1, TEST_ARRAY_AND_SIZE(write2));
+    g_assert_cmpint(test.cmd_done, == ,1);
+    g_assert_cmpint(test.data_done, == ,0);
 
-    /* Same thing but with a completion callback */
-    g_assert(nci_sar_send_command(sar, TEST_GID, TEST_OID, NULL,
-        test_send_err_sar_send_complete, NULL, &test));
-
+    /* The last segment is sent when more credits arrive */
+    nci_sar_add_credits(sar, NCI_STATIC_RF_CONN_ID, 1);
     test_run_loop(&test_opt, test.loop);
+    g_assert_cmpuint(test_io->written->len, == ,3);
+    test_send_batch_check(test_io, 2, TEST_ARRAY_AND_SIZE(write3));
+    g_assert_cmpint(test.data_done, == ,1);
+
     nci_sar_free(sar);
-    test_send_err_hal_io(test_io);
+    test_hal_io_free(test_io);
     g_main_loop_unref(test.loop);
+    g_bytes_unref(payload_bytes);
+    g_bytes_unref(cmd_bytes);
 }
 
 /*==========================================================================*
- * recv_ntf
+ * send_pool
  *==========================================================================*/
 
-typedef struct test_recv_ntf {
-    NciSarClient client;
-    int ntf_received;
-} TestRecvNtf;
+#define TEST_SEND_POOL_APDU_COUNT (100)
+
+typedef struct test_send_pool {
+    GMainLoop* loop;
+    guint8 apdu[32];
+    int sent;
+    int destroyed;
+} TestSendPool;
 
 static
 void
-test_recv_ntf_handle(
+test_send_pool_complete(
     NciSarClient* client,
-    guint8 gid,
-    guint8 oid,
-    const void* payload,
-    guint payload_len)
+    gboolean success,
+    gpointer user_data)
 {
-    TestRecvNtf* test = G_CAST(client, TestRecvNtf, client);
+    TestSendPool* test = user_data;
 
-    g_assert_cmpuint(gid, == ,TEST_GID);
-    g_assert_cmpuint(oid, == ,TEST_OID);
-    g_assert_cmpuint(payload_len, == ,0);
-    test->ntf_received++;
+    g_assert(success);
+    test->sent++;
+    g_main_loop_quit(test->loop);
 }
 
 static
 void
-test_recv_ntf(
+test_send_pool_destroy(
+    gpointer user_data)
+{
+    TestSendPool* test = user_data;
+
+    test->destroyed++;
+}
+
+static
+void
+test_send_pool(
     void)
 {
-    static const NciSarClientFunctions test_recv_ntf_sar_client_fn = {
-        .error = test_sar_client_unexpected,
-        .handle_response = test_dummy_sar_client_handle_response,
-        .handle_notification = test_recv_ntf_handle,
-        .handle_data_packet = test_dummy_sar_client_handle_data_packet
-    };
-    static const guint8 ntf[] = { NCI_MT_NTF_PKT | TEST_GID, TEST_OID, 0 };
-    NciSar* sar;
+    NciSarClient client;
     TestHalIo* test_io = test_hal_io_new();
-    TestRecvNtf test;
+    NciSar* sar = nci_sar_new(&test_io->io, &client);
+    GBytes* bytes;
+    TestSendPool test;
+    guint i;
 
     memset(&test, 0, sizeof(test));
-    test.client.fn = &test_recv_ntf_sar_client_fn;
+    test.loop = g_main_loop_new(NULL, TRUE);
+    client.fn = &test_dummy_sar_client_fn;
+    nci_sar_set_max_data_payload_size(sar, 0xff);
+    nci_sar_set_initial_credits(sar, NCI_STATIC_RF_CONN_ID, 0xff);
+
+    /* Send APDUs one by one straight from the caller's buffer */
+    for (i = 0; i < TEST_SEND_POOL_APDU_COUNT; i++) {
+        GUtilData written;
+
+        memset(test.apdu, i, sizeof(test.apdu));
+        g_assert(nci_sar_send_data_buf(sar, NCI_STATIC_RF_CONN_ID,
+            test.apdu, sizeof(test.apdu), test_send_pool_complete,
+            test_send_pool_destroy, &test));
+        test_run_loop(&test_opt, test.loop);
+        g_assert_cmpint(test.sent, == ,i + 1);
+        g_assert_cmpint(test.destroyed, == ,i + 1);
+        g_assert_cmpuint(test_io->written->len, == ,i + 1);
+        written.bytes = g_bytes_get_data(test_io->written->pdata[i],
+            &written.size);
+        g_assert_cmpuint(written.size, == ,3 + sizeof(test.apdu));
+        g_assert(!memcmp(written.bytes + 3, test.apdu, sizeof(test.apdu)));
+    }
 
-    sar = nci_sar_new(&test_io->io, &test.client);
-    g_assert(nci_sar_start(sar));
-    g_assert(nci_sar_start(sar)); /* Double start is handled */
-    g_assert(test_io->sar);
+    /* Packet descriptor gets reused */
+    GDEBUG("%u allocation(s) per %u APDUs", nci_sar_packets_allocated(sar),
+        TEST_SEND_POOL_APDU_COUNT);
+    g_assert_cmpuint(nci_sar_packets_allocated(sar), == ,1);
 
-    /* Test reception of a complete (non-segmented) packet */
-    test_io->sar->fn->read(test_io->sar, ntf, sizeof(ntf));
-    g_assert_cmpint(test.ntf_received, == ,1);
+    /* Including GBytes based packets */
+    bytes = g_bytes_new_static(test.apdu, sizeof(test.apdu));
+    g_assert(nci_sar_send_data_packet(sar, NCI_STATIC_RF_CONN_ID, bytes,
+        test_send_pool_complete, NULL, &test));
+    test_run_loop(&test_opt, test.loop);
+    g_assert_cmpint(test.sent, == ,TEST_SEND_POOL_APDU_COUNT + 1);
+    g_assert_cmpuint(nci_sar_packets_allocated(sar), == ,1);
+
+    /* Cancelled packet is destroyed, but not completed */
+    g_assert((i = nci_sar_send_data_buf(sar, NCI_STATIC_RF_CONN_ID,
+        test.apdu, sizeof(test.apdu), test_send_pool_complete,
+        test_send_pool_destroy, &test)) != 0);
+    nci_sar_cancel(sar, i);
+    g_assert_cmpint(test.destroyed, == ,TEST_SEND_POOL_APDU_COUNT + 1);
+    g_assert_cmpint(test.sent, == ,TEST_SEND_POOL_APDU_COUNT + 1);
+
+    /* Invalid cid */
+    g_assert(!nci_sar_send_data_buf(sar, 0x0f, test.apdu, sizeof(test.apdu),
+        NULL, NULL, NULL));
 
     nci_sar_free(sar);
     test_hal_io_free(test_io);
+    g_main_loop_unref(test.loop);
+    g_bytes_unref(bytes);
 }
 
 /*==========================================================================*
- * recv_ntf_data
+ * cancel_queue
  *==========================================================================*/
 
-typedef struct test_recv_ntf_data {
-    NciSarClient client;
-    int ntf_received;
-} TestRecvNtfData;
+#define TEST_CANCEL_QUEUE_COUNT (6)
 
-static const guint8 test_recv_ntf_data_payload[] = { 0x01, 0x02, 0x03 };
+typedef struct test_cancel_queue {
+    GMainLoop* loop;
+    NciSar* sar;
+    guint id[TEST_CANCEL_QUEUE_COUNT];
+    guint8 data[TEST_CANCEL_QUEUE_COUNT];
+    guint cancel_on_write;
+    GString* completed;
+    int destroyed;
+} TestCancelQueue;
 
 static
 void
-test_recv_ntf_data_handle(
+test_cancel_queue_complete(
     NciSarClient* client,
-    guint8 gid,
-    guint8 oid,
-    const void* payload,
-    guint payload_len)
+    gboolean success,
+    gpointer user_data)
 {
-    TestRecvNtfData* test = G_CAST(client, TestRecvNtfData, client);
+    TestCancelQueue* test = user_data;
 
-    g_assert_cmpuint(gid, == ,TEST_GID);
-    g_assert_cmpuint(oid, == ,TEST_OID);
-    g_assert_cmpuint(payload_len, == ,sizeof(test_recv_ntf_data_payload));
-    g_assert(!memcmp(test_recv_ntf_data_payload, payload, payload_len));
-    test->ntf_received++;
+    g_assert(success);
+    g_string_append_c(test->completed, 'x');
+    if (test->completed->len == 3) {
+        g_main_loop_quit(test->loop);
+    }
 }
 
 static
 void
-test_recv_ntf_data(
-    void)
+test_cancel_queue_destroy(
+    gpointer user_data)
 {
-    static const NciSarClientFunctions test_recv_ntf_sar_client_fn = {
-        .error = test_sar_client_unexpected,
-        .handle_response = test_dummy_sar_client_handle_response,
-        .handle_notification = test_recv_ntf_data_handle,
-        .handle_data_packet = test_dummy_sar_client_handle_data_packet
-    };
-    static const guint8 hdr[] = { NCI_MT_NTF_PKT | TEST_GID, TEST_OID };
-    NciSar* sar;
-    TestHalIo* test_io = test_hal_io_new();
-    GByteArray* packet = g_byte_array_new();
-    TestRecvNtfData test;
-    guint8 payload_len = sizeof(test_recv_ntf_data_payload);
+    TestCancelQueue* test = user_data;
 
-    g_byte_array_append(packet, hdr, sizeof(hdr));
-    g_byte_array_append(packet, &payload_len, 1);
-    g_byte_array_append(packet, test_recv_ntf_data_payload,
-        sizeof(test_recv_ntf_data_payload));
+    test->destroyed++;
+}
 
-    memset(&test, 0, sizeof(test));
-    test.client.fn = &test_recv_ntf_sar_client_fn;
+static
+gboolean
+test_cancel_queue_hal_io_write(
+    NciHalIo* io,
+    const GUtilData* chunks,
+    guint count,
+    NciHalClientFunc complete)
+{
+    TestHalIo* hal = G_CAST(io, TestHalIo, io);
+    TestCancelQueue* test = hal->test_data;
+
+    g_assert(test_hal_io_write(io, chunks, count, complete));
+    if (test->cancel_on_write) {
+        /* Cancel the packet which is being written */
+        nci_sar_cancel(test->sar, test->cancel_on_write);
+        test->cancel_on_write = 0;
+    }
+    return TRUE;
+}
+
+static
+void
+test_cancel_queue(
+    void)
+{
+    static const NciHalIoFunctions test_cancel_queue_hal_io_fn = {
+        .start = test_hal_io_start,
+        .stop = test_hal_io_stop,
+        .write = test_cancel_queue_hal_io_write,
+        .cancel_write = test_hal_io_cancel_write
+    };
+    static const guint8 expected[] = {
+        0x00, 0x00, 0x01, 0x01,
+        0x00, 0x00, 0x01, 0x03,
+        0x00, 0x00, 0x01, 0x05,
+        0x00, 0x00, 0x01, 0xff
+    };
+    NciSarClient client;
+    TestHalIo* test_io = test_hal_io_new_with_functions
+        (&test_cancel_queue_hal_io_fn);
+    TestCancelQueue test;
+    GByteArray* written = g_byte_array_new();
+    guint i;
+
+    memset(&test, 0, sizeof(test));
+    test.loop = g_main_loop_new(NULL, TRUE);
+    test.sar = nci_sar_new(&test_io->io, &client);
+    test.completed = g_string_new(NULL);
+    test_io->test_data = &test;
+    client.fn = &test_dummy_sar_client_fn;
+    nci_sar_set_max_data_payload_size(test.sar, 0xff);
+
+    /* No credits yet, packets stay in the queue */
+    for (i = 0; i < TEST_CANCEL_QUEUE_COUNT - 1; i++) {
+        test.data[i] = i;
+        test.id[i] = nci_sar_send_data_buf(test.sar, NCI_STATIC_RF_CONN_ID,
+            test.data + i, 1, test_cancel_queue_complete,
+            test_cancel_queue_destroy, &test);
+        g_assert(test.id[i]);
+    }
+
+    /* Cancel the ones in the middle, at the tail and at the head */
+    nci_sar_cancel(test.sar, test.id[2]);
+    g_assert_cmpint(test.destroyed, == ,1);
+    nci_sar_cancel(test.sar, test.id[4]);
+    g_assert_cmpint(test.destroyed, == ,2);
+    nci_sar_cancel(test.sar, test.id[0]);
+    g_assert_cmpint(test.destroyed, == ,3);
+    nci_sar_cancel(test.sar, test.id[0]); /* Invalid ID by now */
+    g_assert_cmpint(test.destroyed, == ,3);
+
+    /* Append one more to make sure that the tail is still valid */
+    test.data[i] = i;
+    test.id[i] = nci_sar_send_data_buf(test.sar, NCI_STATIC_RF_CONN_ID,
+        test.data + i, 1, test_cancel_queue_complete,
+        test_cancel_queue_destroy, &test);
+    g_assert(test.id[i]);
+
+    /* And reuse the slot of a cancelled one */
+    test.data[0] = 0xff;
+    test.id[0] = nci_sar_send_data_buf(test.sar, NCI_STATIC_RF_CONN_ID,
+        test.data, 1, test_cancel_queue_complete,
+        test_cancel_queue_destroy, &test);
+    g_assert(test.id[0]);
+
+    /* Packet 1 gets cancelled while it's being written */
+    test.cancel_on_write = test.id[1];
+    nci_sar_add_credits(test.sar, NCI_STATIC_RF_CONN_ID, 0xff);
+    test_run_loop(&test_opt, test.loop);
+
+    /* It's still written and destroyed but not completed */
+    g_assert_cmpstr(test.completed->str, == ,"xxx");
+    g_assert_cmpint(test.destroyed, == ,3 + 4);
+    for (i = 0; i < test_io->written->len; i++) {
+        gsize size;
+        const void* data = g_bytes_get_data(test_io->written->pdata[i],
+            &size);
+
+        g_byte_array_append(written, data, size);
+    }
+    g_assert_cmpuint(written->len, == ,sizeof(expected));
+    g_assert(!memcmp(written->data, expected, sizeof(expected)));
+
+    nci_sar_free(test.sar);
+    test_hal_io_free(test_io);
+    g_main_loop_unref(test.loop);
+    g_string_free(test.completed, TRUE);
+    g_byte_array_free(written, TRUE);
+}
+
+/*==========================================================================*
+ * cancel_data
+ *==========================================================================*/
+
+static
+void
+test_cancel_data_destroy(
+    gpointer user_data)
+{
+    int* destroyed = user_data;
+
+    (*destroyed)++;
+}
+
+static
+void
+test_cancel_data_complete(
+    NciSarClient* client,
+    gboolean success,
+    gpointer user_data)
+{
+    g_assert(success);
+    g_main_loop_quit((GMainLoop*)user_data);
+}
+
+static
+void
+test_cancel_data(
+    void)
+{
+    static const guint8 cmd_expected[] = {
+        0x21, 0x02, 0x00
+    };
+    static const guint8 data_expected[] = {
+        0x00, 0x00, 0x01, 0x01
+    };
+    static const guint8 data[] = { 0x01 };
+    NciSarClient client;
+    TestHalIo* test_io = test_hal_io_new();
+    NciSar* sar = nci_sar_new(&test_io->io, &client);
+    GMainLoop* loop = g_main_loop_new(NULL, TRUE);
+    int destroyed = 0;
+    guint i;
+
+    client.fn = &test_dummy_sar_client_fn;
+    nci_sar_set_max_data_payload_size(sar, 0xff);
+
+    /* These are stuck because there are no credits */
+    for (i = 0; i < 3; i++) {
+        g_assert(nci_sar_send_data_buf(sar, NCI_STATIC_RF_CONN_ID, data,
+            sizeof(data), test_client_unexpected_completion,
+            test_cancel_data_destroy, &destroyed));
+    }
+
+    /* Invalid cid is ignored */
+    nci_sar_cancel_data(sar, 0x0f);
+    g_assert_cmpint(destroyed, == ,0);
+
+    /* Drop them all at once */
+    nci_sar_cancel_data(sar, NCI_STATIC_RF_CONN_ID);
+    g_assert_cmpint(destroyed, == ,3);
+
+    /* Commands are not affected */
+    g_assert(nci_sar_send_command(sar, TEST_GID, TEST_OID, NULL,
+        test_cancel_data_complete, NULL, loop));
+    nci_sar_cancel_data(sar, NCI_STATIC_RF_CONN_ID);
+    test_run_loop(&test_opt, loop);
+    g_assert_cmpuint(test_io->written->len, == ,1);
+    test_assert_bytes(test_io->written->pdata[0],
+        cmd_expected, sizeof(cmd_expected));
+
+    /* The connection is still usable */
+    nci_sar_add_credits(sar, NCI_STATIC_RF_CONN_ID, 1);
+    g_assert(nci_sar_send_data_buf(sar, NCI_STATIC_RF_CONN_ID, data,
+        sizeof(data), test_cancel_data_complete, NULL, loop));
+    test_run_loop(&test_opt, loop);
+    g_assert_cmpuint(test_io->written->len, == ,2);
+    test_assert_bytes(test_io->written->pdata[1],
+        data_expected, sizeof(data_expected));
+
+    nci_sar_free(sar);
+    test_hal_io_free(test_io);
+    g_main_loop_unref(loop);
+}
+
+/*==========================================================================*
+ * resize
+ *==========================================================================*/
+
+static
+void
+test_resize(
+    void)
+{
+    static const guint8 seg1[] = { 0x10, 0x00, 0x02, 0x01, 0x02 };
+    static const guint8 seg2[] = { 0x00, 0x00, 0x02, 0x03, 0x04 };
+    static const guint8 data[] = { 0x01, 0x02, 0x03, 0x04 };
+    NciSarClient client;
+    TestHalIo* test_io = test_hal_io_new();
+    NciSar* sar = nci_sar_new(&test_io->io, &client);
+    GMainLoop* loop = g_main_loop_new(NULL, TRUE);
+    NciConnStats stats;
+    int destroyed = 0;
+    guint id;
+
+    client.fn = &test_dummy_sar_client_fn;
+    nci_sar_set_max_data_payload_size(sar, 2);
+
+    /* Both are stuck because there are no credits */
+    g_assert(nci_sar_send_data_buf(sar, NCI_STATIC_RF_CONN_ID, data,
+        sizeof(data), test_cancel_data_complete, NULL, loop));
+    id = nci_sar_send_data_buf(sar, NCI_STATIC_RF_CONN_ID, data, 1,
+        test_client_unexpected_completion, test_cancel_data_destroy,
+        &destroyed);
+    g_assert(id);
+
+    /* Connections get reallocated while the packets are queued */
+    nci_sar_set_max_logical_connections(sar, 8);
+    nci_sar_cancel(sar, id);
+    g_assert_cmpint(destroyed, == ,1);
+
+    /* One credit is only enough for the first segment */
+    nci_sar_add_credits(sar, NCI_STATIC_RF_CONN_ID, 1);
+    while (test_io->written->len < 1) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    test_assert_bytes(test_io->written->pdata[0], seg1, sizeof(seg1));
+
+    /* And once again while the rest is waiting for credits */
+    nci_sar_set_max_logical_connections(sar, 16);
+    nci_sar_add_credits(sar, NCI_STATIC_RF_CONN_ID, 1);
+    test_run_loop(&test_opt, loop);
+    g_assert_cmpuint(test_io->written->len, == ,2);
+    test_assert_bytes(test_io->written->pdata[1], seg2, sizeof(seg2));
+
+    g_assert(nci_sar_get_data_stats(sar, NCI_STATIC_RF_CONN_ID, &stats));
+    g_assert_cmpuint(stats.queued, == ,0);
+    g_assert_cmpuint(stats.packets, == ,1);
+    g_assert_cmpuint(stats.bytes, == ,sizeof(data));
+
+    nci_sar_free(sar);
+    test_hal_io_free(test_io);
+    g_main_loop_unref(loop);
+}
+
+/*==========================================================================*
+ * sched
+ *==========================================================================*/
+
+#define TEST_SCHED_CONNS (3)
+#define TEST_SCHED_PACKETS (4)
+#define TEST_SCHED_TOTAL (TEST_SCHED_CONNS * TEST_SCHED_PACKETS)
+
+typedef struct test_sched_data {
+    NCI_DATA_SCHED sched;
+    guint weight[TEST_SCHED_CONNS];
+    guint8 expected[TEST_SCHED_TOTAL]; /* cid << 4 | packet index */
+} TestSchedData;
+
+typedef struct test_sched {
+    GMainLoop* loop;
+    guint8 payload[TEST_SCHED_TOTAL];
+    int completed;
+} TestSched;
+
+static
+void
+test_sched_cmd_complete(
+    NciSarClient* client,
+    gboolean success,
+    gpointer user_data)
+{
+    TestSched* test = user_data;
+
+    /* Command goes first */
+    g_assert(success);
+    g_assert_cmpint(test->completed, == ,0);
+}
+
+static
+void
+test_sched_data_complete(
+    NciSarClient* client,
+    gboolean success,
+    gpointer user_data)
+{
+    TestSched* test = user_data;
+
+    g_assert(success);
+    if (++test->completed == TEST_SCHED_TOTAL) {
+        g_main_loop_quit(test->loop);
+    }
+}
+
+static
+void
+test_sched(
+    gconstpointer test_data)
+{
+    const TestSchedData* data = test_data;
+    NciSarClient client;
+    TestHalIo* test_io = test_hal_io_new();
+    NciSar* sar = nci_sar_new(&test_io->io, &client);
+    NciConnStats stats;
+    TestSched test;
+    guint i, k;
+
+    memset(&test, 0, sizeof(test));
+    test.loop = g_main_loop_new(NULL, TRUE);
+    client.fn = &test_dummy_sar_client_fn;
+    nci_sar_set_max_logical_connections(sar, TEST_SCHED_CONNS);
+    nci_sar_set_data_scheduler(sar, data->sched);
+    g_assert(!nci_sar_get_data_stats(sar, TEST_SCHED_CONNS, &stats));
+
+    /* Fill the queues while there are no credits */
+    for (i = 0; i < TEST_SCHED_CONNS; i++) {
+        nci_sar_set_data_weight(sar, i, data->weight[i]);
+        for (k = 0; k < TEST_SCHED_PACKETS; k++) {
+            guint8* payload = test.payload + i * TEST_SCHED_PACKETS + k;
+
+            *payload = (i << 4) | k;
+            g_assert(nci_sar_send_data_buf(sar, i, payload, 1,
+                test_sched_data_complete, NULL, &test));
+        }
+        g_assert(nci_sar_get_data_stats(sar, i, NULL));
+        g_assert(nci_sar_get_data_stats(sar, i, &stats));
+        g_assert_cmpuint(stats.queued, == ,TEST_SCHED_PACKETS);
+        g_assert_cmpuint(stats.max_queued, == ,TEST_SCHED_PACKETS);
+        g_assert_cmpuint(stats.packets, == ,0);
+    }
+    g_assert(nci_sar_send_command(sar, TEST_GID, TEST_OID, NULL,
+        test_sched_cmd_complete, NULL, &test));
+
+    /* Let them go */
+    for (i = 0; i < TEST_SCHED_CONNS; i++) {
+        nci_sar_add_credits(sar, i, 0xff);
+    }
+    test_run_loop(&test_opt, test.loop);
+
+    /* Each write contains exactly one packet */
+    g_assert_cmpuint(test_io->written->len, == ,TEST_SCHED_TOTAL + 1);
+    for (i = 0; i < TEST_SCHED_TOTAL; i++) {
+        gsize size;
+        const guint8* packet = g_bytes_get_data(test_io->written->pdata
+            [i + 1], &size);
+
+        g_assert_cmpuint(size, == ,4);
+        g_assert_cmphex(packet[3], == ,data->expected[i]);
+        g_assert_cmpuint(packet[0], == ,data->expected[i] >> 4);
+    }
+
+    /* Check the statistics */
+    for (i = 0; i < TEST_SCHED_CONNS; i++) {
+        g_assert(nci_sar_get_data_stats(sar, i, &stats));
+        g_assert_cmpuint(stats.queued, == ,0);
+        g_assert_cmpuint(stats.max_queued, == ,TEST_SCHED_PACKETS);
+        g_assert_cmpuint(stats.packets, == ,TEST_SCHED_PACKETS);
+        g_assert_cmpuint(stats.bytes, == ,TEST_SCHED_PACKETS);
+        g_assert_cmpuint(stats.wait_max, <= ,stats.wait_total);
+    }
+
+    nci_sar_free(sar);
+    test_hal_io_free(test_io);
+    g_main_loop_unref(test.loop);
+}
+
+static const TestSchedData test_sched_priority = {
+    NCI_DATA_SCHED_PRIORITY, { 0, 0, 0 }, {
+        0x00, 0x01, 0x02, 0x03,
+        0x10, 0x11, 0x12, 0x13,
+        0x20, 0x21, 0x22, 0x23
+    }
+};
+
+static const TestSchedData test_sched_round_robin = {
+    NCI_DATA_SCHED_ROUND_ROBIN, { 0, 0, 0 }, {
+        0x00, 0x10, 0x20,
+        0x01, 0x11, 0x21,
+        0x02, 0x12, 0x22,
+        0x03, 0x13, 0x23
+    }
+};
+
+/* cid 1 gets twice the bandwidth of the others while it has data */
+static const TestSchedData test_sched_weighted = {
+    NCI_DATA_SCHED_WEIGHTED, { 1, 2, 0 }, {
+        0x10, 0x11, 0x20, 0x00,
+        0x12, 0x13, 0x21, 0x01,
+        0x22, 0x02, 0x23, 0x03
+    }
+};
+
+/*==========================================================================*
+ * sched_starved
+ *==========================================================================*/
+
+static
+void
+test_sched_starved(
+    void)
+{
+    /* First payload byte of each segment, cid << 4 | index */
+    static const guint8 expected[] = {
+        0x00, 0x02, 0x10, 0x04, 0x12, 0x14
+    };
+    NciSarClient client;
+    TestHalIo* test_io = test_hal_io_new();
+    NciSar* sar = nci_sar_new(&test_io->io, &client);
+    TestSched test;
+    guint i;
+
+    memset(&test, 0, sizeof(test));
+    test.loop = g_main_loop_new(NULL, TRUE);
+    client.fn = &test_dummy_sar_client_fn;
+    nci_sar_set_max_logical_connections(sar, 2);
+    nci_sar_set_max_data_payload_size(sar, 2);
+    nci_sar_set_data_scheduler(sar, NCI_DATA_SCHED_WEIGHTED);
+    for (i = 0; i < 6; i++) {
+        test.payload[i] = i;
+        test.payload[i + 6] = 0x10 | i;
+    }
+
+    /* cid 0 starts with a two segment packet, the rest are one segment */
+    g_assert(nci_sar_send_data_buf(sar, 0, test.payload, 4,
+        test_sched_data_complete, NULL, &test));
+    g_assert(nci_sar_send_data_buf(sar, 0, test.payload + 4, 2,
+        test_sched_data_complete, NULL, &test));
+    for (i = 0; i < 6; i += 2) {
+        g_assert(nci_sar_send_data_buf(sar, 1, test.payload + 6 + i, 2,
+            test_sched_data_complete, NULL, &test));
+    }
+
+    /* cid 0 runs out of credits in the middle of its first packet */
+    test.completed = TEST_SCHED_TOTAL - 5;
+    nci_sar_add_credits(sar, 0, 1);
+    while (test_io->written->len < 1) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+
+    /* The rest of it has been paid for and goes first */
+    nci_sar_add_credits(sar, 0, 0xff);
+    nci_sar_add_credits(sar, 1, 0xff);
+    test_run_loop(&test_opt, test.loop);
+    g_assert_cmpuint(test_io->written->len, == ,G_N_ELEMENTS(expected));
+    for (i = 0; i < G_N_ELEMENTS(expected); i++) {
+        gsize size;
+        const guint8* packet = g_bytes_get_data(test_io->written->pdata[i],
+            &size);
+
+        g_assert_cmpuint(size, == ,5);
+        g_assert_cmpuint(packet[0] & 0x0f, == ,expected[i] >> 4);
+        g_assert_cmphex(packet[3], == ,expected[i]);
+    }
+
+    nci_sar_free(sar);
+    test_hal_io_free(test_io);
+    g_main_loop_unref(test.loop);
+}
+
+/*==========================================================================*
+ * send_err
+ *==========================================================================*/
+
+typedef struct test_send_err_hal_io {
+    NciHalIo io;
+    NciHalClient* sar;
+} TestSendErrHalIo;
+
+typedef struct test_send_err_hal_io_write {
+    NciHalClient* sar;
+    NciHalClientFunc complete;
+} TestSendErrHalIoWrite;
+
+static
+gboolean
+test_send_err_hal_io_start(
+    NciHalIo* io,
+    NciHalClient* sar)
+{
+    TestSendErrHalIo* hal = G_CAST(io, TestSendErrHalIo, io);
+
+    g_assert(!hal->sar);
+    hal->sar = sar;
+    return TRUE;
+}
+
+static
+gboolean
+test_send_err_hal_io_write_cb(
+    gpointer user_data)
+{
+    TestSendErrHalIoWrite* write = user_data;
+
+    write->complete(write->sar, FALSE);
+    return G_SOURCE_REMOVE;
+}
+
+static
+gboolean
+test_send_err_hal_io_write(
+    NciHalIo* io,
+    const GUtilData* chunks,
+    guint count,
+    NciHalClientFunc complete)
+{
+    TestSendErrHalIo* hal = G_CAST(io, TestSendErrHalIo, io);
+    TestSendErrHalIoWrite* write = g_new0(TestSendErrHalIoWrite, 1);
+
+    write->complete = complete;
+    write->sar = hal->sar;
+    g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, test_send_err_hal_io_write_cb,
+        write, g_free);
+    return TRUE;
+}
+
+static
+TestSendErrHalIo*
+test_send_err_hal_io_new(
+    void)
+{
+    static const NciHalIoFunctions test_dummy_hal_io_fn = {
+        .start = test_send_err_hal_io_start,
+        .stop = test_dummy_hal_io_stop,
+        .write = test_send_err_hal_io_write,
+        .cancel_write = test_dummy_hal_io_cancel_write
+    };
+    TestSendErrHalIo* hal = g_new0(TestSendErrHalIo, 1);
+
+    hal->io.fn = &test_dummy_hal_io_fn;
+    return hal;
+}
+
+static
+void
+test_send_err_hal_io(
+    TestSendErrHalIo* hal)
+{
+    g_free(hal);
+}
+
+typedef struct test_send_err_sar_client {
+    NciSarClient client;
+    GMainLoop* loop;
+    gboolean completed;
+} TestSendErrSarClient;
+
+static
+void
+test_send_err_sar_send_complete(
+    NciSarClient* client,
+    gboolean success,
+    gpointer user_data)
+{
+    TestSendErrSarClient* test = user_data;
+
+    g_assert(&test->client == client);
+    g_assert(!success);
+    g_assert(!test->completed);
+    test->completed = TRUE;
+}
+
+static
+void
+test_send_err_sar_client_error(
+    NciSarClient* client)
+{
+    TestSendErrSarClient* test = G_CAST(client, TestSendErrSarClient, client);
+
+    g_main_loop_quit(test->loop);
+}
+
+static
+void
+test_send_err(
+    void)
+{
+    static const NciSarClientFunctions test_send_err_sar_client_fn = {
+        .error = test_send_err_sar_client_error,
+        .handle_response = test_dummy_sar_client_handle_response,
+        .handle_notification = test_dummy_sar_client_handle_notification,
+        .handle_data_packet = test_dummy_sar_client_handle_data_packet
+    };
+    TestSendErrHalIo* test_io = test_send_err_hal_io_new();
+    TestSendErrSarClient test;
+    NciSar* sar;
+
+    memset(&test, 0, sizeof(test));
+    test.client.fn = &test_send_err_sar_client_fn;
+    test.loop = g_main_loop_new(NULL, TRUE);
+
+    sar = nci_sar_new(&test_io->io, &test.client);
+    g_assert(nci_sar_start(sar));
+    g_assert(test_io->sar);
+
+    /* This send fails asynchronously */
+    g_assert(nci_sar_send_command(sar, TEST_GID, TEST_OID, NULL,
+        NULL, NULL, NULL));
+
+    test_run_loop(&test_opt, test.loop);
+
+    /* Same thing but with a completion callback */
+    g_assert(nci_sar_send_command(sar, TEST_GID, TEST_OID, NULL,
+        test_send_err_sar_send_complete, NULL, &test));
+
+    test_run_loop(&test_opt, test.loop);
+    nci_sar_free(sar);
+    test_send_err_hal_io(test_io);
+    g_main_loop_unref(test.loop);
+}
+
+/*==========================================================================*
+ * recv_ntf
+ *==========================================================================*/
+
+typedef struct test_recv_ntf {
+    NciSarClient client;
+    int ntf_received;
+} TestRecvNtf;
+
+static
+void
+test_recv_ntf_handle(
+    NciSarClient* client,
+    guint8 gid,
+    guint8 oid,
+    const void* payload,
+    guint payload_len)
+{
+    TestRecvNtf* test = G_CAST(client, TestRecvNtf, client);
+
+    g_assert_cmpuint(gid, == ,TEST_GID);
+    g_assert_cmpuint(oid, == ,TEST_OID);
+    g_assert_cmpuint(payload_len, == ,0);
+    test->ntf_received++;
+}
+
+static
+void
+test_recv_ntf(
+    void)
+{
+    static const NciSarClientFunctions test_recv_ntf_sar_client_fn = {
+        .error = test_sar_client_unexpected,
+        .handle_response = test_dummy_sar_client_handle_response,
+        .handle_notification = test_recv_ntf_handle,
+        .handle_data_packet = test_dummy_sar_client_handle_data_packet
+    };
+    static const guint8 ntf[] = { NCI_MT_NTF_PKT | TEST_GID, TEST_OID, 0 };
+    NciSar* sar;
+    TestHalIo* test_io = test_hal_io_new();
+    TestRecvNtf test;
+
+    memset(&test, 0, sizeof(test));
+    test.client.fn = &test_recv_ntf_sar_client_fn;
+
+    sar = nci_sar_new(&test_io->io, &test.client);
+    g_assert(nci_sar_start(sar));
+    g_assert(nci_sar_start(sar)); /* Double start is handled */
+    g_assert(test_io->sar);
+
+    /* Test reception of a complete (non-segmented) packet */
+    test_io->sar->fn->read(test_io->sar, ntf, sizeof(ntf));
+    g_assert_cmpint(test.ntf_received, == ,1);
+
+    nci_sar_free(sar);
+    test_hal_io_free(test_io);
+}
+
+/*==========================================================================*
+ * recv_ntf_data
+ *==========================================================================*/
+
+typedef struct test_recv_ntf_data {
+    NciSarClient client;
+    int ntf_received;
+} TestRecvNtfData;
+
+static const guint8 test_recv_ntf_data_payload[] = { 0x01, 0x02, 0x03 };
+
+static
+void
+test_recv_ntf_data_handle(
+    NciSarClient* client,
+    guint8 gid,
+    guint8 oid,
+    const void* payload,
+    guint payload_len)
+{
+    TestRecvNtfData* test = G_CAST(client, TestRecvNtfData, client);
+
+    g_assert_cmpuint(gid, == ,TEST_GID);
+    g_assert_cmpuint(oid, == ,TEST_OID);
+    g_assert_cmpuint(payload_len, == ,sizeof(test_recv_ntf_data_payload));
+    g_assert(!memcmp(test_recv_ntf_data_payload, payload, payload_len));
+    test->ntf_received++;
+}
+
+static
+void
+test_recv_ntf_data(
+    void)
+{
+    static const NciSarClientFunctions test_recv_ntf_sar_client_fn = {
+        .error = test_sar_client_unexpected,
+        .handle_response = test_dummy_sar_client_handle_response,
+        .handle_notification = test_recv_ntf_data_handle,
+        .handle_data_packet = test_dummy_sar_client_handle_data_packet
+    };
+    static const guint8 hdr[] = { NCI_MT_NTF_PKT | TEST_GID, TEST_OID };
+    NciSar* sar;
+    TestHalIo* test_io = test_hal_io_new();
+    GByteArray* packet = g_byte_array_new();
+    TestRecvNtfData test;
+    guint8 payload_len = sizeof(test_recv_ntf_data_payload);
+
+    g_byte_array_append(packet, hdr, sizeof(hdr));
+    g_byte_array_append(packet, &payload_len, 1);
+    g_byte_array_append(packet, test_recv_ntf_data_payload,
+        sizeof(test_recv_ntf_data_payload));
+
+    memset(&test, 0, sizeof(test));
+    test.client.fn = &test_recv_ntf_sar_client_fn;
 
     sar = nci_sar_new(&test_io->io, &test.client);
     g_assert(nci_sar_start(sar));
@@ -1749,6 +2598,235 @@ test_recv_data_seg(
     test_hal_io_free(test_io);
 }
 
+/*==========================================================================*
+ * recv_data_bytes
+ *==========================================================================*/
+
+typedef struct test_recv_data_bytes {
+    NciSarClient client;
+    GPtrArray* packets;
+    int raw_count;
+} TestRecvDataBytes;
+
+static
+void
+test_recv_data_bytes_handle_packet(
+    NciSarClient* client,
+    guint8 cid,
+    const void* payload,
+    guint payload_len)
+{
+    TestRecvDataBytes* test = G_CAST(client, TestRecvDataBytes, client);
+    static const guint8 expected_payload[] = { 0x07 };
+
+    g_assert_cmpuint(cid, == ,1);
+    g_assert_cmpuint(payload_len, == ,sizeof(expected_payload));
+    g_assert(!memcmp(payload, expected_payload, payload_len));
+    test->raw_count++;
+}
+
+static
+void
+test_recv_data_bytes_handle_bytes(
+    NciSarClient* client,
+    guint8 cid,
+    GBytes* payload)
+{
+    TestRecvDataBytes* test = G_CAST(client, TestRecvDataBytes, client);
+
+    g_assert_cmpuint(cid, == ,1);
+    g_ptr_array_add(test->packets, g_bytes_ref(payload));
+}
+
+static
+void
+test_recv_data_bytes(
+    void)
+{
+    static const NciSarClientFunctions test_recv_data_bytes_fn = {
+        .error = test_sar_client_unexpected,
+        .handle_response = test_sar_client_unexpected_resp,
+        .handle_notification = test_sar_client_unexpected_resp,
+        .handle_data_packet = test_recv_data_bytes_handle_packet,
+        .handle_data_bytes = test_recv_data_bytes_handle_bytes
+    };
+    static const guint8 buf1[] = {
+        NCI_MT_DATA_PKT | 1, 0, 2, 0x01, 0x02, /* Complete packet */
+        NCI_MT_DATA_PKT | NCI_PBF | 1, 0, 1, 0x03, /* First segment */
+        NCI_MT_DATA_PKT | 1, 0 /* Part of the last segment */
+    };
+    static const guint8 buf2[] = {
+        2, 0x04, 0x05, /* End of the last segment */
+        NCI_MT_DATA_PKT | 1, 0, 1, 0x06 /* Complete packet */
+    };
+    static const guint8 buf3[] = {
+        NCI_MT_DATA_PKT | 1, 0, 1, 0x07 /* Complete packet */
+    };
+    static const guint8 payload1[] = { 0x01, 0x02 };
+    static const guint8 payload2[] = { 0x03, 0x04, 0x05 };
+    static const guint8 payload3[] = { 0x06 };
+    NciSar* sar;
+    TestHalIo* test_io = test_hal_io_new();
+    TestRecvDataBytes test;
+    GBytes* bytes = g_bytes_new(buf1, sizeof(buf1));
+    gsize size;
+    const guint8* data = g_bytes_get_data(bytes, &size);
+    const guint8* payload;
+
+    memset(&test, 0, sizeof(test));
+    test.client.fn = &test_recv_data_bytes_fn;
+    test.packets = g_ptr_array_new_with_free_func(test_bytes_unref);
+
+    sar = nci_sar_new(&test_io->io, &test.client);
+    g_assert(nci_sar_start(sar));
+    g_assert(test_io->sar);
+    g_assert(test_io->sar->fn->read_bytes);
+    nci_sar_set_max_logical_connections(sar, 2);
+    nci_sar_set_data_bytes(NULL, TRUE); /* Does nothing */
+    nci_sar_set_data_bytes(sar, TRUE);
+
+    /* The complete packet references the HAL buffer */
+    test_io->sar->fn->read_bytes(test_io->sar, bytes);
+    g_bytes_unref(bytes);
+    g_assert_cmpuint(test.packets->len, == ,1);
+    payload = g_bytes_get_data(test.packets->pdata[0], NULL);
+    g_assert(payload == data + 3); /* Right after the header */
+
+    /* The reassembled one and the one passed in as a raw pointer */
+    test_io->sar->fn->read(test_io->sar, buf2, sizeof(buf2));
+    g_assert_cmpuint(test.packets->len, == ,3);
+
+    /* Switch back to raw pointers */
+    nci_sar_set_data_bytes(sar, FALSE);
+    test_io->sar->fn->read(test_io->sar, buf3, sizeof(buf3));
+    g_assert_cmpuint(test.packets->len, == ,3);
+    g_assert_cmpint(test.raw_count, == ,1);
+
+    nci_sar_free(sar);
+    test_hal_io_free(test_io);
+
+    /* The payloads outlive SAR */
+    test_assert_bytes(test.packets->pdata[0], TEST_ARRAY_AND_SIZE(payload1));
+    test_assert_bytes(test.packets->pdata[1], TEST_ARRAY_AND_SIZE(payload2));
+    test_assert_bytes(test.packets->pdata[2], TEST_ARRAY_AND_SIZE(payload3));
+    g_ptr_array_free(test.packets, TRUE);
+}
+
+/*==========================================================================*
+ * recv_data_bytes_split
+ *==========================================================================*/
+
+static
+void
+test_recv_data_bytes_split(
+    void)
+{
+    static const NciSarClientFunctions test_recv_data_bytes_fn = {
+        .error = test_sar_client_unexpected,
+        .handle_response = test_sar_client_unexpected_resp,
+        .handle_notification = test_sar_client_unexpected_resp,
+        .handle_data_packet = test_sar_client_unexpected_data_packet,
+        .handle_data_bytes = test_recv_data_bytes_handle_bytes
+    };
+    static const guint8 data[] = {
+        NCI_MT_DATA_PKT | 1, 0, 2, 0x01, 0x02,
+        NCI_MT_DATA_PKT | NCI_PBF | 1, 0, 1, 0x03,
+        NCI_MT_DATA_PKT | 1, 0, 2, 0x04, 0x05,
+        NCI_MT_DATA_PKT | 1, 0, 1, 0x06
+    };
+    static const guint8 payload1[] = { 0x01, 0x02 };
+    static const guint8 payload2[] = { 0x03, 0x04, 0x05 };
+    static const guint8 payload3[] = { 0x06 };
+    NciSar* sar;
+    TestHalIo* test_io = test_hal_io_new();
+    TestRecvDataBytes test;
+    guint i;
+
+    memset(&test, 0, sizeof(test));
+    test.client.fn = &test_recv_data_bytes_fn;
+    test.packets = g_ptr_array_new_with_free_func(test_bytes_unref);
+
+    sar = nci_sar_new(&test_io->io, &test.client);
+    g_assert(nci_sar_start(sar));
+    g_assert(test_io->sar);
+    nci_sar_set_max_logical_connections(sar, 2);
+    nci_sar_set_data_bytes(sar, TRUE);
+
+    /* Every packet straddles HAL buffers and gets assembled in read_buf */
+    for (i = 0; i < sizeof(data); i++) {
+        GBytes* bytes = g_bytes_new(data + i, 1);
+
+        nci_hal_client_read_bytes(test_io->sar, bytes);
+        g_bytes_unref(bytes);
+    }
+    g_assert_cmpuint(test.packets->len, == ,3);
+
+    nci_sar_free(sar);
+    test_hal_io_free(test_io);
+
+    test_assert_bytes(test.packets->pdata[0], TEST_ARRAY_AND_SIZE(payload1));
+    test_assert_bytes(test.packets->pdata[1], TEST_ARRAY_AND_SIZE(payload2));
+    test_assert_bytes(test.packets->pdata[2], TEST_ARRAY_AND_SIZE(payload3));
+    g_ptr_array_free(test.packets, TRUE);
+}
+
+/*==========================================================================*
+ * read_bytes_fallback
+ *==========================================================================*/
+
+typedef struct test_read_bytes_fallback {
+    NciHalClient client;
+    GByteArray* data;
+} TestReadBytesFallback;
+
+static
+void
+test_read_bytes_fallback_error(
+    NciHalClient* client)
+{
+    g_assert_not_reached();
+}
+
+static
+void
+test_read_bytes_fallback_read(
+    NciHalClient* client,
+    const void* data,
+    guint len)
+{
+    TestReadBytesFallback* test = G_CAST(client, TestReadBytesFallback,
+        client);
+
+    g_byte_array_append(test->data, data, len);
+}
+
+static
+void
+test_read_bytes_fallback(
+    void)
+{
+    /* Client which doesn't provide read_bytes */
+    static const NciHalClientFunctions test_fn = {
+        .error = test_read_bytes_fallback_error,
+        .read = test_read_bytes_fallback_read
+    };
+    static const guint8 data[] = { 0x01, 0x02, 0x03 };
+    GBytes* bytes = g_bytes_new_static(data, sizeof(data));
+    TestReadBytesFallback test;
+
+    memset(&test, 0, sizeof(test));
+    test.client.fn = &test_fn;
+    test.data = g_byte_array_new();
+
+    nci_hal_client_read_bytes(&test.client, NULL); /* Does nothing */
+    nci_hal_client_read_bytes(&test.client, bytes);
+    g_assert_cmpuint(test.data->len, == ,sizeof(data));
+    g_assert(!memcmp(test.data->data, data, sizeof(data)));
+
+    g_bytes_unref(bytes);
+    g_byte_array_free(test.data, TRUE);
+}
+
 /*==========================================================================*
  * recv_reset
  *==========================================================================*/
@@ -1890,6 +2968,150 @@ test_recv_cr(
     g_main_loop_unref(test.loop);
 }
 
+/*==========================================================================*
+ * recv_chunks
+ *==========================================================================*/
+
+#define TEST_RECV_CHUNKS_PACKETS (256)
+#define TEST_RECV_CHUNKS_ROUNDS (16)
+#define TEST_RECV_CHUNKS_RANDOM (0)
+#define TEST_RECV_CHUNKS_MAX (2 * (3 + 0xff)) /* Up to two full packets */
+
+typedef struct test_recv_chunks {
+    NciSarClient client;
+    guint data_count;
+    guint ntf_count;
+} TestRecvChunks;
+
+static
+void
+test_recv_chunks_check_payload(
+    guint index,
+    const guint8* payload,
+    guint payload_len)
+{
+    guint i;
+
+    g_assert_cmpuint(payload_len, == ,index % 0x100);
+    for (i = 0; i < payload_len; i++) {
+        g_assert_cmpuint(payload[i], == ,(guint8)(index + i));
+    }
+}
+
+static
+void
+test_recv_chunks_handle_ntf(
+    NciSarClient* client,
+    guint8 gid,
+    guint8 oid,
+    const void* payload,
+    guint payload_len)
+{
+    TestRecvChunks* test = G_CAST(client, TestRecvChunks, client);
+
+    g_assert_cmpuint(gid, == ,TEST_GID);
+    g_assert_cmpuint(oid, == ,TEST_OID);
+    test_recv_chunks_check_payload(2 * test->ntf_count + 1, payload,
+        payload_len);
+    test->ntf_count = (test->ntf_count + 1) % (TEST_RECV_CHUNKS_PACKETS / 2);
+}
+
+static
+void
+test_recv_chunks_handle_packet(
+    NciSarClient* client,
+    guint8 cid,
+    const void* payload,
+    guint payload_len)
+{
+    TestRecvChunks* test = G_CAST(client, TestRecvChunks, client);
+
+    g_assert_cmpuint(cid, == ,1);
+    test_recv_chunks_check_payload(2 * test->data_count, payload,
+        payload_len);
+    test->data_count = (test->data_count + 1) % (TEST_RECV_CHUNKS_PACKETS/2);
+}
+
+static
+void
+test_recv_chunks(
+    gconstpointer test_data)
+{
+    static const NciSarClientFunctions test_recv_chunks_fn = {
+        .error = test_sar_client_unexpected,
+        .handle_response = test_sar_client_unexpected_resp,
+        .handle_notification = test_recv_chunks_handle_ntf,
+        .handle_data_packet = test_recv_chunks_handle_packet
+    };
+    const guint chunk = GPOINTER_TO_UINT(test_data);
+    GByteArray* stream = g_byte_array_new();
+    GRand* rand = g_rand_new_with_seed(chunk);
+    TestHalIo* test_io = test_hal_io_new();
+    TestRecvChunks test;
+    NciSar* sar;
+    guint i, total = 0;
+    gdouble elapsed;
+
+    /* Even packets are data packets, odd ones are notifications */
+    for (i = 0; i < TEST_RECV_CHUNKS_PACKETS; i++) {
+        const guint len = i % 0x100;
+        guint8 hdr[3];
+        guint k;
+
+        if (i & 1) {
+            hdr[0] = NCI_MT_NTF_PKT | TEST_GID;
+            hdr[1] = TEST_OID;
+        } else {
+            hdr[0] = NCI_MT_DATA_PKT | 1;
+            hdr[1] = 0;
+        }
+        hdr[2] = len;
+        g_byte_array_append(stream, hdr, sizeof(hdr));
+        for (k = 0; k < len; k++) {
+            const guint8 b = (guint8)(i + k);
+
+            g_byte_array_append(stream, &b, 1);
+        }
+    }
+
+    memset(&test, 0, sizeof(test));
+    test.client.fn = &test_recv_chunks_fn;
+    sar = nci_sar_new(&test_io->io, &test.client);
+    g_assert(nci_sar_start(sar));
+    g_assert(test_io->sar);
+    nci_sar_set_max_logical_connections(sar, 2);
+
+    g_test_timer_start();
+    for (i = 0; i < TEST_RECV_CHUNKS_ROUNDS; i++) {
+        const guint8* ptr = stream->data;
+        guint left = stream->len;
+
+        while (left > 0) {
+            const guint step = (chunk == TEST_RECV_CHUNKS_RANDOM) ?
+                (guint)g_rand_int_range(rand, 1, TEST_RECV_CHUNKS_MAX) :
+                chunk;
+            const guint n = MIN(left, step);
+
+            test_io->sar->fn->read(test_io->sar, ptr, n);
+            ptr += n;
+            left -= n;
+        }
+        total += stream->len;
+    }
+    elapsed = g_test_timer_elapsed();
+
+    /* Everything must have been received */
+    g_assert_cmpuint(test.data_count, == ,0);
+    g_assert_cmpuint(test.ntf_count, == ,0);
+    g_test_minimized_result(elapsed, "%.0f bytes/sec",
+        elapsed > 0 ? (total / elapsed) : 0);
+
+    nci_sar_free(sar);
+    test_hal_io_free(test_io);
+    g_byte_array_free(stream, TRUE);
+    g_rand_free(rand);
+}
+
 /*==========================================================================*
  * Common
  *==========================================================================*/
@@ -1907,6 +3129,19 @@ int main(int argc, char* argv[])
     g_test_add_func(TEST_("send_data_seg"), test_send_data_seg);
     g_test_add_func(TEST_("send_data_seg2"), test_send_data_seg2);
     g_test_add_func(TEST_("send_data_seg3"), test_send_data_seg3);
+    g_test_add_func(TEST_("send_datav"), test_send_datav);
+    g_test_add_func(TEST_("send_batch"), test_send_batch);
+    g_test_add_func(TEST_("send_pool"), test_send_pool);
+    g_test_add_func(TEST_("cancel_queue"), test_cancel_queue);
+    g_test_add_func(TEST_("cancel_data"), test_cancel_data);
+    g_test_add_func(TEST_("resize"), test_resize);
+    g_test_add_data_func(TEST_("sched/priority"),
+        &test_sched_priority, test_sched);
+    g_test_add_data_func(TEST_("sched/round_robin"),
+        &test_sched_round_robin, test_sched);
+    g_test_add_data_func(TEST_("sched/weighted"),
+        &test_sched_weighted, test_sched);
+    g_test_add_func(TEST_("sched/starved"), test_sched_starved);
     g_test_add_func(TEST_("send_err"), test_send_err);
     g_test_add_func(TEST_("recv_ntf"), test_recv_ntf);
     g_test_add_func(TEST_("recv_ntf_data"), test_recv_ntf_data);
@@ -1916,8 +3151,18 @@ int main(int argc, char* argv[])
     g_test_add_func(TEST_("bad_cid"), test_bad_cid);
     g_test_add_func(TEST_("recv_data"), test_recv_data);
     g_test_add_func(TEST_("recv_data_seg"), test_recv_data_seg);
+    g_test_add_func(TEST_("recv_data_bytes"), test_recv_data_bytes);
+    g_test_add_func(TEST_("recv_data_bytes_split"),
+        test_recv_data_bytes_split);
+    g_test_add_func(TEST_("read_bytes_fallback"), test_read_bytes_fallback);
     g_test_add_func(TEST_("recv_reset"), test_reset);
     g_test_add_func(TEST_("recv_cr"), test_recv_cr);
+    g_test_add_data_func(TEST_("recv_chunks/1"),
+        GUINT_TO_POINTER(1), test_recv_chunks);
+    g_test_add_data_func(TEST_("recv_chunks/7"),
+        GUINT_TO_POINTER(7), test_recv_chunks);
+    g_test_add_data_func(TEST_("recv_chunks/random"),
+        GUINT_TO_POINTER(TEST_RECV_CHUNKS_RANDOM), test_recv_chunks);
     test_init(&test_opt, argc, argv);
     return g_test_run();
 }
@@ -244,6 +244,7 @@ void
 test_transition_class_init(
     TestTransitionClass* klass)
 {
+    klass->type = NCI_CORE_TRANSITION_RESET; /* For statistics */
     klass->start = test_transition_start;
     klass->finished = test_transition_finished;
 }
@@ -685,6 +686,62 @@ test_transitions(
     nci_transition_unref(NCI_TRANSITION(test_transition));
 }
 
+/*==========================================================================*
+ * stats
+ *==========================================================================*/
+
+static
+void
+test_stats(
+    void)
+{
+    NciSm* sm = nci_sm_new(&test_io);
+    TestTransition* test_transition = test_transition_new(sm, NCI_RFST_IDLE);
+    const NciTransitionStats* t;
+    NciSmStats stats;
+
+    g_assert(test_transition);
+    nci_sm_add_transition(sm, NCI_STATE_INIT, &test_transition->transition);
+    g_assert(nci_sm_enter_state(sm, NCI_STATE_INIT, NULL));
+#if NCI_STATS
+    t = stats.transition + NCI_CORE_TRANSITION_RESET;
+
+    /* Transition which fails to start isn't counted */
+    nci_sm_reset_stats(sm);
+    test_transition->fail_start = TRUE;
+    nci_sm_switch_to(sm, NCI_RFST_IDLE);
+    g_assert_cmpint(sm->last_state->state, == ,NCI_STATE_ERROR);
+    g_assert(nci_sm_get_stats(sm, &stats));
+    g_assert_cmpuint(t->started, == ,0);
+    g_assert_cmpuint(t->failed, == ,0);
+    g_assert_cmpuint(t->duration.count, == ,0);
+
+    /* The one which finishes before nci_transition_start() returns is */
+    test_transition->fail_start = FALSE;
+    g_assert(nci_sm_enter_state(sm, NCI_STATE_INIT, NULL));
+    nci_sm_reset_stats(sm);
+    nci_sm_switch_to(sm, NCI_RFST_IDLE);
+    g_assert_cmpint(sm->last_state->state, == ,NCI_RFST_IDLE);
+    g_assert_cmpint(test_transition->finished, == ,1);
+    g_usleep(1000);
+    g_assert(nci_sm_get_stats(sm, &stats));
+    g_assert_cmpuint(t->started, == ,1);
+    g_assert_cmpuint(t->failed, == ,0);
+    g_assert_cmpuint(t->duration.count, == ,1);
+
+    /* And the state it has reached accumulates residency */
+    g_assert_cmpuint(stats.state[NCI_RFST_IDLE].entered, == ,1);
+    g_assert(stats.state[NCI_RFST_IDLE].residency > 0);
+#else
+    (void)t;
+    g_assert(!nci_sm_get_stats(sm, &stats));
+#endif
+
+    nci_sm_stall(sm, NCI_STALL_STOP);
+    nci_sm_free(sm);
+    nci_transition_unref(NCI_TRANSITION(test_transition));
+}
+
 /*==========================================================================*
  * Common
  *==========================================================================*/
@@ -706,6 +763,7 @@ int main(int argc, char* argv[])
     g_test_add_func(TEST_("last_state"), test_last_state);
     g_test_add_func(TEST_("next_state"), test_next_state);
     g_test_add_func(TEST_("transitions"), test_transitions);
+    g_test_add_func(TEST_("stats"), test_stats);
     test_init(&test_opt, argc, argv);
     return g_test_run();
 }
@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+
+#include "test_common.h"
+
+#include "nci_trace.h"
+
+static TestOpt test_opt;
+
+#define TEST_PCAPNG_HEADERS_SIZE (28 + 20)
+#define TEST_EPB_OVERHEAD (32 + 12)
+#define TEST_NFC_LINUX_HEADER_SIZE (2)
+
+typedef struct test_packet {
+    NCI_TRACE_DIR dir;
+    const guint8* data;
+    guint len;
+} TestPacket;
+
+static
+guint32
+test_u32(
+    const guint8* ptr)
+{
+    guint32 value;
+
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static
+guint16
+test_u16(
+    const guint8* ptr)
+{
+    guint16 value;
+
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+/* Validates the dump and returns the number of packets in it */
+static
+guint
+test_parse(
+    GBytes* bytes,
+    TestPacket* packets,
+    guint max_packets)
+{
+    gsize size;
+    const guint8* ptr = g_bytes_get_data(bytes, &size);
+    const guint8* end = ptr + size;
+    guint n = 0;
+
+    /* Section Header Block */
+    g_assert_cmpuint(size, >= ,TEST_PCAPNG_HEADERS_SIZE);
+    g_assert_cmphex(test_u32(ptr), == ,0x0a0d0d0a);
+    g_assert_cmpuint(test_u32(ptr + 4), == ,28);
+    g_assert_cmphex(test_u32(ptr + 8), == ,0x1a2b3c4d);
+    g_assert_cmpuint(test_u16(ptr + 12), == ,1);
+    g_assert_cmpuint(test_u32(ptr + 24), == ,28);
+    ptr += 28;
+
+    /* Interface Description Block */
+    g_assert_cmpuint(test_u32(ptr), == ,1);
+    g_assert_cmpuint(test_u32(ptr + 4), == ,20);
+    g_assert_cmpuint(test_u16(ptr + 8), == ,249);
+    g_assert_cmpuint(test_u32(ptr + 12), == ,TEST_NFC_LINUX_HEADER_SIZE +
+        3 + 0xff);
+    g_assert_cmpuint(test_u32(ptr + 16), == ,20);
+    ptr += 20;
+
+    /* Enhanced Packet Blocks */
+    while (ptr < end) {
+        const guint32 total = test_u32(ptr + 4);
+        const guint32 len = test_u32(ptr + 20);
+        const guint8* opt = ptr + 28 + ((len + 3) & ~3);
+        const guint32 flags = test_u32(opt + 4);
+
+        g_assert_cmpuint(test_u32(ptr), == ,6);
+        g_assert_cmpuint(total, == ,TEST_EPB_OVERHEAD + ((len + 3) & ~3));
+        g_assert_cmpuint(total, <= ,end - ptr);
+        g_assert_cmpuint(test_u32(ptr + total - 4), == ,total);
+        g_assert_cmpuint(test_u32(ptr + 8), == ,0);
+        g_assert_cmpuint(test_u32(ptr + 24), == ,len);
+        g_assert_cmpuint(test_u16(opt), == ,2);
+        g_assert_cmpuint(test_u16(opt + 2), == ,4);
+        g_assert(flags == 1 || flags == 2);
+        g_assert_cmpuint(test_u32(opt + 8), == ,0);
+
+        /* Linux NFC pseudo-header: adapter index and NCI payload flags */
+        g_assert_cmpuint(len, >= ,TEST_NFC_LINUX_HEADER_SIZE);
+        g_assert_cmpuint(ptr[28], == ,0);
+        g_assert_cmphex(ptr[29], == ,(flags == 1) ? 0x02 : 0x03);
+        if (n < max_packets) {
+            packets[n].dir = (flags == 1) ? NCI_TRACE_IN : NCI_TRACE_OUT;
+            packets[n].data = ptr + 28 + TEST_NFC_LINUX_HEADER_SIZE;
+            packets[n].len = len - TEST_NFC_LINUX_HEADER_SIZE;
+        }
+        n++;
+        ptr += total;
+    }
+    g_assert(ptr == end);
+    return n;
+}
+
+/*==========================================================================*
+ * null
+ *==========================================================================*/
+
+static
+void
+test_null(
+    void)
+{
+    nci_trace_free(NULL);
+    g_assert_cmpuint(nci_trace_count(NULL), == ,0);
+    g_assert(!nci_trace_pcapng(NULL));
+}
+
+/*==========================================================================*
+ * empty
+ *==========================================================================*/
+
+static
+void
+test_empty(
+    void)
+{
+    NciTrace* trace = nci_trace_new(0);
+    GBytes* bytes = nci_trace_pcapng(trace);
+
+    g_assert_cmpuint(nci_trace_count(trace), == ,0);
+    g_assert_cmpuint(g_bytes_get_size(bytes), == ,TEST_PCAPNG_HEADERS_SIZE);
+    g_assert_cmpuint(test_parse(bytes, NULL, 0), == ,0);
+    g_bytes_unref(bytes);
+    nci_trace_free(trace);
+}
+
+/*==========================================================================*
+ * basic
+ *==========================================================================*/
+
+static
+void
+test_basic(
+    void)
+{
+    static const guint8 cmd_hdr[] = { 0x20, 0x00, 0x01 };
+    static const guint8 cmd_payload[] = { 0x00 };
+    static const guint8 cmd[] = { 0x20, 0x00, 0x01, 0x00 };
+    static const guint8 rsp[] = { 0x40, 0x00, 0x03, 0x00, 0x10, 0x00 };
+    NciTrace* trace = nci_trace_new(1024);
+    GUtilData chunks[2];
+    TestPacket packets[2];
+    GBytes* bytes;
+
+    chunks[0].bytes = cmd_hdr;
+    chunks[0].size = sizeof(cmd_hdr);
+    chunks[1].bytes = cmd_payload;
+    chunks[1].size = sizeof(cmd_payload);
+    nci_trace_packet(trace, NCI_TRACE_OUT, chunks, 2);
+    chunks[0].bytes = rsp;
+    chunks[0].size = sizeof(rsp);
+    nci_trace_packet(trace, NCI_TRACE_IN, chunks, 1);
+    g_assert_cmpuint(nci_trace_count(trace), == ,2);
+
+    bytes = nci_trace_pcapng(trace);
+    g_assert_cmpuint(test_parse(bytes, packets, 2), == ,2);
+    g_assert_cmpint(packets[0].dir, == ,NCI_TRACE_OUT);
+    g_assert_cmpuint(packets[0].len, == ,sizeof(cmd));
+    g_assert(!memcmp(packets[0].data, cmd, sizeof(cmd)));
+    g_assert_cmpint(packets[1].dir, == ,NCI_TRACE_IN);
+    g_assert_cmpuint(packets[1].len, == ,sizeof(rsp));
+    g_assert(!memcmp(packets[1].data, rsp, sizeof(rsp)));
+    g_bytes_unref(bytes);
+    nci_trace_free(trace);
+}
+
+/*==========================================================================*
+ * truncate
+ *==========================================================================*/
+
+static
+void
+test_truncate(
+    void)
+{
+    guint8 buf[300];
+    NciTrace* trace = nci_trace_new(0);
+    TestPacket packet;
+    GUtilData data;
+    GBytes* bytes;
+    guint i;
+
+    for (i = 0; i < sizeof(buf); i++) {
+        buf[i] = (guint8)i;
+    }
+    data.bytes = buf;
+    data.size = sizeof(buf);
+
+    /* Nothing longer than the maximum NCI packet gets stored */
+    nci_trace_packet(trace, NCI_TRACE_IN, &data, 1);
+    bytes = nci_trace_pcapng(trace);
+    g_assert_cmpuint(test_parse(bytes, &packet, 1), == ,1);
+    g_assert_cmpuint(packet.len, == ,258);
+    g_assert(!memcmp(packet.data, buf, packet.len));
+    g_bytes_unref(bytes);
+    nci_trace_free(trace);
+}
+
+/*==========================================================================*
+ * wrap
+ *==========================================================================*/
+
+static
+void
+test_wrap(
+    gconstpointer test_data)
+{
+    const gsize size = GPOINTER_TO_SIZE(test_data);
+    NciTrace* trace = nci_trace_new(size);
+    TestPacket packets[64];
+    guint8 buf[64];
+    guint i, k, n;
+
+    memset(buf, 0, sizeof(buf));
+    for (i = 0; i < 1000; i++) {
+        GUtilData data;
+        GBytes* bytes;
+
+        /* Variable length packets tagged with the sequence number */
+        buf[0] = (guint8)i;
+        buf[1] = (guint8)(i >> 8);
+        data.bytes = buf;
+        data.size = 2 + (i * 7) % (sizeof(buf) - 2);
+        nci_trace_packet(trace, (i & 1) ? NCI_TRACE_IN : NCI_TRACE_OUT,
+            &data, 1);
+
+        /* The most recent packets are there, in the right order */
+        n = nci_trace_count(trace);
+        g_assert_cmpuint(n, > ,0);
+        g_assert_cmpuint(n, <= ,i + 1);
+        g_assert_cmpuint(n, <= ,G_N_ELEMENTS(packets));
+        bytes = nci_trace_pcapng(trace);
+        g_assert_cmpuint(test_parse(bytes, packets, n), == ,n);
+        for (k = 0; k < n; k++) {
+            const TestPacket* packet = packets + k;
+            const guint seq = i + 1 - n + k;
+
+            g_assert_cmpuint(packet->len, == ,2 + (seq * 7) %
+                (sizeof(buf) - 2));
+            g_assert_cmpuint(packet->data[0] | (packet->data[1] << 8), == ,
+                seq);
+            g_assert_cmpint(packet->dir, == ,(seq & 1) ? NCI_TRACE_IN :
+                NCI_TRACE_OUT);
+        }
+        g_bytes_unref(bytes);
+    }
+
+    /* The ring is nearly full (but not quite, because of wrapping) */
+    g_assert_cmpuint((n + 2) * (16 + sizeof(buf)), >= ,MAX(size, 280));
+    nci_trace_free(trace);
+}
+
+/*==========================================================================*
+ * Common
+ *==========================================================================*/
+
+#define TEST_(name) "/nci_trace/" name
+
+int main(int argc, char* argv[])
+{
+    static const gsize wrap_sizes[] = { 0, 300, 512, 1000 };
+    guint i;
+
+    g_test_init(&argc, &argv, NULL);
+    test_init(&test_opt, argc, argv);
+    g_test_add_func(TEST_("null"), test_null);
+    g_test_add_func(TEST_("empty"), test_empty);
+    g_test_add_func(TEST_("basic"), test_basic);
+    g_test_add_func(TEST_("truncate"), test_truncate);
+    for (i = 0; i < G_N_ELEMENTS(wrap_sizes); i++) {
+        char* path = g_strdup_printf(TEST_("wrap/%u"), (guint)wrap_sizes[i]);
+
+        g_test_add_data_func(path, GSIZE_TO_POINTER(wrap_sizes[i]),
+            test_wrap);
+        g_free(path);
+    }
+    return g_test_run();
+}
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2019-2023 Slava Monich <slava@monich.com>
+ * Copyright (C) 2019-2026 Slava Monich <slava@monich.com>
  * Copyright (C) 2019-2021 Jolla Ltd.
  * Copyright (C) 2020 Open Mobile Platform LLC.
  *
@@ -50,6 +50,18 @@ test_null(
 {
     g_assert(!nci_discovery_ntf_copy_array(NULL, 0));
     g_assert(!nci_discovery_ntf_copy(NULL));
+    g_assert(!nci_discovery_ntf_arena_copy(NULL, NULL));
+    g_assert(!nci_arena_alloc0(NULL, 0));
+    nci_arena_reset(NULL);
+    nci_arena_free(NULL);
+    nci_id_cache_free(NULL);
+    g_assert(!nci_id_cache_new(0));
+    g_assert(!nci_id_cache_lookup(NULL, NULL));
+    g_assert(!nci_id_cache_update(NULL, NULL, 0));
+    g_assert(!nci_mode_param_id(NCI_MODE_PASSIVE_POLL_A, NULL, NULL));
+    g_assert(!nci_intf_activation_key(NULL, NULL));
+    g_assert(!nci_util_activation_ref(NULL));
+    nci_util_activation_unref(NULL);
     g_assert(!nci_util_copy_mode_param(NULL, 0));
     g_assert(!nci_util_copy_activation_param(NULL, 0, 0));
 }
@@ -416,6 +428,45 @@ test_intf_activated_success(
     }
 }
 
+static
+void
+test_intf_activated_record(
+    gconstpointer user_data)
+{
+    const TestIntfActivatedSuccessData* test = user_data;
+    NciActivation* act = nci_activation_new(test->data.bytes,
+        test->data.size);
+    const guint8* raw;
+    NciIntfActivationNtf ntf;
+    NciModeParam mode_param;
+    NciActivationParam activation_param;
+
+    /* Raw payload is copied */
+    g_assert(act);
+    raw = act->raw.bytes;
+    g_assert(raw != test->data.bytes);
+    g_assert_cmpuint(act->raw.size, == ,test->data.size);
+    g_assert(!memcmp(raw, test->data.bytes, test->data.size));
+
+    /* And parsed views point into the copy */
+    memset(&mode_param, 0, sizeof(mode_param));
+    memset(&activation_param, 0, sizeof(activation_param));
+    g_assert(nci_parse_intf_activated_ntf(&ntf, &mode_param, &activation_param,
+        raw, act->raw.size));
+    g_assert(ntf.mode_param_bytes == act->ntf.mode_param_bytes);
+    g_assert(ntf.activation_param_bytes == act->ntf.activation_param_bytes);
+    g_assert(!ntf.mode_param == !act->ntf.mode_param);
+    g_assert(!ntf.mode_param || !memcmp(ntf.mode_param,
+        act->ntf.mode_param, sizeof(mode_param)));
+    g_assert(!ntf.activation_param == !act->ntf.activation_param);
+    g_assert(!ntf.activation_param || !memcmp(ntf.activation_param,
+        act->ntf.activation_param, sizeof(activation_param)));
+
+    g_assert(nci_util_activation_ref(act) == act);
+    nci_util_activation_unref(act);
+    nci_util_activation_unref(act);
+}
+
 static const guint8 test_intf_activated_ntf_mifare[] = {
     0x01, 0x80, 0x80, 0x00, 0xff, 0x01, 0x0c, 0x44,
     0x00, 0x07, 0x04, 0x47, 0x8a, 0x92, 0x7f, 0x51,
@@ -754,6 +805,15 @@ test_intf_activated_fail(
         test->data.bytes, test->data.size) == test->parse_ok);
     g_assert(!ntf.mode_param == !test->mode_param_ok);
     g_assert(!ntf.activation_param == !test->activation_param_ok);
+    if (test->parse_ok) {
+        NciActivation* act = nci_activation_new(test->data.bytes,
+            test->data.size);
+
+        g_assert(act);
+        nci_util_activation_unref(act);
+    } else {
+        g_assert(!nci_activation_new(test->data.bytes, test->data.size));
+    }
 }
 
 static const guint8 test_intf_activated_ntf_nfc_dep_fail_1[] = {
@@ -1019,14 +1079,212 @@ test_discover_copy(
     const TestDiscoverSuccessData* test = test_data;
     NciDiscoveryNtf ntf = test->ntf;
     NciDiscoveryNtf* copy = nci_discovery_ntf_copy(&test->ntf);
+    NciArena* arena = nci_arena_new(0);
 
     test_discover_copy_check(&test->ntf, copy);
     g_free(copy);
 
+    /* Same thing in the arena */
+    test_discover_copy_check(&test->ntf, (NciDiscoveryNtf*)
+        nci_discovery_ntf_arena_copy(arena, &test->ntf));
+
     ntf.param = NULL;
     copy = nci_discovery_ntf_copy(&ntf);
     test_discover_copy_check(&ntf, copy);
     g_free(copy);
+    test_discover_copy_check(&ntf, (NciDiscoveryNtf*)
+        nci_discovery_ntf_arena_copy(arena, &ntf));
+    nci_arena_free(arena);
+}
+
+/*==========================================================================*
+ * arena
+ *==========================================================================*/
+
+static
+void
+test_arena(
+    void)
+{
+    NciArena* arena = nci_arena_new(64);
+    guint8* ptr[8];
+    guint8* big;
+    guint i;
+
+    /* Allocations are aligned, zeroed and don't overlap */
+    for (i = 0; i < G_N_ELEMENTS(ptr); i++) {
+        guint k;
+
+        ptr[i] = nci_arena_alloc0(arena, i + 1);
+        g_assert(ptr[i]);
+        g_assert(!(GPOINTER_TO_SIZE(ptr[i]) & 7));
+        for (k = 0; k <= i; k++) {
+            g_assert(!ptr[i][k]);
+        }
+        memset(ptr[i], 0xff, i + 1);
+    }
+    for (i = 0; i < G_N_ELEMENTS(ptr); i++) {
+        guint k;
+
+        for (k = 0; k <= i; k++) {
+            g_assert_cmpuint(ptr[i][k], == ,0xff);
+        }
+    }
+
+    /* Oversized allocation */
+    big = nci_arena_alloc0(arena, 1000);
+    g_assert(big);
+    g_assert(!big[999]);
+    memset(big, 0xff, 1000);
+
+    /* After reset, memory is reused and zeroed again */
+    nci_arena_reset(arena);
+    ptr[0] = nci_arena_alloc0(arena, 1000);
+    g_assert(!ptr[0][0]);
+    g_assert(!ptr[0][999]);
+    nci_arena_reset(arena);
+    nci_arena_reset(arena);
+    g_assert(nci_arena_alloc0(arena, 0));
+    nci_arena_free(arena);
+}
+
+/*==========================================================================*
+ * mode_param_id
+ *==========================================================================*/
+
+static
+void
+test_mode_param_id(
+    void)
+{
+    NciModeParam param;
+    GUtilData id;
+
+    memset(&param, 0, sizeof(param));
+    g_assert(!nci_mode_param_id(NCI_MODE_PASSIVE_POLL_A, &param, &id));
+    param.poll_a.nfcid1_len = 7;
+    g_assert(nci_mode_param_id(NCI_MODE_PASSIVE_POLL_A, &param, &id));
+    g_assert(id.bytes == param.poll_a.nfcid1);
+    g_assert_cmpuint(id.size, == ,7);
+    g_assert(nci_mode_param_id(NCI_MODE_ACTIVE_POLL_A, &param, &id));
+    g_assert_cmpuint(id.size, == ,7);
+
+    g_assert(nci_mode_param_id(NCI_MODE_PASSIVE_POLL_B, &param, &id));
+    g_assert(id.bytes == param.poll_b.nfcid0);
+    g_assert_cmpuint(id.size, == ,4);
+
+    g_assert(nci_mode_param_id(NCI_MODE_PASSIVE_POLL_F, &param, &id));
+    g_assert(id.bytes == param.poll_f.nfcid2);
+    g_assert_cmpuint(id.size, == ,8);
+    g_assert(nci_mode_param_id(NCI_MODE_ACTIVE_POLL_F, &param, &id));
+    g_assert_cmpuint(id.size, == ,8);
+
+    g_assert(nci_mode_param_id(NCI_MODE_PASSIVE_POLL_V, &param, &id));
+    g_assert(id.bytes == param.poll_v.uid);
+    g_assert_cmpuint(id.size, == ,8);
+
+    g_assert(!nci_mode_param_id(NCI_MODE_PASSIVE_LISTEN_A, &param, &id));
+    g_assert(!nci_mode_param_id(NCI_MODE_PASSIVE_LISTEN_B, &param, &id));
+    g_assert(!nci_mode_param_id(NCI_MODE_PASSIVE_LISTEN_F, &param, &id));
+    g_assert(!nci_mode_param_id(NCI_MODE_ACTIVE_LISTEN_A, &param, &id));
+    g_assert(!nci_mode_param_id(NCI_MODE_ACTIVE_LISTEN_F, &param, &id));
+    g_assert(!nci_mode_param_id(NCI_MODE_PASSIVE_LISTEN_V, &param, &id));
+}
+
+/*==========================================================================*
+ * intf_activation_key
+ *==========================================================================*/
+
+static
+void
+test_intf_activation_key(
+    void)
+{
+    static const guint8 ats1[] = { 0x05, 0x78, 0x80, 0x81, 0x02 };
+    static const guint8 ats2[] = { 0x05, 0x78, 0x80, 0x81, 0x03 };
+    guint8 key1[NCI_ID_CACHE_MAX_ID];
+    guint8 key2[NCI_ID_CACHE_MAX_ID];
+    NciIntfActivationNtf ntf;
+    NciModeParam param;
+    guint len;
+
+    memset(&ntf, 0, sizeof(ntf));
+    memset(&param, 0, sizeof(param));
+    ntf.rf_intf = NCI_RF_INTERFACE_ISO_DEP;
+    ntf.protocol = NCI_PROTOCOL_ISO_DEP;
+    ntf.mode = NCI_MODE_PASSIVE_POLL_A;
+
+    /* No mode parameters, no id */
+    g_assert(!nci_intf_activation_key(&ntf, key1));
+    ntf.mode_param = &param;
+    g_assert(!nci_intf_activation_key(&ntf, key1));
+
+    /* Id followed by the hash */
+    param.poll_a.nfcid1_len = 7;
+    param.poll_a.nfcid1[0] = 0x04;
+    ntf.activation_param_bytes = ats1;
+    ntf.activation_param_len = sizeof(ats1);
+    len = nci_intf_activation_key(&ntf, key1);
+    g_assert_cmpuint(len, == ,7 + 4);
+    g_assert(!memcmp(key1, param.poll_a.nfcid1, 7));
+    g_assert_cmpuint(nci_intf_activation_key(&ntf, key2), == ,len);
+    g_assert(!memcmp(key1, key2, len));
+
+    /* Different activation parameters produce a different key */
+    ntf.activation_param_bytes = ats2;
+    g_assert_cmpuint(nci_intf_activation_key(&ntf, key2), == ,len);
+    g_assert(memcmp(key1, key2, len));
+
+    /* Listen mode has no remote id */
+    ntf.mode = NCI_MODE_PASSIVE_LISTEN_A;
+    g_assert(!nci_intf_activation_key(&ntf, key2));
+}
+
+/*==========================================================================*
+ * id_cache
+ *==========================================================================*/
+
+static
+void
+test_id_cache(
+    void)
+{
+    static const guint8 id1[] = { 0x01, 0x02, 0x03, 0x04 };
+    static const guint8 id2[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07 };
+    static const guint8 id3[] = { 0x05, 0x06, 0x07, 0x08 };
+    static const guint8 big[NCI_ID_CACHE_MAX_ID + 1] = { 0 };
+    NciIdCache* cache = nci_id_cache_new(2);
+    GUtilData id;
+
+    /* Empty and oversized ids are ignored */
+    id.bytes = big;
+    id.size = 0;
+    g_assert(!nci_id_cache_update(cache, &id, 1));
+    id.size = sizeof(big);
+    g_assert(!nci_id_cache_update(cache, &id, 1));
+    g_assert(!nci_id_cache_lookup(cache, &id));
+
+    /* Update returns the previous time */
+    TEST_BYTES_SET(id, id1);
+    g_assert(!nci_id_cache_lookup(cache, &id));
+    g_assert(!nci_id_cache_update(cache, &id, 10));
+    g_assert_cmpint(nci_id_cache_update(cache, &id, 20), == ,10);
+    g_assert_cmpint(nci_id_cache_lookup(cache, &id), == ,20);
+
+    /* Same prefix, different length */
+    TEST_BYTES_SET(id, id2);
+    g_assert(!nci_id_cache_lookup(cache, &id));
+    g_assert(!nci_id_cache_update(cache, &id, 15));
+
+    /* The least recently seen one (id2) gets replaced */
+    TEST_BYTES_SET(id, id3);
+    g_assert(!nci_id_cache_update(cache, &id, 30));
+    g_assert_cmpint(nci_id_cache_lookup(cache, &id), == ,30);
+    TEST_BYTES_SET(id, id2);
+    g_assert(!nci_id_cache_lookup(cache, &id));
+    TEST_BYTES_SET(id, id1);
+    g_assert_cmpint(nci_id_cache_lookup(cache, &id), == ,20);
+    nci_id_cache_free(cache);
 }
 
 /*==========================================================================*
@@ -1569,6 +1827,10 @@ int main(int argc, char* argv[])
     g_test_add_func(TEST_("nfcid1_dynamic"), test_nfcid1_dynamic);
     g_test_add_func(TEST_("nfcid1_equal"), test_nfcid1_equal);
     g_test_add_func(TEST_("listen_mode"), test_listen_mode);
+    g_test_add_func(TEST_("arena"), test_arena);
+    g_test_add_func(TEST_("mode_param_id"), test_mode_param_id);
+    g_test_add_func(TEST_("intf_activation_key"), test_intf_activation_key);
+    g_test_add_func(TEST_("id_cache"), test_id_cache);
     for (i = 0; i < G_N_ELEMENTS(mode_param_success_tests); i++) {
         const TestModeParamSuccessData* test = mode_param_success_tests + i;
         char* path1 = g_strconcat(TEST_("mode_param/ok/"), test->name, NULL);
@@ -1608,11 +1870,15 @@ int main(int argc, char* argv[])
             test->name, NULL);
         char* path2 = g_strconcat(TEST_("intf_activated/copy_params/"),
             test->name, NULL);
+        char* path3 = g_strconcat(TEST_("intf_activated/record/"),
+            test->name, NULL);
 
         g_test_add_data_func(path1, test, test_intf_activated_success);
         g_test_add_data_func(path2, test, test_intf_activated_copy_params);
+        g_test_add_data_func(path3, test, test_intf_activated_record);
         g_free(path1);
         g_free(path2);
+        g_free(path3);
     }
     for (i = 0; i < G_N_ELEMENTS(intf_activated_fail_tests); i++) {
         const TestIntfActivatedFailData* test = intf_activated_fail_tests + i;